@@ -0,0 +1,365 @@
+#!/usr/bin/env python3
+"""
+JSON vs native automation benchmark
+
+Generates two ESPHome host-platform configurations from the same JSON rule spec:
+one that loads the rules through json_automation and one that declares the same
+rules as compile-time YAML automations. Both are compiled and run, and RAM,
+flash size, boot time and trigger-to-action latency are reported side by side.
+"""
+
+import argparse
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+import time
+
+LATENCY_RE = re.compile(r"BENCH latency (\S+) (\d+)")
+READY_RE = re.compile(r"BENCH ready millis=(\d+)")
+JSON_LOAD_RE = re.compile(r"BENCH json parse_us=(\d+) create_us=(\d+)")
+
+
+def load_spec(path):
+    """Load the rule spec, accepting both the array and the wrapped format"""
+    with open(path) as f:
+        data = json.load(f)
+    if isinstance(data, dict):
+        data = data.get("automations", [])
+    return [rule for rule in data if rule.get("enabled", True)]
+
+
+def trigger_source(rule):
+    """Return the lower-case trigger source of a rule; rules without one are input rules"""
+    return rule["trigger"].get("source", "input").lower()
+
+
+def trigger_sensor(trigger):
+    """Return the sensor of a sensor trigger, which older rule sets name input_id"""
+    return trigger.get("sensor_id", trigger.get("input_id"))
+
+
+def condition_terms(trigger):
+    """Return the (input_id, negate) terms of a while trigger, its dependency list"""
+    terms = trigger.get("all", trigger.get("any", []))
+    return [(term.lstrip("!"), term.startswith("!")) for term in terms]
+
+
+def rule_actions(rule):
+    """Return the actions of a rule followed by the exit actions of a while rule"""
+    return rule.get("actions", []) + rule.get("exit_actions", [])
+
+
+def collect_entities(rules):
+    """Return the sorted input, switch, light and sensor object ids used by the rules"""
+    inputs, switches, lights, sensors = set(), set(), set(), set()
+    # Entities of wasm and snapshot actions are named "<domain>.<object_id>"
+    domains = {"input": inputs, "binary_sensor": inputs, "switch": switches, "light": lights}
+    for rule in rules:
+        source = trigger_source(rule)
+        if source == "while":
+            inputs.update(input_id for input_id, _ in condition_terms(rule["trigger"]))
+        elif source == "sensor":
+            sensors.add(trigger_sensor(rule["trigger"]))
+        else:
+            inputs.add(rule["trigger"]["input_id"])
+        for action in rule_actions(rule):
+            source = action.get("source", "").lower()
+            if source == "switch":
+                switches.add(action["switch_id"])
+            elif source == "light":
+                lights.add(action["switch_id"])
+            for entity in action.get("entities", []):
+                domain, _, object_id = entity.partition(".")
+                if domain in domains and object_id:
+                    domains[domain].add(object_id)
+    return sorted(inputs), sorted(switches), sorted(lights), sorted(sensors)
+
+
+def sensor_thresholds(rules, sensor_id):
+    """Return the thresholds of the sensor rules on sensor_id"""
+    return [
+        float(rule["trigger"]["threshold"])
+        for rule in rules
+        if trigger_source(rule) == "sensor" and trigger_sensor(rule["trigger"]) == sensor_id
+    ]
+
+
+def native_action(action):
+    """Translate one JSON action into its compile-time YAML equivalent"""
+    source = action.get("source", "").lower()
+    if source == "delay":
+        return f"          - delay: {int(action['delay_s'])}s"
+    if source not in ("switch", "light"):
+        # wasm, snapshot, restore and condition actions have no compile-time equivalent here
+        return f'          - logger.log: "{source} action has no native equivalent"'
+    return f"          - {source}.{action['type'].lower()}: {action['switch_id']}"
+
+
+def native_while(index, rule):
+    """Translate a while rule into a template binary sensor over its condition"""
+    trigger = rule["trigger"]
+    joiner = " || " if "any" in trigger else " && "
+    terms = [f"{'!' if negate else ''}id({input_id}).state" for input_id, negate in condition_terms(trigger)]
+    lines = ["  - platform: template", f"    id: while_{index}", f"    lambda: return {joiner.join(terms)};"]
+    for event, key in (("on_press", "actions"), ("on_release", "exit_actions")):
+        if rule.get(key):
+            lines += [f"    {event}:", "      then:"]
+            lines += [native_action(action) for action in rule[key]]
+    return lines
+
+
+def entities_yaml(rules, native):
+    """Build the entity section shared by both variants"""
+    inputs, switches, lights, sensors = collect_entities(rules)
+    lines = ["binary_sensor:"]
+    for input_id in inputs:
+        lines += ["  - platform: template", f"    id: {input_id}", f"    name: {input_id}"]
+        if not native:
+            continue
+        for rule in rules:
+            if trigger_source(rule) != "input" or rule["trigger"]["input_id"] != input_id:
+                continue
+            event = "on_press" if rule["trigger"]["type"].lower() == "press" else "on_release"
+            lines.append(f"    {event}:")
+            lines.append("      then:")
+            lines += [native_action(action) for action in rule["actions"]]
+    if native:
+        for index, rule in enumerate(rules):
+            if trigger_source(rule) == "while":
+                lines += native_while(index, rule)
+
+    if sensors:
+        lines.append("sensor:")
+        for sensor_id in sensors:
+            lines += ["  - platform: template", f"    id: {sensor_id}", f"    name: {sensor_id}"]
+            lines.append("    update_interval: never")
+            if not native:
+                continue
+            # on_value_range fires when the value enters the range, like a threshold crossing
+            sensor_rules = [rule for rule in rules if trigger_source(rule) == "sensor"]
+            sensor_rules = [rule for rule in sensor_rules if trigger_sensor(rule["trigger"]) == sensor_id]
+            if sensor_rules:
+                lines.append("    on_value_range:")
+            for rule in sensor_rules:
+                lines += [f"      - {rule['trigger']['type'].lower()}: {rule['trigger']['threshold']}", "        then:"]
+                lines += [native_action(action) for action in rule["actions"]]
+
+    if switches:
+        lines.append("switch:")
+        for switch_id in switches:
+            lines += ["  - platform: template", f"    id: {switch_id}", f"    name: {switch_id}", "    optimistic: true"]
+
+    if lights:
+        lines.append("output:")
+        for light_id in lights:
+            lines += ["  - platform: template", f"    id: {light_id}_output", "    type: binary", "    write_action: []"]
+        lines.append("light:")
+        for light_id in lights:
+            lines += ["  - platform: binary", f"    id: {light_id}", f"    name: {light_id}", f"    output: {light_id}_output"]
+
+    return lines
+
+
+def stimulus_yaml(rules, samples):
+    """Build an interval that toggles every input and logs the synchronous dispatch time"""
+    inputs, _, _, sensors = collect_entities(rules)
+    lines = [
+        "interval:",
+        "  - interval: 20ms",
+        "    then:",
+        "      - lambda: |-",
+        "          static uint32_t round = 0;",
+        f"          if (round >= {samples})",
+        "            return;",
+        "          round++;",
+    ]
+    for input_id in inputs:
+        lines += [
+            "          {",
+            f"            const bool state = !id({input_id}).state;",
+            "            const uint32_t start = micros();",
+            f"            id({input_id}).publish_state(state);",
+            f'            ESP_LOGI("bench", "BENCH latency {input_id} %u", micros() - start);',
+            "          }",
+        ]
+    # Sensor values alternate across all thresholds of the sensor. The JSON variant evaluates them on the next
+    # loop(), so their dispatch is not timed
+    for sensor_id in sensors:
+        thresholds = sensor_thresholds(rules, sensor_id)
+        low, high = min(thresholds) - 1.0, max(thresholds) + 1.0
+        lines.append(f"          id({sensor_id}).publish_state(round % 2 == 0 ? {high}f : {low}f);")
+    return lines
+
+
+def build_config(name, rules, native, samples, component_path):
+    """Return the full YAML configuration for one benchmark variant"""
+    lines = [
+        "esphome:",
+        f"  name: {name}",
+        "  on_boot:",
+        "    priority: -100",
+        "    then:",
+        "      - lambda: |-",
+    ]
+    if not native:
+        lines += [
+            '          ESP_LOGI("bench", "BENCH json parse_us=%u create_us=%u",',
+            "                   id(rules).get_last_parse_us(), id(rules).get_last_create_us());",
+        ]
+    lines += [
+        '          ESP_LOGI("bench", "BENCH ready millis=%u", millis());',
+        "",
+        "host:",
+        "",
+        "logger:",
+        "  level: INFO",
+        "",
+    ]
+    if not native:
+        lines += [
+            "external_components:",
+            "  - source:",
+            "      type: local",
+            f"      path: {component_path}",
+            "",
+            "json_automation:",
+            "  id: rules",
+            "  json_data: |",
+        ]
+        lines += ["    " + line for line in json.dumps(rules, indent=2).splitlines()]
+        lines.append("")
+    lines += entities_yaml(rules, native)
+    lines.append("")
+    lines += stimulus_yaml(rules, samples)
+    return "\n".join(lines) + "\n"
+
+
+def find_program(workdir, name):
+    """Locate the host executable produced by esphome compile"""
+    build_dir = os.path.join(workdir, ".esphome", "build", name, ".pioenvs", name)
+    for candidate in ("program", "firmware"):
+        path = os.path.join(build_dir, candidate)
+        if os.path.exists(path):
+            return path
+    return None
+
+
+def flash_size(program):
+    """Return text + data bytes of the executable, or its file size without binutils"""
+    try:
+        result = subprocess.run(["size", program], capture_output=True, text=True, check=True)
+        fields = result.stdout.splitlines()[1].split()
+        return int(fields[0]) + int(fields[1])
+    except (FileNotFoundError, subprocess.CalledProcessError, IndexError, ValueError):
+        return os.path.getsize(program)
+
+
+def rss_kib(pid):
+    """Return the resident set size of a running process in KiB"""
+    try:
+        with open(f"/proc/{pid}/status") as f:
+            for line in f:
+                if line.startswith("VmRSS:"):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+    return 0
+
+
+def run_variant(program, inputs, samples, timeout):
+    """Run one executable and collect boot time, RAM and latency samples"""
+    result = {"boot_ms": None, "rss_kib": 0, "latency_us": [], "parse_us": None, "create_us": None}
+    expected = samples * len(inputs)
+    start = time.monotonic()
+    proc = subprocess.Popen([program], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    try:
+        for line in proc.stdout:
+            if result["boot_ms"] is None and READY_RE.search(line):
+                result["boot_ms"] = (time.monotonic() - start) * 1000.0
+                result["rss_kib"] = rss_kib(proc.pid)
+            match = JSON_LOAD_RE.search(line)
+            if match:
+                result["parse_us"], result["create_us"] = int(match.group(1)), int(match.group(2))
+            match = LATENCY_RE.search(line)
+            if match:
+                result["latency_us"].append(int(match.group(2)))
+                if len(result["latency_us"]) >= expected:
+                    break
+            if time.monotonic() - start > timeout:
+                print("  ⚠️  Timed out waiting for latency samples")
+                break
+    finally:
+        proc.kill()
+        proc.wait()
+    return result
+
+
+def format_latency(samples):
+    """Summarise latency samples as median / p99 / max"""
+    if not samples:
+        return "n/a"
+    ordered = sorted(samples)
+    p99 = ordered[min(len(ordered) - 1, int(len(ordered) * 0.99))]
+    return f"{statistics.median(ordered):.0f} / {p99} / {ordered[-1]} us"
+
+
+def main():
+    """Generate, build and run both variants, then print the comparison"""
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--spec", default="example_automation.json", help="JSON rule spec")
+    parser.add_argument("--workdir", default="bench_build", help="Directory for generated configs")
+    parser.add_argument("--samples", type=int, default=200, help="Latency samples per input")
+    parser.add_argument("--timeout", type=float, default=60.0, help="Seconds to wait for each run")
+    parser.add_argument("--esphome", default="esphome", help="ESPHome executable")
+    args = parser.parse_args()
+
+    rules = load_spec(args.spec)
+    inputs, _, _, _ = collect_entities(rules)
+    os.makedirs(args.workdir, exist_ok=True)
+    component_path = os.path.relpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), "components"), args.workdir)
+
+    results = {}
+    for variant, native in (("json", False), ("native", True)):
+        name = f"bench-{variant}"
+        config_path = os.path.join(args.workdir, f"{name}.yaml")
+        with open(config_path, "w") as f:
+            f.write(build_config(name, rules, native, args.samples, component_path))
+
+        print(f"Compiling {config_path}")
+        compiled = subprocess.run([args.esphome, "compile", config_path], capture_output=True, text=True)
+        if compiled.returncode != 0:
+            print(f"  ❌ Compilation failed\n{compiled.stdout[-2000:]}{compiled.stderr[-2000:]}")
+            return 1
+
+        program = find_program(args.workdir, name)
+        if program is None:
+            print(f"  ❌ Host executable for {name} not found")
+            return 1
+
+        print(f"Running {program}")
+        results[variant] = run_variant(program, inputs, args.samples, args.timeout)
+        results[variant]["flash"] = flash_size(program)
+
+    json_result, native_result = results["json"], results["native"]
+    print()
+    print(f"{len(rules)} rules, {len(inputs)} inputs, {args.samples} samples per input")
+    print(f"{'':24}{'json_automation':>24}{'native YAML':>24}")
+    print(f"{'Flash (text+data)':24}{json_result['flash']:>22} B{native_result['flash']:>22} B")
+    print(f"{'RAM (RSS after boot)':24}{json_result['rss_kib']:>20} KiB{native_result['rss_kib']:>20} KiB")
+    json_boot = f"{json_result['boot_ms']:.1f} ms" if json_result["boot_ms"] is not None else "n/a"
+    native_boot = f"{native_result['boot_ms']:.1f} ms" if native_result["boot_ms"] is not None else "n/a"
+    print(f"{'Boot time':24}{json_boot:>24}{native_boot:>24}")
+    print(
+        f"{'Latency med/p99/max':24}{format_latency(json_result['latency_us']):>24}"
+        f"{format_latency(native_result['latency_us']):>24}"
+    )
+    if json_result["parse_us"] is not None:
+        print(f"JSON load: parse {json_result['parse_us']} us, create_all_automations {json_result['create_us']} us")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
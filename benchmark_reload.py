@@ -0,0 +1,253 @@
+#!/usr/bin/env python3
+"""
+Reload-under-load benchmark
+
+Builds an ESPHome host-platform firmware that toggles an input every loop
+iteration while a second interval keeps reloading rule sets of different sizes
+through JsonAutomationComponent::load_json(). One rule maps the input to a sink
+switch, so every press must toggle the sink exactly once: the difference between
+presses sent and sink toggles counts missed or duplicated events. Dispatch pause,
+reload time and heap before/after every reload are reported per rule-set size.
+
+With --incremental-bytes the firmware uses incremental_load: each reload is
+parsed over many loop() calls, and its pause is the longest of those steps.
+"""
+
+import argparse
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+import time
+
+import benchmark_json_vs_native as bench
+
+RELOAD_RE = re.compile(r"BENCH reload size=(\d+) pause_us=(\d+) steps=(\d+) heap_before=(\d+) heap_after=(\d+)")
+SUMMARY_RE = re.compile(r"BENCH summary sent=(\d+) handled=(\d+) max_gap_us=(\d+)")
+
+
+def make_rule(rule_id, input_id, switch_id, action_type):
+    """Return one rule in the component's JSON format"""
+    return {
+        "id": rule_id,
+        "trigger": {"source": "Input", "type": "press", "input_id": input_id},
+        "actions": [{"source": "switch", "type": action_type, "switch_id": switch_id}],
+    }
+
+
+def make_rule_set(size):
+    """Return a compact rule set with one sink rule and size - 1 filler rules"""
+    rules = [make_rule("sink", "stim", "sink", "toggle")]
+    rules += [make_rule(f"filler_{i}", "filler_in", "filler_out", "turn_on") for i in range(size - 1)]
+    return json.dumps(rules, separators=(",", ":"))
+
+
+def build_config(sizes, reloads, reload_ms, incremental_bytes, component_path):
+    """Return the host configuration driving the stimulus and the reload loop"""
+    rule_sets = [make_rule_set(size) for size in sizes]
+    # A load in one go is a single step
+    steps = "id(rules).get_engine().get_last_load_steps()" if incremental_bytes else "1"
+    lines = [
+        "esphome:",
+        "  name: json-automation-reload",
+        "",
+        "host:",
+        "",
+        "logger:",
+        "  level: INFO",
+        "",
+        "external_components:",
+        "  - source:",
+        "      type: local",
+        f"      path: {component_path}",
+        "",
+        "json_automation:",
+        "  id: rules",
+        f"  json_data: '{rule_sets[0]}'",
+    ]
+    if incremental_bytes:
+        lines += ["  incremental_load:", f"    max_bytes: {incremental_bytes}"]
+    lines += [
+        "",
+        "globals:",
+    ]
+    for name in ("sent", "handled", "reload_round", "max_gap_us"):
+        lines += [f"  - id: {name}", "    type: uint32_t", "    initial_value: '0'"]
+    lines += [
+        "",
+        "binary_sensor:",
+        "  - platform: template",
+        "    id: stim",
+        "    name: stim",
+        "  - platform: template",
+        "    id: filler_in",
+        "    name: filler_in",
+        "",
+        "switch:",
+        "  - platform: template",
+        "    id: sink",
+        "    name: sink",
+        "    optimistic: true",
+        "    on_turn_on:",
+        "      - lambda: id(handled) += 1;",
+        "    on_turn_off:",
+        "      - lambda: id(handled) += 1;",
+        "  - platform: template",
+        "    id: filler_out",
+        "    name: filler_out",
+        "    optimistic: true",
+        "",
+        "interval:",
+        "  - interval: 1ms",
+        "    then:",
+        "      - lambda: |-",
+        "          static uint32_t last = micros();",
+        f"          if (id(reload_round) >= {reloads})",
+        "            return;",
+        "          const uint32_t now = micros();",
+        "          id(max_gap_us) = std::max(id(max_gap_us), now - last);",
+        "          last = now;",
+        "          const bool state = !id(stim).state;",
+        "          id(stim).publish_state(state);",
+        "          if (state)",
+        "            id(sent) += 1;",
+        f"  - interval: {reload_ms}ms",
+        "    then:",
+        "      - lambda: |-",
+        "          static const char *const RULE_SETS[] = {",
+    ]
+    lines += [f'              R"json({rule_set})json",' for rule_set in rule_sets]
+    lines += [
+        "          };",
+        f"          static const uint32_t SIZES[] = {{{', '.join(str(size) for size in sizes)}}};",
+        # An incremental load finishes over later loop() calls: report it once it has, then start the next one
+        "          static int32_t loading = -1;",
+        "          if (loading >= 0) {",
+        "            if (id(rules).is_loading())",
+        "              return;",
+        "            const auto &stats = id(rules).get_reload_stats();",
+        f"            const uint32_t steps = {steps};",
+        '            ESP_LOGI("bench", "BENCH reload size=%u pause_us=%u steps=%u heap_before=%u heap_after=%u",',
+        "                     SIZES[loading], stats.last_pause_us, steps, (unsigned) stats.heap_before.used_bytes,",
+        "                     (unsigned) stats.heap_after.used_bytes);",
+        "            loading = -1;",
+        "            id(reload_round) += 1;",
+        "          }",
+        "          const uint32_t round = id(reload_round);",
+        f"          if (round > {reloads})",
+        "            return;",
+        f"          if (round == {reloads}) {{",
+        '            ESP_LOGI("bench", "BENCH summary sent=%u handled=%u max_gap_us=%u", id(sent), id(handled),',
+        "                     id(max_gap_us));",
+        "            id(reload_round) = round + 1;",
+        "            return;",
+        "          }",
+        f"          const uint32_t index = round % {len(sizes)};",
+        "          id(rules).load_json(RULE_SETS[index]);",
+        "          loading = index;",
+    ]
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    """Build and run the reload benchmark, then print the per-size report"""
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--sizes", default="1,8,24", help="Comma separated rule-set sizes to cycle through")
+    parser.add_argument("--reloads", type=int, default=300, help="Total number of reloads")
+    parser.add_argument("--reload-ms", type=int, default=50, help="Interval between reloads")
+    parser.add_argument(
+        "--incremental-bytes", type=int, default=0, help="Load incrementally with this many JSON bytes per loop()"
+    )
+    parser.add_argument("--workdir", default="bench_build", help="Directory for the generated config")
+    parser.add_argument("--timeout", type=float, default=600.0, help="Seconds to wait for the run")
+    parser.add_argument("--esphome", default="esphome", help="ESPHome executable")
+    args = parser.parse_args()
+
+    sizes = [int(size) for size in args.sizes.split(",")]
+    os.makedirs(args.workdir, exist_ok=True)
+    component_path = os.path.relpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), "components"), args.workdir)
+
+    config_path = os.path.join(args.workdir, "json-automation-reload.yaml")
+    with open(config_path, "w") as f:
+        f.write(build_config(sizes, args.reloads, args.reload_ms, args.incremental_bytes, component_path))
+
+    print(f"Compiling {config_path}")
+    compiled = subprocess.run([args.esphome, "compile", config_path], capture_output=True, text=True)
+    if compiled.returncode != 0:
+        print(f"  ❌ Compilation failed\n{compiled.stdout[-2000:]}{compiled.stderr[-2000:]}")
+        return 1
+
+    program = bench.find_program(args.workdir, "json-automation-reload")
+    if program is None:
+        print("  ❌ Host executable not found")
+        return 1
+
+    print(f"Running {program}")
+    reloads = {size: [] for size in sizes}
+    summary = None
+    deadline = time.monotonic() + args.timeout
+    proc = subprocess.Popen([program], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    try:
+        for line in proc.stdout:
+            match = RELOAD_RE.search(line)
+            if match:
+                size, pause, steps, before, after = (int(value) for value in match.groups())
+                reloads[size].append((pause, steps, before, after))
+            match = SUMMARY_RE.search(line)
+            if match:
+                summary = [int(value) for value in match.groups()]
+                break
+            if time.monotonic() > deadline:
+                print("  ⚠️  Timed out before the summary")
+                break
+    finally:
+        proc.kill()
+        proc.wait()
+
+    print()
+    print(
+        f"{'Rules':>6}{'Reloads':>9}{'Pause avg':>12}{'Pause max':>12}{'Steps avg':>11}{'Heap delta avg':>16}"
+    )
+    for size in sizes:
+        samples = reloads[size]
+        if not samples:
+            continue
+        pauses = [pause for pause, _, _, _ in samples]
+        steps = [step_count for _, step_count, _, _ in samples]
+        deltas = [after - before for _, _, before, after in samples]
+        print(
+            f"{size:>6}{len(samples):>9}{statistics.mean(pauses):>9.0f} us{max(pauses):>9} us"
+            f"{statistics.mean(steps):>11.1f}{statistics.mean(deltas):>14.0f} B"
+        )
+
+    all_samples = [sample for samples in reloads.values() for sample in samples]
+    if summary is None or not all_samples:
+        print("❌ Run did not complete")
+        return 1
+
+    sent, handled, max_gap = summary
+    print()
+    print(f"Presses sent: {sent}, sink toggles: {handled}")
+    if handled < sent:
+        print(f"❌ Missed events: {sent - handled}")
+    elif handled > sent:
+        print(f"❌ Duplicated events: {handled - sent}")
+    else:
+        print("✅ No missed or duplicated events")
+    if args.incremental_bytes:
+        # Events are only dispatched between loop() calls, so the longest load step is the pause a reload adds
+        print(f"Max dispatch pause: {max(pause for pause, _, _, _ in all_samples)} us (longest load step)")
+        print(f"Longest gap between presses: {max_gap} us")
+    else:
+        print(f"Max dispatch pause: {max_gap} us")
+    # Heap drift compares the first and last reload of the same size so both hold the same rules
+    drift = [samples[-1][3] - samples[0][3] for samples in reloads.values() if len(samples) > 1]
+    if drift:
+        print(f"Heap drift across reloads: {max(drift)} B")
+    return 0 if handled == sent else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
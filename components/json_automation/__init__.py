@@ -1,11 +1,45 @@
+import json
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
+import esphome.final_validate as fv
 from esphome import automation
-from esphome.const import CONF_ID, CONF_TRIGGER_ID
+from esphome.const import CONF_DATA, CONF_ID, CONF_NAME, CONF_TRIGGER_ID, CONF_VALUE
+
+AUTO_LOAD = ["json"]
 
 CONF_JSON_DATA = "json_data"
 CONF_ON_AUTOMATION_LOADED = "on_automation_loaded"
 CONF_ON_JSON_ERROR = "on_json_error"
+CONF_ON_SLOW_RULE = "on_slow_rule"
+CONF_SLOW_RULE_INTERVAL = "slow_rule_interval"
+CONF_PROFILING = "profiling"
+CONF_STACK_MONITOR = "stack_monitor"
+CONF_CAPTURE_SIZE = "capture_size"
+CONF_SPEED = "speed"
+CONF_INCREMENTAL_LOAD = "incremental_load"
+CONF_MAX_BYTES = "max_bytes"
+CONF_MAX_TIME = "max_time"
+CONF_COMPACTION = "compaction"
+CONF_FRAGMENTATION_THRESHOLD = "fragmentation_threshold"
+CONF_CHECK_INTERVAL = "check_interval"
+CONF_BLOCKS_PER_LOOP = "blocks_per_loop"
+CONF_WASM = "wasm"
+CONF_MEMORY_LIMIT = "memory_limit"
+CONF_FUEL = "fuel"
+CONF_STACK_SIZE = "stack_size"
+CONF_SAVE = "save"
+CONF_SETTLE_TIME = "settle_time"
+CONF_PREFIX = "prefix"
+CONF_AUTOMATION_ID = "automation_id"
+CONF_AUTOMATION_IDS = "automation_ids"
+CONF_INTERLOCKS = "interlocks"
+CONF_ENTITIES = "entities"
+CONF_POLICY = "policy"
+CONF_HISTORY = "history"
+CONF_SIZE = "size"
+CONF_BATCH_SIZE = "batch_size"
+CONF_FLUSH_INTERVAL = "flush_interval"
 
 json_automation_ns = cg.esphome_ns.namespace("json_automation")
 JsonAutomationComponent = json_automation_ns.class_("JsonAutomationComponent", cg.Component)
@@ -18,14 +52,170 @@ JsonErrorTrigger = json_automation_ns.class_(
     "JsonErrorTrigger", automation.Trigger.template(cg.std_string)
 )
 
+SlowRuleTrigger = json_automation_ns.class_(
+    "SlowRuleTrigger", automation.Trigger.template(cg.std_string, cg.uint32)
+)
+
 LoadJsonAction = json_automation_ns.class_("LoadJsonAction", automation.Action)
 SaveJsonAction = json_automation_ns.class_("SaveJsonAction", automation.Action)
 ExecuteAutomationAction = json_automation_ns.class_("ExecuteAutomationAction", automation.Action)
+StartCaptureAction = json_automation_ns.class_("StartCaptureAction", automation.Action)
+StopCaptureAction = json_automation_ns.class_("StopCaptureAction", automation.Action)
+DumpCaptureAction = json_automation_ns.class_("DumpCaptureAction", automation.Action)
+ReplayCaptureAction = json_automation_ns.class_("ReplayCaptureAction", automation.Action)
+LoadWasmAction = json_automation_ns.class_("LoadWasmAction", automation.Action)
+RuleSubtreeAction = json_automation_ns.class_("RuleSubtreeAction", automation.Action)
+SnapshotAction = json_automation_ns.class_("SnapshotAction", automation.Action)
+RestoreAction = json_automation_ns.class_("RestoreAction", automation.Action)
+FlushHistoryAction = json_automation_ns.class_("FlushHistoryAction", automation.Action)
+DumpHistoryAction = json_automation_ns.class_("DumpHistoryAction", automation.Action)
+SubtreeOperation = json_automation_ns.enum("SubtreeOperation", is_class=True)
+InterlockPolicy = json_automation_ns.enum("InterlockPolicy", is_class=True)
+
+SUBTREE_OPERATIONS = {
+    "enable_rules": SubtreeOperation.ENABLE,
+    "disable_rules": SubtreeOperation.DISABLE,
+    "stop_rules": SubtreeOperation.STOP,
+    "remove_rules": SubtreeOperation.REMOVE,
+    "list_rules": SubtreeOperation.LIST,
+    "execute_rules": SubtreeOperation.EXECUTE,
+}
+
+INTERLOCK_POLICIES = {
+    "reject": InterlockPolicy.REJECT,
+    "turn_off_others": InterlockPolicy.TURN_OFF_OTHERS,
+}
+MAX_INTERLOCK_OUTPUTS = 32
+# Records that fit one 4096-byte preferences blob next to the 8-byte header
+MAX_HISTORY_SIZE = 511
+
+
+def validate_output_entity(value):
+    value = cv.string(value)
+    domain, _, object_id = value.partition(".")
+    if domain not in ("switch", "light") or not object_id:
+        raise cv.Invalid("Outputs are switch.<object_id> or light.<object_id>")
+    return value
+
+
+def validate_interlocks(value):
+    outputs = {entity for group in value for entity in group[CONF_ENTITIES]}
+    if len(outputs) > MAX_INTERLOCK_OUTPUTS:
+        raise cv.Invalid(f"At most {MAX_INTERLOCK_OUTPUTS} outputs can be interlocked")
+    return value
+
+
+# Actions whose C++ classes only exist when an option of the component enables them
+OPTIONAL_ACTIONS = {
+    "json_automation.start_capture": CONF_CAPTURE_SIZE,
+    "json_automation.stop_capture": CONF_CAPTURE_SIZE,
+    "json_automation.dump_capture": CONF_CAPTURE_SIZE,
+    "json_automation.replay": CONF_CAPTURE_SIZE,
+    "json_automation.load_wasm": CONF_WASM,
+    "json_automation.flush_history": CONF_HISTORY,
+    "json_automation.dump_history": CONF_HISTORY,
+}
+
+
+def find_actions(value, found):
+    if isinstance(value, dict):
+        for key, item in value.items():
+            if key in OPTIONAL_ACTIONS:
+                found.add(key)
+            find_actions(item, found)
+    elif isinstance(value, list):
+        for item in value:
+            find_actions(item, found)
+
+
+def final_validate(config):
+    found = set()
+    find_actions(fv.full_config.get(), found)
+    for action in sorted(found):
+        if OPTIONAL_ACTIONS[action] not in config:
+            raise cv.Invalid(f"{action} needs {OPTIONAL_ACTIONS[action]} to be set in json_automation")
+    return config
+
+
+def validate_history(value):
+    if value[CONF_BATCH_SIZE] > value[CONF_SIZE]:
+        raise cv.Invalid(f"{CONF_BATCH_SIZE} cannot be larger than {CONF_SIZE}")
+    return value
+
+
+# The base rules are checked at build time and minified, so they take as little flash as possible
+def validate_base_json(value):
+    value = cv.string(value)
+    try:
+        rules = json.loads(value)
+    except ValueError as err:
+        raise cv.Invalid(f"Invalid JSON: {err}") from err
+    if not isinstance(rules, list):
+        raise cv.Invalid("JSON must be an array of automations")
+    for rule in rules:
+        if not isinstance(rule, dict) or "id" not in rule:
+            raise cv.Invalid("Every automation needs an id")
+        if "trigger" not in rule or "actions" not in rule:
+            raise cv.Invalid(f"Automation {rule['id']} needs a trigger and actions")
+    return json.dumps(rules, separators=(",", ":"))
+
 
 CONFIG_SCHEMA = cv.Schema(
     {
         cv.GenerateID(): cv.declare_id(JsonAutomationComponent),
-        cv.Optional(CONF_JSON_DATA): cv.string,
+        cv.Optional(CONF_JSON_DATA): validate_base_json,
+        cv.Optional(CONF_PROFILING, default=False): cv.boolean,
+        cv.Optional(CONF_STACK_MONITOR, default=False): cv.boolean,
+        cv.Optional(CONF_CAPTURE_SIZE): cv.int_range(min=1, max=65535),
+        cv.Optional(CONF_HISTORY): cv.All(
+            cv.Schema(
+                {
+                    cv.Optional(CONF_SIZE, default=256): cv.int_range(min=1, max=MAX_HISTORY_SIZE),
+                    cv.Optional(CONF_BATCH_SIZE, default=64): cv.int_range(min=1, max=MAX_HISTORY_SIZE),
+                    cv.Optional(CONF_FLUSH_INTERVAL, default="1h"): cv.positive_time_period_milliseconds,
+                }
+            ),
+            validate_history,
+        ),
+        cv.Optional(CONF_SETTLE_TIME, default="0s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_INCREMENTAL_LOAD): cv.All(
+            cv.Schema(
+                {
+                    cv.Optional(CONF_MAX_BYTES): cv.int_range(min=16, max=4096),
+                    cv.Optional(CONF_MAX_TIME): cv.positive_time_period_microseconds,
+                }
+            ),
+            cv.has_at_least_one_key(CONF_MAX_BYTES, CONF_MAX_TIME),
+        ),
+        cv.Optional(CONF_COMPACTION): cv.Schema(
+            {
+                cv.Optional(CONF_FRAGMENTATION_THRESHOLD, default="40%"): cv.All(
+                    cv.percentage, cv.Range(min=0.01, max=0.99)
+                ),
+                cv.Optional(CONF_CHECK_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+                cv.Optional(CONF_BLOCKS_PER_LOOP, default=2): cv.int_range(min=1, max=64),
+            }
+        ),
+        cv.Optional(CONF_WASM): cv.Schema(
+            {
+                cv.Optional(CONF_MEMORY_LIMIT, default=4096): cv.int_range(min=0, max=65536),
+                cv.Optional(CONF_FUEL, default=100000): cv.int_range(min=100, max=100000000),
+                cv.Optional(CONF_STACK_SIZE, default=256): cv.int_range(min=16, max=4096),
+            }
+        ),
+        cv.Optional(CONF_INTERLOCKS): cv.All(
+            cv.ensure_list(
+                cv.Schema(
+                    {
+                        cv.Required(CONF_ENTITIES): cv.All(
+                            cv.ensure_list(validate_output_entity), cv.Length(min=2)
+                        ),
+                        cv.Optional(CONF_POLICY, default="reject"): cv.enum(INTERLOCK_POLICIES, lower=True),
+                    }
+                )
+            ),
+            validate_interlocks,
+        ),
         cv.Optional(CONF_ON_AUTOMATION_LOADED): automation.validate_automation(
             {
                 cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(AutomationLoadedTrigger),
@@ -36,16 +226,69 @@ CONFIG_SCHEMA = cv.Schema(
                 cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(JsonErrorTrigger),
             }
         ),
+        cv.Optional(CONF_ON_SLOW_RULE): automation.validate_automation(
+            {
+                cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(SlowRuleTrigger),
+            }
+        ),
+        cv.Optional(CONF_SLOW_RULE_INTERVAL, default="10s"): cv.positive_time_period_milliseconds,
     }
 ).extend(cv.COMPONENT_SCHEMA)
 
+FINAL_VALIDATE_SCHEMA = final_validate
+
 
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
 
     if CONF_JSON_DATA in config:
-        cg.add(var.set_json_data(config[CONF_JSON_DATA]))
+        cg.add(var.set_base_json(config[CONF_JSON_DATA]))
+
+    if config[CONF_PROFILING]:
+        cg.add_define("USE_JSON_AUTOMATION_PROFILING")
+
+    if config[CONF_STACK_MONITOR]:
+        cg.add_define("USE_JSON_AUTOMATION_STACK_MONITOR")
+
+    if CONF_CAPTURE_SIZE in config:
+        cg.add_define("USE_JSON_AUTOMATION_CAPTURE")
+        cg.add(var.set_capture_size(config[CONF_CAPTURE_SIZE]))
+
+    if CONF_HISTORY in config:
+        conf = config[CONF_HISTORY]
+        cg.add_define("USE_JSON_AUTOMATION_HISTORY")
+        cg.add(
+            var.set_history(conf[CONF_SIZE], conf[CONF_BATCH_SIZE], conf[CONF_FLUSH_INTERVAL].total_milliseconds)
+        )
+
+    cg.add(var.set_slow_rule_interval(config[CONF_SLOW_RULE_INTERVAL].total_milliseconds))
+
+    if config[CONF_SETTLE_TIME].total_milliseconds > 0:
+        cg.add(var.set_settle_time(config[CONF_SETTLE_TIME].total_milliseconds))
+
+    if CONF_INCREMENTAL_LOAD in config:
+        conf = config[CONF_INCREMENTAL_LOAD]
+        max_time = conf[CONF_MAX_TIME].total_microseconds if CONF_MAX_TIME in conf else 0
+        cg.add(var.set_load_budget(conf.get(CONF_MAX_BYTES, 0), max_time))
+
+    if CONF_COMPACTION in config:
+        conf = config[CONF_COMPACTION]
+        cg.add(
+            var.set_compaction(
+                round(conf[CONF_FRAGMENTATION_THRESHOLD] * 100),
+                conf[CONF_CHECK_INTERVAL].total_milliseconds,
+                conf[CONF_BLOCKS_PER_LOOP],
+            )
+        )
+
+    if CONF_WASM in config:
+        conf = config[CONF_WASM]
+        cg.add_define("USE_JSON_AUTOMATION_WASM")
+        cg.add(var.set_wasm_limits(conf[CONF_MEMORY_LIMIT], conf[CONF_FUEL], conf[CONF_STACK_SIZE]))
+
+    for conf in config.get(CONF_INTERLOCKS, []):
+        cg.add(var.add_interlock(conf[CONF_ENTITIES], conf[CONF_POLICY]))
 
     for conf in config.get(CONF_ON_AUTOMATION_LOADED, []):
         trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
@@ -55,6 +298,10 @@ async def to_code(config):
         trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
         await automation.build_automation(trigger, [(cg.std_string, "error")], conf)
 
+    for conf in config.get(CONF_ON_SLOW_RULE, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [(cg.std_string, "rule_id"), (cg.uint32, "latency_us")], conf)
+
 
 @automation.register_action(
     "json_automation.load_json",
@@ -92,16 +339,151 @@ async def save_json_action_to_code(config, action_id, template_arg, args):
 @automation.register_action(
     "json_automation.execute",
     ExecuteAutomationAction,
+    cv.All(
+        cv.Schema(
+            {
+                cv.GenerateID(): cv.use_id(JsonAutomationComponent),
+                cv.Optional(CONF_AUTOMATION_ID): cv.templatable(cv.string),
+                cv.Optional(CONF_AUTOMATION_IDS): cv.templatable(cv.ensure_list(cv.string)),
+                cv.Optional(CONF_VALUE): cv.templatable(cv.float_),
+            }
+        ),
+        cv.has_exactly_one_key(CONF_AUTOMATION_ID, CONF_AUTOMATION_IDS),
+    ),
+)
+async def execute_automation_action_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, paren)
+    if CONF_AUTOMATION_IDS in config:
+        template_ = await cg.templatable(config[CONF_AUTOMATION_IDS], args, cg.std_vector.template(cg.std_string))
+        cg.add(var.set_automation_ids(template_))
+    else:
+        template_ = await cg.templatable(config[CONF_AUTOMATION_ID], args, cg.std_string)
+        cg.add(var.set_automation_id(template_))
+    if CONF_VALUE in config:
+        template_ = await cg.templatable(config[CONF_VALUE], args, cg.float_)
+        cg.add(var.set_value(template_))
+    return var
+
+
+PARENT_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.use_id(JsonAutomationComponent),
+    }
+)
+
+
+@automation.register_action("json_automation.start_capture", StartCaptureAction, PARENT_ACTION_SCHEMA)
+@automation.register_action("json_automation.stop_capture", StopCaptureAction, PARENT_ACTION_SCHEMA)
+@automation.register_action("json_automation.dump_capture", DumpCaptureAction, PARENT_ACTION_SCHEMA)
+@automation.register_action("json_automation.flush_history", FlushHistoryAction, PARENT_ACTION_SCHEMA)
+@automation.register_action("json_automation.dump_history", DumpHistoryAction, PARENT_ACTION_SCHEMA)
+async def parent_action_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, paren)
+    return var
+
+
+@automation.register_action(
+    "json_automation.replay",
+    ReplayCaptureAction,
     cv.Schema(
         {
             cv.GenerateID(): cv.use_id(JsonAutomationComponent),
-            cv.Required("automation_id"): cv.templatable(cv.string),
+            cv.Required(CONF_DATA): cv.templatable(cv.string),
+            cv.Optional(CONF_SPEED, default=1.0): cv.templatable(cv.float_range(min=0.0)),
         }
     ),
 )
-async def execute_automation_action_to_code(config, action_id, template_arg, args):
+async def replay_capture_action_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, paren)
+    data_ = await cg.templatable(config[CONF_DATA], args, cg.std_string)
+    cg.add(var.set_data(data_))
+    speed_ = await cg.templatable(config[CONF_SPEED], args, cg.float_)
+    cg.add(var.set_speed(speed_))
+    return var
+
+
+SUBTREE_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.use_id(JsonAutomationComponent),
+        cv.Required(CONF_PREFIX): cv.templatable(cv.string),
+    }
+)
+
+
+def register_subtree_action(name, operation):
+    @automation.register_action(f"json_automation.{name}", RuleSubtreeAction, SUBTREE_ACTION_SCHEMA)
+    async def subtree_action_to_code(config, action_id, template_arg, args):
+        paren = await cg.get_variable(config[CONF_ID])
+        var = cg.new_Pvariable(action_id, paren, operation)
+        template_ = await cg.templatable(config[CONF_PREFIX], args, cg.std_string)
+        cg.add(var.set_prefix(template_))
+        return var
+
+
+for _name, _operation in SUBTREE_OPERATIONS.items():
+    register_subtree_action(_name, _operation)
+
+
+@automation.register_action(
+    "json_automation.snapshot",
+    SnapshotAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(JsonAutomationComponent),
+            cv.Required(CONF_NAME): cv.templatable(cv.string),
+            cv.Optional(CONF_ENTITIES, default=[]): cv.ensure_list(validate_output_entity),
+        }
+    ),
+)
+async def snapshot_action_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, paren)
+    name_ = await cg.templatable(config[CONF_NAME], args, cg.std_string)
+    cg.add(var.set_name(name_))
+    cg.add(var.set_entities(config[CONF_ENTITIES]))
+    return var
+
+
+@automation.register_action(
+    "json_automation.restore",
+    RestoreAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(JsonAutomationComponent),
+            cv.Required(CONF_NAME): cv.templatable(cv.string),
+        }
+    ),
+)
+async def restore_action_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, paren)
+    name_ = await cg.templatable(config[CONF_NAME], args, cg.std_string)
+    cg.add(var.set_name(name_))
+    return var
+
+
+@automation.register_action(
+    "json_automation.load_wasm",
+    LoadWasmAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(JsonAutomationComponent),
+            cv.Required(CONF_NAME): cv.templatable(cv.string),
+            cv.Required(CONF_DATA): cv.templatable(cv.string),
+            cv.Optional(CONF_SAVE, default=True): cv.templatable(cv.boolean),
+        }
+    ),
+)
+async def load_wasm_action_to_code(config, action_id, template_arg, args):
     paren = await cg.get_variable(config[CONF_ID])
     var = cg.new_Pvariable(action_id, paren)
-    template_ = await cg.templatable(config["automation_id"], args, cg.std_string)
-    cg.add(var.set_automation_id(template_))
+    name_ = await cg.templatable(config[CONF_NAME], args, cg.std_string)
+    cg.add(var.set_name(name_))
+    data_ = await cg.templatable(config[CONF_DATA], args, cg.std_string)
+    cg.add(var.set_data(data_))
+    save_ = await cg.templatable(config[CONF_SAVE], args, cg.bool_)
+    cg.add(var.set_save(save_))
     return var
@@ -0,0 +1,113 @@
+#include "capture.h"
+
+#ifdef USE_JSON_AUTOMATION_CAPTURE
+
+namespace esphome {
+namespace json_automation {
+
+// Log layout: magic, version, rules_hash, input count, input keys, record count, records.
+// Each record is a 32-bit timestamp followed by the input index and state byte.
+static const uint8_t CAPTURE_MAGIC[4] = {'J', 'A', 'C', 'P'};
+static const uint8_t CAPTURE_VERSION = 1;
+static const size_t CAPTURE_RECORD_SIZE = 6;
+
+static void put_u32(std::vector<uint8_t> &out, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static uint32_t get_u32(const uint8_t *data) {
+  return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+         (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+void WorkloadCapture::set_capacity(size_t capacity) {
+  this->ring_.assign(capacity, CaptureRecord{});
+  this->head_ = 0;
+  this->count_ = 0;
+}
+
+void WorkloadCapture::start(uint32_t rules_hash, std::vector<uint32_t> input_keys, uint32_t now) {
+  this->rules_hash_ = rules_hash;
+  this->input_keys_ = std::move(input_keys);
+  this->start_ms_ = now;
+  this->head_ = 0;
+  this->count_ = 0;
+  this->overwritten_ = 0;
+  this->active_ = !this->ring_.empty();
+}
+
+void WorkloadCapture::record(uint8_t input, bool state, uint32_t now) {
+  if (!this->active_)
+    return;
+
+  const size_t capacity = this->ring_.size();
+  size_t index = (this->head_ + this->count_) % capacity;
+  if (this->count_ == capacity) {
+    index = this->head_;
+    this->head_ = (this->head_ + 1) % capacity;
+    this->overwritten_++;
+  } else {
+    this->count_++;
+  }
+  this->ring_[index] = CaptureRecord{now - this->start_ms_, input, state};
+}
+
+std::vector<uint8_t> WorkloadCapture::serialize() const {
+  std::vector<uint8_t> out;
+  out.reserve(4 + 1 + 4 + 1 + this->input_keys_.size() * 4 + 4 + this->count_ * CAPTURE_RECORD_SIZE);
+  out.insert(out.end(), CAPTURE_MAGIC, CAPTURE_MAGIC + sizeof(CAPTURE_MAGIC));
+  out.push_back(CAPTURE_VERSION);
+  put_u32(out, this->rules_hash_);
+  out.push_back(static_cast<uint8_t>(this->input_keys_.size()));
+  for (uint32_t key : this->input_keys_)
+    put_u32(out, key);
+  put_u32(out, this->count_);
+  for (size_t i = 0; i < this->count_; i++) {
+    const auto &record = this->ring_[(this->head_ + i) % this->ring_.size()];
+    put_u32(out, record.timestamp_ms);
+    out.push_back(record.input);
+    out.push_back(record.state ? 1 : 0);
+  }
+  return out;
+}
+
+bool WorkloadCapture::deserialize(const std::vector<uint8_t> &data, CaptureLog &log) {
+  size_t pos = 0;
+  if (data.size() < sizeof(CAPTURE_MAGIC) + 1 + 4 + 1)
+    return false;
+  for (uint8_t expected : CAPTURE_MAGIC) {
+    if (data[pos++] != expected)
+      return false;
+  }
+  if (data[pos++] != CAPTURE_VERSION)
+    return false;
+  log.rules_hash = get_u32(&data[pos]);
+  pos += 4;
+
+  const size_t input_count = data[pos++];
+  if (data.size() < pos + input_count * 4 + 4)
+    return false;
+  log.input_keys.clear();
+  for (size_t i = 0; i < input_count; i++, pos += 4)
+    log.input_keys.push_back(get_u32(&data[pos]));
+
+  const uint32_t record_count = get_u32(&data[pos]);
+  pos += 4;
+  if (data.size() != pos + static_cast<size_t>(record_count) * CAPTURE_RECORD_SIZE)
+    return false;
+  log.records.clear();
+  log.records.reserve(record_count);
+  for (uint32_t i = 0; i < record_count; i++, pos += CAPTURE_RECORD_SIZE) {
+    CaptureRecord record{get_u32(&data[pos]), data[pos + 4], data[pos + 5] != 0};
+    if (record.input >= input_count)
+      return false;
+    log.records.push_back(record);
+  }
+  return true;
+}
+
+}  // namespace json_automation
+}  // namespace esphome
+
+#endif  // USE_JSON_AUTOMATION_CAPTURE
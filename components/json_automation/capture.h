@@ -0,0 +1,61 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_JSON_AUTOMATION_CAPTURE
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace json_automation {
+
+/// One input state change, timestamped relative to the start of the capture.
+struct CaptureRecord {
+  uint32_t timestamp_ms;
+  uint8_t input;
+  bool state;
+};
+
+/// Decoded capture log: the rule-set hash, the entity keys of the inputs and the events.
+struct CaptureLog {
+  uint32_t rules_hash{0};
+  std::vector<uint32_t> input_keys;
+  std::vector<CaptureRecord> records;
+};
+
+/// Fixed-size RAM ring of input events. When full, the oldest events are overwritten.
+class WorkloadCapture {
+ public:
+  void set_capacity(size_t capacity);
+  size_t get_capacity() const { return this->ring_.size(); }
+
+  void start(uint32_t rules_hash, std::vector<uint32_t> input_keys, uint32_t now);
+  void stop() { this->active_ = false; }
+  bool is_active() const { return this->active_; }
+
+  void record(uint8_t input, bool state, uint32_t now);
+
+  size_t size() const { return this->count_; }
+  uint32_t get_overwritten() const { return this->overwritten_; }
+
+  /// Encode header and events (oldest first) into the portable little-endian log format.
+  std::vector<uint8_t> serialize() const;
+  static bool deserialize(const std::vector<uint8_t> &data, CaptureLog &log);
+
+ protected:
+  std::vector<CaptureRecord> ring_;
+  std::vector<uint32_t> input_keys_;
+  size_t head_{0};
+  size_t count_{0};
+  uint32_t overwritten_{0};
+  uint32_t rules_hash_{0};
+  uint32_t start_ms_{0};
+  bool active_{false};
+};
+
+}  // namespace json_automation
+}  // namespace esphome
+
+#endif  // USE_JSON_AUTOMATION_CAPTURE
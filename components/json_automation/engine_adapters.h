@@ -0,0 +1,138 @@
+#pragma once
+
+#include "rule_types.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Interfaces through which the rule engine reaches the platform. The ESPHome component implements them
+// in esphome_adapters.h; host tools provide their own.
+
+namespace esphome {
+namespace json_automation {
+
+/// Handle returned by EntityAdapter for an entity that does not exist.
+static const int32_t INVALID_HANDLE = -1;
+/// Largest record StorageAdapter::save_blob() needs to hold.
+static const size_t MAX_BLOB_SIZE = 4096;
+
+enum class PayloadType : uint8_t { NONE, BOOL, INT, FLOAT };
+
+/// Value that made a rule run. It travels with the action chain, also across delays, so actions see the value
+/// of the trigger instead of reading the entity again when it may have changed.
+struct TriggerPayload {
+  PayloadType type{PayloadType::NONE};
+  /// Input or sensor handle of the entity that triggered, or INVALID_HANDLE.
+  int32_t entity{INVALID_HANDLE};
+  union {
+    int32_t int_value;
+    float float_value;
+  };
+
+  TriggerPayload() : int_value(0) {}
+  static TriggerPayload of_bool(int32_t entity, bool state) {
+    TriggerPayload payload;
+    payload.type = PayloadType::BOOL;
+    payload.entity = entity;
+    payload.int_value = state;
+    return payload;
+  }
+  static TriggerPayload of_int(int32_t value) {
+    TriggerPayload payload;
+    payload.type = PayloadType::INT;
+    payload.int_value = value;
+    return payload;
+  }
+  static TriggerPayload of_float(float value, int32_t entity = INVALID_HANDLE) {
+    TriggerPayload payload;
+    payload.type = PayloadType::FLOAT;
+    payload.entity = entity;
+    payload.float_value = value;
+    return payload;
+  }
+  /// The value as an integer: 0 or 1 for a bool, truncated for a float, 0 without a value.
+  int32_t as_int() const {
+    return this->type == PayloadType::FLOAT ? static_cast<int32_t>(this->float_value) : this->int_value;
+  }
+  /// The value as a float, without truncation.
+  float as_float() const {
+    return this->type == PayloadType::FLOAT ? this->float_value : static_cast<float>(this->int_value);
+  }
+};
+
+class EntityAdapter {
+ public:
+  virtual ~EntityAdapter() = default;
+
+  /// Resolve a binary input by object id. The adapter must deliver its state changes to
+  /// RuleEngine::dispatch_input() with the returned handle. Handles stay valid across reloads.
+  virtual int32_t resolve_input(const std::string &object_id) = 0;
+  /// Resolve a numeric sensor by object id. The adapter must deliver its values to RuleEngine::post_sensor()
+  /// with the returned handle. Optional; by default no sensor exists.
+  virtual int32_t resolve_sensor(const std::string &object_id) { return INVALID_HANDLE; }
+  /// Resolve the target of a switch or light action by object id.
+  virtual int32_t resolve_output(ActionSource source, const std::string &object_id) = 0;
+  virtual void perform(ActionSource source, ActionType type, int32_t handle) = 0;
+  /// Current state of an input or output handle.
+  virtual bool get_input_state(int32_t handle) = 0;
+  virtual bool get_output_state(ActionSource source, int32_t handle) = 0;
+  /// Brightness of a light, 0-255. Optional; the default is 255 for any output that is on.
+  virtual uint8_t get_output_level(ActionSource source, int32_t handle) {
+    return this->get_output_state(source, handle) ? 255 : 0;
+  }
+  /// Set the state and, for a light that is on, the brightness of an output in one call. Optional; the
+  /// default only turns the output on or off.
+  virtual void restore_output(ActionSource source, int32_t handle, bool state, uint8_t level) {
+    this->perform(source, state ? ActionType::TURN_ON : ActionType::TURN_OFF, handle);
+  }
+};
+
+class StorageAdapter {
+ public:
+  virtual ~StorageAdapter() = default;
+
+  virtual bool load(std::string &json_data) = 0;
+  virtual bool save(const std::string &json_data) = 0;
+  /// Named binary records, such as WebAssembly modules. Optional; the defaults store nothing.
+  virtual bool load_blob(const std::string &name, std::vector<uint8_t> &data) { return false; }
+  virtual bool save_blob(const std::string &name, const std::vector<uint8_t> &data) { return false; }
+};
+
+/// Runs actions that are programs rather than entity commands (ActionSource::WASM).
+class ScriptAdapter {
+ public:
+  virtual ~ScriptAdapter() = default;
+
+  /// Prepare a call once when its rule is compiled. A handle stays valid until prune_calls() leaves it out.
+  virtual int32_t resolve_call(const WasmCall &call) = 0;
+  /// Called after the rule set changed with the handles its compiled rules still use; the adapter may free the
+  /// other calls and reuse their handles. Optional; the default keeps every call.
+  virtual void prune_calls(const std::vector<int32_t> &used) {}
+  /// Run a prepared call with the payload of the trigger of its rule; false stops the rest of the action chain.
+  virtual bool run_call(int32_t handle, const TriggerPayload &payload) = 0;
+};
+
+class ClockAdapter {
+ public:
+  virtual ~ClockAdapter() = default;
+
+  virtual uint32_t millis() = 0;
+  virtual uint32_t micros() = 0;
+  /// Free-running counter used for per-action profiling.
+  virtual uint32_t cpu_cycles() = 0;
+};
+
+/// Log levels, numbered like ESPHOME_LOG_LEVEL_*.
+enum class LogLevel : uint8_t { ERROR = 1, WARN = 2, INFO = 3, CONFIG = 4, DEBUG = 5, VERBOSE = 6 };
+
+class LogAdapter {
+ public:
+  virtual ~LogAdapter() = default;
+
+  /// Messages above this level are not formatted at all.
+  virtual LogLevel get_level() const = 0;
+  virtual void log(LogLevel level, const char *message) = 0;
+};
+
+}  // namespace json_automation
+}  // namespace esphome
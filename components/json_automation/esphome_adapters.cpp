@@ -0,0 +1,257 @@
+#include "esphome_adapters.h"
+#include "esphome/core/application.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace esphome {
+namespace json_automation {
+
+static const char *const TAG = "json_automation";
+
+template<typename T> static int32_t handle_of(std::vector<T *> &entities, T *entity) {
+  auto it = std::find(entities.begin(), entities.end(), entity);
+  if (it != entities.end())
+    return it - entities.begin();
+  entities.push_back(entity);
+  return entities.size() - 1;
+}
+
+int32_t ESPHomeEntities::resolve_input(const std::string &object_id) {
+  uint32_t key = fnv1_hash(object_id);
+  auto *sensor = App.get_binary_sensor_by_key(key);
+  if (!sensor) {
+    ESP_LOGW(TAG, "Binary sensor not found: %s (hash: %u)", object_id.c_str(), key);
+    return INVALID_HANDLE;
+  }
+  ESP_LOGD(TAG, "Resolved binary_sensor: %s (hash: %u)", object_id.c_str(), key);
+
+  const size_t known = this->inputs_.size();
+  const int32_t handle = handle_of(this->inputs_, sensor);
+  if (this->inputs_.size() != known) {
+    RuleEngine *engine = this->engine_;
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+    StackMonitor *stack = this->stack_;
+    sensor->add_on_state_callback([engine, stack, handle](bool state) {
+      const size_t before = stack->enter();
+      engine->dispatch_input(handle, state);
+      stack->leave(StackProbe::RULES, before);
+    });
+#else
+    sensor->add_on_state_callback([engine, handle](bool state) { engine->dispatch_input(handle, state); });
+#endif
+  }
+  return handle;
+}
+
+#ifdef USE_SENSOR
+int32_t ESPHomeEntities::resolve_sensor(const std::string &object_id) {
+  uint32_t key = fnv1_hash(object_id);
+  auto *sensor = App.get_sensor_by_key(key);
+  if (!sensor) {
+    ESP_LOGW(TAG, "Sensor not found: %s (hash: %u)", object_id.c_str(), key);
+    return INVALID_HANDLE;
+  }
+  ESP_LOGD(TAG, "Resolved sensor: %s (hash: %u)", object_id.c_str(), key);
+
+  const size_t known = this->sensors_.size();
+  const int32_t handle = handle_of(this->sensors_, sensor);
+  if (this->sensors_.size() != known) {
+    // Only stores the value; the rules run from the next loop()
+    RuleEngine *engine = this->engine_;
+    sensor->add_on_state_callback([engine, handle](float value) { engine->post_sensor(handle, value); });
+    if (sensor->has_state())
+      engine->post_sensor(handle, sensor->get_state());
+  }
+  return handle;
+}
+#endif
+
+int32_t ESPHomeEntities::resolve_output(ActionSource source, const std::string &object_id) {
+  uint32_t key = fnv1_hash(object_id);
+  if (source == ActionSource::SWITCH) {
+    auto *sw = App.get_switch_by_key(key);
+    if (!sw) {
+      ESP_LOGW(TAG, "Switch not found: %s (hash: %u)", object_id.c_str(), key);
+      return INVALID_HANDLE;
+    }
+    ESP_LOGD(TAG, "Resolved switch: %s (hash: %u)", object_id.c_str(), key);
+    return handle_of(this->switches_, sw);
+  }
+  if (source == ActionSource::LIGHT) {
+    auto *light = App.get_light_by_key(key);
+    if (!light) {
+      ESP_LOGW(TAG, "Light not found: %s (hash: %u)", object_id.c_str(), key);
+      return INVALID_HANDLE;
+    }
+    ESP_LOGD(TAG, "Resolved light: %s (hash: %u)", object_id.c_str(), key);
+    return handle_of(this->lights_, light);
+  }
+  ESP_LOGW(TAG, "Unsupported action configuration");
+  return INVALID_HANDLE;
+}
+
+void ESPHomeEntities::perform(ActionSource source, ActionType type, int32_t handle) {
+  if (source == ActionSource::SWITCH) {
+    auto *sw = this->switches_[handle];
+    if (type == ActionType::TURN_ON) {
+      sw->turn_on();
+    } else if (type == ActionType::TURN_OFF) {
+      sw->turn_off();
+    } else if (type == ActionType::TOGGLE) {
+      sw->toggle();
+    }
+  } else if (source == ActionSource::LIGHT) {
+    auto *light = this->lights_[handle];
+    if (type == ActionType::TURN_ON) {
+      light->make_call().set_state(true).perform();
+    } else if (type == ActionType::TURN_OFF) {
+      light->make_call().set_state(false).perform();
+    } else if (type == ActionType::TOGGLE) {
+      light->toggle().perform();
+    }
+  }
+}
+
+bool ESPHomeEntities::get_input_state(int32_t handle) { return this->inputs_[handle]->state; }
+
+bool ESPHomeEntities::get_output_state(ActionSource source, int32_t handle) {
+  if (source == ActionSource::SWITCH)
+    return this->switches_[handle]->state;
+  if (source == ActionSource::LIGHT)
+    return this->lights_[handle]->current_values.is_on();
+  return false;
+}
+
+uint8_t ESPHomeEntities::get_output_level(ActionSource source, int32_t handle) {
+  if (source != ActionSource::LIGHT)
+    return EntityAdapter::get_output_level(source, handle);
+  const auto &values = this->lights_[handle]->current_values;
+  return values.is_on() ? static_cast<uint8_t>(values.get_brightness() * 255.0f + 0.5f) : 0;
+}
+
+void ESPHomeEntities::restore_output(ActionSource source, int32_t handle, bool state, uint8_t level) {
+  if (source != ActionSource::LIGHT || !state) {
+    EntityAdapter::restore_output(source, handle, state, level);
+    return;
+  }
+  this->lights_[handle]->make_call().set_state(true).set_brightness(level / 255.0f).perform();
+}
+
+/// Preferences record of a blob: its length, then the data.
+struct BlobRecord {
+  uint16_t size;
+  uint8_t data[MAX_BLOB_SIZE];
+};
+
+void ESPHomeStorage::setup() {
+  this->pref_ = global_preferences->make_preference<char[MAX_JSON_SIZE]>(fnv1_hash(std::string("json_automation")));
+}
+
+bool ESPHomeStorage::load(std::string &json_data) {
+  char buffer[MAX_JSON_SIZE];
+  this->stats_.loads++;
+  if (!this->pref_.load(&buffer))
+    return false;
+  buffer[MAX_JSON_SIZE - 1] = '\0';
+  json_data = buffer;
+  return true;
+}
+
+bool ESPHomeStorage::save(const std::string &json_data) {
+  char buffer[MAX_JSON_SIZE];
+  memset(buffer, 0, MAX_JSON_SIZE);
+  strncpy(buffer, json_data.c_str(), MAX_JSON_SIZE - 1);
+  buffer[MAX_JSON_SIZE - 1] = '\0';
+
+  this->stats_.saves++;
+  if (!this->pref_.save(&buffer)) {
+    this->stats_.save_failures++;
+    return false;
+  }
+  this->stats_.records_written++;
+  this->stats_.bytes_written += sizeof(buffer);
+  this->stats_.last_payload_bytes = json_data.size();
+  ESP_LOGD(TAG, "%u bytes written to preferences in total", (uint32_t) this->stats_.bytes_written);
+  return true;
+}
+
+ESPPreferenceObject &ESPHomeStorage::blob_pref(const std::string &name) {
+  auto it = this->blob_prefs_.find(name);
+  if (it == this->blob_prefs_.end()) {
+    // In flash on every platform: the RTC memory ESP8266 uses by default is lost on power loss
+    auto pref = global_preferences->make_preference<BlobRecord>(fnv1_hash("json_automation_" + name), true);
+    it = this->blob_prefs_.emplace(name, pref).first;
+  }
+  return it->second;
+}
+
+bool ESPHomeStorage::load_blob(const std::string &name, std::vector<uint8_t> &data) {
+  std::unique_ptr<BlobRecord> record(new BlobRecord());
+  this->stats_.loads++;
+  if (!this->blob_pref(name).load(record.get()) || record->size == 0 || record->size > MAX_BLOB_SIZE)
+    return false;
+  data.assign(record->data, record->data + record->size);
+  return true;
+}
+
+bool ESPHomeStorage::save_blob(const std::string &name, const std::vector<uint8_t> &data) {
+  if (data.empty() || data.size() > MAX_BLOB_SIZE)
+    return false;
+  std::unique_ptr<BlobRecord> record(new BlobRecord());
+  record->size = data.size();
+  std::copy(data.begin(), data.end(), record->data);
+
+  this->stats_.saves++;
+  if (!this->blob_pref(name).save(record.get())) {
+    this->stats_.save_failures++;
+    return false;
+  }
+  this->stats_.records_written++;
+  this->stats_.bytes_written += sizeof(BlobRecord);
+  this->stats_.last_payload_bytes = data.size();
+  return true;
+}
+
+uint32_t ESPHomeClock::millis() { return esphome::millis(); }
+
+uint32_t ESPHomeClock::micros() { return esphome::micros(); }
+
+uint32_t ESPHomeClock::cpu_cycles() { return arch_get_cpu_cycle_count(); }
+
+LogLevel ESPHomeLog::get_level() const {
+#ifdef ESPHOME_LOG_LEVEL
+  return static_cast<LogLevel>(std::min(ESPHOME_LOG_LEVEL, ESPHOME_LOG_LEVEL_VERBOSE));
+#else
+  return LogLevel::DEBUG;
+#endif
+}
+
+void ESPHomeLog::log(LogLevel level, const char *message) {
+  switch (level) {
+    case LogLevel::ERROR:
+      ESP_LOGE(TAG, "%s", message);
+      break;
+    case LogLevel::WARN:
+      ESP_LOGW(TAG, "%s", message);
+      break;
+    case LogLevel::INFO:
+      ESP_LOGI(TAG, "%s", message);
+      break;
+    case LogLevel::CONFIG:
+      ESP_LOGCONFIG(TAG, "%s", message);
+      break;
+    case LogLevel::DEBUG:
+      ESP_LOGD(TAG, "%s", message);
+      break;
+    case LogLevel::VERBOSE:
+      ESP_LOGV(TAG, "%s", message);
+      break;
+  }
+}
+
+}  // namespace json_automation
+}  // namespace esphome
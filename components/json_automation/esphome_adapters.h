@@ -0,0 +1,101 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#include "esphome/core/preferences.h"
+#include "esphome/components/binary_sensor/binary_sensor.h"
+#include "esphome/components/switch/switch.h"
+#include "esphome/components/light/light_state.h"
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+#include "rule_engine.h"
+#include "stack_info.h"
+#include <map>
+#include <vector>
+
+namespace esphome {
+namespace json_automation {
+
+/// What the component handed to the preferences backend. Every save writes the whole
+/// MAX_JSON_SIZE record, regardless of the JSON length.
+struct StorageStats {
+  uint32_t saves{0};
+  uint32_t save_failures{0};
+  uint32_t records_written{0};
+  uint64_t bytes_written{0};
+  uint32_t last_payload_bytes{0};
+  uint32_t loads{0};
+};
+
+/// Binary sensors, sensors, switches and lights looked up by object id hash. Handles index the vectors below;
+/// a binary sensor or sensor gets its state callback once, since ESPHome callbacks cannot be removed.
+class ESPHomeEntities : public EntityAdapter {
+ public:
+  void set_engine(RuleEngine *engine) { this->engine_ = engine; }
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+  /// Take stack marks around the rules run by input changes.
+  void set_stack_monitor(StackMonitor *stack) { this->stack_ = stack; }
+#endif
+
+  int32_t resolve_input(const std::string &object_id) override;
+#ifdef USE_SENSOR
+  int32_t resolve_sensor(const std::string &object_id) override;
+#endif
+  int32_t resolve_output(ActionSource source, const std::string &object_id) override;
+  void perform(ActionSource source, ActionType type, int32_t handle) override;
+  bool get_input_state(int32_t handle) override;
+  bool get_output_state(ActionSource source, int32_t handle) override;
+  uint8_t get_output_level(ActionSource source, int32_t handle) override;
+  void restore_output(ActionSource source, int32_t handle, bool state, uint8_t level) override;
+
+  size_t get_input_count() const { return this->inputs_.size(); }
+
+ protected:
+  RuleEngine *engine_{nullptr};
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+  StackMonitor *stack_{nullptr};
+#endif
+  std::vector<binary_sensor::BinarySensor *> inputs_;
+#ifdef USE_SENSOR
+  std::vector<sensor::Sensor *> sensors_;
+#endif
+  std::vector<switch_::Switch *> switches_;
+  std::vector<light::LightState *> lights_;
+};
+
+/// One MAX_JSON_SIZE record in global_preferences, plus one MAX_BLOB_SIZE record per blob name.
+class ESPHomeStorage : public StorageAdapter {
+ public:
+  void setup();
+
+  bool load(std::string &json_data) override;
+  bool save(const std::string &json_data) override;
+  bool load_blob(const std::string &name, std::vector<uint8_t> &data) override;
+  bool save_blob(const std::string &name, const std::vector<uint8_t> &data) override;
+
+  const StorageStats &get_stats() const { return this->stats_; }
+
+ protected:
+  /// Preference objects are created once per name: on some platforms each creation reserves new space.
+  ESPPreferenceObject &blob_pref(const std::string &name);
+
+  ESPPreferenceObject pref_;
+  std::map<std::string, ESPPreferenceObject> blob_prefs_;
+  StorageStats stats_;
+};
+
+class ESPHomeClock : public ClockAdapter {
+ public:
+  uint32_t millis() override;
+  uint32_t micros() override;
+  uint32_t cpu_cycles() override;
+};
+
+class ESPHomeLog : public LogAdapter {
+ public:
+  LogLevel get_level() const override;
+  void log(LogLevel level, const char *message) override;
+};
+
+}  // namespace json_automation
+}  // namespace esphome
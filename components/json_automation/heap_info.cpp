@@ -0,0 +1,33 @@
+#include "heap_info.h"
+#include "esphome/core/defines.h"
+
+#if defined(USE_ESP32)
+#include <esp_heap_caps.h>
+#elif defined(USE_ESP8266)
+#include <Esp.h>
+#elif defined(USE_HOST) && defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace esphome {
+namespace json_automation {
+
+HeapInfo get_heap_info() {
+  HeapInfo info;
+#if defined(USE_ESP32)
+  info.free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  info.used_bytes = heap_caps_get_total_size(MALLOC_CAP_8BIT) - info.free_bytes;
+  info.largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+#elif defined(USE_ESP8266)
+  info.free_bytes = ESP.getFreeHeap();
+  info.largest_free_block = ESP.getMaxFreeBlockSize();
+#elif defined(USE_HOST) && defined(__GLIBC__)
+  const struct mallinfo2 stats = mallinfo2();
+  info.free_bytes = stats.fordblks;
+  info.used_bytes = stats.uordblks;
+#endif
+  return info;
+}
+
+}  // namespace json_automation
+}  // namespace esphome
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+namespace esphome {
+namespace json_automation {
+
+/// Snapshot of the heap. Fields a platform cannot report are left at zero.
+struct HeapInfo {
+  size_t free_bytes{0};
+  size_t used_bytes{0};
+  size_t largest_free_block{0};
+};
+
+HeapInfo get_heap_info();
+
+}  // namespace json_automation
+}  // namespace esphome
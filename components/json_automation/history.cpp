@@ -0,0 +1,120 @@
+#include "history.h"
+
+namespace esphome {
+namespace json_automation {
+
+// Log layout: magic, version, boot number, 16-bit record count, records. Each record is a 32-bit timestamp,
+// the 16-bit rule index, the result and the boot number, all little-endian.
+static const uint8_t HISTORY_MAGIC[4] = {'J', 'A', 'H', 'S'};
+static const uint8_t HISTORY_VERSION = 1;
+static const char *const HISTORY_BLOB = "history";
+
+void ExecutionHistory::set_capacity(size_t capacity) {
+  this->ring_.assign(capacity < MAX_HISTORY_SIZE ? capacity : MAX_HISTORY_SIZE, HistoryRecord{});
+  this->head_ = 0;
+  this->count_ = 0;
+  this->pending_ = 0;
+}
+
+void ExecutionHistory::set_flush_policy(size_t batch, uint32_t interval_ms) {
+  this->batch_ = batch == 0 ? 1 : batch;
+  this->interval_ms_ = interval_ms;
+}
+
+void ExecutionHistory::restore(StorageAdapter *storage) {
+  std::vector<uint8_t> data;
+  if (this->ring_.empty() || !storage->load_blob(HISTORY_BLOB, data) || data.size() < HISTORY_HEADER_SIZE)
+    return;
+  for (size_t i = 0; i < sizeof(HISTORY_MAGIC); i++) {
+    if (data[i] != HISTORY_MAGIC[i])
+      return;
+  }
+  const size_t count = data[6] | (data[7] << 8);
+  if (data[4] != HISTORY_VERSION || data.size() < HISTORY_HEADER_SIZE + count * HISTORY_RECORD_SIZE)
+    return;
+
+  // Keep the newest records if the ring got smaller
+  const size_t skip = count > this->ring_.size() ? count - this->ring_.size() : 0;
+  for (size_t i = skip; i < count; i++) {
+    const uint8_t *p = &data[HISTORY_HEADER_SIZE + i * HISTORY_RECORD_SIZE];
+    const uint32_t time_ms = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+                             (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    this->ring_[i - skip] = HistoryRecord{time_ms, static_cast<uint16_t>(p[4] | (p[5] << 8)), p[6], p[7]};
+  }
+  this->head_ = 0;
+  this->count_ = count - skip;
+  this->boot_ = data[5] + 1;
+}
+
+void ExecutionHistory::record(uint16_t rule, uint8_t result, uint32_t now) {
+  const size_t capacity = this->ring_.size();
+  if (capacity == 0)
+    return;
+
+  size_t index = (this->head_ + this->count_) % capacity;
+  if (this->count_ == capacity) {
+    index = this->head_;
+    this->head_ = (this->head_ + 1) % capacity;
+  } else {
+    this->count_++;
+  }
+  this->ring_[index] = HistoryRecord{now, rule, result, this->boot_};
+  if (this->pending_ < capacity)
+    this->pending_++;
+}
+
+bool ExecutionHistory::is_flush_due(uint32_t now) const {
+  return this->pending_ >= this->batch_ && now - this->last_flush_ms_ >= this->interval_ms_;
+}
+
+bool ExecutionHistory::flush(StorageAdapter *storage, uint32_t now) {
+  if (this->pending_ == 0)
+    return true;
+  std::vector<uint8_t> data(this->encoded_size());
+  this->read(0, data.data(), data.size());
+  this->last_flush_ms_ = now;
+  if (!storage->save_blob(HISTORY_BLOB, data))
+    return false;
+  this->pending_ = 0;
+  this->flushes_++;
+  return true;
+}
+
+size_t ExecutionHistory::read(size_t offset, uint8_t *out, size_t length) const {
+  const size_t size = this->encoded_size();
+  if (offset >= size)
+    return 0;
+  if (length > size - offset)
+    length = size - offset;
+  for (size_t i = 0; i < length; i++)
+    out[i] = this->encoded_byte(offset + i);
+  return length;
+}
+
+uint8_t ExecutionHistory::encoded_byte(size_t offset) const {
+  if (offset < HISTORY_HEADER_SIZE) {
+    switch (offset) {
+      case 4:
+        return HISTORY_VERSION;
+      case 5:
+        return this->boot_;
+      case 6:
+        return this->count_ & 0xFF;
+      case 7:
+        return this->count_ >> 8;
+      default:
+        return HISTORY_MAGIC[offset];
+    }
+  }
+  offset -= HISTORY_HEADER_SIZE;
+  const HistoryRecord &record = this->ring_[(this->head_ + offset / HISTORY_RECORD_SIZE) % this->ring_.size()];
+  const size_t field = offset % HISTORY_RECORD_SIZE;
+  if (field < 4)
+    return record.time_ms >> (8 * field);
+  if (field < 6)
+    return record.rule >> (8 * (field - 4));
+  return field == 6 ? record.result : record.boot;
+}
+
+}  // namespace json_automation
+}  // namespace esphome
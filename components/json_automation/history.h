@@ -0,0 +1,68 @@
+#pragma once
+
+#include "engine_adapters.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace json_automation {
+
+static const size_t HISTORY_HEADER_SIZE = 8;
+static const size_t HISTORY_RECORD_SIZE = 8;
+/// Most records that fit in one storage blob.
+static const size_t MAX_HISTORY_SIZE = (MAX_BLOB_SIZE - HISTORY_HEADER_SIZE) / HISTORY_RECORD_SIZE;
+/// Rule index of the record written when rule indices change; the records after it index the new set.
+static const uint16_t HISTORY_RULES_CHANGED = 0xFFFF;
+
+/// One run of the actions of a rule: milliseconds since boot, rule index, RunResult and boot number.
+struct HistoryRecord {
+  uint32_t time_ms;
+  uint16_t rule;
+  uint8_t result;
+  uint8_t boot;
+};
+
+/// RAM ring of rule runs, saved in a storage blob of its own so it outlives a power loss. Records are saved in
+/// batches: a flush is due once batch records are waiting and interval_ms has passed since the last one, which
+/// bounds the writes to one per interval whatever the rules do. Each flush rewrites the whole ring.
+class ExecutionHistory {
+ public:
+  void set_capacity(size_t capacity);
+  size_t get_capacity() const { return this->ring_.size(); }
+  void set_flush_policy(size_t batch, uint32_t interval_ms);
+
+  /// Load the records saved before the reboot and take the next boot number.
+  void restore(StorageAdapter *storage);
+  void record(uint16_t rule, uint8_t result, uint32_t now);
+  bool is_flush_due(uint32_t now) const;
+  /// Save the ring if records are waiting; false if saving failed, in which case the next try waits for the
+  /// interval again.
+  bool flush(StorageAdapter *storage, uint32_t now);
+
+  size_t size() const { return this->count_; }
+  size_t get_pending() const { return this->pending_; }
+  uint32_t get_flushes() const { return this->flushes_; }
+  uint8_t get_boot() const { return this->boot_; }
+
+  /// The encoded log (header, then the records oldest first) is produced in pieces: read() fills out with up
+  /// to length bytes from offset, so it can be sent without holding the whole log.
+  size_t encoded_size() const { return HISTORY_HEADER_SIZE + this->count_ * HISTORY_RECORD_SIZE; }
+  size_t read(size_t offset, uint8_t *out, size_t length) const;
+
+ protected:
+  uint8_t encoded_byte(size_t offset) const;
+
+  std::vector<HistoryRecord> ring_;
+  size_t head_{0};
+  size_t count_{0};
+  size_t pending_{0};
+  size_t batch_{1};
+  uint32_t interval_ms_{0};
+  uint32_t last_flush_ms_{0};
+  uint32_t flushes_{0};
+  uint8_t boot_{0};
+};
+
+}  // namespace json_automation
+}  // namespace esphome
@@ -9,409 +9,546 @@ namespace json_automation {
 
 static const char *const TAG = "json_automation";
 
+JsonAutomationComponent::JsonAutomationComponent() {
+  this->entities_.set_engine(&this->engine_);
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+  this->entities_.set_stack_monitor(&this->stack_);
+#endif
+#ifdef USE_JSON_AUTOMATION_WASM
+  this->engine_.set_scripts(&this->wasm_);
+  this->wasm_.set_engine(&this->engine_);
+#endif
+  this->engine_.set_on_loaded([this](const std::string &data) { this->trigger_automation_loaded(data); });
+  this->engine_.set_on_error([this](const std::string &error) { this->trigger_json_error(error); });
+  this->engine_.set_on_slow_rule(
+      [this](const std::string &rule_id, uint32_t latency_us) { this->slow_rule_callback_.call(rule_id, latency_us); });
+#ifdef USE_JSON_AUTOMATION_HISTORY
+  this->engine_.set_on_rule_run([this](uint16_t rule, RunResult result) { this->record_run(rule, result); });
+#endif
+}
+
 void JsonAutomationComponent::setup() {
   ESP_LOGCONFIG(TAG, "Setting up JSON Automation Component...");
 
-  this->pref_ = global_preferences->make_preference<char[MAX_JSON_SIZE]>(fnv1_hash(std::string("json_automation")));
-
-  if (!this->json_data_.empty()) {
-    ESP_LOGD(TAG, "Parsing initial JSON data and creating automations");
-    if (this->parse_json_automations(this->json_data_)) {
-      this->save_json_to_preferences();
-      this->create_all_automations();
-    }
-  } else {
-    ESP_LOGD(TAG, "Loading JSON data from preferences");
-    if (this->load_json_from_preferences()) {
-      this->create_all_automations();
-    }
+  this->storage_.setup();
+  this->engine_.begin_settle(this->settle_ms_);
+#ifdef USE_JSON_AUTOMATION_HISTORY
+  this->history_.restore(&this->storage_);
+#endif
+#ifdef USE_JSON_AUTOMATION_PROFILING
+  this->engine_.set_profiling(true);
+#endif
+#ifdef USE_JSON_AUTOMATION_CAPTURE
+  this->setup_capture();
+#endif
+
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+  this->stack_.setup();
+  const size_t stack_before = this->stack_.enter();
+#endif
+
+  // The overlay in preferences is merged with the base rules from the YAML json_data
+  ESP_LOGD(TAG, "Loading JSON data from preferences");
+  if (this->load_json_from_preferences()) {
+    this->create_all_automations();
   }
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+  this->stack_.leave(StackProbe::LOAD, stack_before);
+#endif
 }
 
-void JsonAutomationComponent::loop() {}
+void JsonAutomationComponent::loop() {
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+  // Steps of an incremental load count as loading, everything else as rule runs
+  const StackProbe probe = this->engine_.is_loading() ? StackProbe::LOAD : StackProbe::RULES;
+  const size_t stack_before = this->stack_.enter();
+  this->engine_.loop();
+  this->stack_.leave(probe, stack_before);
+#else
+  this->engine_.loop();
+#endif
+  if (this->reload_pending_ && !this->engine_.is_loading()) {
+    this->reload_pending_ = false;
+    this->finish_reload(this->engine_.get_last_load_max_step_us());
+  }
+  if (this->compaction_threshold_ != 0 && millis() - this->last_compaction_check_ms_ >= this->compaction_interval_ms_) {
+    this->last_compaction_check_ms_ = millis();
+    this->check_fragmentation();
+  }
+#ifdef USE_JSON_AUTOMATION_HISTORY
+  if (this->history_.is_flush_due(millis()))
+    this->history_.flush(&this->storage_, millis());
+#endif
+#ifdef USE_JSON_AUTOMATION_CAPTURE
+  if (this->replay_active_)
+    this->replay_step();
+#endif
+}
 
 void JsonAutomationComponent::dump_config() {
   ESP_LOGCONFIG(TAG, "JSON Automation Component:");
-  ESP_LOGCONFIG(TAG, "  Number of parsed automations: %d", this->automations_.size());
-  ESP_LOGCONFIG(TAG, "  Active automation objects: %d", this->automation_objects_.size());
+  const auto &storage = this->storage_.get_stats();
+  ESP_LOGCONFIG(TAG, "  Number of parsed automations: %d", this->engine_.get_rules().size());
+  ESP_LOGCONFIG(TAG, "  Base rules: %u bytes, overlay: %u bytes", (unsigned) this->engine_.get_base_json().size(),
+                (unsigned) this->engine_.get_json_data().size());
+  ESP_LOGCONFIG(TAG, "  Active rules: %d, pending delays: %d", this->engine_.get_active_count(),
+                this->engine_.get_pending_count());
+  ESP_LOGCONFIG(TAG, "  Input hooks: %d", this->entities_.get_input_count());
+  ESP_LOGCONFIG(TAG, "  Last parse: %u us, last create: %u us", this->engine_.get_last_parse_us(),
+                this->engine_.get_last_create_us());
+  if (this->engine_.has_load_budget()) {
+    ESP_LOGCONFIG(TAG, "  Incremental load: last %u steps, longest %u us", this->engine_.get_last_load_steps(),
+                  this->engine_.get_last_load_max_step_us());
+  }
+  if (this->compaction_threshold_ != 0) {
+    ESP_LOGCONFIG(TAG, "  Compaction: above %u%% fragmentation, %u runs, %u blocks moved", this->compaction_threshold_,
+                  this->engine_.get_compaction_count(), this->engine_.get_compacted_blocks());
+  }
+  const auto &interlocks = this->engine_.get_interlocks();
+  if (!interlocks.empty()) {
+    ESP_LOGCONFIG(TAG, "  Interlocks: %u outputs, %u actions rejected", (unsigned) interlocks.size(),
+                  this->engine_.get_interlock_rejected_count());
+  }
+  for (const auto &scene : this->engine_.get_scenes()) {
+    ESP_LOGCONFIG(TAG, "  Snapshot %s: %u outputs, %u bytes%s", scene.name.c_str(), (unsigned) scene.outputs.size(),
+                  (unsigned) scene.states.size(), scene.captured ? "" : ", not taken");
+  }
+  if (this->engine_.get_slow_rule_count() != 0) {
+    ESP_LOGCONFIG(TAG, "  Slow rules: %u runs over budget, %u not reported", this->engine_.get_slow_rule_count(),
+                  this->engine_.get_slow_rule_dropped());
+  }
+  if (this->settle_ms_ != 0) {
+    ESP_LOGCONFIG(TAG, "  Settle time: %u ms, %u rule runs suppressed", this->settle_ms_,
+                  this->engine_.get_suppressed_count());
+  }
+  ESP_LOGCONFIG(TAG, "  Storage: %u saves (%u failed), %u records / %u bytes written, %u loads", storage.saves,
+                storage.save_failures, storage.records_written, (uint32_t) storage.bytes_written, storage.loads);
+  if (this->reload_stats_.count > 0) {
+    ESP_LOGCONFIG(TAG, "  Reloads: %u, last pause %u us, max pause %u us", this->reload_stats_.count,
+                  this->reload_stats_.last_pause_us, this->reload_stats_.max_pause_us);
+    ESP_LOGCONFIG(TAG, "  Heap around last reload: used %u -> %u bytes, free %u -> %u bytes",
+                  this->reload_stats_.heap_before.used_bytes, this->reload_stats_.heap_after.used_bytes,
+                  this->reload_stats_.heap_before.free_bytes, this->reload_stats_.heap_after.free_bytes);
+  }
+
+  const auto &thresholds = this->engine_.get_thresholds();
+  if (thresholds.size() > 0) {
+    ESP_LOGCONFIG(TAG, "  Sensor thresholds: %u in %u slots, vector kernel: %s", (unsigned) thresholds.size(),
+                  (unsigned) thresholds.get_slot_count(), ThresholdTable::get_vector_isa());
+  }
 
-  for (const auto &automation : this->automations_) {
+  for (const auto &automation : this->engine_.get_rules()) {
     ESP_LOGCONFIG(TAG, "  Automation: %s (%s)", automation.id.c_str(), automation.name.c_str());
     ESP_LOGCONFIG(TAG, "    Enabled: %s", automation.enabled ? "YES" : "NO");
-    ESP_LOGCONFIG(TAG, "    Trigger: input_id=%s", automation.trigger.input_id.c_str());
+    if (automation.max_latency_ms != 0)
+      ESP_LOGCONFIG(TAG, "    Max latency: %u ms", automation.max_latency_ms);
+    if (automation.trigger.source == TriggerSource::WHILE) {
+      std::string condition;
+      for (const auto &term : automation.trigger.condition) {
+        if (!condition.empty())
+          condition += automation.trigger.match_any ? " or " : " and ";
+        condition += (term.negate ? "!" : "") + term.input_id;
+      }
+      ESP_LOGCONFIG(TAG, "    Trigger: while %s", condition.c_str());
+      ESP_LOGCONFIG(TAG, "    Actions: %d, exit actions: %d", automation.actions.size(),
+                    automation.exit_actions.size());
+      continue;
+    }
+    if (automation.trigger.source == TriggerSource::SENSOR) {
+      ESP_LOGCONFIG(TAG, "    Trigger: sensor_id=%s %s %g", automation.trigger.input_id.c_str(),
+                    automation.trigger.type == TriggerType::ABOVE ? "above" : "below", automation.trigger.threshold);
+    } else {
+      ESP_LOGCONFIG(TAG, "    Trigger: input_id=%s", automation.trigger.input_id.c_str());
+    }
     ESP_LOGCONFIG(TAG, "    Actions: %d", automation.actions.size());
   }
-}
-
-void JsonAutomationComponent::set_json_data(const std::string &json_data) { this->json_data_ = json_data; }
 
-bool JsonAutomationComponent::load_json_from_preferences() {
-  char buffer[MAX_JSON_SIZE];
-  if (this->pref_.load(&buffer)) {
-    std::string stored_json(buffer);
-    ESP_LOGD(TAG, "Loaded JSON from preferences (%d bytes)", stored_json.size());
-    this->json_data_ = stored_json;
-    return this->parse_json_automations(stored_json);
+#ifdef USE_JSON_AUTOMATION_PROFILING
+  this->dump_execution_stats();
+#endif
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+  this->dump_stack_marks();
+#endif
+#ifdef USE_JSON_AUTOMATION_WASM
+  const auto &limits = this->wasm_.get_limits();
+  ESP_LOGCONFIG(TAG, "  WebAssembly: %u bytes memory, %u fuel, %u stack slots per module", limits.memory_bytes,
+                limits.fuel, limits.stack_slots);
+  for (const auto &module : this->wasm_.get_modules()) {
+    ESP_LOGCONFIG(TAG, "    Module %s: %s, %u calls, %u traps, max fuel %u", module.name.c_str(),
+                  module.instance ? "loaded" : "missing", module.calls, module.traps, module.max_fuel_used);
   }
-  ESP_LOGW(TAG, "No JSON data found in preferences");
-  return false;
+#endif
+#ifdef USE_JSON_AUTOMATION_HISTORY
+  ESP_LOGCONFIG(TAG, "  History: %u/%u runs, %u not saved, %u flushes, boot %u", (unsigned) this->history_.size(),
+                (unsigned) this->history_.get_capacity(), (unsigned) this->history_.get_pending(),
+                this->history_.get_flushes(), this->history_.get_boot());
+#endif
+#ifdef USE_JSON_AUTOMATION_CAPTURE
+  ESP_LOGCONFIG(TAG, "  Capture: %u/%u events (%s), %u inputs", this->capture_.size(), this->capture_.get_capacity(),
+                this->capture_.is_active() ? "recording" : "stopped", this->capture_inputs_.size());
+#endif
 }
 
-bool JsonAutomationComponent::save_json_to_preferences() {
-  if (this->json_data_.empty()) {
-    ESP_LOGW(TAG, "Cannot save empty JSON data");
-    return false;
+#ifdef USE_JSON_AUTOMATION_PROFILING
+static const char *action_kind_name(ActionSource source, ActionType type) {
+  if (source == ActionSource::SWITCH) {
+    if (type == ActionType::TURN_ON)
+      return "switch.turn_on";
+    if (type == ActionType::TURN_OFF)
+      return "switch.turn_off";
+    if (type == ActionType::TOGGLE)
+      return "switch.toggle";
+  } else if (source == ActionSource::LIGHT) {
+    if (type == ActionType::TURN_ON)
+      return "light.turn_on";
+    if (type == ActionType::TURN_OFF)
+      return "light.turn_off";
+    if (type == ActionType::TOGGLE)
+      return "light.toggle";
+  } else if (source == ActionSource::WASM) {
+    return "wasm";
+  } else if (source == ActionSource::SNAPSHOT) {
+    return "snapshot";
+  } else if (source == ActionSource::RESTORE) {
+    return "restore";
+  } else if (source == ActionSource::CONDITION) {
+    return "condition";
   }
+  return nullptr;
+}
 
-  if (this->json_data_.size() >= MAX_JSON_SIZE) {
-    ESP_LOGE(TAG, "Cannot save: JSON data too large: %d bytes (max: %d)", this->json_data_.size(), MAX_JSON_SIZE - 1);
-    this->trigger_json_error("JSON data exceeds maximum size for saving");
-    return false;
-  }
+static void log_execution_stats(const char *label, const ExecutionStats &stats, float cycles_per_us) {
+  ESP_LOGCONFIG(TAG, "    %s: n=%u min=%.1fus avg=%.1fus max=%.1fus", label, stats.count,
+                stats.min_cycles / cycles_per_us, stats.avg_cycles() / cycles_per_us,
+                stats.max_cycles / cycles_per_us);
+}
 
-  char buffer[MAX_JSON_SIZE];
-  memset(buffer, 0, MAX_JSON_SIZE);
-  strncpy(buffer, this->json_data_.c_str(), MAX_JSON_SIZE - 1);
-  buffer[MAX_JSON_SIZE - 1] = '\0';
+void JsonAutomationComponent::dump_execution_stats() {
+  const float cycles_per_us = arch_get_cpu_freq_hz() / 1e6f;
 
-  if (this->pref_.save(&buffer)) {
-    ESP_LOGD(TAG, "JSON data saved to preferences (%d bytes)", this->json_data_.size());
-    return true;
+  ESP_LOGCONFIG(TAG, "  Action cost per rule:");
+  for (const auto &entry : this->engine_.get_rule_stats()) {
+    if (entry.second.count > 0)
+      log_execution_stats(entry.first.c_str(), entry.second, cycles_per_us);
   }
 
-  ESP_LOGE(TAG, "Failed to save JSON data to preferences");
-  return false;
+  ESP_LOGCONFIG(TAG, "  Action cost per kind:");
+  for (const auto source : {ActionSource::SWITCH, ActionSource::LIGHT}) {
+    for (const auto type : {ActionType::TURN_ON, ActionType::TURN_OFF, ActionType::TOGGLE}) {
+      const auto &stats = this->engine_.get_action_kind_stats(source, type);
+      if (stats.count > 0)
+        log_execution_stats(action_kind_name(source, type), stats, cycles_per_us);
+    }
+  }
+  for (const auto source :
+       {ActionSource::WASM, ActionSource::SNAPSHOT, ActionSource::RESTORE, ActionSource::CONDITION}) {
+    const auto &stats = this->engine_.get_action_kind_stats(source, ActionType::UNKNOWN);
+    if (stats.count > 0)
+      log_execution_stats(action_kind_name(source, ActionType::UNKNOWN), stats, cycles_per_us);
+  }
+  if (this->engine_.get_while_condition_stats().count > 0)
+    log_execution_stats("while condition", this->engine_.get_while_condition_stats(), cycles_per_us);
 }
 
-TriggerSource JsonAutomationComponent::parse_trigger_source(const std::string &source) {
-  std::string lower = source;
-  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
-
-  if (lower == "input")
-    return TriggerSource::INPUT;
-  return TriggerSource::UNKNOWN;
+#endif
+
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+void JsonAutomationComponent::dump_stack_marks() {
+  static const char *const PROBE_NAMES[STACK_PROBE_COUNT] = {"load", "save", "rules"};
+  ESP_LOGCONFIG(TAG, "  Stack high-water: %u bytes free", (unsigned) get_stack_high_water());
+  for (size_t i = 0; i < STACK_PROBE_COUNT; i++) {
+    const StackMark &mark = this->stack_.get_mark(static_cast<StackProbe>(i));
+    if (mark.runs == 0)
+      continue;
+    ESP_LOGCONFIG(TAG, "    %s: %u runs, deepest took it from %u to %u bytes free", PROBE_NAMES[i], mark.runs,
+                  mark.before, mark.after);
+  }
 }
+#endif
 
-TriggerType JsonAutomationComponent::parse_trigger_type(const std::string &type) {
-  std::string lower = type;
-  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+void JsonAutomationComponent::set_json_data(const std::string &json_data) { this->engine_.set_json_data(json_data); }
 
-  if (lower == "press")
-    return TriggerType::PRESS;
-  if (lower == "release")
-    return TriggerType::RELEASE;
-  return TriggerType::UNKNOWN;
+#ifdef USE_JSON_AUTOMATION_WASM
+bool JsonAutomationComponent::load_wasm(const std::string &name, const std::string &hex_data, bool save) {
+  std::vector<uint8_t> data;
+  if (name.empty() || hex_data.size() % 2 != 0 || hex_data.size() / 2 > MAX_WASM_MODULE_SIZE ||
+      !parse_hex(hex_data, data, hex_data.size() / 2)) {
+    ESP_LOGE(TAG, "Invalid WebAssembly module data for %s", name.c_str());
+    return false;
+  }
+  return this->wasm_.add_module(name, data, save);
 }
+#endif
 
-ActionSource JsonAutomationComponent::parse_action_source(const std::string &source) {
-  std::string lower = source;
-  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
-
-  if (lower == "switch")
-    return ActionSource::SWITCH;
-  if (lower == "delay")
-    return ActionSource::DELAY;
-  if (lower == "light")
-    return ActionSource::LIGHT;
-  return ActionSource::UNKNOWN;
-}
+bool JsonAutomationComponent::load_json_from_preferences() { return this->engine_.load_from_storage(); }
 
-ActionType JsonAutomationComponent::parse_action_type(const std::string &type) {
-  std::string lower = type;
-  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
-
-  if (lower == "turn_on")
-    return ActionType::TURN_ON;
-  if (lower == "turn_off")
-    return ActionType::TURN_OFF;
-  if (lower == "toggle")
-    return ActionType::TOGGLE;
-  return ActionType::UNKNOWN;
+bool JsonAutomationComponent::save_json_to_preferences() {
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+  const size_t stack_before = this->stack_.enter();
+  const bool success = this->engine_.save_to_storage();
+  this->stack_.leave(StackProbe::SAVE, stack_before);
+  return success;
+#else
+  return this->engine_.save_to_storage();
+#endif
 }
 
 bool JsonAutomationComponent::parse_json_automations(const std::string &json_data) {
-  ESP_LOGD(TAG, "Parsing JSON automations...");
+  return this->engine_.parse(json_data);
+}
 
-  if (json_data.size() > MAX_JSON_SIZE) {
-    ESP_LOGE(TAG, "JSON data too large: %d bytes (max: %d)", json_data.size(), MAX_JSON_SIZE);
-    this->trigger_json_error("JSON data exceeds maximum size");
-    return false;
+bool JsonAutomationComponent::load_json(const std::string &json_data) {
+  this->reload_stats_.heap_before = get_heap_info();
+  if (this->engine_.has_load_budget()) {
+    // The pause is the longest step, recorded from loop() once the load has finished
+    this->reload_pending_ = this->engine_.begin_load(json_data);
+    return this->reload_pending_;
   }
 
-  this->automations_.clear();
-
-  bool parse_success = json::parse_json(json_data, [this](JsonObject root) -> bool {
-    JsonArray automations_array = root.as<JsonArray>();
-
-    if (!automations_array.isNull()) {
-      for (JsonVariant automation_var : automations_array) {
-        JsonObject automation_obj = automation_var.as<JsonObject>();
-
-        if (!automation_obj.containsKey("id") || !automation_obj.containsKey("trigger") ||
-            !automation_obj.containsKey("actions")) {
-          ESP_LOGW(TAG, "Skipping invalid automation: missing required fields");
-          continue;
-        }
-
-        AutomationRule rule;
-        rule.id = automation_obj["id"].as<std::string>();
-        rule.name = automation_obj.containsKey("name") ? automation_obj["name"].as<std::string>() : rule.id;
-        rule.enabled = automation_obj.containsKey("enabled") ? automation_obj["enabled"].as<bool>() : true;
-
-        JsonObject trigger_obj = automation_obj["trigger"];
-        if (trigger_obj.containsKey("source")) {
-          rule.trigger.source = this->parse_trigger_source(trigger_obj["source"].as<std::string>());
-        }
-        if (trigger_obj.containsKey("type")) {
-          rule.trigger.type = this->parse_trigger_type(trigger_obj["type"].as<std::string>());
-        }
-        if (trigger_obj.containsKey("input_id")) {
-          rule.trigger.input_id = trigger_obj["input_id"].as<std::string>();
-        }
-
-        // Validate trigger fields
-        if (rule.trigger.source == TriggerSource::UNKNOWN || rule.trigger.type == TriggerType::UNKNOWN ||
-            rule.trigger.input_id.empty()) {
-          ESP_LOGW(TAG, "Skipping automation %s: invalid or missing trigger fields", rule.id.c_str());
-          continue;
-        }
-
-        JsonArray actions = automation_obj["actions"];
-        int valid_action_count = 0;
-        for (JsonVariant action_var : actions) {
-          if (action_var.is<JsonObject>()) {
-            JsonObject action_obj = action_var.as<JsonObject>();
-
-            Action action;
-            if (action_obj.containsKey("source")) {
-              action.source = this->parse_action_source(action_obj["source"].as<std::string>());
-            }
-            if (action_obj.containsKey("type")) {
-              action.type = this->parse_action_type(action_obj["type"].as<std::string>());
-            }
-            if (action_obj.containsKey("switch_id")) {
-              action.switch_id = action_obj["switch_id"].as<std::string>();
-            }
-            if (action_obj.containsKey("delay_s")) {
-              action.delay_s = action_obj["delay_s"].as<uint32_t>();
-            }
-
-            // Validate action fields
-            bool valid_action = false;
-            if (action.source == ActionSource::DELAY && action.delay_s > 0) {
-              valid_action = true;
-            } else if ((action.source == ActionSource::SWITCH || action.source == ActionSource::LIGHT) &&
-                       action.type != ActionType::UNKNOWN && !action.switch_id.empty()) {
-              valid_action = true;
-            }
-
-            if (valid_action) {
-              rule.actions.push_back(action);
-              valid_action_count++;
-            } else {
-              ESP_LOGW(TAG, "Skipping invalid action in automation %s", rule.id.c_str());
-            }
-          }
-        }
-
-        // Only add automation if it has at least one valid action
-        if (valid_action_count > 0) {
-          this->automations_.push_back(rule);
-          ESP_LOGD(TAG, "Loaded automation: %s (%s) with %d valid actions", rule.id.c_str(), rule.name.c_str(),
-                   valid_action_count);
-        } else {
-          ESP_LOGW(TAG, "Skipping automation %s: no valid actions", rule.id.c_str());
-        }
-      }
-
-      return true;
-    }
-
-    ESP_LOGE(TAG, "JSON is not an array");
-    this->trigger_json_error("JSON must be an array of automations");
-    return false;
-  });
-
-  if (parse_success) {
-    ESP_LOGI(TAG, "Successfully parsed %d automations", this->automations_.size());
-    this->trigger_automation_loaded(json_data);
-    return true;
-  } else {
-    ESP_LOGE(TAG, "Failed to parse JSON automations");
-    this->trigger_json_error("JSON parsing failed");
-    return false;
-  }
+  const uint32_t start = micros();
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+  const size_t stack_before = this->stack_.enter();
+  const bool success = this->engine_.load(json_data);
+  this->stack_.leave(StackProbe::LOAD, stack_before);
+#else
+  const bool success = this->engine_.load(json_data);
+#endif
+  this->finish_reload(micros() - start);
+  return success;
 }
 
-binary_sensor::BinarySensor *JsonAutomationComponent::resolve_binary_sensor(const std::string &object_id) {
-  uint32_t key = esphome::fnv1_hash(object_id);
-  auto *sensor = App.get_binary_sensor_by_key(key);
-  if (!sensor) {
-    ESP_LOGW(TAG, "Binary sensor not found: %s (hash: %u)", object_id.c_str(), key);
-  } else {
-    ESP_LOGD(TAG, "Resolved binary_sensor: %s (hash: %u)", object_id.c_str(), key);
-  }
-  return sensor;
+void JsonAutomationComponent::finish_reload(uint32_t pause_us) {
+  auto &stats = this->reload_stats_;
+  stats.last_pause_us = pause_us;
+  stats.max_pause_us = std::max(stats.max_pause_us, stats.last_pause_us);
+  stats.count++;
+  stats.heap_after = get_heap_info();
+  ESP_LOGD(TAG, "Reload #%u took %u us", stats.count, stats.last_pause_us);
 }
 
-switch_::Switch *JsonAutomationComponent::resolve_switch(const std::string &object_id) {
-  uint32_t key = esphome::fnv1_hash(object_id);
-  auto *sw = App.get_switch_by_key(key);
-  if (!sw) {
-    ESP_LOGW(TAG, "Switch not found: %s (hash: %u)", object_id.c_str(), key);
-  } else {
-    ESP_LOGD(TAG, "Resolved switch: %s (hash: %u)", object_id.c_str(), key);
-  }
-  return sw;
+void JsonAutomationComponent::check_fragmentation() {
+  if (this->engine_.is_compacting() || this->engine_.is_loading())
+    return;
+  const HeapInfo heap = get_heap_info();
+  // Platforms that cannot report the largest free block never compact
+  if (heap.free_bytes == 0 || heap.largest_free_block == 0)
+    return;
+  const uint32_t fragmentation = 100 - heap.largest_free_block * 100 / heap.free_bytes;
+  if (fragmentation < this->compaction_threshold_)
+    return;
+  ESP_LOGD(TAG, "Heap fragmentation %u%% (largest free block %u of %u bytes), compacting rules", fragmentation,
+           heap.largest_free_block, heap.free_bytes);
+  this->engine_.begin_compaction();
 }
 
-light::LightState *JsonAutomationComponent::resolve_light(const std::string &object_id) {
-  uint32_t key = esphome::fnv1_hash(object_id);
-  auto *light = App.get_light_by_key(key);
-  if (!light) {
-    ESP_LOGW(TAG, "Light not found: %s (hash: %u)", object_id.c_str(), key);
-  } else {
-    ESP_LOGD(TAG, "Resolved light: %s (hash: %u)", object_id.c_str(), key);
+void JsonAutomationComponent::clear_automations() { this->engine_.clear(); }
+
+void JsonAutomationComponent::create_all_automations() { this->engine_.create_all(); }
+
+void JsonAutomationComponent::apply_to_subtree(SubtreeOperation operation, const std::string &prefix) {
+  switch (operation) {
+    case SubtreeOperation::ENABLE:
+    case SubtreeOperation::DISABLE:
+      this->engine_.set_subtree_enabled(prefix, operation == SubtreeOperation::ENABLE);
+      break;
+    case SubtreeOperation::STOP:
+      this->engine_.stop_subtree(prefix);
+      break;
+    case SubtreeOperation::REMOVE:
+      this->engine_.remove_subtree(prefix);
+      break;
+    case SubtreeOperation::LIST: {
+      const auto rules = this->engine_.find_subtree(prefix);
+      ESP_LOGI(TAG, "%u automations under '%s':", (unsigned) rules.size(), prefix.c_str());
+      for (uint16_t index : rules) {
+        const auto &block = *this->engine_.get_rule_blocks()[index];
+        ESP_LOGI(TAG, "  %s (%s): %s", block.rule.id.c_str(), block.rule.name.c_str(),
+                 block.input != INVALID_HANDLE ? "active" : (block.rule.enabled ? "failed" : "disabled"));
+      }
+      break;
+    }
+    case SubtreeOperation::EXECUTE:
+      this->engine_.execute_subtree(prefix);
+      break;
   }
-  return light;
 }
 
-Trigger<> *JsonAutomationComponent::create_trigger(const AutomationRule &rule) {
-  if (rule.trigger.source == TriggerSource::INPUT) {
-    if (rule.trigger.input_id.empty()) {
-      ESP_LOGE(TAG, "Missing input_id for Input trigger");
-      return nullptr;
-    }
-
-    auto *sensor = this->resolve_binary_sensor(rule.trigger.input_id);
-    if (!sensor)
-      return nullptr;
-
-    if (rule.trigger.type == TriggerType::PRESS) {
-      auto *trigger = new binary_sensor::PressTrigger(sensor);
-      return trigger;
-    } else if (rule.trigger.type == TriggerType::RELEASE) {
-      auto *trigger = new binary_sensor::ReleaseTrigger(sensor);
-      return trigger;
-    }
-  }
+#ifdef USE_JSON_AUTOMATION_HISTORY
+static const size_t HISTORY_DUMP_CHUNK = 32;
 
-  ESP_LOGW(TAG, "Unsupported trigger configuration");
-  ESP_LOGW(TAG, "Note: Only Input triggers with press/release are currently supported");
-  return nullptr;
+void JsonAutomationComponent::record_run(uint16_t rule, RunResult result) {
+  const uint32_t now = millis();
+  this->record_rules_changed(now);
+  this->history_.record(rule, static_cast<uint8_t>(result), now);
 }
 
-esphome::Action<> *JsonAutomationComponent::create_action(const Action &action) {
-  if (action.source == ActionSource::SWITCH) {
-    if (action.switch_id.empty()) {
-      ESP_LOGW(TAG, "Missing switch_id for switch action");
-      return nullptr;
-    }
+void JsonAutomationComponent::record_rules_changed(uint32_t now) {
+  if (this->engine_.get_generation() == this->history_generation_)
+    return;
+  this->history_generation_ = this->engine_.get_generation();
+  this->history_.record(HISTORY_RULES_CHANGED, 0, now);
+}
 
-    auto *sw = this->resolve_switch(action.switch_id);
-    if (!sw)
-      return nullptr;
+bool JsonAutomationComponent::flush_history() {
+  const size_t pending = this->history_.get_pending();
+  if (!this->history_.flush(&this->storage_, millis()) || !global_preferences->sync()) {
+    ESP_LOGW(TAG, "Failed to save the execution history");
+    return false;
+  }
+  ESP_LOGD(TAG, "Execution history saved (%u new runs)", (unsigned) pending);
+  return true;
+}
 
-    if (action.type == ActionType::TURN_ON) {
-      return new switch_::TurnOnAction<>(sw);
-    } else if (action.type == ActionType::TURN_OFF) {
-      return new switch_::TurnOffAction<>(sw);
-    } else if (action.type == ActionType::TOGGLE) {
-      return new switch_::ToggleAction<>(sw);
+void JsonAutomationComponent::dump_history() {
+  static const char *const HEX_DIGITS = "0123456789abcdef";
+  uint8_t chunk[HISTORY_DUMP_CHUNK];
+  char hex[HISTORY_DUMP_CHUNK * 2 + 1];
+  // The id table below covers the records after the last change marker, so a reload without runs since needs one
+  this->record_rules_changed(millis());
+  ESP_LOGI(TAG, "History dump: %u bytes, %u runs, boot %u", (unsigned) this->history_.encoded_size(),
+           (unsigned) this->history_.size(), this->history_.get_boot());
+  for (size_t offset = 0;; offset += HISTORY_DUMP_CHUNK) {
+    const size_t len = this->history_.read(offset, chunk, sizeof(chunk));
+    if (len == 0)
+      break;
+    for (size_t i = 0; i < len; i++) {
+      hex[2 * i] = HEX_DIGITS[chunk[i] >> 4];
+      hex[2 * i + 1] = HEX_DIGITS[chunk[i] & 0x0F];
     }
-  } else if (action.source == ActionSource::LIGHT) {
-    if (action.switch_id.empty()) {
-      ESP_LOGW(TAG, "Missing switch_id for light action");
-      return nullptr;
-    }
-
-    auto *light = this->resolve_light(action.switch_id);
-    if (!light)
-      return nullptr;
-
-    if (action.type == ActionType::TURN_ON) {
-      auto *light_action = new light::LightControlAction<>(light);
-      light_action->set_state(true);
-      return light_action;
-    } else if (action.type == ActionType::TURN_OFF) {
-      auto *light_action = new light::LightControlAction<>(light);
-      light_action->set_state(false);
-      return light_action;
-    } else if (action.type == ActionType::TOGGLE) {
-      return new light::ToggleAction<>(light);
+    hex[2 * len] = '\0';
+    ESP_LOGI(TAG, "history[%04u]: %s", (unsigned) offset, hex);
+  }
+  const auto &blocks = this->engine_.get_rule_blocks();
+  for (size_t i = 0; i < blocks.size(); i++)
+    ESP_LOGI(TAG, "history rule[%u]: %s", (unsigned) i, blocks[i]->rule.id.c_str());
+}
+#endif
+
+#ifdef USE_JSON_AUTOMATION_CAPTURE
+static const size_t CAPTURE_MAX_INPUTS = 255;
+static const size_t CAPTURE_DUMP_CHUNK = 32;
+
+void JsonAutomationComponent::setup_capture() {
+  // State callbacks cannot be removed, so every binary sensor is hooked once and gated by the capture state
+  for (auto *sensor : App.get_binary_sensors()) {
+    if (this->capture_inputs_.size() >= CAPTURE_MAX_INPUTS) {
+      ESP_LOGW(TAG, "Only the first %u binary sensors can be captured", CAPTURE_MAX_INPUTS);
+      break;
     }
-  } else if (action.source == ActionSource::DELAY) {
-    auto *delay_action = new esphome::DelayAction<>();
-    delay_action->set_delay(action.delay_s * 1000);
-    return delay_action;
+    const uint8_t index = this->capture_inputs_.size();
+    this->capture_inputs_.push_back(sensor);
+    sensor->add_on_state_callback([this, index](bool state) { this->capture_.record(index, state, millis()); });
   }
-
-  ESP_LOGW(TAG, "Unsupported action configuration");
-  return nullptr;
 }
 
-void JsonAutomationComponent::clear_automations() {
-  ESP_LOGD(TAG, "Clearing %d existing automation objects", this->automation_objects_.size());
-  this->automation_objects_.clear();
+void JsonAutomationComponent::start_capture() {
+  std::vector<uint32_t> input_keys;
+  input_keys.reserve(this->capture_inputs_.size());
+  for (auto *sensor : this->capture_inputs_)
+    input_keys.push_back(sensor->get_object_id_hash());
+
+  const uint32_t rules_hash = this->get_rules_hash();
+  this->capture_.start(rules_hash, std::move(input_keys), millis());
+  ESP_LOGI(TAG, "Capture started (%u events max, rule-set hash 0x%08X)", this->capture_.get_capacity(), rules_hash);
 }
 
-void JsonAutomationComponent::create_all_automations() {
-  for (const auto &rule : this->automations_) {
-    if (!this->create_automation_from_rule(rule)) {
-      ESP_LOGW(TAG, "Failed to create automation: %s", rule.id.c_str());
-    }
+uint32_t JsonAutomationComponent::get_rules_hash() const {
+  // Continue the FNV-1 hash of the base layer over the overlay instead of hashing a concatenated copy
+  uint32_t hash = fnv1_hash(this->engine_.get_base_json());
+  for (char c : this->engine_.get_json_data()) {
+    hash *= 16777619;
+    hash ^= c;
   }
+  return hash;
 }
 
-bool JsonAutomationComponent::create_automation_from_rule(const AutomationRule &rule) {
-  ESP_LOGD(TAG, "Creating automation: %s (%s)", rule.id.c_str(), rule.name.c_str());
+void JsonAutomationComponent::stop_capture() {
+  this->capture_.stop();
+  ESP_LOGI(TAG, "Capture stopped: %u events, %u overwritten", this->capture_.size(), this->capture_.get_overwritten());
+}
 
-  if (!rule.enabled) {
-    ESP_LOGD(TAG, "Automation %s is disabled, skipping", rule.id.c_str());
-    return true;
+void JsonAutomationComponent::dump_capture() {
+  const auto data = this->capture_.serialize();
+  ESP_LOGI(TAG, "Capture dump: %u bytes, %u events", data.size(), this->capture_.size());
+  for (size_t offset = 0; offset < data.size(); offset += CAPTURE_DUMP_CHUNK) {
+    const size_t len = std::min(CAPTURE_DUMP_CHUNK, data.size() - offset);
+    ESP_LOGI(TAG, "capture[%04u]: %s", offset, format_hex(&data[offset], len).c_str());
   }
+}
 
-  Trigger<> *trigger = this->create_trigger(rule);
-  if (!trigger) {
-    ESP_LOGE(TAG, "Failed to create trigger for automation: %s", rule.id.c_str());
+bool JsonAutomationComponent::start_replay(const std::string &hex_data, float speed) {
+  std::vector<uint8_t> data;
+  if (hex_data.size() % 2 != 0 || !parse_hex(hex_data, data, hex_data.size() / 2) ||
+      !WorkloadCapture::deserialize(data, this->replay_log_)) {
+    ESP_LOGE(TAG, "Invalid capture data, not replaying");
     return false;
   }
 
-  Automation<> *automation = new Automation<>(trigger);
-
-  int action_count = 0;
-  for (const auto &action : rule.actions) {
-    esphome::Action<> *action_obj = this->create_action(action);
-    if (action_obj) {
-      automation->add_action(action_obj);
-      action_count++;
-    }
+  const uint32_t rules_hash = this->get_rules_hash();
+  if (this->replay_log_.rules_hash != rules_hash) {
+    ESP_LOGW(TAG, "Capture was recorded with a different rule set (0x%08X, active 0x%08X)",
+             this->replay_log_.rules_hash, rules_hash);
   }
 
-  this->automation_objects_.push_back(std::unique_ptr<Automation<>>(automation));
-
-  ESP_LOGI(TAG, "Successfully created automation: %s with %d actions", rule.id.c_str(), action_count);
-
+  this->replay_sensors_.clear();
+  for (uint32_t key : this->replay_log_.input_keys)
+    this->replay_sensors_.push_back(App.get_binary_sensor_by_key(key));
+
+  this->replay_pos_ = 0;
+  this->replay_speed_ = speed;
+  this->replay_max_lag_ms_ = 0;
+  this->replay_skipped_ = 0;
+  this->replay_dispatch_stats_.reset();
+#ifdef USE_JSON_AUTOMATION_PROFILING
+  this->reset_execution_stats();
+#endif
+  this->replay_start_ms_ = millis();
+  this->replay_active_ = true;
+  ESP_LOGI(TAG, "Replaying %u events at %.1fx", this->replay_log_.records.size(), speed);
   return true;
 }
 
-void JsonAutomationComponent::execute_automation(const std::string &automation_id) {
-  ESP_LOGD(TAG, "Looking up automation: %s", automation_id.c_str());
-
-  for (const auto &automation : this->automations_) {
-    if (automation.id == automation_id) {
-      ESP_LOGI(TAG, "Found automation %s (%s) with %d actions", automation_id.c_str(), automation.name.c_str(),
-               automation.actions.size());
-
-      ESP_LOGI(TAG, "Automation is active and will execute when triggered");
-      ESP_LOGI(TAG, "Enabled: %s", automation.enabled ? "YES" : "NO");
+void JsonAutomationComponent::replay_step() {
+  const uint32_t elapsed = millis() - this->replay_start_ms_;
+  const auto &records = this->replay_log_.records;
 
+  while (this->replay_pos_ < records.size()) {
+    const auto &record = records[this->replay_pos_];
+    const uint32_t due = this->replay_speed_ > 0 ? record.timestamp_ms / this->replay_speed_ : 0;
+    if (due > elapsed)
       return;
+
+    this->replay_max_lag_ms_ = std::max(this->replay_max_lag_ms_, elapsed - due);
+    auto *sensor = this->replay_sensors_[record.input];
+    if (sensor == nullptr) {
+      this->replay_skipped_++;
+    } else {
+      const uint32_t start = arch_get_cpu_cycle_count();
+      sensor->publish_state(record.state);
+      this->replay_dispatch_stats_.record(arch_get_cpu_cycle_count() - start);
     }
+    this->replay_pos_++;
   }
 
-  ESP_LOGW(TAG, "Automation not found: %s", automation_id.c_str());
+  this->finish_replay();
+}
+
+void JsonAutomationComponent::finish_replay() {
+  this->replay_active_ = false;
+  const float cycles_per_us = arch_get_cpu_freq_hz() / 1e6f;
+  const auto &stats = this->replay_dispatch_stats_;
+
+  ESP_LOGI(TAG, "Replay finished: %u events dispatched, %u skipped (unknown input), max lag %u ms", stats.count,
+           this->replay_skipped_, this->replay_max_lag_ms_);
+  if (stats.count > 0) {
+    ESP_LOGI(TAG, "  Dispatch latency: min=%.1fus avg=%.1fus max=%.1fus", stats.min_cycles / cycles_per_us,
+             stats.avg_cycles() / cycles_per_us, stats.max_cycles / cycles_per_us);
+  }
+#ifdef USE_JSON_AUTOMATION_PROFILING
+  this->dump_execution_stats();
+#endif
 }
+#endif
 
 void JsonAutomationComponent::add_on_automation_loaded_callback(std::function<void(std::string)> callback) {
   this->automation_loaded_callback_.add(std::move(callback));
@@ -421,6 +558,10 @@ void JsonAutomationComponent::add_on_json_error_callback(std::function<void(std:
   this->json_error_callback_.add(std::move(callback));
 }
 
+void JsonAutomationComponent::add_on_slow_rule_callback(std::function<void(std::string, uint32_t)> callback) {
+  this->slow_rule_callback_.add(std::move(callback));
+}
+
 void JsonAutomationComponent::trigger_automation_loaded(const std::string &data) {
   this->automation_loaded_callback_.call(data);
 }
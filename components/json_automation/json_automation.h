@@ -2,124 +2,250 @@
 
 #include "esphome/core/component.h"
 #include "esphome/core/automation.h"
+#include "esphome/core/defines.h"
+#include "esphome/core/hal.h"
 #include "esphome/core/preferences.h"
 #include "esphome/core/application.h"
 #include "esphome/core/helpers.h"
-#include "esphome/components/json/json_util.h"
 #include "esphome/components/binary_sensor/binary_sensor.h"
-#include "esphome/components/binary_sensor/automation.h"
-#include "esphome/components/switch/switch.h"
-#include "esphome/components/switch/automation.h"
-#include "esphome/components/light/light_state.h"
-#include "esphome/components/light/automation.h"
+#include "capture.h"
+#include "esphome_adapters.h"
+#include "heap_info.h"
+#include "history.h"
+#include "rule_engine.h"
+#include "stack_info.h"
+#ifdef USE_JSON_AUTOMATION_WASM
+#include "wasm_runtime.h"
+#endif
 #include <map>
 #include <vector>
-#include <memory>
 
 namespace esphome {
 namespace json_automation {
 
-static const size_t MAX_JSON_SIZE = 4096;
-
-enum class TriggerSource { INPUT, UNKNOWN };
-
-enum class TriggerType { PRESS, RELEASE, UNKNOWN };
-
-enum class ActionSource { SWITCH, DELAY, LIGHT, UNKNOWN };
-
-enum class ActionType { TURN_ON, TURN_OFF, TOGGLE, UNKNOWN };
-
-struct Trigger {
-  TriggerSource source;
-  TriggerType type;
-  std::string input_id;
-
-  Trigger() : source(TriggerSource::UNKNOWN), type(TriggerType::UNKNOWN), input_id("") {}
+/// Cost of rule set reloads: how long dispatch was blocked and what the heap looked like around it.
+struct ReloadStats {
+  uint32_t count{0};
+  uint32_t last_pause_us{0};
+  uint32_t max_pause_us{0};
+  HeapInfo heap_before;
+  HeapInfo heap_after;
 };
 
-struct Action {
-  ActionSource source;
-  ActionType type;
-  std::string switch_id;
-  uint32_t delay_s;
-
-  Action() : source(ActionSource::UNKNOWN), type(ActionType::UNKNOWN), delay_s(0) {}
-};
-
-struct AutomationRule {
-  std::string id;
-  std::string name;
-  bool enabled;
-  Trigger trigger;
-  std::vector<Action> actions;
-
-  AutomationRule() : enabled(true) {}
-};
+/// Operation on every rule at or below a prefix of the id hierarchy.
+enum class SubtreeOperation : uint8_t { ENABLE, DISABLE, STOP, REMOVE, LIST, EXECUTE };
 
+/// ESPHome binding of RuleEngine: provides the entity, storage, clock and log adapters, forwards the
+/// engine callbacks to the YAML triggers and drives the engine's delays from loop().
 class JsonAutomationComponent : public Component {
  public:
+  JsonAutomationComponent();
+
   void setup() override;
   void loop() override;
   void dump_config() override;
   float get_setup_priority() const override { return setup_priority::LATE; }
 
+  /// Rules built into the firmware; the JSON in preferences is an overlay on top of them.
+  void set_base_json(const std::string &base_json) { this->engine_.set_base_json(base_json); }
   void set_json_data(const std::string &json_data);
   bool load_json_from_preferences();
   bool save_json_to_preferences();
   bool parse_json_automations(const std::string &json_data);
+  /// Replace the active rule set with json_data and record the reload cost. With a load budget the new set
+  /// is parsed over the next loop() calls and replaces the active one once complete.
+  bool load_json(const std::string &json_data);
+  /// Limit each incremental load step to max_bytes of JSON and max_us of time (0: no limit).
+  void set_load_budget(uint32_t max_bytes, uint32_t max_us) { this->engine_.set_load_budget(max_bytes, max_us); }
+  /// Whether a load_json() is still in progress; get_reload_stats() covers it once this turns false.
+  bool is_loading() const { return this->reload_pending_; }
+  /// Compact the rule blocks, blocks_per_loop at a time, when a heap check every interval_ms finds the largest
+  /// free block below (100 - threshold_percent) % of the free heap.
+  void set_compaction(uint8_t threshold_percent, uint32_t interval_ms, uint16_t blocks_per_loop) {
+    this->compaction_threshold_ = threshold_percent;
+    this->compaction_interval_ms_ = interval_ms;
+    this->engine_.set_compaction_step(blocks_per_loop);
+  }
+
+  /// Outputs of which rule actions may turn on at most one; see RuleEngine::add_interlock().
+  void add_interlock(const std::vector<std::string> &entities, InterlockPolicy policy) {
+    this->engine_.add_interlock(entities, policy);
+  }
 
-  void execute_automation(const std::string &automation_id);
+  /// After boot, ignore input changes for settle_ms except in rules with fire_on_initial_state.
+  void set_settle_time(uint32_t settle_ms) { this->settle_ms_ = settle_ms; }
+
+  /// Run the actions of these rules now with payload as their trigger value. Every id is resolved first.
+  void execute_automations(const std::vector<std::string> &automation_ids,
+                           const TriggerPayload &payload = TriggerPayload()) {
+    this->engine_.execute(automation_ids, payload);
+  }
+  void execute_automation(const std::string &automation_id) { this->execute_automations({automation_id}); }
+  /// Enable, disable, stop, remove, list or execute the rules whose id is prefix or starts with prefix + "/". Changes
+  /// last until the next load and are not saved.
+  void apply_to_subtree(SubtreeOperation operation, const std::string &prefix);
+  bool snapshot(const std::string &name, const std::vector<std::string> &entities) {
+    return this->engine_.snapshot(name, entities);
+  }
+  bool restore(const std::string &name) { return this->engine_.restore(name); }
+  void clear_automations();
+  void create_all_automations();
 
   void add_on_automation_loaded_callback(std::function<void(std::string)> callback);
   void add_on_json_error_callback(std::function<void(std::string)> callback);
-
-  const std::vector<AutomationRule> &get_automations() const { return automations_; }
+  void add_on_slow_rule_callback(std::function<void(std::string, uint32_t)> callback);
+  /// Report rules over their max_latency_ms at most once per interval_ms.
+  void set_slow_rule_interval(uint32_t interval_ms) { this->engine_.set_slow_rule_interval(interval_ms); }
+
+  RuleList get_automations() const { return engine_.get_rules(); }
+  /// Duration of the last parse_json_automations() call in microseconds.
+  uint32_t get_last_parse_us() const { return engine_.get_last_parse_us(); }
+  /// Duration of the last create_all_automations() call in microseconds.
+  uint32_t get_last_create_us() const { return engine_.get_last_create_us(); }
+  const ReloadStats &get_reload_stats() const { return reload_stats_; }
+  const StorageStats &get_storage_stats() const { return storage_.get_stats(); }
+  RuleEngine &get_engine() { return engine_; }
+
+#ifdef USE_JSON_AUTOMATION_PROFILING
+  /// Per-rule action cost, keyed by automation id.
+  const std::map<std::string, ExecutionStats> &get_rule_stats() const { return engine_.get_rule_stats(); }
+  const ExecutionStats &get_action_kind_stats(ActionSource source, ActionType type) const {
+    return engine_.get_action_kind_stats(source, type);
+  }
+  const ExecutionStats &get_while_condition_stats() const { return engine_.get_while_condition_stats(); }
+  void reset_execution_stats() { this->engine_.reset_execution_stats(); }
+#endif
+
+#ifdef USE_JSON_AUTOMATION_WASM
+  void set_wasm_limits(uint32_t memory_bytes, uint32_t fuel, uint16_t stack_slots) {
+    WasmLimits limits;
+    limits.memory_bytes = memory_bytes;
+    limits.fuel = fuel;
+    limits.stack_slots = stack_slots;
+    this->wasm_.set_limits(limits);
+  }
+  /// Load a hex-encoded WebAssembly module for "wasm" actions, replacing one of the same name.
+  bool load_wasm(const std::string &name, const std::string &hex_data, bool save);
+  const WasmRuntime &get_wasm() const { return this->wasm_; }
+#endif
+
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+  const StackMonitor &get_stack_monitor() const { return this->stack_; }
+#endif
+
+#ifdef USE_JSON_AUTOMATION_HISTORY
+  void set_history(size_t size, size_t batch, uint32_t flush_interval_ms) {
+    this->history_.set_capacity(size);
+    this->history_.set_flush_policy(batch, flush_interval_ms);
+  }
+  /// Save the waiting history records and commit them to flash now, e.g. on a power-fail warning.
+  bool flush_history();
+  /// Log the history as hex lines, encoding one line at a time, then the id of each current rule index.
+  void dump_history();
+  const ExecutionHistory &get_history() const { return this->history_; }
+  void on_shutdown() override { this->flush_history(); }
+#endif
+
+#ifdef USE_JSON_AUTOMATION_CAPTURE
+  void set_capture_size(size_t size) { this->capture_.set_capacity(size); }
+  void start_capture();
+  void stop_capture();
+  /// Log the serialized capture as hex lines that the host replay tool can read back.
+  void dump_capture();
+  std::vector<uint8_t> get_capture() const { return this->capture_.serialize(); }
+  /// Replay a hex-encoded capture; speed scales time (2.0 = twice as fast, 0 = as fast as possible).
+  bool start_replay(const std::string &hex_data, float speed);
+  bool is_replaying() const { return this->replay_active_; }
+  /// FNV-1 hash of the base rules followed by the overlay, which identifies the merged rule set in a capture.
+  uint32_t get_rules_hash() const;
+#endif
 
  protected:
-  std::string json_data_;
-  std::vector<AutomationRule> automations_;
-  ESPPreferenceObject pref_;
+  ESPHomeEntities entities_;
+  ESPHomeStorage storage_;
+  ESPHomeClock clock_;
+  ESPHomeLog log_;
+  RuleEngine engine_{&entities_, &storage_, &clock_, &log_};
+#ifdef USE_JSON_AUTOMATION_WASM
+  WasmRuntime wasm_{&entities_, &storage_, &clock_, &log_};
+#endif
+  ReloadStats reload_stats_;
+  bool reload_pending_{false};
+  uint32_t settle_ms_{0};
+  uint8_t compaction_threshold_{0};
+  uint32_t compaction_interval_ms_{0};
+  uint32_t last_compaction_check_ms_{0};
 
   CallbackManager<void(std::string)> automation_loaded_callback_;
   CallbackManager<void(std::string)> json_error_callback_;
-
-  std::vector<std::unique_ptr<Automation<>>> automation_objects_;
-
+  CallbackManager<void(std::string, uint32_t)> slow_rule_callback_;
+
+#ifdef USE_JSON_AUTOMATION_PROFILING
+  void dump_execution_stats();
+#endif
+
+#ifdef USE_JSON_AUTOMATION_STACK_MONITOR
+  StackMonitor stack_;
+  void dump_stack_marks();
+#endif
+
+#ifdef USE_JSON_AUTOMATION_HISTORY
+  ExecutionHistory history_;
+  /// Engine generation of the last history record; a change is recorded as HISTORY_RULES_CHANGED.
+  uint32_t history_generation_{0};
+  void record_run(uint16_t rule, RunResult result);
+  /// Record HISTORY_RULES_CHANGED if the rule indices changed since the last record.
+  void record_rules_changed(uint32_t now);
+#endif
+
+#ifdef USE_JSON_AUTOMATION_CAPTURE
+  WorkloadCapture capture_;
+  std::vector<binary_sensor::BinarySensor *> capture_inputs_;
+
+  CaptureLog replay_log_;
+  std::vector<binary_sensor::BinarySensor *> replay_sensors_;
+  size_t replay_pos_{0};
+  uint32_t replay_start_ms_{0};
+  float replay_speed_{1.0f};
+  uint32_t replay_max_lag_ms_{0};
+  uint32_t replay_skipped_{0};
+  ExecutionStats replay_dispatch_stats_;
+  bool replay_active_{false};
+
+  void setup_capture();
+  void replay_step();
+  void finish_replay();
+#endif
+
+  void finish_reload(uint32_t pause_us);
+  void check_fragmentation();
   void trigger_automation_loaded(const std::string &data);
   void trigger_json_error(const std::string &error);
-
-  bool create_automation_from_rule(const AutomationRule &rule);
-  void clear_automations();
-  void create_all_automations();
-
-  binary_sensor::BinarySensor *resolve_binary_sensor(const std::string &object_id);
-  switch_::Switch *resolve_switch(const std::string &object_id);
-  light::LightState *resolve_light(const std::string &object_id);
-
-  Trigger<> *create_trigger(const AutomationRule &rule);
-  esphome::Action<> *create_action(const Action &action);
-
-  TriggerSource parse_trigger_source(const std::string &source);
-  TriggerType parse_trigger_type(const std::string &type);
-  ActionSource parse_action_source(const std::string &source);
-  ActionType parse_action_type(const std::string &type);
 };
 
-class AutomationLoadedTrigger : public Trigger<std::string> {
+class AutomationLoadedTrigger : public esphome::Trigger<std::string> {
  public:
   explicit AutomationLoadedTrigger(JsonAutomationComponent *parent) {
     parent->add_on_automation_loaded_callback([this](std::string data) { this->trigger(data); });
   }
 };
 
-class JsonErrorTrigger : public Trigger<std::string> {
+class JsonErrorTrigger : public esphome::Trigger<std::string> {
  public:
   explicit JsonErrorTrigger(JsonAutomationComponent *parent) {
     parent->add_on_json_error_callback([this](std::string error) { this->trigger(error); });
   }
 };
 
-template<typename... Ts> class LoadJsonAction : public Action<Ts...> {
+class SlowRuleTrigger : public esphome::Trigger<std::string, uint32_t> {
+ public:
+  explicit SlowRuleTrigger(JsonAutomationComponent *parent) {
+    parent->add_on_slow_rule_callback(
+        [this](std::string rule_id, uint32_t latency_us) { this->trigger(rule_id, latency_us); });
+  }
+};
+
+template<typename... Ts> class LoadJsonAction : public esphome::Action<Ts...> {
  public:
   LoadJsonAction(JsonAutomationComponent *parent) : parent_(parent) {}
 
@@ -127,21 +253,14 @@ template<typename... Ts> class LoadJsonAction : public Action<Ts...> {
 
   void play(Ts... x) override {
     auto json_data = this->json_data_.value(x...);
-    this->parent_->clear_automations();
-    this->parent_->set_json_data(json_data);
-    if (this->parent_->parse_json_automations(json_data)) {
-      auto automations = this->parent_->get_automations();
-      for (const auto &rule : automations) {
-        this->parent_->create_automation_from_rule(rule);
-      }
-    }
+    this->parent_->load_json(json_data);
   }
 
  protected:
   JsonAutomationComponent *parent_;
 };
 
-template<typename... Ts> class SaveJsonAction : public Action<Ts...> {
+template<typename... Ts> class SaveJsonAction : public esphome::Action<Ts...> {
  public:
   SaveJsonAction(JsonAutomationComponent *parent) : parent_(parent) {}
 
@@ -151,20 +270,153 @@ template<typename... Ts> class SaveJsonAction : public Action<Ts...> {
   JsonAutomationComponent *parent_;
 };
 
-template<typename... Ts> class ExecuteAutomationAction : public Action<Ts...> {
+template<typename... Ts> class ExecuteAutomationAction : public esphome::Action<Ts...> {
  public:
   ExecuteAutomationAction(JsonAutomationComponent *parent) : parent_(parent) {}
 
   TEMPLATABLE_VALUE(std::string, automation_id)
+  TEMPLATABLE_VALUE(std::vector<std::string>, automation_ids)
+  TEMPLATABLE_VALUE(float, value)
 
   void play(Ts... x) override {
-    auto automation_id = this->automation_id_.value(x...);
-    this->parent_->execute_automation(automation_id);
+    // The value is taken once here, so the rules see it even if its source changes while they run
+    const TriggerPayload payload =
+        this->value_.has_value() ? TriggerPayload::of_float(this->value_.value(x...)) : TriggerPayload();
+    if (this->automation_ids_.has_value()) {
+      this->parent_->execute_automations(this->automation_ids_.value(x...), payload);
+      return;
+    }
+    this->parent_->execute_automations({this->automation_id_.value(x...)}, payload);
   }
 
  protected:
   JsonAutomationComponent *parent_;
 };
 
+template<typename... Ts> class RuleSubtreeAction : public esphome::Action<Ts...> {
+ public:
+  RuleSubtreeAction(JsonAutomationComponent *parent, SubtreeOperation operation)
+      : parent_(parent), operation_(operation) {}
+
+  TEMPLATABLE_VALUE(std::string, prefix)
+
+  void play(Ts... x) override { this->parent_->apply_to_subtree(this->operation_, this->prefix_.value(x...)); }
+
+ protected:
+  JsonAutomationComponent *parent_;
+  SubtreeOperation operation_;
+};
+
+template<typename... Ts> class SnapshotAction : public esphome::Action<Ts...> {
+ public:
+  SnapshotAction(JsonAutomationComponent *parent) : parent_(parent) {}
+
+  TEMPLATABLE_VALUE(std::string, name)
+  void set_entities(const std::vector<std::string> &entities) { this->entities_ = entities; }
+
+  void play(Ts... x) override { this->parent_->snapshot(this->name_.value(x...), this->entities_); }
+
+ protected:
+  JsonAutomationComponent *parent_;
+  std::vector<std::string> entities_;
+};
+
+template<typename... Ts> class RestoreAction : public esphome::Action<Ts...> {
+ public:
+  RestoreAction(JsonAutomationComponent *parent) : parent_(parent) {}
+
+  TEMPLATABLE_VALUE(std::string, name)
+
+  void play(Ts... x) override { this->parent_->restore(this->name_.value(x...)); }
+
+ protected:
+  JsonAutomationComponent *parent_;
+};
+
+#ifdef USE_JSON_AUTOMATION_WASM
+template<typename... Ts> class LoadWasmAction : public esphome::Action<Ts...> {
+ public:
+  LoadWasmAction(JsonAutomationComponent *parent) : parent_(parent) {}
+
+  TEMPLATABLE_VALUE(std::string, name)
+  TEMPLATABLE_VALUE(std::string, data)
+  TEMPLATABLE_VALUE(bool, save)
+
+  void play(Ts... x) override {
+    this->parent_->load_wasm(this->name_.value(x...), this->data_.value(x...), this->save_.value(x...));
+  }
+
+ protected:
+  JsonAutomationComponent *parent_;
+};
+#endif
+
+#ifdef USE_JSON_AUTOMATION_HISTORY
+template<typename... Ts> class FlushHistoryAction : public esphome::Action<Ts...> {
+ public:
+  FlushHistoryAction(JsonAutomationComponent *parent) : parent_(parent) {}
+
+  void play(Ts... x) override { this->parent_->flush_history(); }
+
+ protected:
+  JsonAutomationComponent *parent_;
+};
+
+template<typename... Ts> class DumpHistoryAction : public esphome::Action<Ts...> {
+ public:
+  DumpHistoryAction(JsonAutomationComponent *parent) : parent_(parent) {}
+
+  void play(Ts... x) override { this->parent_->dump_history(); }
+
+ protected:
+  JsonAutomationComponent *parent_;
+};
+#endif
+
+#ifdef USE_JSON_AUTOMATION_CAPTURE
+template<typename... Ts> class StartCaptureAction : public esphome::Action<Ts...> {
+ public:
+  StartCaptureAction(JsonAutomationComponent *parent) : parent_(parent) {}
+
+  void play(Ts... x) override { this->parent_->start_capture(); }
+
+ protected:
+  JsonAutomationComponent *parent_;
+};
+
+template<typename... Ts> class StopCaptureAction : public esphome::Action<Ts...> {
+ public:
+  StopCaptureAction(JsonAutomationComponent *parent) : parent_(parent) {}
+
+  void play(Ts... x) override { this->parent_->stop_capture(); }
+
+ protected:
+  JsonAutomationComponent *parent_;
+};
+
+template<typename... Ts> class DumpCaptureAction : public esphome::Action<Ts...> {
+ public:
+  DumpCaptureAction(JsonAutomationComponent *parent) : parent_(parent) {}
+
+  void play(Ts... x) override { this->parent_->dump_capture(); }
+
+ protected:
+  JsonAutomationComponent *parent_;
+};
+
+template<typename... Ts> class ReplayCaptureAction : public esphome::Action<Ts...> {
+ public:
+  ReplayCaptureAction(JsonAutomationComponent *parent) : parent_(parent) {}
+
+  TEMPLATABLE_VALUE(std::string, data)
+  TEMPLATABLE_VALUE(float, speed)
+
+  void play(Ts... x) override { this->parent_->start_replay(this->data_.value(x...), this->speed_.value(x...)); }
+
+ protected:
+  JsonAutomationComponent *parent_;
+};
+#endif
+
 }  // namespace json_automation
 }  // namespace esphome
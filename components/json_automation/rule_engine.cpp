@@ -0,0 +1,1259 @@
+#include "rule_engine.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+namespace esphome {
+namespace json_automation {
+
+static const size_t LOG_BUFFER_SIZE = 192;
+/// Bytes scanned between two checks of the time budget.
+static const size_t LOAD_SCAN_CHUNK = 128;
+/// Level of a WHILE rule that was not evaluated yet; its first evaluation runs no exit actions.
+static const uint8_t LEVEL_UNKNOWN = 2;
+
+/// Rule lists stay sorted, so the rules of an input run in definition order whatever order they were added in.
+static void insert_sorted(std::vector<uint16_t> &list, uint16_t index) {
+  const auto it = std::lower_bound(list.begin(), list.end(), index);
+  if (it == list.end() || *it != index)
+    list.insert(it, index);
+}
+
+static void erase_sorted(std::vector<uint16_t> &list, uint16_t index) {
+  const auto it = std::lower_bound(list.begin(), list.end(), index);
+  if (it != list.end() && *it == index)
+    list.erase(it);
+}
+
+static bool pending_after(const PendingRun &a, const PendingRun &b) {
+  const int32_t diff = static_cast<int32_t>(a.due_ms - b.due_ms);
+  if (diff != 0)
+    return diff > 0;
+  return static_cast<int32_t>(a.sequence - b.sequence) > 0;
+}
+
+void RuleEngine::logf(LogLevel level, const char *format, ...) {
+  if (level > this->log_->get_level())
+    return;
+  char buffer[LOG_BUFFER_SIZE];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  this->log_->log(level, buffer);
+}
+
+void RuleEngine::error(const std::string &message) {
+  if (this->on_error_)
+    this->on_error_(message);
+}
+
+bool RuleEngine::parse(const std::string &json_data) {
+  this->logf(LogLevel::DEBUG, "Parsing JSON automations...");
+
+  if (json_data.size() > MAX_JSON_SIZE) {
+    this->logf(LogLevel::ERROR, "JSON data too large: %u bytes (max: %u)", (unsigned) json_data.size(),
+               (unsigned) MAX_JSON_SIZE);
+    this->error("JSON data exceeds maximum size");
+    return false;
+  }
+
+  // A synchronous parse supersedes an incremental load in progress
+  this->cancel_load();
+  // Input lists and pending delays index rules_
+  if (this->active_count_ != 0 || !this->pending_.empty())
+    this->clear();
+  this->rules_.clear();
+  this->activated_ = false;
+
+  ParseReport report;
+  std::vector<AutomationRule> rules;
+  std::vector<AutomationRule> base;
+  const uint32_t start = this->clock_->micros();
+  {
+    JsonDocument doc;
+    // With a base layer, an empty overlay is valid
+    if (!json_data.empty() || this->base_json_.empty())
+      parse_rules(doc, json_data, rules, report);
+    if (report.ok() && !this->base_json_.empty() && !parse_rules(doc, this->base_json_, base, report))
+      report.error = "Base rules: " + report.error;
+  }
+  std::vector<AutomationRule> patches;
+  this->rules_.reserve(rules.size() + base.size());
+  for (auto &rule : rules) {
+    if (rule.is_patch()) {
+      patches.push_back(std::move(rule));
+      continue;
+    }
+    this->rules_.push_back(std::make_shared<RuleBlock>());
+    this->rules_.back()->rule = std::move(rule);
+  }
+  const size_t overlay_count = this->rules_.size();
+  for (auto &rule : base) {
+    if (rule.is_patch()) {
+      report.warnings.push_back("Skipping base automation " + rule.id + ": missing required fields");
+      continue;
+    }
+    if (!apply_overlay(rule, this->rules_, overlay_count, patches))
+      continue;
+    this->rules_.push_back(std::make_shared<RuleBlock>());
+    this->rules_.back()->rule = std::move(rule);
+  }
+  this->warn_unmatched(patches);
+  this->last_parse_us_ = this->clock_->micros() - start;
+  this->index_ids();
+
+  for (const auto &warning : report.warnings)
+    this->logf(LogLevel::WARN, "%s", warning.c_str());
+
+  if (!report.ok()) {
+    this->logf(LogLevel::ERROR, "Failed to parse JSON automations: %s", report.error.c_str());
+    this->error(report.error);
+    return false;
+  }
+
+  for (const auto &rule : this->get_rules()) {
+    this->logf(LogLevel::DEBUG, "Loaded automation: %s (%s) with %u valid actions", rule.id.c_str(), rule.name.c_str(),
+               (unsigned) rule.actions.size());
+  }
+  this->logf(LogLevel::INFO, "Successfully parsed %u automations", (unsigned) this->rules_.size());
+  if (this->on_loaded_)
+    this->on_loaded_(json_data);
+  return true;
+}
+
+void RuleEngine::clear() {
+  this->logf(LogLevel::DEBUG, "Clearing %u active rules, %u pending delays", (unsigned) this->active_count_,
+             (unsigned) this->pending_.size());
+  for (auto &input : this->inputs_) {
+    input.press.clear();
+    input.release.clear();
+    input.level.clear();
+  }
+  this->pending_.clear();
+  this->active_count_ = 0;
+  this->activated_ = false;
+  this->stats_.clear();
+  this->levels_.clear();
+  this->rule_stats_.clear();
+  this->thresholds_dirty_ = true;
+  this->generation_++;
+}
+
+void RuleEngine::create_all() {
+  const uint32_t start = this->clock_->micros();
+  for (auto &input : this->inputs_) {
+    input.press.clear();
+    input.release.clear();
+    input.level.clear();
+  }
+  this->active_count_ = 0;
+  for (size_t i = 0; i < this->rules_.size(); i++) {
+    auto &block = this->rules_[i];
+    // Blocks keep their compiled actions across clear(); only new ones are compiled
+    if (!block->compiled) {
+      if (block.use_count() > 1)
+        block = std::make_shared<RuleBlock>(*block);
+      if (!this->compile_rule(*block))
+        this->logf(LogLevel::WARN, "Failed to create automation: %s", block->rule.id.c_str());
+    }
+    if (block->input != INVALID_HANDLE) {
+      add_to_inputs(this->inputs_, *block, i);
+      this->active_count_++;
+    }
+  }
+  this->activated_ = true;
+  this->thresholds_dirty_ = true;
+  this->attach_stats();
+  this->prune_scripts();
+  this->last_create_us_ = this->clock_->micros() - start;
+  this->logf(LogLevel::DEBUG, "Activated %u rules in %u us", (unsigned) this->active_count_,
+             (unsigned) this->last_create_us_);
+  this->levels_.assign(this->rules_.size(), LEVEL_UNKNOWN);
+  this->update_levels();
+}
+
+bool RuleEngine::load(const std::string &json_data) {
+  this->clear();
+  this->set_json_data(json_data);
+  const bool success = this->parse(json_data);
+  if (success)
+    this->create_all();
+  return success;
+}
+
+bool RuleEngine::begin_load(const std::string &json_data) {
+  if (json_data.size() > MAX_JSON_SIZE) {
+    this->logf(LogLevel::ERROR, "JSON data too large: %u bytes (max: %u)", (unsigned) json_data.size(),
+               (unsigned) MAX_JSON_SIZE);
+    this->error("JSON data exceeds maximum size");
+    return false;
+  }
+  if (this->staged_)
+    this->logf(LogLevel::DEBUG, "Restarting incremental load");
+  this->staged_.reset(new StagedLoad());
+  this->staged_->json_data = json_data;
+  this->staged_->in_base = json_data.empty() && !this->base_json_.empty();
+  this->logf(LogLevel::DEBUG, "Loading %u bytes of JSON incrementally", (unsigned) json_data.size());
+  return true;
+}
+
+bool RuleEngine::step_load() {
+  if (!this->staged_)
+    return false;
+  StagedLoad &staged = *this->staged_;
+  const uint32_t start = this->clock_->micros();
+  size_t budget = this->load_budget_bytes_ != 0 ? this->load_budget_bytes_ : MAX_JSON_SIZE;
+
+  RuleScanner::Status status = RuleScanner::Status::MORE;
+  while (budget > 0) {
+    const std::string &json = staged.in_base ? this->base_json_ : staged.json_data;
+    const size_t position = staged.scanner.position();
+    size_t element_start, element_end;
+    status = staged.scanner.scan(json, std::min(budget, LOAD_SCAN_CHUNK), element_start, element_end, staged.report);
+    budget -= std::min(budget, staged.scanner.position() - position);
+
+    if (status == RuleScanner::Status::ELEMENT) {
+      const size_t warnings = staged.report.warnings.size();
+      AutomationRule rule;
+      const bool valid = parse_rule_element(staged.doc, json, element_start, element_end, rule, staged.report);
+      if (valid && rule.is_patch()) {
+        if (staged.in_base) {
+          staged.report.warnings.push_back("Skipping base automation " + rule.id + ": missing required fields");
+        } else {
+          staged.patches.push_back(std::move(rule));
+        }
+      } else if (valid &&
+                 (!staged.in_base || apply_overlay(rule, staged.rules, staged.overlay_count, staged.patches))) {
+        this->logf(LogLevel::DEBUG, "Loaded automation: %s (%s) with %u valid actions", rule.id.c_str(),
+                   rule.name.c_str(), (unsigned) rule.actions.size());
+        RuleBlockRef block = this->find_reusable(rule, staged.rules.size());
+        if (block) {
+          staged.reused++;
+        } else {
+          block = std::make_shared<RuleBlock>();
+          block->rule = std::move(rule);
+          if (!this->compile_rule(*block))
+            this->logf(LogLevel::WARN, "Failed to create automation: %s", block->rule.id.c_str());
+        }
+        if (block->input != INVALID_HANDLE) {
+          add_to_inputs(staged.inputs, *block, staged.rules.size());
+          staged.active++;
+        }
+        staged.rules.push_back(std::move(block));
+      }
+      for (size_t i = warnings; i < staged.report.warnings.size(); i++)
+        this->logf(LogLevel::WARN, "%s", staged.report.warnings[i].c_str());
+      if (!staged.report.ok())
+        status = RuleScanner::Status::ERROR;
+    }
+    if (status == RuleScanner::Status::DONE && !staged.in_base && !this->base_json_.empty()) {
+      staged.in_base = true;
+      staged.overlay_count = staged.rules.size();
+      staged.scanner.reset();
+      status = RuleScanner::Status::MORE;
+    }
+    if (status == RuleScanner::Status::DONE || status == RuleScanner::Status::ERROR)
+      break;
+    if (this->load_budget_us_ != 0 && this->clock_->micros() - start >= this->load_budget_us_)
+      break;
+  }
+
+  const uint32_t elapsed = this->clock_->micros() - start;
+  staged.busy_us += elapsed;
+  staged.max_step_us = std::max(staged.max_step_us, elapsed);
+  staged.steps++;
+
+  if (status == RuleScanner::Status::ERROR) {
+    const std::string error = (staged.in_base ? "Base rules: " : "") + staged.report.error;
+    this->staged_.reset();
+    this->logf(LogLevel::ERROR, "Failed to parse JSON automations: %s", error.c_str());
+    this->error(error);
+    return false;
+  }
+  if (status == RuleScanner::Status::DONE) {
+    this->warn_unmatched(staged.patches);
+    this->finish_load();
+    return false;
+  }
+  return true;
+}
+
+void RuleEngine::finish_load() {
+  std::unique_ptr<StagedLoad> staged = std::move(this->staged_);
+  // Reused blocks keep the level of their WHILE rule, so its actions do not run again
+  std::vector<uint8_t> levels(staged->rules.size(), LEVEL_UNKNOWN);
+  for (size_t i = 0; i < staged->rules.size(); i++) {
+    if (staged->rules[i]->rule.trigger.source != TriggerSource::WHILE)
+      continue;
+    for (size_t j = 0; j < this->levels_.size(); j++) {
+      if (this->rules_[j] == staged->rules[i]) {
+        levels[i] = this->levels_[j];
+        break;
+      }
+    }
+  }
+  this->clear();
+  // Blocks of removed or changed rules are freed here, when the old list goes away with staged
+  this->rules_.swap(staged->rules);
+  this->inputs_.swap(staged->inputs);
+  this->levels_.swap(levels);
+  this->active_count_ = staged->active;
+  this->activated_ = true;
+  this->thresholds_dirty_ = true;
+  this->index_ids();
+  this->json_data_ = std::move(staged->json_data);
+  this->attach_stats();
+  this->prune_scripts();
+
+  // Parsing and compiling are interleaved, so the parse time covers both
+  this->last_parse_us_ = staged->busy_us;
+  this->last_create_us_ = 0;
+  this->last_load_max_step_us_ = staged->max_step_us;
+  this->last_load_steps_ = staged->steps;
+  this->last_load_reused_ = staged->reused;
+  this->logf(LogLevel::INFO, "Successfully parsed %u automations in %u steps (longest %u us), %u unchanged",
+             (unsigned) this->rules_.size(), (unsigned) staged->steps, (unsigned) staged->max_step_us,
+             (unsigned) staged->reused);
+  staged.reset();
+  this->update_levels();
+  if (this->on_loaded_)
+    this->on_loaded_(this->json_data_);
+}
+
+void RuleEngine::attach_stats() {
+  this->stats_.clear();
+  if (!this->profiling_)
+    return;
+  this->stats_.resize(this->rules_.size(), nullptr);
+  for (size_t i = 0; i < this->rules_.size(); i++) {
+    if (this->rules_[i]->input != INVALID_HANDLE)
+      this->stats_[i] = &this->rule_stats_[this->rules_[i]->rule.id];
+  }
+}
+
+void RuleEngine::prune_scripts() {
+  if (this->scripts_ == nullptr)
+    return;
+  // A staged load compiles against the script adapter too, and its calls must survive until it completes
+  std::vector<int32_t> used;
+  auto collect = [&used](const std::vector<RuleBlockRef> &blocks) {
+    for (const auto &block : blocks) {
+      for (const auto &action : block->actions) {
+        if (action.source == ActionSource::WASM)
+          used.push_back(action.target);
+      }
+    }
+  };
+  collect(this->rules_);
+  if (this->staged_)
+    collect(this->staged_->rules);
+  this->scripts_->prune_calls(used);
+}
+
+RuleBlockRef RuleEngine::find_reusable(const AutomationRule &rule, size_t hint) const {
+  // Unchanged rules usually keep their position, so try that first
+  if (hint < this->rules_.size() && this->rules_[hint]->compiled && this->rules_[hint]->rule == rule)
+    return this->rules_[hint];
+  for (const auto &block : this->rules_) {
+    if (block->compiled && block->rule.id == rule.id && block->rule == rule)
+      return block;
+  }
+  return nullptr;
+}
+
+bool RuleEngine::apply_overlay(AutomationRule &rule, const std::vector<RuleBlockRef> &rules, size_t overlay_count,
+                               std::vector<AutomationRule> &patches) {
+  for (size_t i = 0; i < overlay_count; i++) {
+    if (rules[i]->rule.id == rule.id)
+      return false;
+  }
+  for (auto it = patches.begin(); it != patches.end(); ++it) {
+    if (it->id == rule.id) {
+      rule.enabled = it->enabled;
+      patches.erase(it);
+      break;
+    }
+  }
+  return true;
+}
+
+void RuleEngine::warn_unmatched(const std::vector<AutomationRule> &patches) {
+  for (const auto &patch : patches)
+    this->logf(LogLevel::WARN, "Overlay entry %s matches no base automation", patch.id.c_str());
+}
+
+void RuleEngine::add_to_inputs(std::vector<InputRules> &inputs, const RuleBlock &block, uint16_t index) {
+  // Sensor rules are indexed in thresholds_, which is rebuilt from the active rules
+  if (block.rule.trigger.source == TriggerSource::SENSOR)
+    return;
+  if (block.rule.trigger.source == TriggerSource::WHILE) {
+    // A condition may test the same input more than once; insert_sorted() adds the rule once
+    for (const auto &term : block.condition) {
+      if (static_cast<size_t>(term.input) >= inputs.size())
+        inputs.resize(term.input + 1);
+      insert_sorted(inputs[term.input].level, index);
+    }
+    return;
+  }
+  if (static_cast<size_t>(block.input) >= inputs.size())
+    inputs.resize(block.input + 1);
+  insert_sorted(block.rule.trigger.type == TriggerType::PRESS ? inputs[block.input].press
+                                                              : inputs[block.input].release,
+                index);
+}
+
+void RuleEngine::remove_from_inputs(std::vector<InputRules> &inputs, const RuleBlock &block, uint16_t index) {
+  if (block.rule.trigger.source == TriggerSource::SENSOR)
+    return;
+  if (block.rule.trigger.source == TriggerSource::WHILE) {
+    for (const auto &term : block.condition) {
+      if (static_cast<size_t>(term.input) < inputs.size())
+        erase_sorted(inputs[term.input].level, index);
+    }
+    return;
+  }
+  if (static_cast<size_t>(block.input) < inputs.size()) {
+    erase_sorted(block.rule.trigger.type == TriggerType::PRESS ? inputs[block.input].press
+                                                               : inputs[block.input].release,
+                 index);
+  }
+}
+
+void RuleEngine::index_ids() {
+  this->tree_.clear();
+  for (size_t i = 0; i < this->rules_.size(); i++) {
+    if (!this->tree_.insert(this->rules_[i]->rule.id, i))
+      this->logf(LogLevel::WARN, "Duplicate automation id %s cannot be addressed", this->rules_[i]->rule.id.c_str());
+  }
+}
+
+std::vector<uint16_t> RuleEngine::find_subtree(const std::string &prefix) const {
+  std::vector<uint16_t> rules;
+  this->tree_.collect(prefix, rules);
+  return rules;
+}
+
+size_t RuleEngine::execute(const std::vector<std::string> &ids, const TriggerPayload &payload) {
+  std::vector<uint16_t> rules;
+  rules.reserve(ids.size());
+  for (const auto &id : ids) {
+    const int32_t index = this->tree_.find(id);
+    if (index < 0) {
+      this->logf(LogLevel::WARN, "Automation not found: %s", id.c_str());
+      continue;
+    }
+    rules.push_back(index);
+  }
+  return this->execute_rules(rules, payload);
+}
+
+size_t RuleEngine::execute_subtree(const std::string &prefix, const TriggerPayload &payload) {
+  return this->execute_rules(this->find_subtree(prefix), payload);
+}
+
+size_t RuleEngine::execute_rules(const std::vector<uint16_t> &rules, const TriggerPayload &payload) {
+  if (!this->activated_)
+    return 0;
+  const uint32_t generation = this->generation_;
+  size_t executed = 0;
+  for (uint16_t index : rules) {
+    // An action may reload the rules; the remaining indices would refer to the new set
+    if (generation != this->generation_)
+      break;
+    if (this->rules_[index]->input == INVALID_HANDLE) {
+      this->logf(LogLevel::DEBUG, "Automation %s is not active, skipping", this->rules_[index]->rule.id.c_str());
+      continue;
+    }
+    this->run(index, 0, payload);
+    executed++;
+  }
+  this->logf(LogLevel::DEBUG, "Executed %u of %u automations", (unsigned) executed, (unsigned) rules.size());
+  return executed;
+}
+
+void RuleEngine::activate(uint16_t rule) {
+  const RuleBlock &block = *this->rules_[rule];
+  if (block.input == INVALID_HANDLE)
+    return;
+  add_to_inputs(this->inputs_, block, rule);
+  this->active_count_++;
+  if (rule < this->stats_.size())
+    this->stats_[rule] = &this->rule_stats_[block.rule.id];
+  if (block.rule.trigger.source == TriggerSource::SENSOR)
+    this->thresholds_dirty_ = true;
+  if (block.rule.trigger.source == TriggerSource::WHILE) {
+    this->levels_[rule] = LEVEL_UNKNOWN;
+    this->update_level(rule, this->is_settling(), INVALID_HANDLE);
+  }
+}
+
+void RuleEngine::deactivate(uint16_t rule) {
+  const RuleBlock &block = *this->rules_[rule];
+  if (block.input == INVALID_HANDLE)
+    return;
+  remove_from_inputs(this->inputs_, block, rule);
+  this->active_count_--;
+  this->cancel_pending(rule);
+  if (rule < this->stats_.size())
+    this->stats_[rule] = nullptr;
+  if (block.rule.trigger.source == TriggerSource::SENSOR)
+    this->thresholds_dirty_ = true;
+  this->levels_[rule] = LEVEL_UNKNOWN;
+}
+
+size_t RuleEngine::set_subtree_enabled(const std::string &prefix, bool enabled) {
+  const uint32_t generation = this->generation_;
+  size_t changed = 0;
+  for (uint16_t index : this->find_subtree(prefix)) {
+    // Enabling a while rule runs its actions, which may reload the rules
+    if (generation != this->generation_)
+      break;
+    if (this->rules_[index]->rule.enabled == enabled)
+      continue;
+    if (this->activated_)
+      this->deactivate(index);
+    RuleBlockRef &block = this->rules_[index];
+    // Blocks are not modified while shared
+    if (block.use_count() > 1)
+      block = std::make_shared<RuleBlock>(*block);
+    block->rule.enabled = enabled;
+    if (block->compiled && !this->compile_rule(*block))
+      this->logf(LogLevel::WARN, "Failed to create automation: %s", block->rule.id.c_str());
+    if (this->activated_)
+      this->activate(index);
+    changed++;
+  }
+  this->logf(LogLevel::INFO, "%s %u automations under '%s'", enabled ? "Enabled" : "Disabled", (unsigned) changed,
+             prefix.c_str());
+  return changed;
+}
+
+size_t RuleEngine::stop_subtree(const std::string &prefix) {
+  std::vector<uint16_t> rules = this->find_subtree(prefix);
+  std::sort(rules.begin(), rules.end());
+  const size_t before = this->pending_.size();
+  const auto end = std::remove_if(this->pending_.begin(), this->pending_.end(), [&rules](const PendingRun &pending) {
+    return std::binary_search(rules.begin(), rules.end(), pending.rule);
+  });
+  this->pending_.erase(end, this->pending_.end());
+  std::make_heap(this->pending_.begin(), this->pending_.end(), pending_after);
+  this->logf(LogLevel::INFO, "Stopped %u pending delays under '%s'", (unsigned) (before - this->pending_.size()),
+             prefix.c_str());
+  return before - this->pending_.size();
+}
+
+size_t RuleEngine::remove_subtree(const std::string &prefix) {
+  const std::vector<uint16_t> removed = this->find_subtree(prefix);
+  if (removed.empty())
+    return 0;
+  std::vector<int32_t> remap(this->rules_.size(), 0);
+  for (uint16_t index : removed) {
+    remap[index] = -1;
+    this->rule_stats_.erase(this->rules_[index]->rule.id);
+  }
+
+  std::vector<RuleBlockRef> rules;
+  std::vector<uint8_t> levels;
+  rules.reserve(this->rules_.size() - removed.size());
+  for (size_t i = 0; i < this->rules_.size(); i++) {
+    if (remap[i] < 0)
+      continue;
+    remap[i] = rules.size();
+    rules.push_back(std::move(this->rules_[i]));
+    if (i < this->levels_.size())
+      levels.push_back(this->levels_[i]);
+  }
+  // Delays of the remaining rules continue under their new index
+  std::vector<PendingRun> pending;
+  for (const auto &run : this->pending_) {
+    if (remap[run.rule] >= 0)
+      pending.push_back(PendingRun{run.due_ms, run.sequence, static_cast<uint16_t>(remap[run.rule]), run.next_action,
+                                   run.payload});
+  }
+  std::make_heap(pending.begin(), pending.end(), pending_after);
+  this->rules_.swap(rules);
+  this->levels_.swap(levels);
+  this->pending_.swap(pending);
+  // Chains running now refer to the old indices
+  this->generation_++;
+  this->thresholds_dirty_ = true;
+
+  for (auto &input : this->inputs_) {
+    input.press.clear();
+    input.release.clear();
+    input.level.clear();
+  }
+  this->active_count_ = 0;
+  if (this->activated_) {
+    for (size_t i = 0; i < this->rules_.size(); i++) {
+      if (this->rules_[i]->input != INVALID_HANDLE) {
+        add_to_inputs(this->inputs_, *this->rules_[i], i);
+        this->active_count_++;
+      }
+    }
+  }
+  this->attach_stats();
+  this->prune_scripts();
+  this->index_ids();
+  this->logf(LogLevel::INFO, "Removed %u automations under '%s'", (unsigned) removed.size(), prefix.c_str());
+  return removed.size();
+}
+
+bool RuleEngine::compile_rule(RuleBlock &block) {
+  const AutomationRule &rule = block.rule;
+  block.compiled = true;
+  block.input = INVALID_HANDLE;
+  block.actions.clear();
+  block.condition.clear();
+  this->logf(LogLevel::DEBUG, "Creating automation: %s (%s)", rule.id.c_str(), rule.name.c_str());
+
+  if (!rule.enabled) {
+    this->logf(LogLevel::DEBUG, "Automation %s is disabled, skipping", rule.id.c_str());
+    return true;
+  }
+
+  if (rule.trigger.source == TriggerSource::WHILE) {
+    for (const auto &term : rule.trigger.condition) {
+      const int32_t input = this->entities_->resolve_input(term.input_id);
+      if (input == INVALID_HANDLE) {
+        this->logf(LogLevel::ERROR, "Failed to create condition for automation: %s (unknown input %s)",
+                   rule.id.c_str(), term.input_id.c_str());
+        block.condition.clear();
+        return false;
+      }
+      block.condition.push_back(CompiledTerm{input, term.negate});
+    }
+  } else if (rule.trigger.source == TriggerSource::SENSOR) {
+    if (rule.trigger.type != TriggerType::ABOVE && rule.trigger.type != TriggerType::BELOW) {
+      this->logf(LogLevel::WARN, "Unsupported sensor trigger type in automation: %s", rule.id.c_str());
+      return false;
+    }
+  } else if (rule.trigger.source != TriggerSource::INPUT ||
+             (rule.trigger.type != TriggerType::PRESS && rule.trigger.type != TriggerType::RELEASE)) {
+    this->logf(LogLevel::WARN, "Unsupported trigger configuration");
+    this->logf(LogLevel::WARN, "Note: Only Input triggers with press/release are currently supported");
+    return false;
+  }
+
+  int32_t input;
+  if (rule.trigger.source == TriggerSource::WHILE) {
+    input = block.condition.front().input;
+  } else if (rule.trigger.source == TriggerSource::SENSOR) {
+    input = this->entities_->resolve_sensor(rule.trigger.input_id);
+  } else {
+    input = this->entities_->resolve_input(rule.trigger.input_id);
+  }
+  if (input == INVALID_HANDLE) {
+    this->logf(LogLevel::ERROR, "Failed to create trigger for automation: %s", rule.id.c_str());
+    return false;
+  }
+
+  this->compile_actions(rule.actions, block.actions);
+  block.exit_start = block.actions.size();
+  this->compile_actions(rule.exit_actions, block.actions);
+  block.input = input;
+
+  this->logf(LogLevel::INFO, "Successfully created automation: %s with %u actions", rule.id.c_str(),
+             (unsigned) block.actions.size());
+  return true;
+}
+
+void RuleEngine::compile_actions(const std::vector<Action> &actions, std::vector<CompiledAction> &out) {
+  if (!this->interlocks_resolved_)
+    this->resolve_interlocks();
+  for (const auto &action : actions) {
+    if (action.source == ActionSource::DELAY) {
+      out.push_back(CompiledAction{action.source, action.type, NO_INTERLOCK, INVALID_HANDLE, action.delay_s * 1000});
+      continue;
+    }
+    if (action.source == ActionSource::SNAPSHOT || action.source == ActionSource::RESTORE) {
+      const int32_t scene = this->scene_of(action.switch_id, action.entities.get());
+      if (scene == INVALID_HANDLE) {
+        this->logf(LogLevel::WARN, "Skipping snapshot %s without entities", action.switch_id.c_str());
+        continue;
+      }
+      out.push_back(CompiledAction{action.source, action.type, NO_INTERLOCK, scene, 0});
+      continue;
+    }
+    if (action.source == ActionSource::CONDITION) {
+      const int32_t compare = static_cast<int32_t>(action.condition->compare);
+      CompiledAction condition{action.source, ActionType::UNKNOWN, NO_INTERLOCK, compare, 0};
+      condition.limit = action.condition->limit;
+      out.push_back(condition);
+      continue;
+    }
+    if (action.source == ActionSource::WASM) {
+      const int32_t call = this->scripts_ != nullptr ? this->scripts_->resolve_call(*action.wasm) : INVALID_HANDLE;
+      if (call == INVALID_HANDLE) {
+        this->logf(LogLevel::WARN, "Skipping WebAssembly action %s.%s%s", action.wasm->module.c_str(),
+                   action.wasm->function.c_str(), this->scripts_ == nullptr ? " (not enabled)" : "");
+        continue;
+      }
+      out.push_back(CompiledAction{action.source, action.type, NO_INTERLOCK, call, 0});
+      continue;
+    }
+    const int32_t target = this->entities_->resolve_output(action.source, action.switch_id);
+    if (target == INVALID_HANDLE) {
+      this->logf(LogLevel::WARN, "Skipping action on unknown entity %s", action.switch_id.c_str());
+      continue;
+    }
+    out.push_back(CompiledAction{action.source, action.type, this->interlock_of(action.source, target), target, 0});
+  }
+}
+
+/// Split "switch.<object_id>" or "light.<object_id>"; UNKNOWN for any other name.
+static ActionSource parse_output_entity(const std::string &name, std::string &object_id) {
+  const size_t dot = name.find('.');
+  if (dot == std::string::npos)
+    return ActionSource::UNKNOWN;
+  const ActionSource source = parse_action_source(name.substr(0, dot));
+  if (source != ActionSource::SWITCH && source != ActionSource::LIGHT)
+    return ActionSource::UNKNOWN;
+  object_id = name.substr(dot + 1);
+  return source;
+}
+
+bool RuleEngine::add_interlock(const std::vector<std::string> &entities, InterlockPolicy policy) {
+  uint32_t group = 0;
+  for (const auto &name : entities) {
+    std::string object_id;
+    const ActionSource source = parse_output_entity(name, object_id);
+    if (source == ActionSource::UNKNOWN) {
+      this->logf(LogLevel::ERROR, "Invalid interlocked entity %s", name.c_str());
+      return false;
+    }
+    size_t bit = 0;
+    while (bit < this->interlocks_.size() && this->interlocks_[bit].name != name)
+      bit++;
+    if (bit == MAX_INTERLOCK_OUTPUTS) {
+      this->logf(LogLevel::ERROR, "At most %u outputs can be interlocked", (unsigned) MAX_INTERLOCK_OUTPUTS);
+      return false;
+    }
+    if (bit == this->interlocks_.size())
+      this->interlocks_.push_back(InterlockOutput{name, source, INVALID_HANDLE, 0, 0});
+    group |= 1u << bit;
+  }
+  for (uint32_t members = group; members != 0; members &= members - 1) {
+    const int bit = __builtin_ctz(members);
+    InterlockOutput &output = this->interlocks_[bit];
+    (policy == InterlockPolicy::REJECT ? output.reject : output.turn_off) |= group & ~(1u << bit);
+  }
+  this->interlocks_resolved_ = false;
+  return true;
+}
+
+uint8_t RuleEngine::interlock_of(ActionSource source, int32_t handle) const {
+  for (size_t i = 0; i < this->interlocks_.size(); i++) {
+    if (this->interlocks_[i].source == source && this->interlocks_[i].handle == handle)
+      return i;
+  }
+  return NO_INTERLOCK;
+}
+
+bool RuleEngine::perform_output(ActionSource source, ActionType type, int32_t handle) {
+  if (!this->interlocks_resolved_)
+    this->resolve_interlocks();
+  const CompiledAction action{source, type, this->interlock_of(source, handle), handle, 0};
+  if (action.interlock != NO_INTERLOCK && action.type != ActionType::TURN_OFF && !this->check_interlock(action))
+    return false;
+  this->entities_->perform(source, type, handle);
+  return true;
+}
+
+void RuleEngine::resolve_interlocks() {
+  for (auto &output : this->interlocks_) {
+    output.handle = this->entities_->resolve_output(output.source, output.name.substr(output.name.find('.') + 1));
+    if (output.handle == INVALID_HANDLE)
+      this->logf(LogLevel::WARN, "Unknown interlocked entity %s", output.name.c_str());
+  }
+  this->interlocks_resolved_ = true;
+}
+
+void RuleEngine::begin_settle(uint32_t ms) {
+  this->settling_ = ms > 0;
+  this->settle_end_ms_ = this->clock_->millis() + ms;
+}
+
+bool RuleEngine::is_settling() {
+  if (!this->settling_)
+    return false;
+  if (static_cast<int32_t>(this->clock_->millis() - this->settle_end_ms_) < 0)
+    return true;
+  this->settling_ = false;
+  this->logf(LogLevel::DEBUG, "Settle period over, %u rule runs suppressed", (unsigned) this->suppressed_count_);
+  return false;
+}
+
+void RuleEngine::dispatch_input(int32_t input, bool state) {
+  if (input < 0 || static_cast<size_t>(input) >= this->inputs_.size())
+    return;
+  const uint32_t generation = this->generation_;
+  const uint32_t dispatch_us = this->clock_->micros();
+  // Inputs publish their initial state while the device settles; only rules that ask for it run on those
+  const bool settling = this->is_settling();
+  // Indexed loop: an action may publish another input and re-enter the dispatcher, or reload the rules
+  for (size_t i = 0; generation == this->generation_; i++) {
+    const auto &triggers = state ? this->inputs_[input].press : this->inputs_[input].release;
+    if (i >= triggers.size())
+      break;
+    if (settling && !this->rules_[triggers[i]]->rule.fire_on_initial_state) {
+      this->suppressed_count_++;
+      continue;
+    }
+    const uint16_t rule = triggers[i];
+    this->run(rule, 0, TriggerPayload::of_bool(input, state));
+    if (generation == this->generation_)
+      this->check_latency(rule, dispatch_us);
+  }
+  for (size_t i = 0; generation == this->generation_ && i < this->inputs_[input].level.size(); i++) {
+    const uint16_t rule = this->inputs_[input].level[i];
+    if (this->update_level(rule, settling, input) && generation == this->generation_)
+      this->check_latency(rule, dispatch_us);
+  }
+}
+
+void RuleEngine::check_latency(uint16_t rule, uint32_t dispatch_us) {
+  const RuleBlock &block = *this->rules_[rule];
+  if (block.rule.max_latency_ms == 0)
+    return;
+  const uint32_t latency_us = this->clock_->micros() - dispatch_us;
+  if (latency_us <= block.rule.max_latency_ms * 1000u)
+    return;
+  this->slow_rule_count_++;
+  const uint32_t now = this->clock_->millis();
+  if (this->slow_rule_reported_ && now - this->last_slow_rule_ms_ < this->slow_rule_interval_ms_) {
+    this->slow_rule_dropped_++;
+    return;
+  }
+  this->slow_rule_reported_ = true;
+  this->last_slow_rule_ms_ = now;
+  this->logf(LogLevel::WARN, "Automation %s took %u us, over its budget of %u ms", block.rule.id.c_str(),
+             (unsigned) latency_us, (unsigned) block.rule.max_latency_ms);
+  if (this->on_slow_rule_) {
+    // The callback may reload the rules and free the block
+    const std::string id = block.rule.id;
+    this->on_slow_rule_(id, latency_us);
+  }
+}
+
+bool RuleEngine::evaluate(const RuleBlock &block) const {
+  const bool match_any = block.rule.trigger.match_any;
+  for (const auto &term : block.condition) {
+    if ((this->entities_->get_input_state(term.input) != term.negate) == match_any)
+      return match_any;
+  }
+  return !match_any;
+}
+
+bool RuleEngine::update_level(uint16_t rule, bool settling, int32_t input) {
+  bool active;
+  if (!this->profiling_) {
+    active = this->evaluate(*this->rules_[rule]);
+  } else {
+    const uint32_t start = this->clock_->cpu_cycles();
+    active = this->evaluate(*this->rules_[rule]);
+    const uint32_t cycles = this->clock_->cpu_cycles() - start;
+    this->while_condition_stats_.record(cycles);
+    if (rule < this->stats_.size() && this->stats_[rule] != nullptr)
+      this->stats_[rule]->record(cycles);
+  }
+  const uint8_t previous = this->levels_[rule];
+  if (previous == static_cast<uint8_t>(active))
+    return false;
+  this->levels_[rule] = active;
+  if (previous == LEVEL_UNKNOWN && !active)
+    return false;
+  // The level is tracked while settling, so the first transition afterwards is a real one
+  if (settling && !this->rules_[rule]->rule.fire_on_initial_state) {
+    this->suppressed_count_++;
+    return false;
+  }
+
+  this->logf(LogLevel::DEBUG, "Automation %s: condition %s", this->rules_[rule]->rule.id.c_str(),
+             active ? "entered" : "exited");
+  // The chain of the previous transition stops where it is
+  this->cancel_pending(rule);
+  const uint16_t exit_start = this->rules_[rule]->exit_start;
+  const TriggerPayload payload = TriggerPayload::of_bool(input, active);
+  if (!active) {
+    this->run(rule, exit_start, payload);
+  } else if (exit_start > 0) {
+    this->run(rule, 0, payload);
+  }
+  return true;
+}
+
+void RuleEngine::update_levels() {
+  const uint32_t generation = this->generation_;
+  const bool settling = this->is_settling();
+  for (size_t i = 0; generation == this->generation_ && i < this->rules_.size(); i++) {
+    if (this->rules_[i]->input != INVALID_HANDLE && this->rules_[i]->rule.trigger.source == TriggerSource::WHILE)
+      this->update_level(i, settling, INVALID_HANDLE);
+  }
+}
+
+void RuleEngine::build_thresholds() {
+  this->thresholds_.clear();
+  for (size_t i = 0; this->activated_ && i < this->rules_.size(); i++) {
+    const RuleBlock &block = *this->rules_[i];
+    if (block.input != INVALID_HANDLE && block.rule.trigger.source == TriggerSource::SENSOR)
+      this->thresholds_.add(block.input, block.rule.trigger.threshold, block.rule.trigger.type == TriggerType::ABOVE,
+                            i);
+  }
+  this->thresholds_.build();
+  this->thresholds_dirty_ = false;
+}
+
+void RuleEngine::post_sensor(int32_t sensor, float value) {
+  if (!this->thresholds_.has_pending())
+    this->posted_us_ = this->clock_->micros();
+  this->thresholds_.post(sensor, value);
+}
+
+void RuleEngine::evaluate_thresholds() {
+  const uint32_t dispatch_us = this->posted_us_;
+  if (this->thresholds_.evaluate(this->fired_) == 0)
+    return;
+  const uint32_t generation = this->generation_;
+  const bool settling = this->is_settling();
+  for (size_t word = 0; generation == this->generation_ && word < this->fired_.size(); word++) {
+    for (uint32_t bits = this->fired_[word]; bits != 0 && generation == this->generation_; bits &= bits - 1) {
+      const uint16_t rule = word * 32 + __builtin_ctz(bits);
+      const RuleBlock &block = *this->rules_[rule];
+      // An earlier rule of the batch may have disabled this one
+      if (block.input == INVALID_HANDLE)
+        continue;
+      if (settling && !block.rule.fire_on_initial_state) {
+        this->suppressed_count_++;
+        continue;
+      }
+      this->run(rule, 0, TriggerPayload::of_float(this->thresholds_.get_value(block.input), block.input));
+      if (generation == this->generation_)
+        this->check_latency(rule, dispatch_us);
+    }
+  }
+}
+
+void RuleEngine::cancel_pending(uint16_t rule) {
+  const auto end = std::remove_if(this->pending_.begin(), this->pending_.end(),
+                                  [rule](const PendingRun &pending) { return pending.rule == rule; });
+  if (end == this->pending_.end())
+    return;
+  this->pending_.erase(end, this->pending_.end());
+  std::make_heap(this->pending_.begin(), this->pending_.end(), pending_after);
+}
+
+void RuleEngine::run(uint16_t rule, uint16_t first_action, const TriggerPayload &payload) {
+  const uint32_t generation = this->generation_;
+  const RunResult result = this->run_actions(rule, first_action, payload);
+  // After a reload the index belongs to the old rule set
+  if (this->on_rule_run_ && generation == this->generation_)
+    this->on_rule_run_(rule, result);
+}
+
+RunResult RuleEngine::run_actions(uint16_t rule, uint16_t first_action, const TriggerPayload &payload) {
+  const uint32_t generation = this->generation_;
+  // The actions of a WHILE rule end where its exit actions start
+  const RuleBlock &block = *this->rules_[rule];
+  const size_t size = block.actions.size();
+  const size_t end = first_action < block.exit_start ? block.exit_start : size;
+  for (size_t i = first_action; generation == this->generation_ && i < end; i++) {
+    const CompiledAction action = this->rules_[rule]->actions[i];
+    if (action.source == ActionSource::DELAY) {
+      // Resuming after a delay that ends the actions would start the exit actions
+      if (i + 1 == end && end < size)
+        return RunResult::DONE;
+      this->pending_.push_back(PendingRun{this->clock_->millis() + action.delay_ms, this->sequence_++, rule,
+                                          static_cast<uint16_t>(i + 1), payload});
+      std::push_heap(this->pending_.begin(), this->pending_.end(), pending_after);
+      return RunResult::DELAYED;
+    }
+
+    if (!this->profiling_) {
+      if (!this->perform(action, payload))
+        return RunResult::STOPPED;
+      continue;
+    }
+    const uint32_t start = this->clock_->cpu_cycles();
+    const bool proceed = this->perform(action, payload);
+    const uint32_t cycles = this->clock_->cpu_cycles() - start;
+    this->action_kind_stats_[action_kind_index(action.source, action.type)].record(cycles);
+    // The action may have reloaded the rules, which frees the per-rule stats
+    if (generation == this->generation_ && rule < this->stats_.size() && this->stats_[rule] != nullptr)
+      this->stats_[rule]->record(cycles);
+    if (!proceed)
+      return RunResult::STOPPED;
+  }
+  return RunResult::DONE;
+}
+
+int32_t RuleEngine::scene_of(const std::string &name, const std::vector<std::string> *entities) {
+  size_t index = 0;
+  while (index < this->scenes_.size() && this->scenes_[index].name != name)
+    index++;
+  if (index == this->scenes_.size()) {
+    this->scenes_.emplace_back();
+    this->scenes_.back().name = name;
+  }
+  Scene &scene = this->scenes_[index];
+  if (entities == nullptr || entities->empty() || *entities == scene.entities)
+    return index;
+  if (scene.restoring) {
+    this->logf(LogLevel::WARN, "Snapshot %s keeps its entity list while it is restored", name.c_str());
+    return index;
+  }
+
+  if (!scene.entities.empty())
+    this->logf(LogLevel::DEBUG, "Snapshot %s gets a new entity list", name.c_str());
+  scene.entities = *entities;
+  scene.outputs.clear();
+  scene.captured = false;
+  size_t lights = 0;
+  for (const auto &entity : *entities) {
+    std::string object_id;
+    const ActionSource source = parse_output_entity(entity, object_id);
+    const int32_t handle =
+        source == ActionSource::UNKNOWN ? INVALID_HANDLE : this->entities_->resolve_output(source, object_id);
+    if (handle == INVALID_HANDLE) {
+      this->logf(LogLevel::WARN, "Unknown entity %s in snapshot %s", entity.c_str(), name.c_str());
+      continue;
+    }
+    scene.outputs.push_back(SceneOutput{source, handle});
+    if (source == ActionSource::LIGHT)
+      lights++;
+  }
+  scene.states.assign((scene.outputs.size() + 7) / 8 + lights, 0);
+  return scene.outputs.empty() ? INVALID_HANDLE : index;
+}
+
+void RuleEngine::capture(Scene &scene) {
+  const size_t bytes = (scene.outputs.size() + 7) / 8;
+  std::fill(scene.states.begin(), scene.states.begin() + bytes, 0);
+  uint8_t *level = scene.states.data() + bytes;
+  for (size_t i = 0; i < scene.outputs.size(); i++) {
+    const SceneOutput &output = scene.outputs[i];
+    if (this->entities_->get_output_state(output.source, output.handle))
+      scene.states[i / 8] |= 1 << (i % 8);
+    if (output.source == ActionSource::LIGHT)
+      *level++ = this->entities_->get_output_level(output.source, output.handle);
+  }
+  scene.captured = true;
+}
+
+bool RuleEngine::apply_scene(size_t index) {
+  if (!this->scenes_[index].captured) {
+    this->logf(LogLevel::WARN, "Snapshot %s has not been taken", this->scenes_[index].name.c_str());
+    return true;
+  }
+  if (!this->interlocks_resolved_)
+    this->resolve_interlocks();
+  // Outputs may run actions that take a new snapshot of the same name, so the saved states are copied first.
+  // Such a snapshot keeps the entity list while the restore runs, and new scenes may move the vector, so the
+  // outputs are read by index.
+  const std::vector<uint8_t> states = this->scenes_[index].states;
+  const size_t count = this->scenes_[index].outputs.size();
+  const size_t bytes = (count + 7) / 8;
+  const bool restoring = this->scenes_[index].restoring;
+  this->scenes_[index].restoring = true;
+  // Off before on, so outputs that must not be on together never are. Turning on is subject to the interlocks
+  // of the output like a turn_on action, because a partner outside the snapshot may be on by now.
+  bool rejected = false;
+  for (const bool on : {false, true}) {
+    const uint8_t *level = states.data() + bytes;
+    for (size_t i = 0; i < count; i++) {
+      const SceneOutput output = this->scenes_[index].outputs[i];
+      const bool state = (states[i / 8] >> (i % 8)) & 1;
+      const uint8_t brightness = output.source == ActionSource::LIGHT ? *level++ : 255;
+      if (state != on)
+        continue;
+      const CompiledAction action{output.source, ActionType::TURN_ON, this->interlock_of(output.source, output.handle),
+                                  output.handle, 0};
+      if (on && action.interlock != NO_INTERLOCK && !this->check_interlock(action)) {
+        rejected = true;
+        continue;
+      }
+      this->entities_->restore_output(output.source, output.handle, state, brightness);
+    }
+  }
+  this->scenes_[index].restoring = restoring;
+  return !rejected;
+}
+
+bool RuleEngine::snapshot(const std::string &name, const std::vector<std::string> &entities) {
+  const int32_t index = this->scene_of(name, &entities);
+  if (index == INVALID_HANDLE || this->scenes_[index].outputs.empty()) {
+    this->logf(LogLevel::WARN, "Snapshot %s has no entities", name.c_str());
+    return false;
+  }
+  this->capture(this->scenes_[index]);
+  return true;
+}
+
+bool RuleEngine::restore(const std::string &name) {
+  for (size_t i = 0; i < this->scenes_.size(); i++) {
+    if (this->scenes_[i].name == name && this->scenes_[i].captured)
+      return this->apply_scene(i);
+  }
+  this->logf(LogLevel::WARN, "Snapshot %s has not been taken", name.c_str());
+  return false;
+}
+
+bool RuleEngine::check_interlock(const CompiledAction &action) {
+  // Toggling an output that is on turns it off
+  if (action.type == ActionType::TOGGLE && this->entities_->get_output_state(action.source, action.target))
+    return true;
+  const InterlockOutput &output = this->interlocks_[action.interlock];
+  uint32_t on = 0;
+  for (uint32_t others = output.reject | output.turn_off; others != 0; others &= others - 1) {
+    const int bit = __builtin_ctz(others);
+    const InterlockOutput &other = this->interlocks_[bit];
+    if (other.handle != INVALID_HANDLE && this->entities_->get_output_state(other.source, other.handle))
+      on |= 1u << bit;
+  }
+  if ((on & output.reject) != 0) {
+    this->interlock_rejected_++;
+    this->logf(LogLevel::WARN, "Interlock: not turning on %s while %s is on", output.name.c_str(),
+               this->interlocks_[__builtin_ctz(on & output.reject)].name.c_str());
+    return false;
+  }
+  for (uint32_t off = on & output.turn_off; off != 0; off &= off - 1) {
+    const InterlockOutput &other = this->interlocks_[__builtin_ctz(off)];
+    this->logf(LogLevel::DEBUG, "Interlock: turning off %s before %s", other.name.c_str(), output.name.c_str());
+    this->entities_->perform(other.source, ActionType::TURN_OFF, other.handle);
+  }
+  return true;
+}
+
+/// Whether the trigger value passes a CONDITION action. A rule run without a value, and NaN, pass no test.
+static bool holds(const CompiledAction &condition, const TriggerPayload &payload) {
+  if (payload.type == PayloadType::NONE)
+    return false;
+  const float value = payload.as_float();
+  switch (static_cast<ValueCompare>(condition.target)) {
+    case ValueCompare::ABOVE:
+      return value > condition.limit;
+    case ValueCompare::BELOW:
+      return value < condition.limit;
+    case ValueCompare::EQUALS:
+      return value == condition.limit;
+  }
+  return false;
+}
+
+bool RuleEngine::perform(const CompiledAction &action, const TriggerPayload &payload) {
+  if (action.source == ActionSource::CONDITION)
+    return holds(action, payload);
+  if (action.source == ActionSource::WASM)
+    return this->scripts_->run_call(action.target, payload);
+  if (action.source == ActionSource::SNAPSHOT) {
+    this->capture(this->scenes_[action.target]);
+    return true;
+  }
+  if (action.source == ActionSource::RESTORE)
+    return this->apply_scene(action.target);
+  if (action.interlock != NO_INTERLOCK && action.type != ActionType::TURN_OFF && !this->check_interlock(action))
+    return false;
+  this->entities_->perform(action.source, action.type, action.target);
+  return true;
+}
+
+void RuleEngine::loop() {
+  if (this->thresholds_dirty_)
+    this->build_thresholds();
+  if (this->thresholds_.has_pending())
+    this->evaluate_thresholds();
+  const uint32_t now = this->clock_->millis();
+  while (!this->pending_.empty() && static_cast<int32_t>(now - this->pending_.front().due_ms) >= 0) {
+    std::pop_heap(this->pending_.begin(), this->pending_.end(), pending_after);
+    const PendingRun pending = this->pending_.back();
+    this->pending_.pop_back();
+    this->run(pending.rule, pending.next_action, pending.payload);
+  }
+  if (this->staged_) {
+    this->step_load();
+  } else if (this->compacting_) {
+    this->step_compaction();
+  }
+}
+
+void RuleEngine::begin_compaction() {
+  if (this->compacting_)
+    return;
+  this->logf(LogLevel::DEBUG, "Compacting %u rule blocks", (unsigned) this->rules_.size());
+  this->compacting_ = true;
+  this->compact_next_ = 0;
+}
+
+void RuleEngine::step_compaction() {
+  for (uint16_t moved = 0; moved < this->compaction_step_ && this->compact_next_ < this->rules_.size();
+       this->compact_next_++) {
+    auto &block = this->rules_[this->compact_next_];
+    // A shared block is also referenced elsewhere; copying it would not free anything
+    if (block.use_count() > 1)
+      continue;
+    block = std::make_shared<RuleBlock>(*block);
+    moved++;
+    this->compacted_blocks_++;
+  }
+  if (this->compact_next_ < this->rules_.size())
+    return;
+
+  // The index vectors go last, in one step: they are small, and copies come out exactly sized
+  std::vector<InputRules>(this->inputs_).swap(this->inputs_);
+  std::vector<RuleBlockRef>(this->rules_).swap(this->rules_);
+  std::vector<ExecutionStats *>(this->stats_).swap(this->stats_);
+  std::vector<uint8_t>(this->levels_).swap(this->levels_);
+  this->tree_ = RuleTree(this->tree_);
+  std::vector<PendingRun>(this->pending_).swap(this->pending_);
+  this->compacting_ = false;
+  this->compaction_count_++;
+  this->logf(LogLevel::DEBUG, "Compaction #%u done, %u blocks moved in total", (unsigned) this->compaction_count_,
+             (unsigned) this->compacted_blocks_);
+}
+
+bool RuleEngine::load_from_storage() {
+  std::string stored_json;
+  if (!this->storage_->load(stored_json)) {
+    if (this->base_json_.empty()) {
+      this->logf(LogLevel::WARN, "No JSON data found in preferences");
+      return false;
+    }
+    this->logf(LogLevel::DEBUG, "No overlay in preferences, using the base rules");
+  }
+  this->logf(LogLevel::DEBUG, "Loaded JSON from preferences (%u bytes)", (unsigned) stored_json.size());
+  this->json_data_ = stored_json;
+  return this->parse(stored_json);
+}
+
+bool RuleEngine::save_to_storage() {
+  if (this->json_data_.empty()) {
+    this->logf(LogLevel::WARN, "Cannot save empty JSON data");
+    return false;
+  }
+
+  if (this->json_data_.size() >= MAX_JSON_SIZE) {
+    this->logf(LogLevel::ERROR, "Cannot save: JSON data too large: %u bytes (max: %u)",
+               (unsigned) this->json_data_.size(), (unsigned) MAX_JSON_SIZE - 1);
+    this->error("JSON data exceeds maximum size for saving");
+    return false;
+  }
+
+  if (!this->storage_->save(this->json_data_)) {
+    this->logf(LogLevel::ERROR, "Failed to save JSON data to preferences");
+    return false;
+  }
+  this->logf(LogLevel::DEBUG, "JSON data saved to preferences (%u bytes)", (unsigned) this->json_data_.size());
+  return true;
+}
+
+void RuleEngine::reset_execution_stats() {
+  for (auto &entry : this->rule_stats_)
+    entry.second.reset();
+  for (auto &stats : this->action_kind_stats_)
+    stats.reset();
+  this->while_condition_stats_.reset();
+}
+
+}  // namespace json_automation
+}  // namespace esphome
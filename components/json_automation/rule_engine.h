@@ -0,0 +1,465 @@
+#pragma once
+
+#include "engine_adapters.h"
+#include "rule_parser.h"
+#include "rule_tree.h"
+#include "threshold_table.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace json_automation {
+
+/// Min/avg/max of CPU cycles spent in one instrumented operation.
+struct ExecutionStats {
+  uint32_t count{0};
+  uint32_t min_cycles{UINT32_MAX};
+  uint32_t max_cycles{0};
+  uint64_t total_cycles{0};
+
+  void record(uint32_t cycles) {
+    this->count++;
+    this->total_cycles += cycles;
+    if (cycles < this->min_cycles)
+      this->min_cycles = cycles;
+    if (cycles > this->max_cycles)
+      this->max_cycles = cycles;
+  }
+  uint32_t avg_cycles() const { return this->count == 0 ? 0 : this->total_cycles / this->count; }
+  void reset() { *this = ExecutionStats(); }
+};
+
+/// Number of distinct (source, type) action kinds tracked by the profiler.
+static const size_t ACTION_KIND_COUNT = 8 * 4;
+
+inline size_t action_kind_index(ActionSource source, ActionType type) {
+  return static_cast<size_t>(source) * 4 + static_cast<size_t>(type);
+}
+
+static const uint8_t NO_INTERLOCK = 0xFF;
+static const size_t MAX_INTERLOCK_OUTPUTS = 32;
+
+/// Action with its target resolved to an entity handle.
+struct CompiledAction {
+  ActionSource source;
+  ActionType type;
+  /// Index of the target in the interlocked outputs, or NO_INTERLOCK.
+  uint8_t interlock;
+  /// Entity, scene or script handle; the ValueCompare of a CONDITION.
+  int32_t target;
+  union {
+    uint32_t delay_ms;
+    /// Limit of a CONDITION.
+    float limit;
+  };
+};
+
+/// What a rule action does that would turn on an output while another output of its interlock group is on.
+enum class InterlockPolicy : uint8_t {
+  /// Skip the action and stop the rest of the chain.
+  REJECT,
+  /// Turn the other outputs off first.
+  TURN_OFF_OTHERS,
+};
+
+/// How a run of the actions of a rule ended.
+enum class RunResult : uint8_t {
+  /// The actions ran to the end.
+  DONE,
+  /// A delay parked the rest of the chain.
+  DELAYED,
+  /// An action stopped the chain: a WebAssembly condition, a trap or an interlock rejection.
+  STOPPED,
+};
+
+/// Output that belongs to one or more interlock groups. Bit i of the masks stands for output i.
+struct InterlockOutput {
+  std::string name;
+  ActionSource source;
+  int32_t handle;
+  /// Outputs that block this one from turning on, and outputs turned off before it turns on.
+  uint32_t reject;
+  uint32_t turn_off;
+};
+
+struct SceneOutput {
+  ActionSource source;
+  int32_t handle;
+};
+
+/// States of a list of outputs saved by a snapshot. The buffer is sized when the list is set: one on/off bit
+/// per output, then one brightness byte per light.
+struct Scene {
+  std::string name;
+  std::vector<std::string> entities;
+  std::vector<SceneOutput> outputs;
+  std::vector<uint8_t> states;
+  bool captured{false};
+  /// Set while the scene is restored; its entity list is not replaced then.
+  bool restoring{false};
+};
+
+/// Condition term with its input resolved to a handle.
+struct CompiledTerm {
+  int32_t input;
+  bool negate;
+};
+
+/// One parsed rule and, once compiled, its actions with resolved handles. Blocks are reference counted and
+/// not modified while shared, so a staged rule set reuses the blocks of unchanged rules from the active one
+/// and a reload only allocates memory for the rules that changed.
+struct RuleBlock {
+  AutomationRule rule;
+  /// Actions, followed by the exit actions of a WHILE rule from exit_start.
+  std::vector<CompiledAction> actions;
+  std::vector<CompiledTerm> condition;
+  uint16_t exit_start{0};
+  /// Input the rule runs on (the first dependency of a WHILE rule); INVALID_HANDLE if it is disabled or could
+  /// not be compiled.
+  int32_t input{INVALID_HANDLE};
+  bool compiled{false};
+};
+
+using RuleBlockRef = std::shared_ptr<RuleBlock>;
+
+/// Read-only view of the rules in a list of blocks.
+class RuleList {
+ public:
+  class Iterator {
+   public:
+    explicit Iterator(std::vector<RuleBlockRef>::const_iterator it) : it_(it) {}
+    const AutomationRule &operator*() const { return (*this->it_)->rule; }
+    const AutomationRule *operator->() const { return &(*this->it_)->rule; }
+    Iterator &operator++() {
+      ++this->it_;
+      return *this;
+    }
+    bool operator!=(const Iterator &other) const { return this->it_ != other.it_; }
+
+   protected:
+    std::vector<RuleBlockRef>::const_iterator it_;
+  };
+
+  explicit RuleList(const std::vector<RuleBlockRef> &blocks) : blocks_(blocks) {}
+  Iterator begin() const { return Iterator(this->blocks_.begin()); }
+  Iterator end() const { return Iterator(this->blocks_.end()); }
+  size_t size() const { return this->blocks_.size(); }
+  bool empty() const { return this->blocks_.empty(); }
+  const AutomationRule &operator[](size_t index) const { return this->blocks_[index]->rule; }
+
+ protected:
+  const std::vector<RuleBlockRef> &blocks_;
+};
+
+/// Rules (indices into the rule blocks) to run on the state changes of one input handle.
+struct InputRules {
+  std::vector<uint16_t> press;
+  std::vector<uint16_t> release;
+  /// WHILE rules that depend on the input and are re-evaluated when it changes.
+  std::vector<uint16_t> level;
+};
+
+/// Rest of an action chain waiting for a delay to expire.
+struct PendingRun {
+  uint32_t due_ms;
+  uint32_t sequence;
+  uint16_t rule;
+  uint16_t next_action;
+  TriggerPayload payload;
+};
+
+/// Rule set being built by the incremental loader while the previous one stays active.
+struct StagedLoad {
+  std::string json_data;
+  RuleScanner scanner;
+  JsonDocument doc;
+  ParseReport report;
+  std::vector<RuleBlockRef> rules;
+  std::vector<InputRules> inputs;
+  /// Overlay rules come first in rules; the base layer is scanned once the overlay is done.
+  bool in_base{false};
+  size_t overlay_count{0};
+  std::vector<AutomationRule> patches;
+  size_t active{0};
+  size_t reused{0};
+  uint32_t busy_us{0};
+  uint32_t max_step_us{0};
+  uint32_t steps{0};
+};
+
+/// Platform-independent rule engine: parses JSON rule sets, compiles them against the entities
+/// of the platform, dispatches input events and runs delayed action chains from loop().
+class RuleEngine {
+ public:
+  RuleEngine(EntityAdapter *entities, StorageAdapter *storage, ClockAdapter *clock, LogAdapter *log)
+      : entities_(entities), storage_(storage), clock_(clock), log_(log) {}
+
+  /// Enable WebAssembly actions; without a script adapter they are skipped when rules are compiled.
+  void set_scripts(ScriptAdapter *scripts) { this->scripts_ = scripts; }
+
+  /// Base layer, typically built into the firmware. The JSON passed to parse() and the loads is an overlay
+  /// on top of it: overlay rules replace base rules with the same id, {"id": ..., "enabled": ...} entries
+  /// enable or disable a base rule, and the remaining base rules follow the overlay rules.
+  void set_base_json(const std::string &base_json) { this->base_json_ = base_json; }
+  const std::string &get_base_json() const { return this->base_json_; }
+
+  void set_json_data(const std::string &json_data) { this->json_data_ = json_data; }
+  const std::string &get_json_data() const { return this->json_data_; }
+
+  bool parse(const std::string &json_data);
+  /// Resolve entities of all enabled rules and make them active.
+  void create_all();
+  /// Deactivate all rules and cancel pending delays.
+  void clear();
+  /// Replace the active rule set: clear(), parse() and create_all().
+  bool load(const std::string &json_data);
+
+  /// Start replacing the active rule set with json_data over the next loop() calls. The active set keeps
+  /// running until the new one is complete; a parse error leaves it untouched.
+  bool begin_load(const std::string &json_data);
+  /// Parse and compile up to max_bytes of JSON or for up to max_us per loop() call (0: no limit).
+  void set_load_budget(uint32_t max_bytes, uint32_t max_us) {
+    this->load_budget_bytes_ = max_bytes;
+    this->load_budget_us_ = max_us;
+  }
+  bool has_load_budget() const { return this->load_budget_bytes_ != 0 || this->load_budget_us_ != 0; }
+  /// Advance the incremental load by one budget; returns true while it is still in progress.
+  bool step_load();
+  void cancel_load() { this->staged_.reset(); }
+  bool is_loading() const { return this->staged_ != nullptr; }
+  /// Longest single step and number of steps of the last completed incremental load.
+  uint32_t get_last_load_max_step_us() const { return this->last_load_max_step_us_; }
+  uint32_t get_last_load_steps() const { return this->last_load_steps_; }
+  /// Rules of the last incremental load that shared their block with the previous rule set.
+  uint32_t get_last_load_reused() const { return this->last_load_reused_; }
+
+  /// Move every rule block and index vector into a fresh, exactly sized allocation, a few blocks per loop()
+  /// call. First-fit allocators place the copies in the lowest holes, so rule data that survived many reloads
+  /// packs together and the space it leaves merges into larger free blocks. Rule indices do not change.
+  void begin_compaction();
+  void set_compaction_step(uint16_t blocks) { this->compaction_step_ = blocks > 0 ? blocks : 1; }
+  bool is_compacting() const { return this->compacting_; }
+  uint32_t get_compaction_count() const { return this->compaction_count_; }
+  uint32_t get_compacted_blocks() const { return this->compacted_blocks_; }
+
+  bool load_from_storage();
+  bool save_to_storage();
+
+  /// At most one of entities ("switch.<object_id>" or "light.<object_id>") may be on at a time; policy decides
+  /// what a rule action that would turn on a second one does. Groups are compiled into bitmasks and must be
+  /// added before the first rule is compiled. False if an entity name is invalid or there are too many outputs.
+  bool add_interlock(const std::vector<std::string> &entities, InterlockPolicy policy);
+  const std::vector<InterlockOutput> &get_interlocks() const { return this->interlocks_; }
+  uint32_t get_interlock_rejected_count() const { return this->interlock_rejected_; }
+  /// Turn on, off or toggle an output on behalf of code outside the rule actions (WebAssembly host functions),
+  /// under the same interlocks as a rule action. False if an interlock rejected it.
+  bool perform_output(ActionSource source, ActionType type, int32_t handle);
+
+  /// Save the states of entities ("switch.<object_id>" or "light.<object_id>") under name, replacing the list
+  /// of an earlier snapshot of that name; an empty list keeps it. Snapshots stay in RAM across reloads.
+  bool snapshot(const std::string &name, const std::vector<std::string> &entities);
+  /// Put the outputs of a snapshot back: those that were off are turned off first, then the others on, subject
+  /// to the interlocks. False if the snapshot has not been taken or an interlock rejected an output.
+  bool restore(const std::string &name);
+  const std::vector<Scene> &get_scenes() const { return this->scenes_; }
+
+  /// Input changes within ms of now only run rules with fire_on_initial_state; 0 disables the settle period.
+  void begin_settle(uint32_t ms);
+  bool is_settling();
+  uint32_t get_suppressed_count() const { return this->suppressed_count_; }
+
+  void dispatch_input(int32_t input, bool state);
+  /// Store a new value of a sensor handle. Sensor rules are not evaluated here but in one batch on the next
+  /// loop(), against the latest value of every sensor that changed. Their latency counts from the first value
+  /// of the batch.
+  void post_sensor(int32_t sensor, float value);
+  /// Evaluate the sensor thresholds and run the rules that fired, continue action chains whose delay has expired,
+  /// then advance an incremental load or compaction.
+  void loop();
+
+  void set_on_loaded(std::function<void(const std::string &)> callback) { this->on_loaded_ = std::move(callback); }
+  void set_on_error(std::function<void(const std::string &)> callback) { this->on_error_ = std::move(callback); }
+  /// Called with the rule id and latency in us when the immediate actions of a rule with max_latency_ms end
+  /// later than that after the input change; at most once per interval_ms.
+  void set_on_slow_rule(std::function<void(const std::string &, uint32_t)> callback) {
+    this->on_slow_rule_ = std::move(callback);
+  }
+  void set_slow_rule_interval(uint32_t interval_ms) { this->slow_rule_interval_ms_ = interval_ms; }
+  /// Rule runs over their latency budget, and how many of them were not reported because of the interval.
+  uint32_t get_slow_rule_count() const { return this->slow_rule_count_; }
+  uint32_t get_slow_rule_dropped() const { return this->slow_rule_dropped_; }
+  /// Called with the rule index and how its actions ended, each time they run or resume after a delay.
+  void set_on_rule_run(std::function<void(uint16_t, RunResult)> callback) { this->on_rule_run_ = std::move(callback); }
+  /// Changes whenever rule indices do: on every load and when rules are removed.
+  uint32_t get_generation() const { return this->generation_; }
+
+  /// Index of the rule with this id, or -1.
+  int32_t find_rule(const std::string &id) const { return this->tree_.find(id); }
+  /// Indices of the rules at or below prefix in the id hierarchy, in id order: "zone1" covers "zone1" and
+  /// "zone1/lights/night"; an empty prefix covers every rule.
+  std::vector<uint16_t> find_subtree(const std::string &prefix) const;
+  /// Enable or disable the rules of a subtree until the next load; returns the number of rules changed.
+  size_t set_subtree_enabled(const std::string &prefix, bool enabled);
+  /// Cancel the pending delays of the rules of a subtree; returns the number cancelled.
+  size_t stop_subtree(const std::string &prefix);
+  /// Remove the rules of a subtree from the rule set until the next load; returns the number removed. Unlike
+  /// the other subtree operations, this renumbers the remaining rules.
+  size_t remove_subtree(const std::string &prefix);
+  /// Run the actions of the rules with these ids now, as if they had triggered; returns the number run. All
+  /// ids are resolved before the first rule runs. Unknown and disabled rules are skipped, and the actions of
+  /// a while rule run without changing its level. The actions see payload as the value of their trigger.
+  size_t execute(const std::vector<std::string> &ids, const TriggerPayload &payload = TriggerPayload());
+  /// Run the actions of the rules of a subtree, in id order.
+  size_t execute_subtree(const std::string &prefix, const TriggerPayload &payload = TriggerPayload());
+
+  RuleList get_rules() const { return RuleList(this->rules_); }
+  const std::vector<RuleBlockRef> &get_rule_blocks() const { return this->rules_; }
+  size_t get_active_count() const { return this->active_count_; }
+  const ThresholdTable &get_thresholds() const { return this->thresholds_; }
+  size_t get_pending_count() const { return this->pending_.size(); }
+  /// Deadline of the earliest pending delay; false if none is pending.
+  bool get_next_due(uint32_t &due_ms) const {
+    if (this->pending_.empty())
+      return false;
+    due_ms = this->pending_.front().due_ms;
+    return true;
+  }
+  uint32_t get_last_parse_us() const { return this->last_parse_us_; }
+  uint32_t get_last_create_us() const { return this->last_create_us_; }
+
+  void set_profiling(bool profiling) { this->profiling_ = profiling; }
+  const std::map<std::string, ExecutionStats> &get_rule_stats() const { return this->rule_stats_; }
+  const ExecutionStats &get_action_kind_stats(ActionSource source, ActionType type) const {
+    return this->action_kind_stats_[action_kind_index(source, type)];
+  }
+  /// Cost of evaluating the conditions of while rules; each evaluation also counts towards the stats of its rule.
+  const ExecutionStats &get_while_condition_stats() const { return this->while_condition_stats_; }
+  void reset_execution_stats();
+
+ protected:
+  EntityAdapter *entities_;
+  StorageAdapter *storage_;
+  ClockAdapter *clock_;
+  LogAdapter *log_;
+  ScriptAdapter *scripts_{nullptr};
+
+  std::string base_json_;
+  std::string json_data_;
+  std::vector<RuleBlockRef> rules_;
+  std::vector<InputRules> inputs_;
+  /// Rule ids of rules_, rebuilt whenever rules_ is replaced.
+  RuleTree tree_;
+  /// Per-rule stats, parallel to rules_ while profiling.
+  std::vector<ExecutionStats *> stats_;
+  /// Whether the condition of each WHILE rule held at its last evaluation, parallel to rules_.
+  std::vector<uint8_t> levels_;
+  /// Thresholds of the active SENSOR rules, rebuilt by loop() when thresholds_dirty_ is set.
+  ThresholdTable thresholds_;
+  /// micros() at the first post_sensor() since the last evaluation.
+  uint32_t posted_us_{0};
+  bool thresholds_dirty_{false};
+  /// Bitmask of the rules fired by the last evaluation of thresholds_.
+  std::vector<uint32_t> fired_;
+  size_t active_count_{0};
+  /// Min-heap on due_ms, then sequence, so equal deadlines run in scheduling order.
+  std::vector<PendingRun> pending_;
+  uint32_t sequence_{0};
+  /// rules_ is compiled and indexed in inputs_.
+  bool activated_{false};
+  /// Bumped whenever the compiled rules change, so chains of the old set stop.
+  uint32_t generation_{0};
+  std::vector<InterlockOutput> interlocks_;
+  /// Indexed by the target of compiled SNAPSHOT and RESTORE actions; never shrinks.
+  std::vector<Scene> scenes_;
+  /// Handles of interlocks_ are resolved with the first compiled rule.
+  bool interlocks_resolved_{true};
+  uint32_t interlock_rejected_{0};
+  bool settling_{false};
+  uint32_t settle_end_ms_{0};
+  /// Rule runs and level transitions skipped during the settle period.
+  uint32_t suppressed_count_{0};
+  uint32_t slow_rule_interval_ms_{10000};
+  uint32_t last_slow_rule_ms_{0};
+  bool slow_rule_reported_{false};
+  uint32_t slow_rule_count_{0};
+  uint32_t slow_rule_dropped_{0};
+  uint32_t last_parse_us_{0};
+  uint32_t last_create_us_{0};
+
+  std::unique_ptr<StagedLoad> staged_;
+  uint32_t load_budget_bytes_{0};
+  uint32_t load_budget_us_{0};
+  uint32_t last_load_max_step_us_{0};
+  uint32_t last_load_steps_{0};
+  uint32_t last_load_reused_{0};
+
+  bool compacting_{false};
+  size_t compact_next_{0};
+  uint16_t compaction_step_{2};
+  uint32_t compaction_count_{0};
+  uint32_t compacted_blocks_{0};
+
+  bool profiling_{false};
+  std::map<std::string, ExecutionStats> rule_stats_;
+  ExecutionStats action_kind_stats_[ACTION_KIND_COUNT];
+  ExecutionStats while_condition_stats_;
+
+  std::function<void(const std::string &)> on_loaded_;
+  std::function<void(const std::string &)> on_error_;
+  std::function<void(const std::string &, uint32_t)> on_slow_rule_;
+  std::function<void(uint16_t, RunResult)> on_rule_run_;
+
+  bool compile_rule(RuleBlock &block);
+  void compile_actions(const std::vector<Action> &actions, std::vector<CompiledAction> &out);
+  RuleBlockRef find_reusable(const AutomationRule &rule, size_t hint) const;
+  /// Fold the overlay into a base rule; false if an overlay rule (rules[0, overlay_count)) replaces it.
+  static bool apply_overlay(AutomationRule &rule, const std::vector<RuleBlockRef> &rules, size_t overlay_count,
+                            std::vector<AutomationRule> &patches);
+  void warn_unmatched(const std::vector<AutomationRule> &patches);
+  static void add_to_inputs(std::vector<InputRules> &inputs, const RuleBlock &block, uint16_t index);
+  static void remove_from_inputs(std::vector<InputRules> &inputs, const RuleBlock &block, uint16_t index);
+  void index_ids();
+  void activate(uint16_t rule);
+  void deactivate(uint16_t rule);
+  void attach_stats();
+  /// Let the script adapter drop the calls that neither the active nor a staged rule set uses any more.
+  void prune_scripts();
+  void finish_load();
+  void step_compaction();
+  bool evaluate(const RuleBlock &block) const;
+  /// Re-evaluate a WHILE rule and run its actions or exit actions if the result changed; true if they ran.
+  /// Their payload is the new level, with input as the entity that changed it.
+  bool update_level(uint16_t rule, bool settling, int32_t input);
+  void update_levels();
+  void build_thresholds();
+  /// Run the rules whose threshold the values posted since the last loop() crossed, in rule order.
+  void evaluate_thresholds();
+  void cancel_pending(uint16_t rule);
+  /// Compare the time since dispatch_us with the latency budget of a rule that has just run.
+  void check_latency(uint16_t rule, uint32_t dispatch_us);
+  size_t execute_rules(const std::vector<uint16_t> &rules, const TriggerPayload &payload);
+  void run(uint16_t rule, uint16_t first_action, const TriggerPayload &payload);
+  RunResult run_actions(uint16_t rule, uint16_t first_action, const TriggerPayload &payload);
+  void resolve_interlocks();
+  /// Index of an output in the interlocked outputs, or NO_INTERLOCK.
+  uint8_t interlock_of(ActionSource source, int32_t handle) const;
+  /// Index of the scene called name, created if needed. A non-null entities list replaces its outputs;
+  /// INVALID_HANDLE if none of them exists.
+  int32_t scene_of(const std::string &name, const std::vector<std::string> *entities);
+  void capture(Scene &scene);
+  /// Restore a scene; false if an interlock kept an output off, which stops the chain like a rejected action.
+  bool apply_scene(size_t index);
+  /// Apply the interlock policy before action turns its output on; false if it must not.
+  bool check_interlock(const CompiledAction &action);
+  /// Perform one entity, script or condition action; false stops the chain.
+  bool perform(const CompiledAction &action, const TriggerPayload &payload);
+  void error(const std::string &message);
+  void logf(LogLevel level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+};
+
+}  // namespace json_automation
+}  // namespace esphome
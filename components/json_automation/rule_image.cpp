@@ -0,0 +1,384 @@
+#include "rule_image.h"
+#include <cstring>
+#include <unordered_map>
+
+namespace esphome {
+namespace json_automation {
+
+// Image layout, all integers little-endian:
+//   header   magic "JARI", version, reserved, rule count u16, action count u16, term count u16,
+//            entity count u16, string bytes u16, source hash u32, FNV-1 checksum of everything after the header u32
+//   rules    id, name, input_id string offsets u16, match_any << 2 | fire_on_initial_state << 1 | enabled u8,
+//            trigger source << 4 | type u8, input key u32, action count u16, exit action count u16,
+//            max_latency_ms u16, condition term count u16, threshold f32
+//   actions  source u8, condition compare or wasm trigger_arg << 4 | type u8, target string offset u16,
+//            target key, delay in seconds, wasm arg or condition limit u32, wasm module and function string
+//            offsets u16, first entity u16, entity count u16; the actions of a rule precede its exit actions
+//   terms    input_id string offset u16, negate u8, reserved u8, input key u32
+//   entities string offset u16, reserved u16, key of the object id after the domain u32
+//   strings  NUL-terminated, deduplicated; offset 0 is the empty string
+static const uint8_t IMAGE_MAGIC[4] = {'J', 'A', 'R', 'I'};
+static const uint8_t IMAGE_VERSION = 3;
+static const size_t IMAGE_HEADER_SIZE = 24;
+static const size_t IMAGE_RULE_SIZE = 24;
+static const size_t IMAGE_ACTION_SIZE = 16;
+static const size_t IMAGE_TERM_SIZE = 8;
+static const size_t IMAGE_ENTITY_SIZE = 8;
+
+static void put_u16(std::vector<uint8_t> &out, uint16_t value) {
+  out.push_back(static_cast<uint8_t>(value));
+  out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+static void put_u32(std::vector<uint8_t> &out, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static uint16_t get_u16(const uint8_t *data) { return static_cast<uint16_t>(data[0] | (data[1] << 8)); }
+
+static uint32_t get_u32(const uint8_t *data) {
+  return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+         (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+static uint32_t fnv1(const uint8_t *data, size_t len) {
+  uint32_t hash = 2166136261UL;
+  for (size_t i = 0; i < len; i++) {
+    hash *= 16777619UL;
+    hash ^= data[i];
+  }
+  return hash;
+}
+
+uint32_t rule_key(const std::string &object_id) {
+  return fnv1(reinterpret_cast<const uint8_t *>(object_id.data()), object_id.size());
+}
+
+class StringTable {
+ public:
+  StringTable() { this->data_.push_back('\0'); }
+
+  bool add(const std::string &value, uint16_t &offset) {
+    if (value.empty()) {
+      offset = 0;
+      return true;
+    }
+    auto it = this->offsets_.find(value);
+    if (it != this->offsets_.end()) {
+      offset = it->second;
+      return true;
+    }
+    if (this->data_.size() + value.size() + 1 > UINT16_MAX)
+      return false;
+    offset = this->data_.size();
+    this->data_.insert(this->data_.end(), value.begin(), value.end());
+    this->data_.push_back('\0');
+    this->offsets_.emplace(value, offset);
+    return true;
+  }
+
+  const std::vector<uint8_t> &data() const { return this->data_; }
+
+ protected:
+  std::vector<uint8_t> data_;
+  std::unordered_map<std::string, uint16_t> offsets_;
+};
+
+static uint32_t float_bits(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static float bits_float(uint32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/// Entities of a WASM or SNAPSHOT action, nullptr for other actions.
+static const std::vector<std::string> *action_entities(const Action &action) {
+  if (action.wasm)
+    return &action.wasm->entities;
+  return action.entities.get();
+}
+
+/// Key of the object id in "<domain>.<object_id>".
+static uint32_t entity_key(const std::string &entity) {
+  const size_t dot = entity.find('.');
+  return dot == std::string::npos ? rule_key(entity) : rule_key(entity.substr(dot + 1));
+}
+
+static bool put_action(const Action &action, StringTable &strings, std::vector<uint8_t> &entities,
+                       std::vector<uint8_t> &out) {
+  uint16_t target, module = 0, function = 0;
+  if (!strings.add(action.switch_id, target) ||
+      (action.wasm && (!strings.add(action.wasm->module, module) || !strings.add(action.wasm->function, function))))
+    return false;
+
+  uint8_t detail = 0;
+  uint32_t value = rule_key(action.switch_id);
+  if (action.source == ActionSource::DELAY) {
+    value = action.delay_s;
+  } else if (action.wasm) {
+    detail = action.wasm->trigger_arg ? 1 : 0;
+    value = static_cast<uint32_t>(action.wasm->arg);
+  } else if (action.condition) {
+    detail = static_cast<uint8_t>(action.condition->compare);
+    value = float_bits(action.condition->limit);
+  }
+  out.push_back(static_cast<uint8_t>(action.source));
+  out.push_back(static_cast<uint8_t>(detail << 4 | static_cast<uint8_t>(action.type)));
+  put_u16(out, target);
+  put_u32(out, value);
+  put_u16(out, module);
+  put_u16(out, function);
+
+  const std::vector<std::string> *list = action_entities(action);
+  put_u16(out, entities.size() / IMAGE_ENTITY_SIZE);
+  put_u16(out, list != nullptr ? list->size() : 0);
+  if (list == nullptr)
+    return true;
+  for (const auto &entity : *list) {
+    uint16_t offset;
+    if (!strings.add(entity, offset))
+      return false;
+    put_u16(entities, offset);
+    put_u16(entities, 0);
+    put_u32(entities, entity_key(entity));
+  }
+  return true;
+}
+
+bool compile_rule_image(const std::vector<AutomationRule> &rules, uint32_t source_hash, std::vector<uint8_t> &out,
+                        std::string &error) {
+  size_t action_count = 0, term_count = 0, entity_count = 0;
+  for (const auto &rule : rules) {
+    action_count += rule.actions.size() + rule.exit_actions.size();
+    term_count += rule.trigger.condition.size();
+    for (const auto *actions : {&rule.actions, &rule.exit_actions}) {
+      for (const auto &action : *actions) {
+        const std::vector<std::string> *list = action_entities(action);
+        entity_count += list != nullptr ? list->size() : 0;
+      }
+    }
+  }
+  if (rules.size() > UINT16_MAX || action_count > UINT16_MAX || term_count > UINT16_MAX ||
+      entity_count > UINT16_MAX) {
+    error = "Too many rules, actions, condition terms or entities for the image format";
+    return false;
+  }
+
+  StringTable strings;
+  std::vector<uint8_t> entities;
+  entities.reserve(entity_count * IMAGE_ENTITY_SIZE);
+  out.clear();
+  out.reserve(IMAGE_HEADER_SIZE + rules.size() * IMAGE_RULE_SIZE + action_count * IMAGE_ACTION_SIZE +
+              term_count * IMAGE_TERM_SIZE + entity_count * IMAGE_ENTITY_SIZE);
+  out.resize(IMAGE_HEADER_SIZE);
+
+  for (const auto &rule : rules) {
+    uint16_t id, name, input;
+    if (!strings.add(rule.id, id) || !strings.add(rule.name, name) || !strings.add(rule.trigger.input_id, input)) {
+      error = "String table exceeds 64 KiB";
+      return false;
+    }
+    put_u16(out, id);
+    put_u16(out, name);
+    put_u16(out, input);
+    out.push_back((rule.trigger.match_any ? 4 : 0) | (rule.fire_on_initial_state ? 2 : 0) | (rule.enabled ? 1 : 0));
+    out.push_back(static_cast<uint8_t>(static_cast<uint8_t>(rule.trigger.source) << 4 |
+                                       static_cast<uint8_t>(rule.trigger.type)));
+    put_u32(out, rule_key(rule.trigger.input_id));
+    put_u16(out, rule.actions.size());
+    put_u16(out, rule.exit_actions.size());
+    put_u16(out, rule.max_latency_ms);
+    put_u16(out, rule.trigger.condition.size());
+    put_u32(out, float_bits(rule.trigger.threshold));
+  }
+
+  for (const auto &rule : rules) {
+    for (const auto *actions : {&rule.actions, &rule.exit_actions}) {
+      for (const auto &action : *actions) {
+        if (!put_action(action, strings, entities, out)) {
+          error = "String table exceeds 64 KiB";
+          return false;
+        }
+      }
+    }
+  }
+
+  for (const auto &rule : rules) {
+    for (const auto &term : rule.trigger.condition) {
+      uint16_t input;
+      if (!strings.add(term.input_id, input)) {
+        error = "String table exceeds 64 KiB";
+        return false;
+      }
+      put_u16(out, input);
+      out.push_back(term.negate ? 1 : 0);
+      out.push_back(0);
+      put_u32(out, rule_key(term.input_id));
+    }
+  }
+
+  out.insert(out.end(), entities.begin(), entities.end());
+  out.insert(out.end(), strings.data().begin(), strings.data().end());
+
+  std::vector<uint8_t> header;
+  header.reserve(IMAGE_HEADER_SIZE);
+  header.insert(header.end(), IMAGE_MAGIC, IMAGE_MAGIC + sizeof(IMAGE_MAGIC));
+  header.push_back(IMAGE_VERSION);
+  header.push_back(0);
+  put_u16(header, rules.size());
+  put_u16(header, action_count);
+  put_u16(header, term_count);
+  put_u16(header, entity_count);
+  put_u16(header, strings.data().size());
+  put_u32(header, source_hash);
+  put_u32(header, fnv1(out.data() + IMAGE_HEADER_SIZE, out.size() - IMAGE_HEADER_SIZE));
+  std::memcpy(out.data(), header.data(), IMAGE_HEADER_SIZE);
+  return true;
+}
+
+static bool get_string(const uint8_t *table, size_t table_size, uint16_t offset, std::string &value) {
+  if (offset >= table_size)
+    return false;
+  const void *end = std::memchr(table + offset, '\0', table_size - offset);
+  if (end == nullptr)
+    return false;
+  value.assign(reinterpret_cast<const char *>(table + offset), static_cast<const uint8_t *>(end) - (table + offset));
+  return true;
+}
+
+/// Reader of the variable-length sections, which checks the records of each rule against the header counts.
+struct ImageSections {
+  const uint8_t *strings;
+  size_t string_bytes;
+  const uint8_t *entities;
+  size_t entity_count;
+
+  bool string(uint16_t offset, std::string &value) const {
+    return get_string(this->strings, this->string_bytes, offset, value);
+  }
+
+  bool entity_list(size_t first, size_t count, std::vector<std::string> &out) const {
+    if (first > this->entity_count || count > this->entity_count - first)
+      return false;
+    out.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      if (!this->string(get_u16(this->entities + (first + i) * IMAGE_ENTITY_SIZE), out[i]))
+        return false;
+    }
+    return true;
+  }
+};
+
+static bool get_action(const uint8_t *record, const ImageSections &sections, Action &action) {
+  action.source = static_cast<ActionSource>(record[0]);
+  action.type = static_cast<ActionType>(record[1] & 0x0F);
+  const uint8_t detail = record[1] >> 4;
+  const uint32_t value = get_u32(record + 4);
+  const size_t first_entity = get_u16(record + 12);
+  const size_t entity_count = get_u16(record + 14);
+  if (!sections.string(get_u16(record + 2), action.switch_id))
+    return false;
+
+  if (action.source == ActionSource::DELAY) {
+    action.delay_s = value;
+  } else if (action.source == ActionSource::WASM) {
+    auto call = std::make_shared<WasmCall>();
+    call->arg = static_cast<int32_t>(value);
+    call->trigger_arg = detail != 0;
+    if (!sections.string(get_u16(record + 8), call->module) || !sections.string(get_u16(record + 10), call->function) ||
+        !sections.entity_list(first_entity, entity_count, call->entities))
+      return false;
+    action.wasm = std::move(call);
+  } else if (action.source == ActionSource::SNAPSHOT) {
+    auto entities = std::make_shared<std::vector<std::string>>();
+    if (!sections.entity_list(first_entity, entity_count, *entities))
+      return false;
+    action.entities = std::move(entities);
+  } else if (action.source == ActionSource::CONDITION) {
+    auto condition = std::make_shared<ValueCondition>();
+    condition->compare = static_cast<ValueCompare>(detail);
+    condition->limit = bits_float(value);
+    action.condition = std::move(condition);
+  }
+  return true;
+}
+
+bool decode_rule_image(const std::vector<uint8_t> &data, std::vector<AutomationRule> &rules, uint32_t *source_hash) {
+  if (data.size() < IMAGE_HEADER_SIZE || std::memcmp(data.data(), IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+      data[4] != IMAGE_VERSION)
+    return false;
+
+  const size_t rule_count = get_u16(&data[6]);
+  const size_t action_count = get_u16(&data[8]);
+  const size_t term_count = get_u16(&data[10]);
+  const size_t entity_count = get_u16(&data[12]);
+  const size_t string_bytes = get_u16(&data[14]);
+  const size_t actions_offset = IMAGE_HEADER_SIZE + rule_count * IMAGE_RULE_SIZE;
+  const size_t terms_offset = actions_offset + action_count * IMAGE_ACTION_SIZE;
+  const size_t entities_offset = terms_offset + term_count * IMAGE_TERM_SIZE;
+  const size_t strings_offset = entities_offset + entity_count * IMAGE_ENTITY_SIZE;
+  if (data.size() != strings_offset + string_bytes ||
+      get_u32(&data[20]) != fnv1(data.data() + IMAGE_HEADER_SIZE, data.size() - IMAGE_HEADER_SIZE))
+    return false;
+  if (source_hash != nullptr)
+    *source_hash = get_u32(&data[16]);
+
+  const ImageSections sections{data.data() + strings_offset, string_bytes, data.data() + entities_offset,
+                               entity_count};
+  const uint8_t *action_record = data.data() + actions_offset;
+  const uint8_t *term_record = data.data() + terms_offset;
+  size_t actions_left = action_count;
+  size_t terms_left = term_count;
+
+  rules.clear();
+  rules.reserve(rule_count);
+  for (size_t i = 0; i < rule_count; i++) {
+    const uint8_t *record = data.data() + IMAGE_HEADER_SIZE + i * IMAGE_RULE_SIZE;
+    AutomationRule rule;
+    if (!sections.string(get_u16(record), rule.id) || !sections.string(get_u16(record + 2), rule.name) ||
+        !sections.string(get_u16(record + 4), rule.trigger.input_id))
+      return false;
+    rule.enabled = (record[6] & 1) != 0;
+    rule.fire_on_initial_state = (record[6] & 2) != 0;
+    rule.trigger.match_any = (record[6] & 4) != 0;
+    rule.trigger.source = static_cast<TriggerSource>(record[7] >> 4);
+    rule.trigger.type = static_cast<TriggerType>(record[7] & 0x0F);
+    rule.max_latency_ms = get_u16(record + 16);
+    rule.trigger.threshold = bits_float(get_u32(record + 20));
+
+    const size_t rule_actions = get_u16(record + 12);
+    const size_t rule_exit_actions = get_u16(record + 14);
+    const size_t rule_terms = get_u16(record + 18);
+    if (rule_actions + rule_exit_actions > actions_left || rule_terms > terms_left)
+      return false;
+    actions_left -= rule_actions + rule_exit_actions;
+    terms_left -= rule_terms;
+    rule.actions.resize(rule_actions);
+    rule.exit_actions.resize(rule_exit_actions);
+    for (auto *actions : {&rule.actions, &rule.exit_actions}) {
+      for (auto &action : *actions) {
+        if (!get_action(action_record, sections, action))
+          return false;
+        action_record += IMAGE_ACTION_SIZE;
+      }
+    }
+    rule.trigger.condition.resize(rule_terms);
+    for (auto &term : rule.trigger.condition) {
+      if (!sections.string(get_u16(term_record), term.input_id))
+        return false;
+      term.negate = term_record[2] != 0;
+      term_record += IMAGE_TERM_SIZE;
+    }
+    rules.push_back(std::move(rule));
+  }
+  return actions_left == 0 && terms_left == 0;
+}
+
+}  // namespace json_automation
+}  // namespace esphome
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "rule_types.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace json_automation {
+
+/// FNV-1 hash of an object id, equal to EntityBase::get_object_id_hash() of the entity it names.
+uint32_t rule_key(const std::string &object_id);
+
+/// Encode parsed rules into the compact little-endian rule image: header, fixed-size rule, action, condition
+/// term and entity records, then a deduplicated string table. Entity references carry both the object id and its
+/// key.
+/// out is cleared first, so callers compiling many rule sets can reuse the buffer.
+bool compile_rule_image(const std::vector<AutomationRule> &rules, uint32_t source_hash, std::vector<uint8_t> &out,
+                        std::string &error);
+
+/// Decode an image produced by compile_rule_image() back into rules.
+bool decode_rule_image(const std::vector<uint8_t> &data, std::vector<AutomationRule> &rules,
+                       uint32_t *source_hash = nullptr);
+
+}  // namespace json_automation
+}  // namespace esphome
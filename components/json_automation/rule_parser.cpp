@@ -0,0 +1,371 @@
+#include "rule_parser.h"
+#include <algorithm>
+#include <cctype>
+
+namespace esphome {
+namespace json_automation {
+
+static std::string to_lower(const std::string &value) {
+  std::string lower = value;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  return lower;
+}
+
+TriggerSource parse_trigger_source(const std::string &source) {
+  std::string lower = to_lower(source);
+
+  if (lower == "input")
+    return TriggerSource::INPUT;
+  if (lower == "while")
+    return TriggerSource::WHILE;
+  if (lower == "sensor")
+    return TriggerSource::SENSOR;
+  return TriggerSource::UNKNOWN;
+}
+
+TriggerType parse_trigger_type(const std::string &type) {
+  std::string lower = to_lower(type);
+
+  if (lower == "press")
+    return TriggerType::PRESS;
+  if (lower == "release")
+    return TriggerType::RELEASE;
+  if (lower == "above")
+    return TriggerType::ABOVE;
+  if (lower == "below")
+    return TriggerType::BELOW;
+  return TriggerType::UNKNOWN;
+}
+
+ActionSource parse_action_source(const std::string &source) {
+  std::string lower = to_lower(source);
+
+  if (lower == "switch")
+    return ActionSource::SWITCH;
+  if (lower == "delay")
+    return ActionSource::DELAY;
+  if (lower == "light")
+    return ActionSource::LIGHT;
+  if (lower == "wasm")
+    return ActionSource::WASM;
+  if (lower == "snapshot")
+    return ActionSource::SNAPSHOT;
+  if (lower == "restore")
+    return ActionSource::RESTORE;
+  if (lower == "condition")
+    return ActionSource::CONDITION;
+  return ActionSource::UNKNOWN;
+}
+
+ActionType parse_action_type(const std::string &type) {
+  std::string lower = to_lower(type);
+
+  if (lower == "turn_on")
+    return ActionType::TURN_ON;
+  if (lower == "turn_off")
+    return ActionType::TURN_OFF;
+  if (lower == "toggle")
+    return ActionType::TOGGLE;
+  return ActionType::UNKNOWN;
+}
+
+static bool parse_action(JsonObject action_obj, Action &action) {
+  if (action_obj.containsKey("source")) {
+    action.source = parse_action_source(action_obj["source"].as<std::string>());
+  }
+  if (action_obj.containsKey("type")) {
+    action.type = parse_action_type(action_obj["type"].as<std::string>());
+  }
+  if (action_obj.containsKey("switch_id")) {
+    action.switch_id = action_obj["switch_id"].as<std::string>();
+  }
+  if (action_obj.containsKey("delay_s")) {
+    action.delay_s = action_obj["delay_s"].as<uint32_t>();
+  }
+
+  if (action.source == ActionSource::DELAY)
+    return action.delay_s > 0;
+  if (action.source == ActionSource::WASM) {
+    auto call = std::make_shared<WasmCall>();
+    if (action_obj.containsKey("module")) {
+      call->module = action_obj["module"].as<std::string>();
+    }
+    if (action_obj.containsKey("function")) {
+      call->function = action_obj["function"].as<std::string>();
+    }
+    if (action_obj["arg"].is<const char *>()) {
+      call->trigger_arg = action_obj["arg"].as<std::string>() == "trigger";
+      if (!call->trigger_arg)
+        return false;
+    } else if (action_obj.containsKey("arg")) {
+      call->arg = action_obj["arg"].as<int32_t>();
+    }
+    JsonArray entities = action_obj["entities"];
+    for (JsonVariant entity : entities)
+      call->entities.push_back(entity.as<std::string>());
+    action.wasm = std::move(call);
+    return !action.wasm->module.empty() && !action.wasm->function.empty();
+  }
+  if (action.source == ActionSource::CONDITION) {
+    // Exactly one of "above", "below" or "equals" with a number
+    static const char *const KEYS[] = {"above", "below", "equals"};
+    auto condition = std::make_shared<ValueCondition>();
+    size_t found = 0;
+    for (size_t i = 0; i < 3; i++) {
+      JsonVariant limit = action_obj[KEYS[i]];
+      if (limit.isNull())
+        continue;
+      if (!limit.is<float>())
+        return false;
+      condition->compare = static_cast<ValueCompare>(i);
+      condition->limit = limit.as<float>();
+      found++;
+    }
+    action.condition = std::move(condition);
+    return found == 1;
+  }
+  if (action.source == ActionSource::SNAPSHOT || action.source == ActionSource::RESTORE) {
+    if (action_obj.containsKey("name")) {
+      action.switch_id = action_obj["name"].as<std::string>();
+    }
+    if (action.source == ActionSource::RESTORE)
+      return !action.switch_id.empty();
+    auto entities = std::make_shared<std::vector<std::string>>();
+    JsonArray entity_array = action_obj["entities"];
+    for (JsonVariant entity : entity_array)
+      entities->push_back(entity.as<std::string>());
+    action.entities = std::move(entities);
+    return !action.switch_id.empty() && !action.entities->empty();
+  }
+  return (action.source == ActionSource::SWITCH || action.source == ActionSource::LIGHT) &&
+         action.type != ActionType::UNKNOWN && !action.switch_id.empty();
+}
+
+/// Condition of a WHILE trigger: "all" or "any", a list of input ids, each optionally prefixed with "!".
+static bool parse_condition(JsonObject trigger_obj, Trigger &trigger) {
+  if (trigger_obj.containsKey("all") == trigger_obj.containsKey("any"))
+    return false;
+  trigger.match_any = trigger_obj.containsKey("any");
+  JsonArray terms = trigger_obj[trigger.match_any ? "any" : "all"];
+  for (JsonVariant term_var : terms) {
+    ConditionTerm term;
+    term.input_id = term_var.as<std::string>();
+    if (!term.input_id.empty() && term.input_id[0] == '!') {
+      term.negate = true;
+      term.input_id.erase(0, 1);
+    }
+    if (term.input_id.empty())
+      return false;
+    trigger.condition.push_back(term);
+  }
+  return !trigger.condition.empty();
+}
+
+static void parse_actions(JsonArray actions, std::vector<Action> &out, const AutomationRule &rule,
+                          ParseReport &report) {
+  for (JsonVariant action_var : actions) {
+    if (!action_var.is<JsonObject>())
+      continue;
+
+    Action action;
+    if (parse_action(action_var.as<JsonObject>(), action)) {
+      out.push_back(action);
+    } else if (action.source == ActionSource::CONDITION) {
+      // The actions after a condition must not run without it
+      report.warnings.push_back("Skipping invalid condition and the actions after it in automation " + rule.id);
+      return;
+    } else {
+      report.warnings.push_back("Skipping invalid action in automation " + rule.id);
+    }
+  }
+}
+
+static bool parse_rule(JsonObject automation_obj, AutomationRule &rule, ParseReport &report) {
+  // Overlay patch of a base rule; see AutomationRule::is_patch()
+  if (automation_obj.containsKey("id") && automation_obj.containsKey("enabled") &&
+      !automation_obj.containsKey("trigger") && !automation_obj.containsKey("actions")) {
+    rule.id = automation_obj["id"].as<std::string>();
+    rule.name = rule.id;
+    rule.enabled = automation_obj["enabled"].as<bool>();
+    return true;
+  }
+  if (!automation_obj.containsKey("id") || !automation_obj.containsKey("trigger") ||
+      !automation_obj.containsKey("actions")) {
+    report.warnings.push_back("Skipping invalid automation: missing required fields");
+    return false;
+  }
+
+  rule.id = automation_obj["id"].as<std::string>();
+  rule.name = automation_obj.containsKey("name") ? automation_obj["name"].as<std::string>() : rule.id;
+  rule.enabled = automation_obj.containsKey("enabled") ? automation_obj["enabled"].as<bool>() : true;
+  if (automation_obj.containsKey("fire_on_initial_state"))
+    rule.fire_on_initial_state = automation_obj["fire_on_initial_state"].as<bool>();
+  if (automation_obj.containsKey("max_latency_ms")) {
+    const uint32_t max_latency_ms = automation_obj["max_latency_ms"].as<uint32_t>();
+    if (max_latency_ms > UINT16_MAX)
+      report.warnings.push_back("max_latency_ms of automation " + rule.id + " is limited to 65535");
+    rule.max_latency_ms = std::min<uint32_t>(max_latency_ms, UINT16_MAX);
+  }
+
+  JsonObject trigger_obj = automation_obj["trigger"];
+  if (trigger_obj.containsKey("source")) {
+    rule.trigger.source = parse_trigger_source(trigger_obj["source"].as<std::string>());
+  }
+  if (trigger_obj.containsKey("type")) {
+    rule.trigger.type = parse_trigger_type(trigger_obj["type"].as<std::string>());
+  }
+  if (trigger_obj.containsKey("input_id")) {
+    rule.trigger.input_id = trigger_obj["input_id"].as<std::string>();
+  }
+
+  if (rule.trigger.source == TriggerSource::WHILE) {
+    if (!parse_condition(trigger_obj, rule.trigger)) {
+      report.warnings.push_back("Skipping automation " + rule.id + ": invalid or missing condition");
+      return false;
+    }
+  } else if (rule.trigger.source == TriggerSource::SENSOR) {
+    if (trigger_obj.containsKey("sensor_id"))
+      rule.trigger.input_id = trigger_obj["sensor_id"].as<std::string>();
+    if ((rule.trigger.type != TriggerType::ABOVE && rule.trigger.type != TriggerType::BELOW) ||
+        rule.trigger.input_id.empty() || !trigger_obj["threshold"].is<float>()) {
+      report.warnings.push_back("Skipping automation " + rule.id + ": invalid or missing sensor trigger fields");
+      return false;
+    }
+    rule.trigger.threshold = trigger_obj["threshold"].as<float>();
+  } else if (rule.trigger.source == TriggerSource::UNKNOWN || rule.trigger.type == TriggerType::UNKNOWN ||
+             rule.trigger.input_id.empty()) {
+    report.warnings.push_back("Skipping automation " + rule.id + ": invalid or missing trigger fields");
+    return false;
+  }
+
+  parse_actions(automation_obj["actions"], rule.actions, rule, report);
+  if (rule.trigger.source == TriggerSource::WHILE && automation_obj.containsKey("exit_actions"))
+    parse_actions(automation_obj["exit_actions"], rule.exit_actions, rule, report);
+
+  // Only keep the automation if it has at least one valid action
+  if (rule.actions.empty() && rule.exit_actions.empty()) {
+    report.warnings.push_back("Skipping automation " + rule.id + ": no valid actions");
+    return false;
+  }
+  return true;
+}
+
+bool parse_rules(JsonDocument &doc, const std::string &json_data, std::vector<AutomationRule> &rules,
+                 ParseReport &report) {
+  DeserializationError err = deserializeJson(doc, json_data);
+  if (err) {
+    report.error = std::string("JSON parsing failed: ") + err.c_str();
+    return false;
+  }
+
+  JsonArray automations_array = doc.as<JsonArray>();
+  if (automations_array.isNull()) {
+    report.error = "JSON must be an array of automations";
+    return false;
+  }
+
+  for (JsonVariant automation_var : automations_array) {
+    AutomationRule rule;
+    if (parse_rule(automation_var.as<JsonObject>(), rule, report))
+      rules.push_back(std::move(rule));
+  }
+  return true;
+}
+
+bool parse_rule_element(JsonDocument &doc, const std::string &json_data, size_t start, size_t end,
+                        AutomationRule &rule, ParseReport &report) {
+  DeserializationError err = deserializeJson(doc, json_data.data() + start, end - start);
+  if (err) {
+    report.error = std::string("JSON parsing failed: ") + err.c_str();
+    return false;
+  }
+  return parse_rule(doc.as<JsonObject>(), rule, report);
+}
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+RuleScanner::Status RuleScanner::scan(const std::string &json_data, size_t max_bytes, size_t &start, size_t &end,
+                                      ParseReport &report) {
+  const size_t limit = std::min(json_data.size(), this->position_ + max_bytes);
+  while (this->position_ < limit) {
+    const char c = json_data[this->position_];
+
+    if (!this->in_element_) {
+      if (is_space(c)) {
+        this->position_++;
+        continue;
+      }
+      if (this->expect_ == Expect::ARRAY) {
+        if (c != '[') {
+          // Same outcome as deserializing the whole document: another JSON value, or no JSON at all
+          report.error = (c == '{' || c == '"' || c == '-' || isdigit(c) || c == 't' || c == 'f' || c == 'n')
+                             ? "JSON must be an array of automations"
+                             : "JSON parsing failed: InvalidInput";
+          return Status::ERROR;
+        }
+        this->expect_ = Expect::FIRST;
+        this->position_++;
+        continue;
+      }
+      if (c == ']' && this->expect_ != Expect::ELEMENT)
+        return Status::DONE;
+      if (this->expect_ == Expect::SEPARATOR) {
+        if (c != ',') {
+          report.error = "JSON parsing failed: InvalidInput";
+          return Status::ERROR;
+        }
+        this->expect_ = Expect::ELEMENT;
+        this->position_++;
+        continue;
+      }
+      if (c == ',' || c == ']') {
+        report.error = "JSON parsing failed: InvalidInput";
+        return Status::ERROR;
+      }
+      this->in_element_ = true;
+      this->value_done_ = false;
+      this->element_start_ = this->position_;
+    }
+
+    if (this->in_string_) {
+      if (this->escape_) {
+        this->escape_ = false;
+      } else if (c == '\\') {
+        this->escape_ = true;
+      } else if (c == '"') {
+        this->in_string_ = false;
+        this->value_done_ = this->depth_ == 0;
+      }
+    } else if (this->depth_ == 0 && (c == ',' || c == ']')) {
+      // The separator is consumed with the next call
+      this->in_element_ = false;
+      this->expect_ = Expect::SEPARATOR;
+      start = this->element_start_;
+      end = this->position_;
+      return Status::ELEMENT;
+    } else if (this->depth_ == 0 && is_space(c)) {
+      this->value_done_ = true;
+    } else if (this->value_done_ || (this->depth_ == 0 && c == '}')) {
+      report.error = "JSON parsing failed: InvalidInput";
+      return Status::ERROR;
+    } else if (c == '"') {
+      this->in_string_ = true;
+    } else if (c == '{' || c == '[') {
+      this->depth_++;
+    } else if (c == '}' || c == ']') {
+      this->depth_--;
+      this->value_done_ = this->depth_ == 0;
+    }
+    this->position_++;
+  }
+
+  if (this->position_ >= json_data.size()) {
+    report.error = this->expect_ == Expect::ARRAY ? "JSON parsing failed: EmptyInput"
+                                                  : "JSON parsing failed: IncompleteInput";
+    return Status::ERROR;
+  }
+  return Status::MORE;
+}
+
+}  // namespace json_automation
+}  // namespace esphome
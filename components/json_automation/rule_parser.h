@@ -0,0 +1,68 @@
+#pragma once
+
+#include "rule_types.h"
+#include <ArduinoJson.h>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace json_automation {
+
+/// Outcome of parsing one rule set: the error that rejected it, if any, and why individual rules or
+/// actions were skipped.
+struct ParseReport {
+  std::string error;
+  std::vector<std::string> warnings;
+
+  bool ok() const { return this->error.empty(); }
+  void clear() {
+    this->error.clear();
+    this->warnings.clear();
+  }
+};
+
+TriggerSource parse_trigger_source(const std::string &source);
+TriggerType parse_trigger_type(const std::string &type);
+ActionSource parse_action_source(const std::string &source);
+ActionType parse_action_type(const std::string &type);
+
+/// Parse a JSON array of automations, appending the valid ones to rules.
+/// doc is scratch storage; callers parsing many rule sets can reuse it (and its allocator).
+bool parse_rules(JsonDocument &doc, const std::string &json_data, std::vector<AutomationRule> &rules,
+                 ParseReport &report);
+
+/// Parse one element of the automations array, json_data[start, end). Returns true if it is a valid rule;
+/// false with report.error set if the element is not valid JSON, or with a warning if the rule was skipped.
+bool parse_rule_element(JsonDocument &doc, const std::string &json_data, size_t start, size_t end,
+                        AutomationRule &rule, ParseReport &report);
+
+/// Resumable scanner that splits the top-level automations array into its elements, a bounded number of
+/// bytes per call, so a large rule set can be parsed over many loop() iterations. It only tracks nesting
+/// and strings; each element is validated when it is parsed.
+class RuleScanner {
+ public:
+  enum class Status : uint8_t { MORE, ELEMENT, DONE, ERROR };
+
+  void reset() { *this = RuleScanner(); }
+  /// Scan up to max_bytes. ELEMENT sets [start, end) to the element just completed; MORE means the budget
+  /// ran out; ERROR sets report.error.
+  Status scan(const std::string &json_data, size_t max_bytes, size_t &start, size_t &end, ParseReport &report);
+  size_t position() const { return this->position_; }
+
+ protected:
+  /// What may come next outside an element.
+  enum class Expect : uint8_t { ARRAY, FIRST, SEPARATOR, ELEMENT };
+
+  size_t position_{0};
+  size_t element_start_{0};
+  uint16_t depth_{0};
+  Expect expect_{Expect::ARRAY};
+  bool in_element_{false};
+  bool in_string_{false};
+  bool escape_{false};
+  /// The element's top-level value is complete; only whitespace may follow it.
+  bool value_done_{false};
+};
+
+}  // namespace json_automation
+}  // namespace esphome
@@ -0,0 +1,135 @@
+#include "rule_tree.h"
+#include <algorithm>
+
+namespace esphome {
+namespace json_automation {
+
+void RuleTree::clear() {
+  this->nodes_.clear();
+  this->chars_.clear();
+  // Node 0 is the root, with an empty label
+  this->add_node(0, 0, NO_NODE, NO_RULE);
+}
+
+uint16_t RuleTree::add_node(uint16_t label, uint16_t length, uint16_t sibling, uint16_t rule) {
+  this->nodes_.push_back(Node{label, length, NO_NODE, sibling, rule});
+  return this->nodes_.size() - 1;
+}
+
+uint16_t RuleTree::find_child(uint16_t node, char c, uint16_t &prev) const {
+  prev = NO_NODE;
+  for (uint16_t child = this->nodes_[node].child; child != NO_NODE; child = this->nodes_[child].sibling) {
+    const uint8_t first = this->chars_[this->nodes_[child].label];
+    if (first == static_cast<uint8_t>(c))
+      return child;
+    if (first > static_cast<uint8_t>(c))
+      break;
+    prev = child;
+  }
+  return NO_NODE;
+}
+
+bool RuleTree::insert(const std::string &id, uint16_t rule) {
+  uint16_t node = 0;
+  size_t pos = 0;
+  while (pos < id.size()) {
+    uint16_t prev;
+    uint16_t child = this->find_child(node, id[pos], prev);
+    if (child == NO_NODE) {
+      const size_t length = id.size() - pos;
+      if (this->chars_.size() + length > UINT16_MAX || this->nodes_.size() >= NO_NODE)
+        return false;
+      const uint16_t label = this->chars_.size();
+      this->chars_.append(id, pos, length);
+      const uint16_t next = prev == NO_NODE ? this->nodes_[node].child : this->nodes_[prev].sibling;
+      const uint16_t leaf = this->add_node(label, length, next, rule);
+      (prev == NO_NODE ? this->nodes_[node].child : this->nodes_[prev].sibling) = leaf;
+      return true;
+    }
+
+    const Node edge = this->nodes_[child];
+    size_t common = 1;
+    while (common < edge.length && pos + common < id.size() && this->chars_[edge.label + common] == id[pos + common])
+      common++;
+    if (common < edge.length) {
+      if (this->nodes_.size() >= NO_NODE)
+        return false;
+      // Split the edge: a new node takes the common part and the child keeps the rest of its label
+      const uint16_t middle = this->add_node(edge.label, common, edge.sibling, NO_RULE);
+      this->nodes_[middle].child = child;
+      this->nodes_[child].label += common;
+      this->nodes_[child].length -= common;
+      this->nodes_[child].sibling = NO_NODE;
+      (prev == NO_NODE ? this->nodes_[node].child : this->nodes_[prev].sibling) = middle;
+      child = middle;
+    }
+    node = child;
+    pos += common;
+  }
+  if (this->nodes_[node].rule != NO_RULE)
+    return false;
+  this->nodes_[node].rule = rule;
+  return true;
+}
+
+int32_t RuleTree::find(const std::string &id) const {
+  uint16_t node = 0;
+  size_t pos = 0;
+  while (pos < id.size()) {
+    uint16_t prev;
+    node = this->find_child(node, id[pos], prev);
+    if (node == NO_NODE)
+      return -1;
+    const Node &edge = this->nodes_[node];
+    if (id.compare(pos, edge.length, this->chars_, edge.label, edge.length) != 0)
+      return -1;
+    pos += edge.length;
+  }
+  return this->nodes_[node].rule == NO_RULE ? -1 : this->nodes_[node].rule;
+}
+
+uint16_t RuleTree::find_prefix(const std::string &key) const {
+  uint16_t node = 0;
+  size_t pos = 0;
+  while (pos < key.size()) {
+    uint16_t prev;
+    node = this->find_child(node, key[pos], prev);
+    if (node == NO_NODE)
+      return NO_NODE;
+    const Node &edge = this->nodes_[node];
+    // The key may end inside the last edge
+    const size_t length = std::min<size_t>(edge.length, key.size() - pos);
+    if (key.compare(pos, length, this->chars_, edge.label, length) != 0)
+      return NO_NODE;
+    pos += length;
+  }
+  return node;
+}
+
+void RuleTree::collect(const std::string &prefix, std::vector<uint16_t> &out) const {
+  if (prefix.empty()) {
+    this->collect_subtree(0, out);
+    return;
+  }
+  if (prefix.back() == '/') {
+    this->collect(prefix.substr(0, prefix.size() - 1), out);
+    return;
+  }
+  const int32_t exact = this->find(prefix);
+  if (exact >= 0)
+    out.push_back(exact);
+  const uint16_t node = this->find_prefix(prefix + "/");
+  if (node != NO_NODE)
+    this->collect_subtree(node, out);
+}
+
+void RuleTree::collect_subtree(uint16_t node, std::vector<uint16_t> &out) const {
+  if (this->nodes_[node].rule != NO_RULE)
+    out.push_back(this->nodes_[node].rule);
+  // Recursion depth is bounded by the number of branches along one id
+  for (uint16_t child = this->nodes_[node].child; child != NO_NODE; child = this->nodes_[child].sibling)
+    this->collect_subtree(child, out);
+}
+
+}  // namespace json_automation
+}  // namespace esphome
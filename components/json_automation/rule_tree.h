@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace json_automation {
+
+/// Radix tree from hierarchical rule ids ("zone1/lights/night") to rule indices. Nodes are 10 bytes and their
+/// edge labels are ranges of one shared character buffer, so splitting an edge copies no text. Lookups cost
+/// the length of the id, and collecting a subtree costs the size of that subtree, not the number of rules.
+class RuleTree {
+ public:
+  static const uint16_t NO_RULE = 0xFFFF;
+
+  RuleTree() { this->clear(); }
+
+  void clear();
+  /// False if the id is already present or the tree is full.
+  bool insert(const std::string &id, uint16_t rule);
+  /// Rule index of id, or -1.
+  int32_t find(const std::string &id) const;
+  /// Append the rules whose id is prefix or starts with prefix + "/", in id order; every rule for an empty
+  /// prefix. "zone1" covers "zone1/lights" but not "zone10".
+  void collect(const std::string &prefix, std::vector<uint16_t> &out) const;
+
+  size_t get_node_count() const { return this->nodes_.size(); }
+
+ protected:
+  static const uint16_t NO_NODE = 0xFFFF;
+
+  struct Node {
+    uint16_t label;
+    uint16_t length;
+    /// Children are a sibling list sorted by the first character of their label.
+    uint16_t child;
+    uint16_t sibling;
+    uint16_t rule;
+  };
+
+  uint16_t add_node(uint16_t label, uint16_t length, uint16_t sibling, uint16_t rule);
+  /// Child of node whose label starts with c, or NO_NODE; prev is set to the child before it.
+  uint16_t find_child(uint16_t node, char c, uint16_t &prev) const;
+  /// Node whose path from the root starts with key and is the shortest such path, or NO_NODE.
+  uint16_t find_prefix(const std::string &key) const;
+  void collect_subtree(uint16_t node, std::vector<uint16_t> &out) const;
+
+  std::vector<Node> nodes_;
+  std::string chars_;
+};
+
+}  // namespace json_automation
+}  // namespace esphome
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Rule model shared by the ESPHome component and the host tools. Kept free of ESPHome headers.
+
+namespace esphome {
+namespace json_automation {
+
+static const size_t MAX_JSON_SIZE = 4096;
+
+// New sources and types go last so the values stored in rule images stay the same
+enum class TriggerSource { INPUT, UNKNOWN, WHILE, SENSOR };
+
+enum class TriggerType { PRESS, RELEASE, UNKNOWN, ABOVE, BELOW };
+
+// New sources go last so the values stored in rule images stay the same
+enum class ActionSource { SWITCH, DELAY, LIGHT, UNKNOWN, WASM, SNAPSHOT, RESTORE, CONDITION };
+
+enum class ActionType { TURN_ON, TURN_OFF, TOGGLE, UNKNOWN };
+
+/// One input of a level condition; negate tests for the input being off.
+struct ConditionTerm {
+  std::string input_id;
+  bool negate;
+
+  ConditionTerm() : negate(false) {}
+
+  bool operator==(const ConditionTerm &other) const {
+    return this->input_id == other.input_id && this->negate == other.negate;
+  }
+};
+
+struct Trigger {
+  TriggerSource source;
+  TriggerType type;
+  std::string input_id;
+  /// Condition of a WHILE trigger: all terms hold, or with match_any at least one. Its inputs are the
+  /// dependencies of the rule.
+  std::vector<ConditionTerm> condition;
+  bool match_any;
+  /// Limit of a SENSOR trigger; the rule runs when the value of the sensor (input_id) crosses it upwards for
+  /// ABOVE or downwards for BELOW.
+  float threshold;
+
+  Trigger()
+      : source(TriggerSource::UNKNOWN), type(TriggerType::UNKNOWN), input_id(""), match_any(false), threshold(0) {}
+
+  bool operator==(const Trigger &other) const {
+    return this->source == other.source && this->type == other.type && this->input_id == other.input_id &&
+           this->condition == other.condition && this->match_any == other.match_any &&
+           this->threshold == other.threshold;
+  }
+};
+
+/// Call of an exported function of a WebAssembly module. Entities are "switch.<id>", "light.<id>" or
+/// "input.<id>"; the module addresses them by their index in this list.
+struct WasmCall {
+  std::string module;
+  std::string function;
+  std::vector<std::string> entities;
+  int32_t arg;
+  /// Pass the trigger payload instead of arg ("arg": "trigger").
+  bool trigger_arg;
+
+  WasmCall() : arg(0), trigger_arg(false) {}
+
+  bool operator==(const WasmCall &other) const {
+    return this->module == other.module && this->function == other.function && this->entities == other.entities &&
+           this->arg == other.arg && this->trigger_arg == other.trigger_arg;
+  }
+};
+
+enum class ValueCompare : uint8_t { ABOVE, BELOW, EQUALS };
+
+/// Test of the trigger value by a CONDITION action; the rest of the actions only run while it holds.
+struct ValueCondition {
+  ValueCompare compare;
+  float limit;
+
+  ValueCondition() : compare(ValueCompare::EQUALS), limit(0) {}
+
+  bool operator==(const ValueCondition &other) const {
+    return this->compare == other.compare && this->limit == other.limit;
+  }
+};
+
+struct Action {
+  ActionSource source;
+  ActionType type;
+  /// Object id of the target; the scene name for SNAPSHOT and RESTORE.
+  std::string switch_id;
+  uint32_t delay_s;
+  /// Set for ActionSource::WASM only; shared between copies of the rule.
+  std::shared_ptr<const WasmCall> wasm;
+  /// Entities of a SNAPSHOT, "switch.<id>" or "light.<id>"; shared between copies of the rule.
+  std::shared_ptr<const std::vector<std::string>> entities;
+  /// Set for ActionSource::CONDITION only; shared between copies of the rule.
+  std::shared_ptr<const ValueCondition> condition;
+
+  Action() : source(ActionSource::UNKNOWN), type(ActionType::UNKNOWN), delay_s(0) {}
+
+  template<typename T> static bool same(const std::shared_ptr<const T> &a, const std::shared_ptr<const T> &b) {
+    return a == b || (a && b && *a == *b);
+  }
+
+  bool operator==(const Action &other) const {
+    return this->source == other.source && this->type == other.type && this->switch_id == other.switch_id &&
+           this->delay_s == other.delay_s && same(this->wasm, other.wasm) && same(this->entities, other.entities) &&
+           same(this->condition, other.condition);
+  }
+};
+
+struct AutomationRule {
+  std::string id;
+  std::string name;
+  bool enabled;
+  /// Run even for input changes during the settle period after boot, when inputs publish their initial state.
+  bool fire_on_initial_state;
+  /// Budget from the input change to the end of the immediate actions, in ms; 0 for none.
+  uint16_t max_latency_ms;
+  Trigger trigger;
+  /// For a WHILE rule, actions run when the condition starts to hold and exit_actions when it stops.
+  std::vector<Action> actions;
+  std::vector<Action> exit_actions;
+
+  AutomationRule() : enabled(true), fire_on_initial_state(false), max_latency_ms(0) {}
+
+  bool operator==(const AutomationRule &other) const {
+    return this->id == other.id && this->name == other.name && this->enabled == other.enabled &&
+           this->fire_on_initial_state == other.fire_on_initial_state &&
+           this->max_latency_ms == other.max_latency_ms && this->trigger == other.trigger &&
+           this->actions == other.actions && this->exit_actions == other.exit_actions;
+  }
+  bool operator!=(const AutomationRule &other) const { return !(*this == other); }
+
+  /// Overlay entry with only an id and "enabled", which enables or disables the base rule with that id.
+  bool is_patch() const {
+    return this->trigger.source == TriggerSource::UNKNOWN && this->actions.empty() && this->exit_actions.empty();
+  }
+};
+
+}  // namespace json_automation
+}  // namespace esphome
@@ -0,0 +1,54 @@
+#include "stack_info.h"
+#include "esphome/core/defines.h"
+
+#if defined(USE_ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#elif defined(USE_ESP8266)
+#include <Esp.h>
+#endif
+
+namespace esphome {
+namespace json_automation {
+
+#if defined(USE_ESP32)
+// ESP-IDF counts stack in bytes
+size_t get_stack_high_water() { return uxTaskGetStackHighWaterMark(nullptr); }
+
+void paint_stack() {}
+#elif defined(USE_ESP8266)
+// The loop runs on the cont stack, which the core paints at startup
+size_t get_stack_high_water() { return ESP.getFreeContStack(); }
+
+void paint_stack() {}
+#elif defined(USE_HOST) && (defined(__GNUC__) || defined(__clang__))
+static const size_t STACK_PAINT_SIZE = 32 * 1024;
+/// Left unpainted below the caller, for the frames of paint_stack() and get_stack_high_water() themselves.
+static const size_t STACK_PAINT_MARGIN = 512;
+static const uint8_t STACK_PAINT = 0xA5;
+static volatile uint8_t *painted = nullptr;
+
+__attribute__((noinline, no_sanitize_address)) size_t get_stack_high_water() {
+  if (painted == nullptr)
+    return 0;
+  size_t free = 0;
+  while (free < STACK_PAINT_SIZE && painted[free] == STACK_PAINT)
+    free++;
+  return free;
+}
+
+__attribute__((noinline, no_sanitize_address)) void paint_stack() {
+  // The stack grows down; the region ends some way below this frame
+  volatile uint8_t *top = static_cast<volatile uint8_t *>(__builtin_frame_address(0)) - STACK_PAINT_MARGIN;
+  painted = top - STACK_PAINT_SIZE;
+  for (size_t i = 0; i < STACK_PAINT_SIZE; i++)
+    painted[i] = STACK_PAINT;
+}
+#else
+size_t get_stack_high_water() { return 0; }
+
+void paint_stack() {}
+#endif
+
+}  // namespace json_automation
+}  // namespace esphome
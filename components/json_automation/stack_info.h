@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace json_automation {
+
+/// Lowest free stack of the calling task so far, in bytes; 0 if the platform cannot report it.
+size_t get_stack_high_water();
+/// On the host, paint the unused stack below the caller so get_stack_high_water() can tell how deep later
+/// calls went. Device task stacks are painted by the RTOS, so this does nothing there.
+void paint_stack();
+
+enum class StackProbe : uint8_t { LOAD, SAVE, RULES };
+static const size_t STACK_PROBE_COUNT = 3;
+
+/// High-water marks around the runs of one operation. The mark only moves down, so before and after are
+/// kept from the run that last lowered it: that run needed before - after more bytes than anything earlier.
+struct StackMark {
+  uint32_t runs{0};
+  uint32_t before{0};
+  uint32_t after{0};
+};
+
+/// Stack high-water marks taken around the operations of the loop task that use the most stack.
+class StackMonitor {
+ public:
+  void setup() { paint_stack(); }
+  size_t enter() const { return get_stack_high_water(); }
+  void leave(StackProbe probe, size_t before) {
+    StackMark &mark = this->marks_[static_cast<size_t>(probe)];
+    const size_t after = get_stack_high_water();
+    if (mark.runs++ == 0 || after < before) {
+      mark.before = before;
+      mark.after = after;
+    }
+  }
+  const StackMark &get_mark(StackProbe probe) const { return this->marks_[static_cast<size_t>(probe)]; }
+
+ protected:
+  StackMark marks_[STACK_PROBE_COUNT];
+};
+
+}  // namespace json_automation
+}  // namespace esphome
@@ -0,0 +1,199 @@
+#include "threshold_table.h"
+#include <algorithm>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define JSON_AUTOMATION_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define JSON_AUTOMATION_NEON
+#endif
+
+namespace esphome {
+namespace json_automation {
+
+/// Bit k of the result is set if values[k] * signs[k] > limits[k].
+static inline uint32_t compare4_scalar(const float *values, const float *signs, const float *limits) {
+  uint32_t mask = 0;
+  for (uint32_t k = 0; k < 4; k++) {
+    if (values[k] * signs[k] > limits[k])
+      mask |= 1u << k;
+  }
+  return mask;
+}
+
+static inline uint32_t compare4_vector(const float *values, const float *signs, const float *limits) {
+#if defined(JSON_AUTOMATION_SSE2)
+  const __m128 scaled = _mm_mul_ps(_mm_loadu_ps(values), _mm_loadu_ps(signs));
+  return _mm_movemask_ps(_mm_cmpgt_ps(scaled, _mm_loadu_ps(limits)));
+#elif defined(JSON_AUTOMATION_NEON)
+  static const uint32_t LANE_BITS[4] = {1, 2, 4, 8};
+  const uint32x4_t greater = vcgtq_f32(vmulq_f32(vld1q_f32(values), vld1q_f32(signs)), vld1q_f32(limits));
+  return vaddvq_u32(vandq_u32(greater, vld1q_u32(LANE_BITS)));
+#else
+  return compare4_scalar(values, signs, limits);
+#endif
+}
+
+const char *ThresholdTable::get_vector_isa() {
+#if defined(JSON_AUTOMATION_SSE2)
+  return "SSE2";
+#elif defined(JSON_AUTOMATION_NEON)
+  return "NEON";
+#else
+  return "none";
+#endif
+}
+
+template<bool Vector>
+inline
+size_t ThresholdTable::evaluate_block(uint32_t slot, const float *values, std::vector<uint32_t> &fired) {
+  const uint32_t mask = Vector ? compare4_vector(values, &this->signs_[slot], &this->limits_[slot])
+                               : compare4_scalar(values, &this->signs_[slot], &this->limits_[slot]);
+  // Blocks start at a multiple of four, so the four bits never straddle two words
+  uint32_t &word = this->states_[slot / 32];
+  const uint32_t shift = slot % 32;
+  uint32_t rising = mask & ~(word >> shift) & 0xF;
+  word = (word & ~(0xFu << shift)) | (mask << shift);
+  size_t count = 0;
+  for (; rising != 0; rising &= rising - 1) {
+    const uint16_t rule = this->rules_[slot + __builtin_ctz(rising)];
+    fired[rule / 32] |= 1u << (rule % 32);
+    count++;
+  }
+  return count;
+}
+
+inline void ThresholdTable::share(uint32_t begin, uint32_t end, float value) {
+  if (begin == end)
+    return;
+  std::fill(this->slot_values_.begin() + begin, this->slot_values_.begin() + end, value);
+  // The slots lie in one block
+  const uint32_t block = begin / 4;
+  this->dirty_[block / 32] |= 1u << (block % 32);
+}
+
+template<bool Vector> size_t ThresholdTable::evaluate_pending(std::vector<uint32_t> &fired) {
+  size_t count = 0;
+  for (int32_t sensor : this->pending_) {
+    this->queued_[sensor] = 0;
+    const float value = this->values_[sensor];
+    this->evaluated_[sensor] = value;
+    // Blocks of this sensor alone are compared right away; the partial blocks at either end may hold slots of
+    // other sensors and are compared once all sensors have stored their value
+    const Group group = this->groups_[sensor];
+    const uint32_t own_begin = std::min((group.begin + 3) & ~3u, group.end);
+    const uint32_t own_end = std::max(group.end & ~3u, own_begin);
+    this->share(group.begin, own_begin, value);
+    this->share(own_end, group.end, value);
+    const float splat[4] = {value, value, value, value};
+    for (uint32_t slot = own_begin; slot < own_end; slot += 4)
+      count += this->evaluate_block<Vector>(slot, splat, fired);
+  }
+  this->pending_.clear();
+  // Slots of sensors that did not change compare their unchanged value again, which cannot fire them
+  for (size_t w = 0; w < this->dirty_.size(); w++) {
+    for (uint32_t bits = this->dirty_[w]; bits != 0; bits &= bits - 1) {
+      const uint32_t slot = (w * 32 + __builtin_ctz(bits)) * 4;
+      count += this->evaluate_block<Vector>(slot, &this->slot_values_[slot], fired);
+    }
+    this->dirty_[w] = 0;
+  }
+  return count;
+}
+
+void ThresholdTable::clear() {
+  this->entries_.clear();
+  this->count_ = 0;
+  this->limits_.clear();
+  this->signs_.clear();
+  this->slot_values_.clear();
+  this->rules_.clear();
+  this->states_.clear();
+  this->dirty_.clear();
+  this->rule_words_ = 0;
+  std::fill(this->groups_.begin(), this->groups_.end(), Group{0, 0});
+}
+
+void ThresholdTable::add(int32_t sensor, float limit, bool above, uint16_t rule) {
+  this->entries_.push_back(Entry{sensor, limit, above, rule});
+}
+
+void ThresholdTable::build() {
+  // Rules of one sensor stay in rule order
+  std::stable_sort(this->entries_.begin(), this->entries_.end(),
+                   [](const Entry &a, const Entry &b) { return a.sensor < b.sensor; });
+  this->count_ = this->entries_.size();
+  this->limits_.clear();
+  this->signs_.clear();
+  this->slot_values_.clear();
+  this->rules_.clear();
+  uint16_t last_rule = 0;
+  for (size_t i = 0; i < this->entries_.size();) {
+    const int32_t sensor = this->entries_[i].sensor;
+    this->add_sensor(sensor);
+    Group &group = this->groups_[sensor];
+    group.begin = this->limits_.size();
+    for (; i < this->entries_.size() && this->entries_[i].sensor == sensor; i++) {
+      const Entry &entry = this->entries_[i];
+      const float sign = entry.above ? 1.0f : -1.0f;
+      this->limits_.push_back(entry.limit * sign);
+      this->signs_.push_back(sign);
+      this->slot_values_.push_back(this->evaluated_[sensor]);
+      this->rules_.push_back(entry.rule);
+      last_rule = std::max(last_rule, entry.rule);
+    }
+    group.end = this->limits_.size();
+  }
+  // value * 1 > +inf holds for no value, NaN included
+  while (this->limits_.size() % 4 != 0) {
+    this->limits_.push_back(std::numeric_limits<float>::infinity());
+    this->signs_.push_back(1.0f);
+    this->slot_values_.push_back(0.0f);
+    this->rules_.push_back(0);
+  }
+  std::vector<Entry>().swap(this->entries_);
+  this->rule_words_ = this->count_ == 0 ? 0 : last_rule / 32 + 1;
+  this->states_.assign((this->limits_.size() + 31) / 32, 0);
+  this->dirty_.assign((this->limits_.size() / 4 + 31) / 32, 0);
+
+  std::vector<uint32_t> fired(this->rule_words_);
+  for (uint32_t slot = 0; slot < this->limits_.size(); slot += 4)
+    this->evaluate_block<false>(slot, &this->slot_values_[slot], fired);
+}
+
+void ThresholdTable::add_sensor(int32_t sensor) {
+  if (static_cast<size_t>(sensor) < this->groups_.size())
+    return;
+  this->groups_.resize(sensor + 1, Group{0, 0});
+  this->values_.resize(sensor + 1, std::numeric_limits<float>::quiet_NaN());
+  this->evaluated_.resize(sensor + 1, std::numeric_limits<float>::quiet_NaN());
+  this->queued_.resize(sensor + 1, 0);
+}
+
+void ThresholdTable::post(int32_t sensor, float value) {
+  if (sensor < 0)
+    return;
+  this->add_sensor(sensor);
+  this->values_[sensor] = value;
+  // A sensor is compared once per evaluation, however often it changed
+  if (!this->queued_[sensor]) {
+    this->queued_[sensor] = 1;
+    this->pending_.push_back(sensor);
+  }
+}
+
+size_t ThresholdTable::evaluate(std::vector<uint32_t> &fired) {
+  fired.assign(this->rule_words_, 0);
+  return this->kernel_ == Kernel::VECTOR ? this->evaluate_pending<true>(fired) : this->evaluate_pending<false>(fired);
+}
+
+float ThresholdTable::get_value(int32_t sensor) const {
+  if (sensor < 0 || static_cast<size_t>(sensor) >= this->evaluated_.size())
+    return std::numeric_limits<float>::quiet_NaN();
+  return this->evaluated_[sensor];
+}
+
+}  // namespace json_automation
+}  // namespace esphome
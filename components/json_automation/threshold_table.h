@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace json_automation {
+
+/// Numeric thresholds of sensor rules, stored as parallel arrays sorted by sensor and compared four at a time.
+/// The slots are not padded per sensor, so a block of four may hold the thresholds of several sensors and sensors
+/// with one or two thresholds do not leave most of a block empty. Values posted between two evaluations are
+/// batched: evaluate() compares the blocks of each sensor that changed once, with its latest value; a shared
+/// block takes the value of each of its sensors from a per-slot copy. A threshold fires when its comparison turns
+/// true and is armed again when it turns false; NaN turns every comparison false.
+class ThresholdTable {
+ public:
+  enum class Kernel : uint8_t { SCALAR, VECTOR };
+
+  /// Instruction set of the vector kernel: "SSE2", "NEON", or "none" where it is the scalar one.
+  static const char *get_vector_isa();
+
+  /// Drop all thresholds; the sensor values are kept.
+  void clear();
+  void add(int32_t sensor, float limit, bool above, uint16_t rule);
+  /// Lay out the thresholds added since clear(). Each starts in the state the last evaluated value of its sensor
+  /// puts it in, so a rebuild fires nothing.
+  void build();
+
+  /// Keep the value of a sensor for the next evaluate().
+  void post(int32_t sensor, float value);
+  bool has_pending() const { return !this->pending_.empty(); }
+  /// Compare the posted values and set bit i of fired for each rule i that fires; returns how many did.
+  size_t evaluate(std::vector<uint32_t> &fired);
+  /// Value of a sensor at the last evaluate(); NaN if it has none.
+  float get_value(int32_t sensor) const;
+
+  void set_kernel(Kernel kernel) { this->kernel_ = kernel; }
+  size_t size() const { return this->count_; }
+  /// Slots including the padding of the table to a multiple of four.
+  size_t get_slot_count() const { return this->limits_.size(); }
+
+ protected:
+  struct Entry {
+    int32_t sensor;
+    float limit;
+    bool above;
+    uint16_t rule;
+  };
+  /// Slots [begin, end) of one sensor.
+  struct Group {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  void add_sensor(int32_t sensor);
+  /// Compare the four slots from slot against values, with the kernel chosen at compile time so that it inlines.
+  template<bool Vector> size_t evaluate_block(uint32_t slot, const float *values, std::vector<uint32_t> &fired);
+  /// Store value in slots [begin, end) of one block and mark the block dirty.
+  void share(uint32_t begin, uint32_t end, float value);
+  template<bool Vector> size_t evaluate_pending(std::vector<uint32_t> &fired);
+
+  std::vector<Entry> entries_;
+  size_t count_{0};
+  /// Per slot: the limit times the sign, and the sign (1 above, -1 below), so value * sign > limit * sign tests
+  /// both directions with one compare, and the last evaluated value of the sensor, read by shared blocks only.
+  /// Padding slots never hold.
+  std::vector<float> limits_;
+  std::vector<float> signs_;
+  std::vector<float> slot_values_;
+  std::vector<uint16_t> rules_;
+  /// One bit per slot: whether the comparison held at the last evaluation.
+  std::vector<uint32_t> states_;
+  /// One bit per block shared by several sensors that holds a slot of a sensor posted since the last evaluation.
+  std::vector<uint32_t> dirty_;
+  size_t rule_words_{0};
+  /// Indexed by sensor handle.
+  std::vector<Group> groups_;
+  std::vector<float> values_;
+  std::vector<float> evaluated_;
+  std::vector<uint8_t> queued_;
+  std::vector<int32_t> pending_;
+  Kernel kernel_{Kernel::VECTOR};
+};
+
+}  // namespace json_automation
+}  // namespace esphome
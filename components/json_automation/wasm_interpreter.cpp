@@ -0,0 +1,1178 @@
+#include "wasm_interpreter.h"
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace json_automation {
+
+static const uint8_t WASM_MAGIC[4] = {0x00, 'a', 's', 'm'};
+static const uint32_t WASM_VERSION = 1;
+static const uint8_t TYPE_I32 = 0x7F;
+static const uint8_t TYPE_FUNC = 0x60;
+static const uint8_t BLOCK_EMPTY = 0x40;
+static const uint32_t MAX_LOCALS = 1024;
+static const uint32_t NO_FIXUP = UINT32_MAX;
+
+enum SectionId : uint8_t {
+  SECTION_CUSTOM = 0,
+  SECTION_TYPE = 1,
+  SECTION_IMPORT = 2,
+  SECTION_FUNCTION = 3,
+  SECTION_TABLE = 4,
+  SECTION_MEMORY = 5,
+  SECTION_GLOBAL = 6,
+  SECTION_EXPORT = 7,
+  SECTION_START = 8,
+  SECTION_ELEMENT = 9,
+  SECTION_CODE = 10,
+  SECTION_DATA = 11,
+  SECTION_DATA_COUNT = 12,
+};
+
+// Translated code reuses the WebAssembly opcodes. block, loop, else, end and nop disappear; if becomes a
+// jump taken on zero, br and br_if become jumps with a stack adjustment and end of function becomes return.
+enum Opcode : uint8_t {
+  OP_UNREACHABLE = 0x00,
+  OP_NOP = 0x01,
+  OP_BLOCK = 0x02,
+  OP_LOOP = 0x03,
+  OP_IF = 0x04,
+  OP_ELSE = 0x05,
+  OP_END = 0x0B,
+  OP_BR = 0x0C,
+  OP_BR_IF = 0x0D,
+  OP_BR_TABLE = 0x0E,
+  OP_RETURN = 0x0F,
+  OP_CALL = 0x10,
+  OP_DROP = 0x1A,
+  OP_SELECT = 0x1B,
+  OP_LOCAL_GET = 0x20,
+  OP_LOCAL_SET = 0x21,
+  OP_LOCAL_TEE = 0x22,
+  OP_GLOBAL_GET = 0x23,
+  OP_GLOBAL_SET = 0x24,
+  OP_I32_LOAD = 0x28,
+  OP_I32_LOAD8_S = 0x2C,
+  OP_I32_LOAD8_U = 0x2D,
+  OP_I32_LOAD16_S = 0x2E,
+  OP_I32_LOAD16_U = 0x2F,
+  OP_I32_STORE = 0x36,
+  OP_I32_STORE8 = 0x3A,
+  OP_I32_STORE16 = 0x3B,
+  OP_MEMORY_SIZE = 0x3F,
+  OP_MEMORY_GROW = 0x40,
+  OP_I32_CONST = 0x41,
+  OP_I32_EQZ = 0x45,
+  OP_I32_EQ = 0x46,
+  OP_I32_NE = 0x47,
+  OP_I32_LT_S = 0x48,
+  OP_I32_LT_U = 0x49,
+  OP_I32_GT_S = 0x4A,
+  OP_I32_GT_U = 0x4B,
+  OP_I32_LE_S = 0x4C,
+  OP_I32_LE_U = 0x4D,
+  OP_I32_GE_S = 0x4E,
+  OP_I32_GE_U = 0x4F,
+  OP_I32_CLZ = 0x67,
+  OP_I32_CTZ = 0x68,
+  OP_I32_POPCNT = 0x69,
+  OP_I32_ADD = 0x6A,
+  OP_I32_SUB = 0x6B,
+  OP_I32_MUL = 0x6C,
+  OP_I32_DIV_S = 0x6D,
+  OP_I32_DIV_U = 0x6E,
+  OP_I32_REM_S = 0x6F,
+  OP_I32_REM_U = 0x70,
+  OP_I32_AND = 0x71,
+  OP_I32_OR = 0x72,
+  OP_I32_XOR = 0x73,
+  OP_I32_SHL = 0x74,
+  OP_I32_SHR_S = 0x75,
+  OP_I32_SHR_U = 0x76,
+  OP_I32_ROTL = 0x77,
+  OP_I32_ROTR = 0x78,
+  OP_I32_EXTEND8_S = 0xC0,
+  OP_I32_EXTEND16_S = 0xC1,
+};
+
+enum HostFunctionId : uint8_t { HOST_GET_STATE, HOST_SET_STATE, HOST_TOGGLE, HOST_MILLIS, HOST_LOG };
+
+struct HostFunction {
+  const char *name;
+  uint8_t params;
+  uint8_t results;
+};
+
+// Indexed by HostFunctionId
+static const HostFunction HOST_FUNCTIONS[] = {
+    {"get_state", 1, 1}, {"set_state", 2, 0}, {"toggle", 1, 0}, {"millis", 0, 1}, {"log", 2, 0},
+};
+static const size_t HOST_FUNCTION_COUNT = sizeof(HOST_FUNCTIONS) / sizeof(HOST_FUNCTIONS[0]);
+/// Longest message passed to WasmHost::log().
+static const uint32_t MAX_LOG_LENGTH = 128;
+
+static bool fail(std::string &error, const char *message) {
+  error = message;
+  return false;
+}
+
+static bool read_byte(const uint8_t *&p, const uint8_t *end, uint8_t &value) {
+  if (p >= end)
+    return false;
+  value = *p++;
+  return true;
+}
+
+static bool read_u32(const uint8_t *&p, const uint8_t *end, uint32_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (p >= end)
+      return false;
+    const uint8_t byte = *p++;
+    value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+      return shift < 28 || (byte & 0x70) == 0;
+  }
+  return false;
+}
+
+static bool read_s32(const uint8_t *&p, const uint8_t *end, int32_t &value) {
+  uint32_t result = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (p >= end)
+      return false;
+    const uint8_t byte = *p++;
+    result |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      if (shift < 25 && (byte & 0x40) != 0)
+        result |= UINT32_MAX << (shift + 7);
+      value = static_cast<int32_t>(result);
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool read_name(const uint8_t *&p, const uint8_t *end, std::string &name) {
+  uint32_t length;
+  if (!read_u32(p, end, length) || length > static_cast<size_t>(end - p))
+    return false;
+  name.assign(reinterpret_cast<const char *>(p), length);
+  p += length;
+  return true;
+}
+
+/// Constant expression: i32.const followed by end.
+static bool read_const_expr(const uint8_t *&p, const uint8_t *end, int32_t &value) {
+  uint8_t op, terminator;
+  return read_byte(p, end, op) && op == OP_I32_CONST && read_s32(p, end, value) && read_byte(p, end, terminator) &&
+         terminator == OP_END;
+}
+
+/// Position of a non-custom section in the order the binary format requires; the data count section comes between
+/// the element and code sections.
+static uint8_t section_order(uint8_t id) {
+  if (id == SECTION_DATA_COUNT)
+    return SECTION_ELEMENT + 1;
+  return id > SECTION_ELEMENT ? id + 1 : id;
+}
+
+static bool read_block_type(const uint8_t *&p, const uint8_t *end, uint8_t &arity) {
+  uint8_t type;
+  if (!read_byte(p, end, type))
+    return false;
+  if (type == BLOCK_EMPTY) {
+    arity = 0;
+    return true;
+  }
+  arity = 1;
+  return type == TYPE_I32;
+}
+
+bool WasmModule::parse(const uint8_t *data, size_t size, std::string &error) {
+  if (size > MAX_WASM_MODULE_SIZE)
+    return fail(error, "module too large");
+  const uint8_t *p = data;
+  const uint8_t *end = data + size;
+  if (size < 8 || memcmp(p, WASM_MAGIC, 4) != 0)
+    return fail(error, "not a WebAssembly module");
+  if ((p[4] | (p[5] << 8) | (p[6] << 16) | (static_cast<uint32_t>(p[7]) << 24)) != WASM_VERSION)
+    return fail(error, "unsupported WebAssembly version");
+  p += 8;
+  this->size_ = size;
+
+  bool have_code = false;
+  uint8_t last_order = 0;
+  while (p < end) {
+    uint8_t id;
+    uint32_t length;
+    if (!read_byte(p, end, id) || !read_u32(p, end, length) || length > static_cast<size_t>(end - p))
+      return fail(error, "truncated section");
+    // Each section is validated against the ones before it, e.g. call targets against the imports
+    if (id != SECTION_CUSTOM && id <= SECTION_DATA_COUNT) {
+      if (section_order(id) <= last_order)
+        return fail(error, "section out of order or repeated");
+      last_order = section_order(id);
+    }
+    const uint8_t *section_end = p + length;
+    bool ok = true;
+    switch (id) {
+      case SECTION_CUSTOM:
+      case SECTION_DATA_COUNT:
+        p = section_end;
+        break;
+      case SECTION_TYPE:
+        ok = this->parse_types(p, section_end, error);
+        break;
+      case SECTION_IMPORT:
+        ok = this->parse_imports(p, section_end, error);
+        break;
+      case SECTION_FUNCTION:
+        ok = this->parse_functions(p, section_end, error);
+        break;
+      case SECTION_MEMORY:
+        ok = this->parse_memory(p, section_end, error);
+        break;
+      case SECTION_GLOBAL:
+        ok = this->parse_globals(p, section_end, error);
+        break;
+      case SECTION_EXPORT:
+        ok = this->parse_exports(p, section_end, error);
+        break;
+      case SECTION_CODE:
+        ok = this->parse_code(p, section_end, error);
+        have_code = true;
+        break;
+      case SECTION_DATA:
+        ok = this->parse_data(p, section_end, error);
+        break;
+      case SECTION_TABLE:
+      case SECTION_START:
+      case SECTION_ELEMENT:
+        return fail(error, "tables and start functions are not supported");
+      default:
+        return fail(error, "unknown section");
+    }
+    if (!ok)
+      return false;
+    if (p != section_end)
+      return fail(error, "malformed section");
+  }
+  if (!this->functions_.empty() && !have_code)
+    return fail(error, "missing code section");
+  // Translation ends every function with a return, so no code means no body was read
+  for (const auto &function : this->functions_) {
+    if (function.code.empty())
+      return fail(error, "code and function sections do not match");
+  }
+  return true;
+}
+
+bool WasmModule::parse_types(const uint8_t *&p, const uint8_t *end, std::string &error) {
+  uint32_t count;
+  if (!read_u32(p, end, count))
+    return fail(error, "truncated type section");
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t form;
+    uint32_t params, results;
+    if (!read_byte(p, end, form) || form != TYPE_FUNC || !read_u32(p, end, params) || params > UINT8_MAX)
+      return fail(error, "malformed function type");
+    for (uint32_t j = 0; j < params; j++) {
+      uint8_t type;
+      if (!read_byte(p, end, type) || type != TYPE_I32)
+        return fail(error, "only i32 parameters are supported");
+    }
+    if (!read_u32(p, end, results) || results > 1)
+      return fail(error, "functions may return at most one value");
+    for (uint32_t j = 0; j < results; j++) {
+      uint8_t type;
+      if (!read_byte(p, end, type) || type != TYPE_I32)
+        return fail(error, "only i32 results are supported");
+    }
+    this->types_.push_back(WasmFuncType{static_cast<uint8_t>(params), static_cast<uint8_t>(results)});
+  }
+  return true;
+}
+
+bool WasmModule::parse_imports(const uint8_t *&p, const uint8_t *end, std::string &error) {
+  uint32_t count;
+  if (!read_u32(p, end, count))
+    return fail(error, "truncated import section");
+  for (uint32_t i = 0; i < count; i++) {
+    std::string module, name;
+    uint8_t kind;
+    uint32_t type;
+    if (!read_name(p, end, module) || !read_name(p, end, name) || !read_byte(p, end, kind))
+      return fail(error, "truncated import section");
+    if (kind != 0 || module != "env")
+      return fail(error, "only function imports from env are supported");
+    if (!read_u32(p, end, type) || type >= this->types_.size())
+      return fail(error, "invalid import type");
+    size_t host = 0;
+    while (host < HOST_FUNCTION_COUNT && name != HOST_FUNCTIONS[host].name)
+      host++;
+    if (host == HOST_FUNCTION_COUNT) {
+      error = "unknown import env." + name;
+      return false;
+    }
+    if (this->types_[type].params != HOST_FUNCTIONS[host].params ||
+        this->types_[type].results != HOST_FUNCTIONS[host].results) {
+      error = "wrong signature for env." + name;
+      return false;
+    }
+    this->imports_.push_back(host);
+    this->import_types_.push_back(type);
+  }
+  return true;
+}
+
+bool WasmModule::parse_functions(const uint8_t *&p, const uint8_t *end, std::string &error) {
+  uint32_t count;
+  if (!read_u32(p, end, count) || count > static_cast<size_t>(end - p))
+    return fail(error, "truncated function section");
+  this->functions_.resize(count);
+  for (auto &function : this->functions_) {
+    if (!read_u32(p, end, function.type) || function.type >= this->types_.size())
+      return fail(error, "invalid function type");
+  }
+  return true;
+}
+
+bool WasmModule::parse_memory(const uint8_t *&p, const uint8_t *end, std::string &error) {
+  uint32_t count, pages;
+  uint8_t flags;
+  if (!read_u32(p, end, count) || count > 1)
+    return fail(error, "at most one memory is supported");
+  if (count == 0)
+    return true;
+  if (!read_byte(p, end, flags) || flags > 1 || !read_u32(p, end, pages))
+    return fail(error, "malformed memory limits");
+  if (flags == 1) {
+    uint32_t maximum;
+    if (!read_u32(p, end, maximum))
+      return fail(error, "malformed memory limits");
+  }
+  this->has_memory_ = true;
+  this->memory_pages_ = pages;
+  return true;
+}
+
+bool WasmModule::parse_globals(const uint8_t *&p, const uint8_t *end, std::string &error) {
+  uint32_t count;
+  if (!read_u32(p, end, count))
+    return fail(error, "truncated global section");
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t type, mutability;
+    WasmGlobal global;
+    if (!read_byte(p, end, type) || type != TYPE_I32 || !read_byte(p, end, mutability) || mutability > 1)
+      return fail(error, "only i32 globals are supported");
+    if (!read_const_expr(p, end, global.init))
+      return fail(error, "unsupported global initializer");
+    global.is_mutable = mutability == 1;
+    this->globals_.push_back(global);
+  }
+  return true;
+}
+
+bool WasmModule::parse_exports(const uint8_t *&p, const uint8_t *end, std::string &error) {
+  uint32_t count;
+  if (!read_u32(p, end, count))
+    return fail(error, "truncated export section");
+  for (uint32_t i = 0; i < count; i++) {
+    Export entry;
+    uint8_t kind;
+    if (!read_name(p, end, entry.name) || !read_byte(p, end, kind) || !read_u32(p, end, entry.function))
+      return fail(error, "truncated export section");
+    // Memory and global exports are of no use to the host
+    if (kind != 0)
+      continue;
+    if (entry.function >= this->imports_.size() + this->functions_.size())
+      return fail(error, "invalid export index");
+    this->exports_.push_back(std::move(entry));
+  }
+  return true;
+}
+
+bool WasmModule::parse_code(const uint8_t *&p, const uint8_t *end, std::string &error) {
+  uint32_t count;
+  if (!read_u32(p, end, count) || count != this->functions_.size())
+    return fail(error, "code and function sections do not match");
+  for (auto &function : this->functions_) {
+    uint32_t length;
+    if (!read_u32(p, end, length) || length > static_cast<size_t>(end - p))
+      return fail(error, "truncated function body");
+    const uint8_t *body_end = p + length;
+    if (!this->translate(p, body_end, function, error))
+      return false;
+    if (p != body_end)
+      return fail(error, "code after end of function");
+  }
+  return true;
+}
+
+bool WasmModule::parse_data(const uint8_t *&p, const uint8_t *end, std::string &error) {
+  uint32_t count;
+  if (!read_u32(p, end, count))
+    return fail(error, "truncated data section");
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t mode, length;
+    int32_t offset;
+    if (!read_u32(p, end, mode) || mode != 0 || !this->has_memory_)
+      return fail(error, "only active data segments are supported");
+    if (!read_const_expr(p, end, offset) || !read_u32(p, end, length) || length > static_cast<size_t>(end - p))
+      return fail(error, "malformed data segment");
+    this->data_.push_back(WasmDataSegment{static_cast<uint32_t>(offset), std::vector<uint8_t>(p, p + length)});
+    p += length;
+  }
+  return true;
+}
+
+/// Block being translated. Forward branches to it are patched once its end is reached.
+struct ControlFrame {
+  uint8_t kind;
+  uint8_t arity;
+  uint32_t height;
+  uint32_t start_pc;
+  uint32_t else_fixup;
+  bool unreachable;
+  std::vector<uint32_t> fixups;
+  std::vector<uint32_t> table_fixups;
+};
+
+/// Tracks the operand stack height through a function body. All values are i32, so validation comes down
+/// to heights; code after an unconditional branch is unreachable and may pop anything.
+class Translator {
+ public:
+  Translator(std::vector<WasmInstr> &code, std::vector<WasmBranch> &branches, std::string &error)
+      : code_(code), branches_(branches), error_(error) {}
+
+  std::vector<ControlFrame> controls;
+  uint32_t height{0};
+  uint32_t max_height{0};
+
+  bool pop(uint32_t count) {
+    ControlFrame &frame = this->controls.back();
+    if (this->height < frame.height + count) {
+      if (!frame.unreachable)
+        return fail(this->error_, "operand stack underflow");
+      this->height = frame.height;
+      return true;
+    }
+    this->height -= count;
+    return true;
+  }
+
+  bool push(uint32_t count) {
+    this->height += count;
+    if (this->height > this->max_height)
+      this->max_height = this->height;
+    if (this->height > UINT16_MAX)
+      return fail(this->error_, "operand stack too deep");
+    return true;
+  }
+
+  /// Values on top of the stack that a branch carries.
+  bool has_values(uint32_t count) {
+    const ControlFrame &frame = this->controls.back();
+    return frame.unreachable || this->height >= frame.height + count;
+  }
+
+  void set_unreachable() {
+    this->controls.back().unreachable = true;
+    this->height = this->controls.back().height;
+  }
+
+  void begin(uint8_t kind, uint8_t arity) {
+    ControlFrame frame;
+    frame.kind = kind;
+    frame.arity = arity;
+    frame.height = this->height;
+    frame.start_pc = this->code_.size();
+    frame.else_fixup = NO_FIXUP;
+    frame.unreachable = false;
+    this->controls.push_back(std::move(frame));
+  }
+
+  void emit(uint8_t op, uint32_t a = 0) { this->code_.push_back(WasmInstr{op, 0, 0, a}); }
+
+  /// Resolve a label, returning the frame and the number of values its branches carry.
+  bool label(uint32_t depth, ControlFrame *&target, uint8_t &arity) {
+    if (depth >= this->controls.size())
+      return fail(this->error_, "branch depth out of range");
+    target = &this->controls[this->controls.size() - 1 - depth];
+    arity = target->kind == OP_LOOP ? 0 : target->arity;
+    if (!this->has_values(arity))
+      return fail(this->error_, "operand stack underflow");
+    return true;
+  }
+
+  bool branch(uint8_t op, uint32_t depth) {
+    ControlFrame *target;
+    uint8_t arity;
+    if (!this->label(depth, target, arity))
+      return false;
+    WasmInstr instr{op, arity, static_cast<uint16_t>(target->height), target->start_pc};
+    if (target->kind != OP_LOOP)
+      target->fixups.push_back(this->code_.size());
+    this->code_.push_back(instr);
+    return true;
+  }
+
+  bool branch_table(const uint8_t *&p, const uint8_t *end) {
+    uint32_t count;
+    if (!read_u32(p, end, count) || count >= UINT16_MAX)
+      return fail(this->error_, "malformed br_table");
+    const uint32_t first = this->branches_.size();
+    int arity = -1;
+    for (uint32_t i = 0; i <= count; i++) {
+      uint32_t depth;
+      ControlFrame *target;
+      uint8_t target_arity;
+      if (!read_u32(p, end, depth) || !this->label(depth, target, target_arity))
+        return false;
+      if (arity >= 0 && target_arity != arity)
+        return fail(this->error_, "br_table labels differ in arity");
+      arity = target_arity;
+      if (target->kind != OP_LOOP)
+        target->table_fixups.push_back(this->branches_.size());
+      this->branches_.push_back(WasmBranch{target->start_pc, static_cast<uint16_t>(target->height), target_arity});
+    }
+    this->code_.push_back(WasmInstr{OP_BR_TABLE, 0, static_cast<uint16_t>(count + 1), first});
+    return true;
+  }
+
+  bool end() {
+    ControlFrame &frame = this->controls.back();
+    if (!frame.unreachable && this->height != frame.height + frame.arity)
+      return fail(this->error_, "operand stack height mismatch at end of block");
+    if (frame.kind == OP_IF && frame.else_fixup != NO_FIXUP && frame.arity != 0)
+      return fail(this->error_, "if with a result needs an else");
+    if (frame.kind == OP_RETURN)
+      this->emit(OP_RETURN);
+    // Branches to a function end land on its return
+    const uint32_t end_pc = frame.kind == OP_RETURN ? this->code_.size() - 1 : this->code_.size();
+    for (uint32_t fixup : frame.fixups)
+      this->code_[fixup].a = end_pc;
+    for (uint32_t fixup : frame.table_fixups)
+      this->branches_[fixup].pc = end_pc;
+    if (frame.else_fixup != NO_FIXUP)
+      this->code_[frame.else_fixup].a = end_pc;
+    this->height = frame.height + frame.arity;
+    this->controls.pop_back();
+    return true;
+  }
+
+ protected:
+  std::vector<WasmInstr> &code_;
+  std::vector<WasmBranch> &branches_;
+  std::string &error_;
+};
+
+bool WasmModule::translate(const uint8_t *&p, const uint8_t *end, WasmFunction &function, std::string &error) {
+  const WasmFuncType type = this->types_[function.type];
+  uint32_t groups;
+  uint32_t locals = type.params;
+  if (!read_u32(p, end, groups))
+    return fail(error, "truncated locals");
+  for (uint32_t i = 0; i < groups; i++) {
+    uint32_t count;
+    uint8_t value_type;
+    if (!read_u32(p, end, count) || !read_byte(p, end, value_type))
+      return fail(error, "truncated locals");
+    if (value_type != TYPE_I32)
+      return fail(error, "only i32 locals are supported");
+    if (count > MAX_LOCALS || locals + count > MAX_LOCALS)
+      return fail(error, "too many locals");
+    locals += count;
+  }
+  function.locals = locals;
+
+  Translator t(function.code, this->branches_, error);
+  // The function body is a block whose end returns
+  t.begin(OP_RETURN, type.results);
+  const uint32_t function_count = this->imports_.size() + this->functions_.size();
+
+  while (!t.controls.empty()) {
+    uint8_t op;
+    if (!read_byte(p, end, op))
+      return fail(error, "unexpected end of function body");
+    uint32_t index;
+    int32_t value;
+    uint8_t arity;
+    switch (op) {
+      case OP_UNREACHABLE:
+        t.emit(OP_UNREACHABLE);
+        t.set_unreachable();
+        break;
+      case OP_NOP:
+        break;
+      case OP_BLOCK:
+      case OP_LOOP:
+        if (!read_block_type(p, end, arity))
+          return fail(error, "unsupported block type");
+        t.begin(op, arity);
+        break;
+      case OP_IF:
+        if (!read_block_type(p, end, arity))
+          return fail(error, "unsupported block type");
+        if (!t.pop(1))
+          return false;
+        t.begin(OP_IF, arity);
+        t.controls.back().else_fixup = function.code.size();
+        t.emit(OP_IF);
+        break;
+      case OP_ELSE: {
+        ControlFrame &frame = t.controls.back();
+        if (frame.kind != OP_IF || frame.else_fixup == NO_FIXUP)
+          return fail(error, "else without if");
+        if (!frame.unreachable && t.height != frame.height + frame.arity)
+          return fail(error, "operand stack height mismatch at else");
+        // The then branch jumps over the else branch; its values are already in place
+        frame.fixups.push_back(function.code.size());
+        function.code.push_back(
+            WasmInstr{OP_BR, 0, static_cast<uint16_t>(frame.height + frame.arity), frame.start_pc});
+        function.code[frame.else_fixup].a = function.code.size();
+        frame.else_fixup = NO_FIXUP;
+        frame.unreachable = false;
+        t.height = frame.height;
+        break;
+      }
+      case OP_END:
+        if (!t.end())
+          return false;
+        break;
+      case OP_BR:
+      case OP_BR_IF:
+        if (!read_u32(p, end, index))
+          return fail(error, "malformed branch");
+        if ((op == OP_BR_IF && !t.pop(1)) || !t.branch(op, index))
+          return false;
+        if (op == OP_BR)
+          t.set_unreachable();
+        break;
+      case OP_BR_TABLE:
+        if (!t.pop(1) || !t.branch_table(p, end))
+          return false;
+        t.set_unreachable();
+        break;
+      case OP_RETURN:
+        if (!t.has_values(type.results))
+          return fail(error, "operand stack underflow");
+        t.emit(OP_RETURN);
+        t.set_unreachable();
+        break;
+      case OP_CALL: {
+        if (!read_u32(p, end, index) || index >= function_count)
+          return fail(error, "invalid call target");
+        const WasmFuncType &callee = this->get_type(index);
+        if (!t.pop(callee.params) || !t.push(callee.results))
+          return false;
+        t.emit(OP_CALL, index);
+        break;
+      }
+      case OP_DROP:
+        if (!t.pop(1))
+          return false;
+        t.emit(op);
+        break;
+      case OP_SELECT:
+        if (!t.pop(3) || !t.push(1))
+          return false;
+        t.emit(op);
+        break;
+      case OP_LOCAL_GET:
+      case OP_LOCAL_SET:
+      case OP_LOCAL_TEE:
+        if (!read_u32(p, end, index) || index >= locals)
+          return fail(error, "invalid local index");
+        if (op != OP_LOCAL_GET && !t.pop(1))
+          return false;
+        if (op != OP_LOCAL_SET && !t.push(1))
+          return false;
+        t.emit(op, index);
+        break;
+      case OP_GLOBAL_GET:
+      case OP_GLOBAL_SET:
+        if (!read_u32(p, end, index) || index >= this->globals_.size())
+          return fail(error, "invalid global index");
+        if (op == OP_GLOBAL_SET && !this->globals_[index].is_mutable)
+          return fail(error, "global is immutable");
+        if (!(op == OP_GLOBAL_GET ? t.push(1) : t.pop(1)))
+          return false;
+        t.emit(op, index);
+        break;
+      case OP_I32_LOAD:
+      case OP_I32_LOAD8_S:
+      case OP_I32_LOAD8_U:
+      case OP_I32_LOAD16_S:
+      case OP_I32_LOAD16_U:
+      case OP_I32_STORE:
+      case OP_I32_STORE8:
+      case OP_I32_STORE16: {
+        uint32_t align;
+        if (!this->has_memory_)
+          return fail(error, "memory access without memory");
+        if (!read_u32(p, end, align) || !read_u32(p, end, index))
+          return fail(error, "malformed memory access");
+        const bool store = op >= OP_I32_STORE;
+        if (!t.pop(store ? 2 : 1) || !t.push(store ? 0 : 1))
+          return false;
+        t.emit(op, index);
+        break;
+      }
+      case OP_MEMORY_SIZE:
+      case OP_MEMORY_GROW: {
+        uint8_t memory;
+        if (!this->has_memory_ || !read_byte(p, end, memory) || memory != 0)
+          return fail(error, "invalid memory index");
+        if (!t.pop(op == OP_MEMORY_GROW ? 1 : 0) || !t.push(1))
+          return false;
+        t.emit(op);
+        break;
+      }
+      case OP_I32_CONST:
+        if (!read_s32(p, end, value))
+          return fail(error, "malformed i32.const");
+        if (!t.push(1))
+          return false;
+        t.emit(op, static_cast<uint32_t>(value));
+        break;
+      case OP_I32_EQZ:
+      case OP_I32_CLZ:
+      case OP_I32_CTZ:
+      case OP_I32_POPCNT:
+      case OP_I32_EXTEND8_S:
+      case OP_I32_EXTEND16_S:
+        if (!t.pop(1) || !t.push(1))
+          return false;
+        t.emit(op);
+        break;
+      default:
+        if ((op >= OP_I32_EQ && op <= OP_I32_GE_U) || (op >= OP_I32_ADD && op <= OP_I32_ROTR)) {
+          if (!t.pop(2) || !t.push(1))
+            return false;
+          t.emit(op);
+          break;
+        }
+        error = "unsupported instruction 0x";
+        error += "0123456789abcdef"[op >> 4];
+        error += "0123456789abcdef"[op & 0x0F];
+        return false;
+    }
+  }
+  function.max_height = t.max_height;
+  return true;
+}
+
+int32_t WasmModule::find_export(const std::string &name) const {
+  for (const auto &entry : this->exports_) {
+    if (entry.name == name)
+      return entry.function;
+  }
+  return -1;
+}
+
+const WasmFuncType &WasmModule::get_type(uint32_t function) const {
+  if (function < this->imports_.size())
+    return this->types_[this->import_types_[function]];
+  return this->types_[this->functions_[function - this->imports_.size()].type];
+}
+
+bool WasmInstance::instantiate(std::shared_ptr<const WasmModule> module, const WasmLimits &limits,
+                               std::string &error) {
+  this->module_ = std::move(module);
+  this->limits_ = limits;
+  const WasmModule &m = *this->module_;
+
+  uint64_t memory_size = 0;
+  if (m.has_memory_) {
+    memory_size = static_cast<uint64_t>(m.memory_pages_) * 65536;
+    if (memory_size > limits.memory_bytes)
+      memory_size = limits.memory_bytes;
+  }
+  this->memory_.assign(memory_size, 0);
+  for (const auto &segment : m.data_) {
+    if (static_cast<uint64_t>(segment.offset) + segment.data.size() > memory_size)
+      return fail(error, "data segment exceeds the memory limit");
+    std::copy(segment.data.begin(), segment.data.end(), this->memory_.begin() + segment.offset);
+  }
+
+  this->globals_.clear();
+  for (const auto &global : m.globals_)
+    this->globals_.push_back(global.init);
+  this->stack_.assign(limits.stack_slots, 0);
+  this->frames_.clear();
+  this->frames_.reserve(limits.call_depth);
+  return true;
+}
+
+bool WasmInstance::call(uint32_t function, const int32_t *args, size_t arg_count, WasmHost *host, int32_t &result,
+                        bool &has_result, std::string &error) {
+  has_result = false;
+  this->last_fuel_used_ = 0;
+  if (this->running_)
+    return fail(error, "reentrant call");
+  const WasmModule &module = *this->module_;
+  if (function < module.imports_.size() || function >= module.imports_.size() + module.functions_.size())
+    return fail(error, "not a module function");
+  const WasmFuncType &type = module.get_type(function);
+  if (arg_count != type.params)
+    return fail(error, "argument count mismatch");
+
+  this->running_ = true;
+  this->host_ = host;
+  const bool ok = this->execute(function - module.imports_.size(), args, result, error);
+  this->running_ = false;
+  has_result = ok && type.results == 1;
+  return ok;
+}
+
+static inline bool in_bounds(uint32_t address, uint32_t offset, uint32_t size, size_t memory_size) {
+  return static_cast<uint64_t>(address) + offset + size <= memory_size;
+}
+
+bool WasmInstance::execute(uint32_t function, const int32_t *args, int32_t &result, std::string &error) {
+  const WasmModule &module = *this->module_;
+  const uint32_t imports = module.imports_.size();
+  int32_t *stack = this->stack_.data();
+  const size_t capacity = this->stack_.size();
+  uint8_t *memory = this->memory_.data();
+  const size_t memory_size = this->memory_.size();
+  uint32_t fuel = this->limits_.fuel;
+  this->frames_.clear();
+
+  const WasmFunction *fn = nullptr;
+  const WasmInstr *code = nullptr;
+  uint32_t pc = 0;
+  uint32_t sp = 0;
+  uint32_t operands = 0;
+
+  // Push a frame for a module function whose arguments are on top of the stack
+  auto enter = [&](uint32_t index, uint32_t return_pc) -> bool {
+    const WasmFunction &callee = module.functions_[index];
+    const uint32_t base = sp - module.types_[callee.type].params;
+    if (this->frames_.size() >= this->limits_.call_depth)
+      return fail(error, "call stack exhausted");
+    if (static_cast<size_t>(base) + callee.locals + callee.max_height > capacity)
+      return fail(error, "value stack exhausted");
+    while (sp < base + callee.locals)
+      stack[sp++] = 0;
+    this->frames_.push_back(Frame{index, return_pc, base});
+    fn = &callee;
+    code = callee.code.data();
+    pc = 0;
+    operands = base + callee.locals;
+    return true;
+  };
+  // Keep arity values and drop the stack down to height above the operand base
+  auto unwind = [&](uint16_t height, uint8_t arity) {
+    if (arity != 0) {
+      const int32_t value = stack[sp - 1];
+      sp = operands + height;
+      stack[sp++] = value;
+    } else {
+      sp = operands + height;
+    }
+  };
+
+  const uint8_t params = module.types_[module.functions_[function].type].params;
+  if (params > capacity)
+    return fail(error, "value stack exhausted");
+  for (; sp < params; sp++)
+    stack[sp] = args[sp];
+  bool ok = enter(function, 0);
+
+  while (ok) {
+    if (fuel == 0) {
+      ok = fail(error, "out of fuel");
+      break;
+    }
+    fuel--;
+    const WasmInstr instr = code[pc++];
+    switch (instr.op) {
+      case OP_UNREACHABLE:
+        ok = fail(error, "unreachable executed");
+        break;
+      case OP_IF:
+        if (stack[--sp] == 0)
+          pc = instr.a;
+        break;
+      case OP_BR:
+        unwind(instr.height, instr.arity);
+        pc = instr.a;
+        break;
+      case OP_BR_IF:
+        if (stack[--sp] != 0) {
+          unwind(instr.height, instr.arity);
+          pc = instr.a;
+        }
+        break;
+      case OP_BR_TABLE: {
+        uint32_t index = static_cast<uint32_t>(stack[--sp]);
+        if (index >= static_cast<uint32_t>(instr.height - 1))
+          index = instr.height - 1;
+        const WasmBranch &target = module.branches_[instr.a + index];
+        unwind(target.height, target.arity);
+        pc = target.pc;
+        break;
+      }
+      case OP_RETURN: {
+        const Frame frame = this->frames_.back();
+        this->frames_.pop_back();
+        if (module.types_[fn->type].results != 0) {
+          stack[frame.base] = stack[sp - 1];
+          sp = frame.base + 1;
+        } else {
+          sp = frame.base;
+        }
+        if (this->frames_.empty()) {
+          if (sp != 0)
+            result = stack[0];
+          this->last_fuel_used_ = this->limits_.fuel - fuel;
+          return true;
+        }
+        const Frame &caller = this->frames_.back();
+        fn = &module.functions_[caller.function];
+        code = fn->code.data();
+        operands = caller.base + fn->locals;
+        pc = frame.return_pc;
+        break;
+      }
+      case OP_CALL:
+        if (instr.a >= imports) {
+          ok = enter(instr.a - imports, pc);
+          break;
+        }
+        {
+          const HostFunction &host = HOST_FUNCTIONS[module.imports_[instr.a]];
+          int32_t value = 0;
+          sp -= host.params;
+          ok = this->call_host(module.imports_[instr.a], &stack[sp], value, error);
+          if (host.results != 0)
+            stack[sp++] = value;
+        }
+        break;
+      case OP_DROP:
+        sp--;
+        break;
+      case OP_SELECT:
+        sp -= 2;
+        if (stack[sp + 1] == 0)
+          stack[sp - 1] = stack[sp];
+        break;
+      case OP_LOCAL_GET:
+        stack[sp++] = stack[operands - fn->locals + instr.a];
+        break;
+      case OP_LOCAL_SET:
+        stack[operands - fn->locals + instr.a] = stack[--sp];
+        break;
+      case OP_LOCAL_TEE:
+        stack[operands - fn->locals + instr.a] = stack[sp - 1];
+        break;
+      case OP_GLOBAL_GET:
+        stack[sp++] = this->globals_[instr.a];
+        break;
+      case OP_GLOBAL_SET:
+        this->globals_[instr.a] = stack[--sp];
+        break;
+      case OP_I32_LOAD:
+      case OP_I32_LOAD8_S:
+      case OP_I32_LOAD8_U:
+      case OP_I32_LOAD16_S:
+      case OP_I32_LOAD16_U: {
+        const uint32_t size = instr.op == OP_I32_LOAD ? 4 : instr.op <= OP_I32_LOAD8_U ? 1 : 2;
+        const uint32_t address = static_cast<uint32_t>(stack[sp - 1]);
+        if (!in_bounds(address, instr.a, size, memory_size)) {
+          ok = fail(error, "memory access out of bounds");
+          break;
+        }
+        const uint8_t *src = memory + address + instr.a;
+        int32_t value;
+        if (size == 4) {
+          value = static_cast<int32_t>(src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<uint32_t>(src[3]) << 24));
+        } else if (size == 2) {
+          const uint16_t half = src[0] | (src[1] << 8);
+          value = instr.op == OP_I32_LOAD16_S ? static_cast<int16_t>(half) : half;
+        } else {
+          value = instr.op == OP_I32_LOAD8_S ? static_cast<int8_t>(src[0]) : src[0];
+        }
+        stack[sp - 1] = value;
+        break;
+      }
+      case OP_I32_STORE:
+      case OP_I32_STORE8:
+      case OP_I32_STORE16: {
+        const uint32_t size = instr.op == OP_I32_STORE ? 4 : instr.op == OP_I32_STORE8 ? 1 : 2;
+        const uint32_t value = static_cast<uint32_t>(stack[--sp]);
+        const uint32_t address = static_cast<uint32_t>(stack[--sp]);
+        if (!in_bounds(address, instr.a, size, memory_size)) {
+          ok = fail(error, "memory access out of bounds");
+          break;
+        }
+        for (uint32_t i = 0; i < size; i++)
+          memory[address + instr.a + i] = static_cast<uint8_t>(value >> (8 * i));
+        break;
+      }
+      case OP_MEMORY_SIZE:
+        stack[sp++] = module.memory_pages_;
+        break;
+      case OP_MEMORY_GROW:
+        // Memory is fixed at the limit; growing always fails
+        stack[sp - 1] = -1;
+        break;
+      case OP_I32_CONST:
+        stack[sp++] = static_cast<int32_t>(instr.a);
+        break;
+      case OP_I32_EQZ:
+        stack[sp - 1] = stack[sp - 1] == 0;
+        break;
+      case OP_I32_CLZ: {
+        const uint32_t value = stack[sp - 1];
+        stack[sp - 1] = value == 0 ? 32 : __builtin_clz(value);
+        break;
+      }
+      case OP_I32_CTZ: {
+        const uint32_t value = stack[sp - 1];
+        stack[sp - 1] = value == 0 ? 32 : __builtin_ctz(value);
+        break;
+      }
+      case OP_I32_POPCNT:
+        stack[sp - 1] = __builtin_popcount(static_cast<uint32_t>(stack[sp - 1]));
+        break;
+      case OP_I32_EXTEND8_S:
+        stack[sp - 1] = static_cast<int8_t>(stack[sp - 1]);
+        break;
+      case OP_I32_EXTEND16_S:
+        stack[sp - 1] = static_cast<int16_t>(stack[sp - 1]);
+        break;
+      default: {
+        // Binary operators
+        const int32_t b = stack[--sp];
+        const int32_t a = stack[sp - 1];
+        const uint32_t ua = a, ub = b;
+        int32_t &out = stack[sp - 1];
+        switch (instr.op) {
+          case OP_I32_EQ:
+            out = a == b;
+            break;
+          case OP_I32_NE:
+            out = a != b;
+            break;
+          case OP_I32_LT_S:
+            out = a < b;
+            break;
+          case OP_I32_LT_U:
+            out = ua < ub;
+            break;
+          case OP_I32_GT_S:
+            out = a > b;
+            break;
+          case OP_I32_GT_U:
+            out = ua > ub;
+            break;
+          case OP_I32_LE_S:
+            out = a <= b;
+            break;
+          case OP_I32_LE_U:
+            out = ua <= ub;
+            break;
+          case OP_I32_GE_S:
+            out = a >= b;
+            break;
+          case OP_I32_GE_U:
+            out = ua >= ub;
+            break;
+          case OP_I32_ADD:
+            out = ua + ub;
+            break;
+          case OP_I32_SUB:
+            out = ua - ub;
+            break;
+          case OP_I32_MUL:
+            out = ua * ub;
+            break;
+          case OP_I32_DIV_S:
+          case OP_I32_REM_S:
+            if (b == 0) {
+              ok = fail(error, "integer divide by zero");
+            } else if (a == INT32_MIN && b == -1) {
+              if (instr.op == OP_I32_DIV_S) {
+                ok = fail(error, "integer overflow");
+              } else {
+                out = 0;
+              }
+            } else {
+              out = instr.op == OP_I32_DIV_S ? a / b : a % b;
+            }
+            break;
+          case OP_I32_DIV_U:
+          case OP_I32_REM_U:
+            if (b == 0) {
+              ok = fail(error, "integer divide by zero");
+            } else {
+              out = instr.op == OP_I32_DIV_U ? ua / ub : ua % ub;
+            }
+            break;
+          case OP_I32_AND:
+            out = a & b;
+            break;
+          case OP_I32_OR:
+            out = a | b;
+            break;
+          case OP_I32_XOR:
+            out = a ^ b;
+            break;
+          case OP_I32_SHL:
+            out = ua << (ub & 31);
+            break;
+          case OP_I32_SHR_S:
+            out = a >> (ub & 31);
+            break;
+          case OP_I32_SHR_U:
+            out = ua >> (ub & 31);
+            break;
+          case OP_I32_ROTL:
+            out = (ua << (ub & 31)) | (ua >> ((32 - (ub & 31)) & 31));
+            break;
+          case OP_I32_ROTR:
+            out = (ua >> (ub & 31)) | (ua << ((32 - (ub & 31)) & 31));
+            break;
+        }
+        break;
+      }
+    }
+  }
+  this->last_fuel_used_ = this->limits_.fuel - fuel;
+  return false;
+}
+
+bool WasmInstance::call_host(uint8_t host_function, const int32_t *args, int32_t &result, std::string &error) {
+  switch (host_function) {
+    case HOST_GET_STATE:
+      result = this->host_->get_state(args[0]);
+      return true;
+    case HOST_SET_STATE:
+      this->host_->set_state(args[0], args[1] != 0);
+      return true;
+    case HOST_TOGGLE:
+      this->host_->toggle(args[0]);
+      return true;
+    case HOST_MILLIS:
+      result = this->host_->millis();
+      return true;
+    case HOST_LOG: {
+      const uint32_t address = args[0];
+      uint32_t length = args[1];
+      if (length > MAX_LOG_LENGTH)
+        length = MAX_LOG_LENGTH;
+      if (!in_bounds(address, 0, length, this->memory_.size()))
+        return fail(error, "memory access out of bounds");
+      this->host_->log(reinterpret_cast<const char *>(this->memory_.data() + address), length);
+      return true;
+    }
+  }
+  return fail(error, "unknown host function");
+}
+
+}  // namespace json_automation
+}  // namespace esphome
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Small WebAssembly interpreter for sandboxed custom actions. Kept free of ESPHome headers.
+//
+// Supported subset: the MVP binary format with i32 as the only value type (no floats, no i64, no tables),
+// one linear memory, mutable and immutable globals, and function imports from the host functions in
+// WasmHost. Modules are validated and translated to a compact internal code once, so the interpreter
+// needs no checks for stack underflow or malformed code at run time.
+
+namespace esphome {
+namespace json_automation {
+
+static const size_t MAX_WASM_MODULE_SIZE = 4096;
+
+/// Resources one instance may use.
+struct WasmLimits {
+  /// Linear memory actually allocated; accesses beyond it trap, whatever the module declares.
+  uint32_t memory_bytes{4096};
+  /// Instructions per call.
+  uint32_t fuel{100000};
+  /// Value stack slots (locals and operands) of all active frames.
+  uint16_t stack_slots{256};
+  uint8_t call_depth{16};
+};
+
+/// Host functions a module can import from "env". Entities are indices into the entity list of the call.
+class WasmHost {
+ public:
+  virtual ~WasmHost() = default;
+
+  /// 1 or 0 for an entity that is on or off, -1 for an unknown entity.
+  virtual int32_t get_state(uint32_t entity) = 0;
+  virtual void set_state(uint32_t entity, bool state) = 0;
+  virtual void toggle(uint32_t entity) = 0;
+  virtual uint32_t millis() = 0;
+  virtual void log(const char *message, size_t length) = 0;
+};
+
+/// Translated instruction. Branches carry their target pc, plus the operand height and number of values
+/// kept at the target label.
+struct WasmInstr {
+  uint8_t op;
+  uint8_t arity;
+  uint16_t height;
+  uint32_t a;
+};
+
+/// Target of one br_table label; the instruction holds the index of its first entry and the entry count.
+struct WasmBranch {
+  uint32_t pc;
+  uint16_t height;
+  uint8_t arity;
+};
+
+struct WasmFuncType {
+  uint8_t params;
+  uint8_t results;
+};
+
+struct WasmFunction {
+  uint32_t type;
+  uint16_t locals;
+  uint16_t max_height;
+  std::vector<WasmInstr> code;
+};
+
+struct WasmGlobal {
+  int32_t init;
+  bool is_mutable;
+};
+
+struct WasmDataSegment {
+  uint32_t offset;
+  std::vector<uint8_t> data;
+};
+
+/// Decoded and validated module. Immutable once parsed; instances keep their own memory and globals.
+class WasmModule {
+ public:
+  bool parse(const uint8_t *data, size_t size, std::string &error);
+
+  /// Index of an exported function, or -1.
+  int32_t find_export(const std::string &name) const;
+  const WasmFuncType &get_type(uint32_t function) const;
+  size_t get_size() const { return this->size_; }
+
+ protected:
+  friend class WasmInstance;
+
+  struct Export {
+    std::string name;
+    uint32_t function;
+  };
+
+  bool parse_types(const uint8_t *&p, const uint8_t *end, std::string &error);
+  bool parse_imports(const uint8_t *&p, const uint8_t *end, std::string &error);
+  bool parse_functions(const uint8_t *&p, const uint8_t *end, std::string &error);
+  bool parse_memory(const uint8_t *&p, const uint8_t *end, std::string &error);
+  bool parse_globals(const uint8_t *&p, const uint8_t *end, std::string &error);
+  bool parse_exports(const uint8_t *&p, const uint8_t *end, std::string &error);
+  bool parse_code(const uint8_t *&p, const uint8_t *end, std::string &error);
+  bool parse_data(const uint8_t *&p, const uint8_t *end, std::string &error);
+  bool translate(const uint8_t *&p, const uint8_t *end, WasmFunction &function, std::string &error);
+
+  std::vector<WasmFuncType> types_;
+  /// Host function id of each import; imports come first in the function index space.
+  std::vector<uint8_t> imports_;
+  std::vector<uint32_t> import_types_;
+  std::vector<WasmFunction> functions_;
+  std::vector<WasmGlobal> globals_;
+  std::vector<Export> exports_;
+  std::vector<WasmDataSegment> data_;
+  std::vector<WasmBranch> branches_;
+  bool has_memory_{false};
+  uint32_t memory_pages_{0};
+  size_t size_{0};
+};
+
+/// Memory and globals of one module, and the interpreter that runs its functions.
+class WasmInstance {
+ public:
+  bool instantiate(std::shared_ptr<const WasmModule> module, const WasmLimits &limits, std::string &error);
+
+  /// Call a function with args. On a trap returns false and sets error; result is set if the function
+  /// returns a value. Not reentrant: a nested call on the same instance traps.
+  bool call(uint32_t function, const int32_t *args, size_t arg_count, WasmHost *host, int32_t &result,
+            bool &has_result, std::string &error);
+
+  const WasmModule &get_module() const { return *this->module_; }
+  bool is_running() const { return this->running_; }
+  /// Instructions executed by the last call.
+  uint32_t get_last_fuel_used() const { return this->last_fuel_used_; }
+
+ protected:
+  struct Frame {
+    uint32_t function;
+    uint32_t return_pc;
+    uint32_t base;
+  };
+
+  bool execute(uint32_t function, const int32_t *args, int32_t &result, std::string &error);
+  bool call_host(uint8_t host_function, const int32_t *args, int32_t &result, std::string &error);
+
+  std::shared_ptr<const WasmModule> module_;
+  WasmLimits limits_;
+  std::vector<uint8_t> memory_;
+  std::vector<int32_t> globals_;
+  std::vector<int32_t> stack_;
+  std::vector<Frame> frames_;
+  WasmHost *host_{nullptr};
+  uint32_t last_fuel_used_{0};
+  bool running_{false};
+};
+
+}  // namespace json_automation
+}  // namespace esphome
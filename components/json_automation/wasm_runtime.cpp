@@ -0,0 +1,268 @@
+#include "wasm_runtime.h"
+#include <cstdarg>
+#include <cstdio>
+
+namespace esphome {
+namespace json_automation {
+
+static const size_t LOG_BUFFER_SIZE = 192;
+
+static std::string blob_name(const std::string &module) { return "wasm:" + module; }
+
+void WasmRuntime::logf(LogLevel level, const char *format, ...) {
+  if (level > this->log_->get_level())
+    return;
+  char buffer[LOG_BUFFER_SIZE];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  this->log_->log(level, buffer);
+}
+
+bool WasmRuntime::add_module(const std::string &name, const std::vector<uint8_t> &data, bool save) {
+  std::string error;
+  WasmModuleSlot &slot = this->modules_[this->slot_of(name)];
+  if (!this->instantiate(slot, data, error)) {
+    this->logf(LogLevel::ERROR, "Invalid WebAssembly module %s: %s", name.c_str(), error.c_str());
+    return false;
+  }
+  this->logf(LogLevel::INFO, "Loaded WebAssembly module %s (%u bytes)", name.c_str(), (unsigned) data.size());
+  if (save && !this->storage_->save_blob(blob_name(name), data))
+    this->logf(LogLevel::WARN, "Failed to save WebAssembly module %s", name.c_str());
+  return true;
+}
+
+size_t WasmRuntime::slot_of(const std::string &name) {
+  for (size_t i = 0; i < this->modules_.size(); i++) {
+    if (this->modules_[i].name == name)
+      return i;
+  }
+  this->modules_.emplace_back();
+  this->modules_.back().name = name;
+
+  std::vector<uint8_t> stored;
+  std::string error;
+  if (this->storage_->load_blob(blob_name(name), stored)) {
+    if (this->instantiate(this->modules_.back(), stored, error)) {
+      this->logf(LogLevel::DEBUG, "Loaded WebAssembly module %s from preferences (%u bytes)", name.c_str(),
+                 (unsigned) stored.size());
+    } else {
+      this->logf(LogLevel::ERROR, "Stored WebAssembly module %s is invalid: %s", name.c_str(), error.c_str());
+    }
+  }
+  return this->modules_.size() - 1;
+}
+
+bool WasmRuntime::instantiate(WasmModuleSlot &slot, const std::vector<uint8_t> &data, std::string &error) {
+  if (slot.instance && slot.instance->is_running()) {
+    error = "module is running";
+    return false;
+  }
+  auto module = std::make_shared<WasmModule>();
+  if (!module->parse(data.data(), data.size(), error))
+    return false;
+  std::unique_ptr<WasmInstance> instance(new WasmInstance());
+  if (!instance->instantiate(std::move(module), this->limits_, error))
+    return false;
+  slot.instance = std::move(instance);
+  slot.version++;
+  return true;
+}
+
+int32_t WasmRuntime::resolve_call(const WasmCall &call) {
+  for (size_t i = 0; i < this->calls_.size(); i++) {
+    if (this->calls_[i].in_use && this->calls_[i].call == call)
+      return i;
+  }
+
+  PreparedWasmCall prepared;
+  for (const auto &name : call.entities) {
+    const size_t dot = name.find('.');
+    const std::string domain = name.substr(0, dot);
+    const std::string object_id = dot == std::string::npos ? "" : name.substr(dot + 1);
+    WasmEntity entity{ActionSource::UNKNOWN, false, INVALID_HANDLE};
+    if (domain == "input" || domain == "binary_sensor") {
+      entity.input = true;
+      entity.handle = this->entities_->resolve_input(object_id);
+    } else if (domain == "switch" || domain == "light") {
+      entity.source = domain == "switch" ? ActionSource::SWITCH : ActionSource::LIGHT;
+      entity.handle = this->entities_->resolve_output(entity.source, object_id);
+    }
+    if (entity.handle == INVALID_HANDLE) {
+      this->logf(LogLevel::WARN, "Unknown entity %s in WebAssembly action", name.c_str());
+      return INVALID_HANDLE;
+    }
+    prepared.entities.push_back(entity);
+  }
+
+  prepared.call = call;
+  prepared.module = this->slot_of(call.module);
+  if (!this->modules_[prepared.module].instance) {
+    this->logf(LogLevel::WARN, "WebAssembly module %s is not loaded yet", call.module.c_str());
+  } else if (!this->bind(prepared)) {
+    return INVALID_HANDLE;
+  }
+  // A deferred prune only spares calls prepared after it, so free entries are not reused until it has run
+  for (size_t i = 0; !this->prune_deferred_ && i < this->calls_.size(); i++) {
+    if (!this->calls_[i].in_use) {
+      this->calls_[i] = std::move(prepared);
+      return i;
+    }
+  }
+  this->calls_.push_back(std::move(prepared));
+  return this->calls_.size() - 1;
+}
+
+void WasmRuntime::prune_calls(const std::vector<int32_t> &used) {
+  if (this->current_ >= 0) {
+    this->deferred_used_ = used;
+    this->deferred_limit_ = this->calls_.size();
+    this->prune_deferred_ = true;
+    return;
+  }
+  this->release_calls(used, this->calls_.size());
+}
+
+void WasmRuntime::release_calls(const std::vector<int32_t> &used, size_t limit) {
+  std::vector<bool> keep(this->calls_.size(), false);
+  for (int32_t handle : used) {
+    if (handle >= 0 && static_cast<size_t>(handle) < keep.size())
+      keep[handle] = true;
+  }
+  size_t released = 0;
+  for (size_t i = 0; i < limit && i < this->calls_.size(); i++) {
+    if (keep[i] || !this->calls_[i].in_use)
+      continue;
+    this->calls_[i] = PreparedWasmCall();
+    this->calls_[i].in_use = false;
+    released++;
+  }
+  while (!this->calls_.empty() && !this->calls_.back().in_use)
+    this->calls_.pop_back();
+  if (released != 0)
+    this->logf(LogLevel::DEBUG, "Released %u unused WebAssembly calls", (unsigned) released);
+}
+
+size_t WasmRuntime::get_call_count() const {
+  size_t count = 0;
+  for (const auto &prepared : this->calls_)
+    count += prepared.in_use ? 1 : 0;
+  return count;
+}
+
+bool WasmRuntime::bind(PreparedWasmCall &prepared) {
+  const WasmModuleSlot &slot = this->modules_[prepared.module];
+  const WasmModule &module = slot.instance->get_module();
+  prepared.version = slot.version;
+  prepared.function = module.find_export(prepared.call.function);
+  if (prepared.function < 0) {
+    this->logf(LogLevel::WARN, "WebAssembly module %s has no function %s", slot.name.c_str(),
+               prepared.call.function.c_str());
+    return false;
+  }
+  const WasmFuncType &type = module.get_type(prepared.function);
+  if (type.params > 1) {
+    this->logf(LogLevel::WARN, "WebAssembly function %s.%s must take no parameter or one i32", slot.name.c_str(),
+               prepared.call.function.c_str());
+    prepared.function = -1;
+    return false;
+  }
+  prepared.params = type.params;
+  return true;
+}
+
+bool WasmRuntime::run_call(int32_t handle, const TriggerPayload &payload) {
+  PreparedWasmCall &prepared = this->calls_[handle];
+  WasmModuleSlot &slot = this->modules_[prepared.module];
+  if (!slot.instance) {
+    this->logf(LogLevel::WARN, "WebAssembly module %s is not loaded", slot.name.c_str());
+    return false;
+  }
+  if (prepared.version != slot.version)
+    this->bind(prepared);
+  if (prepared.function < 0)
+    return false;
+
+  // The module may make actions run that reload the rules and prepare new calls, so nothing that lives in
+  // calls_ or modules_ is referenced across the call
+  WasmInstance *instance = slot.instance.get();
+  const size_t module = prepared.module;
+  const uint32_t function = prepared.function;
+  const int32_t arg = prepared.call.trigger_arg ? payload.as_int() : prepared.call.arg;
+  const size_t arg_count = prepared.params;
+  const int32_t previous = this->current_;
+  int32_t result = 0;
+  bool has_result = false;
+  std::string error;
+  this->current_ = handle;
+  const bool ok = instance->call(function, &arg, arg_count, this, result, has_result, error);
+  this->current_ = previous;
+
+  WasmModuleSlot &ran = this->modules_[module];
+  ran.calls++;
+  if (instance->get_last_fuel_used() > ran.max_fuel_used)
+    ran.max_fuel_used = instance->get_last_fuel_used();
+  if (!ok) {
+    ran.traps++;
+    this->logf(LogLevel::WARN, "WebAssembly trap in %s.%s: %s", ran.name.c_str(),
+               this->calls_[handle].call.function.c_str(), error.c_str());
+  }
+  if (this->current_ < 0 && this->prune_deferred_) {
+    this->prune_deferred_ = false;
+    std::vector<int32_t> used;
+    used.swap(this->deferred_used_);
+    this->release_calls(used, this->deferred_limit_);
+  }
+  // A function that returns a value acts as a condition: zero stops the chain
+  return ok && (!has_result || result != 0);
+}
+
+const WasmEntity *WasmRuntime::entity(uint32_t index) const {
+  if (this->current_ < 0)
+    return nullptr;
+  const auto &entities = this->calls_[this->current_].entities;
+  return index < entities.size() ? &entities[index] : nullptr;
+}
+
+int32_t WasmRuntime::get_state(uint32_t index) {
+  const WasmEntity *entity = this->entity(index);
+  if (entity == nullptr)
+    return -1;
+  if (entity->input)
+    return this->entities_->get_input_state(entity->handle) ? 1 : 0;
+  return this->entities_->get_output_state(entity->source, entity->handle) ? 1 : 0;
+}
+
+void WasmRuntime::set_state(uint32_t index, bool state) {
+  const WasmEntity *entity = this->entity(index);
+  if (entity == nullptr || entity->input)
+    return;
+  this->perform(*entity, state ? ActionType::TURN_ON : ActionType::TURN_OFF);
+}
+
+void WasmRuntime::toggle(uint32_t index) {
+  const WasmEntity *entity = this->entity(index);
+  if (entity == nullptr || entity->input)
+    return;
+  this->perform(*entity, ActionType::TOGGLE);
+}
+
+void WasmRuntime::perform(const WasmEntity &entity, ActionType type) {
+  // A rejection is counted and logged by the engine; the module keeps running, like after a no-op
+  if (this->engine_ != nullptr) {
+    this->engine_->perform_output(entity.source, type, entity.handle);
+  } else {
+    this->entities_->perform(entity.source, type, entity.handle);
+  }
+}
+
+uint32_t WasmRuntime::millis() { return this->clock_->millis(); }
+
+void WasmRuntime::log(const char *message, size_t length) {
+  const std::string &module = this->modules_[this->calls_[this->current_].module].name;
+  this->logf(LogLevel::INFO, "[%s] %.*s", module.c_str(), (int) length, message);
+}
+
+}  // namespace json_automation
+}  // namespace esphome
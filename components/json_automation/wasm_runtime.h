@@ -0,0 +1,107 @@
+#pragma once
+
+#include "engine_adapters.h"
+#include "rule_engine.h"
+#include "wasm_interpreter.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace json_automation {
+
+/// A named module and the one instance all calls to it share, so its memory and globals persist between
+/// calls. Replacing the module creates a fresh instance.
+struct WasmModuleSlot {
+  std::string name;
+  /// Null until the module is loaded.
+  std::unique_ptr<WasmInstance> instance;
+  /// Bumped on every load, so prepared calls look their export up again.
+  uint32_t version{0};
+  uint32_t calls{0};
+  uint32_t traps{0};
+  uint32_t max_fuel_used{0};
+};
+
+/// Entity of a call, resolved through the EntityAdapter.
+struct WasmEntity {
+  ActionSource source;
+  bool input;
+  int32_t handle;
+};
+
+struct PreparedWasmCall {
+  WasmCall call;
+  uint16_t module;
+  std::vector<WasmEntity> entities;
+  int32_t function{-1};
+  uint8_t params{0};
+  uint32_t version{0};
+  /// False once pruned; the entry is kept so other handles do not move, and reused by the next new call.
+  bool in_use{true};
+};
+
+/// ScriptAdapter that runs WebAssembly actions in WasmInstance sandboxes: memory, fuel and stack are bounded
+/// by WasmLimits and the module reaches entities only through the host functions of WasmHost. Modules are
+/// kept in the StorageAdapter blob "wasm:<name>" and loaded on first use.
+class WasmRuntime : public ScriptAdapter, protected WasmHost {
+ public:
+  WasmRuntime(EntityAdapter *entities, StorageAdapter *storage, ClockAdapter *clock, LogAdapter *log)
+      : entities_(entities), storage_(storage), clock_(clock), log_(log) {}
+
+  /// Route the output changes of modules through the engine, so they obey its interlocks. Without an engine they
+  /// go straight to the entity adapter.
+  void set_engine(RuleEngine *engine) { this->engine_ = engine; }
+
+  /// Applies to modules loaded afterwards.
+  void set_limits(const WasmLimits &limits) { this->limits_ = limits; }
+  const WasmLimits &get_limits() const { return this->limits_; }
+
+  /// Validate and instantiate a module, replacing one of the same name; with save, also store it for the
+  /// next boot. Prepared calls use the new module from their next run.
+  bool add_module(const std::string &name, const std::vector<uint8_t> &data, bool save);
+  const std::vector<WasmModuleSlot> &get_modules() const { return this->modules_; }
+
+  int32_t resolve_call(const WasmCall &call) override;
+  /// Free the calls not in used. While a module is running (its actions may reload the rules) this waits until
+  /// the outermost call has returned.
+  void prune_calls(const std::vector<int32_t> &used) override;
+  bool run_call(int32_t handle, const TriggerPayload &payload) override;
+  /// Prepared calls in use.
+  size_t get_call_count() const;
+
+ protected:
+  int32_t get_state(uint32_t entity) override;
+  void set_state(uint32_t entity, bool state) override;
+  void toggle(uint32_t entity) override;
+  uint32_t millis() override;
+  void log(const char *message, size_t length) override;
+
+  size_t slot_of(const std::string &name);
+  bool instantiate(WasmModuleSlot &slot, const std::vector<uint8_t> &data, std::string &error);
+  bool bind(PreparedWasmCall &prepared);
+  /// Free the calls below limit that are not in used.
+  void release_calls(const std::vector<int32_t> &used, size_t limit);
+  const WasmEntity *entity(uint32_t index) const;
+  void perform(const WasmEntity &entity, ActionType type);
+  void logf(LogLevel level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+  EntityAdapter *entities_;
+  StorageAdapter *storage_;
+  ClockAdapter *clock_;
+  LogAdapter *log_;
+  RuleEngine *engine_{nullptr};
+  WasmLimits limits_;
+  std::vector<WasmModuleSlot> modules_;
+  std::vector<PreparedWasmCall> calls_;
+  /// Call whose module is running, for the host functions; -1 outside of calls.
+  int32_t current_{-1};
+  /// prune_calls() that came during a call: its handles, and the number of calls prepared by then.
+  std::vector<int32_t> deferred_used_;
+  size_t deferred_limit_{0};
+  bool prune_deferred_{false};
+};
+
+}  // namespace json_automation
+}  // namespace esphome
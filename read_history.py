@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""
+Decode a json_automation execution history
+
+Reads a history exported with `json_automation.dump_history` (either the device
+log containing the `history[....]:` lines or a plain hex string) and prints one
+line per rule run, oldest first: boot number, time since that boot, rule and
+result. The device log also has the id of each rule index at dump time, which
+names the runs since the last rule set change. With --rules, older runs are
+named by their index in that rule set.
+"""
+
+import argparse
+import json
+import re
+import struct
+import sys
+
+HISTORY_LINE_RE = re.compile(r"history\[(\d+)\]: ([0-9a-fA-F]+)")
+RULE_LINE_RE = re.compile(r"history rule\[(\d+)\]: ([^\s\x1b]+)")
+HISTORY_MAGIC = b"JAHS"
+HISTORY_VERSION = 1
+RULES_CHANGED = 0xFFFF
+RESULTS = {0: "done", 1: "delayed", 2: "stopped"}
+
+
+def read_dump(path):
+    """Return the history as bytes from a device log or a raw hex file, and the rule ids the log exports"""
+    with open(path) as f:
+        text = f.read()
+    chunks = {int(offset): data for offset, data in HISTORY_LINE_RE.findall(text)}
+    if not chunks:
+        return bytes.fromhex("".join(text.split())), []
+    rules = {int(index): rule_id for index, rule_id in RULE_LINE_RE.findall(text)}
+    ids = [rules.get(index, f"#{index}") for index in range(max(rules) + 1)] if rules else []
+    return bytes.fromhex("".join(chunks[offset] for offset in sorted(chunks))), ids
+
+
+def decode(data):
+    """Return the boot number of the dump and the records as (time_ms, rule, result, boot) tuples"""
+    if len(data) < 8 or data[:4] != HISTORY_MAGIC or data[4] != HISTORY_VERSION:
+        raise ValueError("not an execution history")
+    boot, count = struct.unpack_from("<BH", data, 5)
+    if len(data) < 8 + count * 8:
+        raise ValueError(f"history is truncated ({len(data)} bytes for {count} records)")
+    return boot, [struct.unpack_from("<IHBB", data, 8 + i * 8) for i in range(count)]
+
+
+def first_current(boot, records):
+    """Return the index of the first record of the rule set active at dump time
+
+    That is the record after the last rule set change of the dumping boot; a dump always has one once the
+    rules changed, since the device marks a change it has not recorded yet before dumping.
+    """
+    for i in range(len(records) - 1, -1, -1):
+        if records[i][1] == RULES_CHANGED:
+            return i + 1 if records[i][3] == boot else len(records)
+    return len(records)
+
+
+def main():
+    """Print the decoded history"""
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("history", help="Device log or hex file with the exported history")
+    parser.add_argument("--rules", help="JSON rule set of older runs, in the order of the engine, to show their ids")
+    args = parser.parse_args()
+
+    older_ids = []
+    if args.rules:
+        with open(args.rules) as f:
+            older_ids = [rule.get("id", "?") for rule in json.load(f)]
+    try:
+        data, current_ids = read_dump(args.history)
+        boot, records = decode(data)
+    except ValueError as err:
+        print(f"❌ {err}")
+        return 1
+
+    print(f"{len(records)} runs, dumped during boot {boot}")
+    current = first_current(boot, records)
+    for index, (time_ms, rule, result, record_boot) in enumerate(records):
+        stamp = f"boot {record_boot:3d} {time_ms / 1000:12.3f}s"
+        if rule == RULES_CHANGED:
+            print(f"{stamp}  -- rule set changed --")
+            continue
+        ids = current_ids if index >= current else older_ids
+        name = ids[rule] if rule < len(ids) else f"#{rule}"
+        print(f"{stamp}  {name}: {RESULTS.get(result, result)}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
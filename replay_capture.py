@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""
+Host replay of a json_automation workload capture
+
+Reads a capture exported with `json_automation.dump_capture` (either the device
+log containing the `capture[....]:` lines or a plain hex string), builds an
+ESPHome host-platform firmware with the same base rules, overlay and template
+entities, replays the captured input events at real or accelerated time and prints the
+dispatch latency and per-action cost profile reported by the component.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import time
+
+import benchmark_json_vs_native as bench
+
+CAPTURE_LINE_RE = re.compile(r"capture\[(\d+)\]: ([0-9a-fA-F]+)")
+REPORT_RE = re.compile(r"(Replay|Replaying|Dispatch latency|Action cost|    \S.*: n=\d+|Capture was recorded)")
+
+
+def read_capture(path):
+    """Return the capture as a hex string from a device log or a raw hex file"""
+    with open(path) as f:
+        text = f.read()
+    chunks = {int(offset): data for offset, data in CAPTURE_LINE_RE.findall(text)}
+    if chunks:
+        return "".join(chunks[offset] for offset in sorted(chunks))
+    return "".join(text.split())
+
+
+def build_config(rules, rules_text, overlay_text, capture_hex, speed, component_path):
+    """Return a host configuration that loads the overlay and replays the capture once on boot"""
+    lines = [
+        "esphome:",
+        "  name: json-automation-replay",
+        "  on_boot:",
+        "    priority: -100",
+        "    then:",
+    ]
+    if overlay_text is not None:
+        lines += [
+            "      - json_automation.load_json:",
+            "          id: rules",
+            f"          json_data: {json.dumps(overlay_text)}",
+        ]
+    lines += [
+        "      - json_automation.replay:",
+        "          id: rules",
+        f'          data: "{capture_hex}"',
+        f"          speed: {speed}",
+        "",
+        "host:",
+        "",
+        "logger:",
+        "  level: INFO",
+        "",
+        "external_components:",
+        "  - source:",
+        "      type: local",
+        f"      path: {component_path}",
+        "",
+        "json_automation:",
+        "  id: rules",
+        "  profiling: true",
+        "  capture_size: 1",
+        "  json_data: |",
+    ]
+    lines += ["    " + line for line in rules_text.strip().splitlines()]
+    lines.append("")
+    lines += bench.entities_yaml(rules, native=False)
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    """Build the replay firmware, run it and print the replay report"""
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("capture", help="Device log or hex file with the exported capture")
+    parser.add_argument("--rules", required=True, help="JSON base rules (json_data) the capture was recorded with")
+    parser.add_argument("--overlay", help="JSON overlay that was loaded on top of the base rules, if any")
+    parser.add_argument("--speed", type=float, default=1.0, help="Time scale, 0 replays as fast as possible")
+    parser.add_argument("--workdir", default="bench_build", help="Directory for the generated config")
+    parser.add_argument("--timeout", type=float, default=600.0, help="Seconds to wait for the replay to finish")
+    parser.add_argument("--esphome", default="esphome", help="ESPHome executable")
+    args = parser.parse_args()
+
+    # The capture header hashes the base rules followed by the overlay, so both are used as raw text: the base
+    # as json_data and the overlay through load_json before the replay starts
+    rules = bench.load_spec(args.rules)
+    with open(args.rules) as f:
+        rules_text = f.read()
+    overlay_text = None
+    if args.overlay:
+        # Patches without a trigger only enable or disable base rules and declare no entities
+        rules += [rule for rule in bench.load_spec(args.overlay) if "trigger" in rule]
+        with open(args.overlay) as f:
+            overlay_text = f.read()
+    capture_hex = read_capture(args.capture)
+    os.makedirs(args.workdir, exist_ok=True)
+    component_path = os.path.relpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), "components"), args.workdir)
+
+    config_path = os.path.join(args.workdir, "json-automation-replay.yaml")
+    with open(config_path, "w") as f:
+        f.write(build_config(rules, rules_text, overlay_text, capture_hex, args.speed, component_path))
+
+    print(f"Compiling {config_path}")
+    compiled = subprocess.run([args.esphome, "compile", config_path], capture_output=True, text=True)
+    if compiled.returncode != 0:
+        print(f"  ❌ Compilation failed\n{compiled.stdout[-2000:]}{compiled.stderr[-2000:]}")
+        return 1
+
+    program = bench.find_program(args.workdir, "json-automation-replay")
+    if program is None:
+        print("  ❌ Host executable not found")
+        return 1
+
+    print(f"Running {program}")
+    proc = subprocess.Popen([program], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    finished = False
+    deadline = time.monotonic() + args.timeout
+    try:
+        for line in proc.stdout:
+            if not REPORT_RE.search(line):
+                if finished or time.monotonic() > deadline:
+                    break
+                continue
+            print(line.rstrip())
+            finished |= "Replay finished" in line
+    finally:
+        proc.kill()
+        proc.wait()
+    return 0 if finished else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
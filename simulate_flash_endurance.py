@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""
+Flash endurance simulator for json_automation storage
+
+Replays an update schedule against a simulated preferences backend and projects
+sector erase counts over the years. The ESP32 model follows the NVS layout
+(4 KiB pages of 126 32-byte entries, blobs split into chunks with one header
+entry each, the oldest page erased and its live entries relocated when the log
+wraps). The ESP8266 model rewrites the single preferences sector on every commit.
+Saves that fall into the same flash_write_interval window are coalesced into
+one commit, like ESPHome's preferences sync.
+
+The schedule is either synthetic (--saves-per-day, --boots-per-day) or a file
+with one save timestamp in seconds per line, repeated over the horizon. Use the
+`Storage:` line of dump_config to measure the real save rate of a device.
+"""
+
+import argparse
+import math
+import sys
+
+NVS_PAGE_SIZE = 4096
+NVS_ENTRY_SIZE = 32
+NVS_ENTRIES_PER_PAGE = 126
+ESP8266_STORAGE_BYTES = 512
+SECONDS_PER_DAY = 24 * 3600
+
+
+class NvsModel:
+    """Ring of NVS pages with per-page erase counters"""
+
+    def __init__(self, partition_bytes, static_entries):
+        # The page NVS keeps free for garbage collection moves along the ring, so all pages wear
+        self.pages = partition_bytes // NVS_PAGE_SIZE
+        if self.pages < 2:
+            raise ValueError("NVS partition needs at least two pages")
+        self.erases = [0] * self.pages
+        self.static_entries = static_entries
+        self.current = 0
+        self.used = static_entries
+        self.entries_written = 0
+
+    def advance(self):
+        """Move to the next page, erasing it and relocating other live preferences"""
+        self.current = (self.current + 1) % self.pages
+        self.erases[self.current] += 1
+        self.used = self.static_entries
+        self.entries_written += self.static_entries
+
+    def write_blob(self, size):
+        """Append one blob version: data chunks with a header entry each, then the index entry"""
+        remaining = size
+        while remaining > 0:
+            available = NVS_ENTRIES_PER_PAGE - self.used - 1
+            if available < 1:
+                self.advance()
+                continue
+            chunk = min(remaining, available * NVS_ENTRY_SIZE)
+            entries = 1 + math.ceil(chunk / NVS_ENTRY_SIZE)
+            self.used += entries
+            self.entries_written += entries
+            remaining -= chunk
+        if self.used >= NVS_ENTRIES_PER_PAGE:
+            self.advance()
+        self.used += 1
+        self.entries_written += 1
+
+    def physical_bytes(self):
+        return self.entries_written * NVS_ENTRY_SIZE
+
+
+class Esp8266Model:
+    """Single preferences sector erased and rewritten on every commit"""
+
+    def __init__(self):
+        self.erases = [0]
+        self.bytes_written = 0
+
+    def write_blob(self, size):
+        self.erases[0] += 1
+        self.bytes_written += ESP8266_STORAGE_BYTES
+
+    def physical_bytes(self):
+        return self.bytes_written
+
+
+def load_schedule(args):
+    """Return (period_seconds, sorted save timestamps within one period)"""
+    if args.schedule:
+        with open(args.schedule) as f:
+            times = sorted(float(line.split()[0]) for line in f if line.strip() and not line.startswith("#"))
+        period = max(args.schedule_period or 0, (times[-1] + 1) if times else SECONDS_PER_DAY)
+        return period, times
+
+    times = []
+    if args.saves_per_day > 0:
+        step = SECONDS_PER_DAY / args.saves_per_day
+        times += [i * step for i in range(int(args.saves_per_day))]
+    if args.boots_per_day > 0:
+        # Boots that save, e.g. a save_json in on_boot
+        step = SECONDS_PER_DAY / args.boots_per_day
+        times += [i * step + step / 2 for i in range(int(args.boots_per_day))]
+    return SECONDS_PER_DAY, sorted(times)
+
+
+def commits_in_period(times, interval):
+    """Coalesce saves that fall into the same flash_write_interval window"""
+    if interval <= 0:
+        return len(times)
+    return len({int(t // interval) for t in times})
+
+
+def main():
+    """Run the simulation and print the projection"""
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--platform", choices=["esp32", "esp8266"], default="esp32")
+    parser.add_argument("--record-bytes", type=int, default=4096, help="Bytes per save (4096 = current full record)")
+    parser.add_argument("--saves-per-day", type=float, default=24, help="Synthetic rule updates per day")
+    parser.add_argument("--boots-per-day", type=float, default=0, help="Boots per day that save the rules")
+    parser.add_argument("--schedule", help="File with one save timestamp in seconds per line")
+    parser.add_argument("--schedule-period", type=float, help="Length of the schedule file period in seconds")
+    parser.add_argument("--flash-write-interval", type=float, default=60, help="preferences flash_write_interval in s")
+    parser.add_argument("--nvs-size", type=lambda value: int(value, 0), default=0x5000, help="NVS partition size")
+    parser.add_argument("--static-entries", type=int, default=16, help="NVS entries used by other preferences")
+    parser.add_argument("--endurance", type=int, default=100000, help="Rated erase cycles per sector")
+    parser.add_argument("--years", type=int, default=10, help="Projection horizon")
+    args = parser.parse_args()
+
+    period, times = load_schedule(args)
+    commits = commits_in_period(times, args.flash_write_interval)
+    commits_per_day = commits * SECONDS_PER_DAY / period
+
+    if args.platform == "esp32":
+        model = NvsModel(args.nvs_size, args.static_entries)
+    else:
+        model = Esp8266Model()
+        if args.record_bytes > ESP8266_STORAGE_BYTES:
+            print(f"⚠️  {args.record_bytes} B does not fit the {ESP8266_STORAGE_BYTES} B ESP8266 preferences storage")
+
+    # Simulate one year of commits and scale linearly for the projection
+    year_commits = int(round(commits_per_day * 365))
+    for _ in range(year_commits):
+        model.write_blob(args.record_bytes)
+
+    max_erases_per_year = max(model.erases)
+    print(f"Platform:              {args.platform}")
+    print(f"Saves per period:      {len(times)} in {period / 3600:.1f} h -> {commits} commits")
+    print(f"Commits per day:       {commits_per_day:.1f}")
+    print(f"Logical bytes/commit:  {args.record_bytes} B")
+    if year_commits:
+        print(f"Physical bytes/commit: {model.physical_bytes() / year_commits:.0f} B")
+    print(f"Sectors in rotation:   {len(model.erases)}")
+    print()
+    print(f"{'Year':>4}{'Max erases/sector':>20}{'Endurance used':>16}")
+    for year in range(1, args.years + 1):
+        erases = max_erases_per_year * year
+        print(f"{year:>4}{erases:>20}{erases / args.endurance:>15.1%}")
+
+    if max_erases_per_year:
+        lifetime = args.endurance / max_erases_per_year
+        print()
+        print(f"Projected lifetime: {lifetime:.1f} years until a sector reaches {args.endurance} erases")
+        return 0 if lifetime >= args.years else 1
+    print()
+    print("No commits in the schedule")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+"""
+Reload soak test
+
+Builds an ESPHome host-platform firmware that performs thousands of reload
+cycles: load a randomly chosen rule set, fire its inputs so delay chains are
+left running, load a patch overlay that enables or disables base rules by id and
+fire the inputs again, then reload the baseline rule set and sample the heap. Live
+allocations after every baseline reload must stay at the level of the first
+sample; the test reports leak growth per cycle and heap fragmentation and exits
+non-zero when the heap drifts beyond the tolerance.
+"""
+
+import argparse
+import json
+import os
+import random
+import re
+import subprocess
+import sys
+import time
+
+import benchmark_json_vs_native as bench
+
+SAMPLE_RE = re.compile(r"SOAK cycle=(\d+) used=(\d+) free=(\d+)")
+DONE_RE = re.compile(r"SOAK done cycles=(\d+)")
+
+INPUTS = [f"soak_in_{i}" for i in range(4)]
+SWITCHES = [f"soak_sw_{i}" for i in range(3)]
+LIGHTS = [f"soak_light_{i}" for i in range(2)]
+MAX_JSON_SIZE = 4095
+
+
+def random_action(rng):
+    """Return a random action, occasionally one referencing a missing entity"""
+    kind = rng.choice(["switch", "switch", "light", "delay"])
+    if kind == "delay":
+        return {"source": "delay", "delay_s": rng.randint(1, 3)}
+    targets = SWITCHES if kind == "switch" else LIGHTS
+    target = rng.choice(targets) if rng.random() > 0.05 else "missing_entity"
+    return {"source": kind, "type": rng.choice(["turn_on", "turn_off", "toggle"]), "switch_id": target}
+
+
+def random_rule_set(rng, index):
+    """Return a random rule set that fits into MAX_JSON_SIZE"""
+    rules = []
+    for rule_index in range(rng.randint(1, 24)):
+        rule = {
+            "id": f"soak_{index}_{rule_index}",
+            "enabled": rng.random() > 0.1,
+            "trigger": {"source": "Input", "type": rng.choice(["press", "release"]), "input_id": rng.choice(INPUTS)},
+            "actions": [random_action(rng) for _ in range(rng.randint(1, 4))],
+        }
+        candidate = json.dumps(rules + [rule], separators=(",", ":"))
+        if len(candidate) > MAX_JSON_SIZE:
+            break
+        rules.append(rule)
+    return json.dumps(rules, separators=(",", ":"))
+
+
+def random_patch_set(rng, baseline):
+    """Return an overlay of {"id", "enabled"} patches for random base rules, plus one that matches no rule"""
+    ids = [rule["id"] for rule in json.loads(baseline)]
+    patched = rng.sample(ids, rng.randint(1, len(ids)))
+    patches = [{"id": rule_id, "enabled": rng.random() > 0.5} for rule_id in patched]
+    patches.append({"id": "soak_missing", "enabled": False})
+    return json.dumps(patches, separators=(",", ":"))
+
+
+def build_config(rule_sets, patch_sets, cycles, sample_every, component_path):
+    """Return the host configuration running the soak loop"""
+    baseline = rule_sets[0]
+    # A pseudo rule per input lets entities_yaml() declare every entity the random sets may use
+    targets = [{"source": "switch", "switch_id": switch_id} for switch_id in SWITCHES]
+    targets += [{"source": "light", "switch_id": light_id} for light_id in LIGHTS]
+    entities = [{"trigger": {"input_id": input_id}, "actions": targets} for input_id in INPUTS]
+
+    lines = [
+        "esphome:",
+        "  name: json-automation-soak",
+        "",
+        "host:",
+        "",
+        "logger:",
+        "  level: INFO",
+        "",
+        "external_components:",
+        "  - source:",
+        "      type: local",
+        f"      path: {component_path}",
+        "",
+        "json_automation:",
+        "  id: rules",
+        f"  json_data: '{baseline}'",
+        "",
+    ]
+    lines += bench.entities_yaml(entities, native=False)
+    lines += [
+        "",
+        "interval:",
+        "  - interval: 1ms",
+        "    then:",
+        "      - lambda: |-",
+        "          static const char *const RULE_SETS[] = {",
+    ]
+    lines += [f'              R"json({rule_set})json",' for rule_set in rule_sets[1:]]
+    lines += [
+        "          };",
+        "          static const char *const PATCH_SETS[] = {",
+    ]
+    lines += [f'              R"json({patch_set})json",' for patch_set in patch_sets]
+    lines += [
+        "          };",
+        "          static uint32_t cycle = 0;",
+        f"          if (cycle > {cycles})",
+        "            return;",
+        f"          if (cycle == {cycles}) {{",
+        '            ESP_LOGI("soak", "SOAK done cycles=%u", cycle);',
+        "            cycle++;",
+        "            return;",
+        "          }",
+        "          id(rules).load_json(RULE_SETS[random_uint32() % (sizeof(RULE_SETS) / sizeof(RULE_SETS[0]))]);",
+    ]
+    fire_inputs = []
+    for input_id in INPUTS:
+        fire_inputs += [
+            f"          id({input_id}).publish_state(true);",
+            f"          id({input_id}).publish_state(false);",
+        ]
+    lines += fire_inputs
+    lines += [
+        "          id(rules).load_json(PATCH_SETS[random_uint32() % (sizeof(PATCH_SETS) / sizeof(PATCH_SETS[0]))]);",
+    ]
+    lines += fire_inputs
+    lines += [
+        f'          id(rules).load_json(R"json({baseline})json");',
+        f"          if (cycle % {sample_every} == 0) {{",
+        "            const auto &heap = id(rules).get_reload_stats().heap_after;",
+        '            ESP_LOGI("soak", "SOAK cycle=%u used=%u free=%u", cycle, (unsigned) heap.used_bytes,',
+        "                     (unsigned) heap.free_bytes);",
+        "          }",
+        "          cycle++;",
+    ]
+    return "\n".join(lines) + "\n"
+
+
+def slope(samples):
+    """Least-squares slope of used bytes over cycles"""
+    n = len(samples)
+    mean_x = sum(cycle for cycle, _, _ in samples) / n
+    mean_y = sum(used for _, used, _ in samples) / n
+    num = sum((cycle - mean_x) * (used - mean_y) for cycle, used, _ in samples)
+    den = sum((cycle - mean_x) ** 2 for cycle, _, _ in samples)
+    return num / den if den else 0.0
+
+
+def main():
+    """Build and run the soak firmware, then evaluate the heap samples"""
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--cycles", type=int, default=5000, help="Number of reload cycles")
+    parser.add_argument("--rule-sets", type=int, default=16, help="Number of random rule sets to cycle through")
+    parser.add_argument("--sample-every", type=int, default=100, help="Heap sample interval in cycles")
+    parser.add_argument("--tolerance", type=int, default=1024, help="Allowed heap growth in bytes")
+    parser.add_argument("--seed", type=int, default=1, help="Seed for the random rule sets")
+    parser.add_argument("--workdir", default="bench_build", help="Directory for the generated config")
+    parser.add_argument("--timeout", type=float, default=1800.0, help="Seconds to wait for the run")
+    parser.add_argument("--esphome", default="esphome", help="ESPHome executable")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    rule_sets = [random_rule_set(rng, index) for index in range(args.rule_sets + 1)]
+    patch_sets = [random_patch_set(rng, rule_sets[0]) for _ in range(args.rule_sets)]
+    os.makedirs(args.workdir, exist_ok=True)
+    component_path = os.path.relpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), "components"), args.workdir)
+
+    config_path = os.path.join(args.workdir, "json-automation-soak.yaml")
+    with open(config_path, "w") as f:
+        f.write(build_config(rule_sets, patch_sets, args.cycles, args.sample_every, component_path))
+
+    print(f"Compiling {config_path}")
+    compiled = subprocess.run([args.esphome, "compile", config_path], capture_output=True, text=True)
+    if compiled.returncode != 0:
+        print(f"  ❌ Compilation failed\n{compiled.stdout[-2000:]}{compiled.stderr[-2000:]}")
+        return 1
+
+    program = bench.find_program(args.workdir, "json-automation-soak")
+    if program is None:
+        print("  ❌ Host executable not found")
+        return 1
+
+    print(f"Running {program} for {args.cycles} cycles")
+    samples = []
+    done = False
+    deadline = time.monotonic() + args.timeout
+    proc = subprocess.Popen([program], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    try:
+        for line in proc.stdout:
+            match = SAMPLE_RE.search(line)
+            if match:
+                samples.append(tuple(int(value) for value in match.groups()))
+            if DONE_RE.search(line):
+                done = True
+                break
+            if time.monotonic() > deadline:
+                print("  ⚠️  Timed out before the soak finished")
+                break
+    finally:
+        proc.kill()
+        proc.wait()
+
+    if not done or len(samples) < 2:
+        print("❌ Soak did not complete")
+        return 1
+
+    _, baseline_used, _ = samples[0]
+    last_cycle, last_used, last_free = samples[-1]
+    peak_used = max(used for _, used, _ in samples)
+    fragmentation = last_free / (last_used + last_free) if last_used + last_free else 0.0
+
+    print()
+    print(f"Baseline live heap:     {baseline_used} B")
+    print(f"Final live heap:        {last_used} B after {last_cycle} cycles (peak {peak_used} B)")
+    print(f"Leak growth per cycle:  {slope(samples):.2f} B")
+    print(f"Free heap inside arena: {last_free} B ({fragmentation:.1%} of arena, fragmentation indicator)")
+
+    if last_used - baseline_used > args.tolerance:
+        print(f"❌ Live heap grew by {last_used - baseline_used} B (tolerance {args.tolerance} B)")
+        return 1
+    print("✅ Live allocations returned to baseline")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
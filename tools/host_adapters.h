@@ -0,0 +1,181 @@
+#pragma once
+
+// Host implementations of the rule engine adapters, shared by the tools under tools/.
+
+#include "engine_adapters.h"
+#include "rule_engine.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace esphome {
+namespace json_automation {
+
+/// Inputs, sensors and outputs created on first reference, so any rule set resolves completely.
+/// Handles index the state vectors; perform() applies the action and counts it.
+class HostEntities : public EntityAdapter {
+ public:
+  void set_engine(RuleEngine *engine) { this->engine_ = engine; }
+
+  int32_t resolve_input(const std::string &object_id) override {
+    return handle_of(this->input_ids_, this->inputs_, object_id);
+  }
+
+  int32_t resolve_sensor(const std::string &object_id) override {
+    auto it = this->sensor_ids_.find(object_id);
+    if (it != this->sensor_ids_.end())
+      return it->second;
+    const int32_t handle = this->sensor_ids_.size();
+    this->sensor_ids_.emplace(object_id, handle);
+    return handle;
+  }
+
+  int32_t resolve_output(ActionSource source, const std::string &object_id) override {
+    if (source != ActionSource::SWITCH && source != ActionSource::LIGHT)
+      return INVALID_HANDLE;
+    return handle_of(this->output_ids_, this->outputs_, object_id);
+  }
+
+  void perform(ActionSource source, ActionType type, int32_t handle) override {
+    auto &state = this->outputs_[handle];
+    if (type == ActionType::TURN_ON) {
+      state = true;
+    } else if (type == ActionType::TURN_OFF) {
+      state = false;
+    } else if (type == ActionType::TOGGLE) {
+      state = !state;
+    }
+    this->actions_performed_++;
+  }
+
+  bool get_input_state(int32_t handle) override { return this->inputs_[handle] != 0; }
+  bool get_output_state(ActionSource source, int32_t handle) override { return this->outputs_[handle] != 0; }
+
+  /// Publish an input state; like a binary sensor, only changes reach the engine (if there is one).
+  void set_input(int32_t handle, bool state) {
+    if (this->inputs_[handle] == static_cast<uint8_t>(state))
+      return;
+    this->inputs_[handle] = state;
+    if (this->engine_ != nullptr)
+      this->engine_->dispatch_input(handle, state);
+  }
+
+  /// Publish a sensor value to the engine (if there is one).
+  void set_sensor(int32_t handle, float value) {
+    if (this->engine_ != nullptr)
+      this->engine_->post_sensor(handle, value);
+  }
+
+  size_t get_input_count() const { return this->inputs_.size(); }
+  size_t get_sensor_count() const { return this->sensor_ids_.size(); }
+  size_t get_output_count() const { return this->outputs_.size(); }
+  bool get_output(int32_t handle) const { return this->outputs_[handle] != 0; }
+  uint64_t get_actions_performed() const { return this->actions_performed_; }
+
+ protected:
+  static int32_t handle_of(std::unordered_map<std::string, int32_t> &ids, std::vector<uint8_t> &states,
+                           const std::string &object_id) {
+    auto it = ids.find(object_id);
+    if (it != ids.end())
+      return it->second;
+    const int32_t handle = states.size();
+    ids.emplace(object_id, handle);
+    states.push_back(0);
+    return handle;
+  }
+
+  RuleEngine *engine_{nullptr};
+  std::unordered_map<std::string, int32_t> input_ids_;
+  std::unordered_map<std::string, int32_t> output_ids_;
+  std::unordered_map<std::string, int32_t> sensor_ids_;
+  std::vector<uint8_t> inputs_;
+  std::vector<uint8_t> outputs_;
+  uint64_t actions_performed_{0};
+};
+
+/// Preferences record kept in memory.
+class MemoryStorage : public StorageAdapter {
+ public:
+  bool load(std::string &json_data) override {
+    if (!this->stored_)
+      return false;
+    json_data = this->data_;
+    return true;
+  }
+
+  bool save(const std::string &json_data) override {
+    this->data_ = json_data;
+    this->stored_ = true;
+    return true;
+  }
+
+  bool load_blob(const std::string &name, std::vector<uint8_t> &data) override {
+    auto it = this->blobs_.find(name);
+    if (it == this->blobs_.end())
+      return false;
+    data = it->second;
+    return true;
+  }
+
+  bool save_blob(const std::string &name, const std::vector<uint8_t> &data) override {
+    this->blobs_[name] = data;
+    return true;
+  }
+
+ protected:
+  std::string data_;
+  bool stored_{false};
+  std::unordered_map<std::string, std::vector<uint8_t>> blobs_;
+};
+
+/// Simulated time set by the caller. The cycle counter runs on host nanoseconds, so profiling
+/// reports real host cost.
+class VirtualClock : public ClockAdapter {
+ public:
+  void set_us(uint64_t now_us) { this->now_us_ = now_us; }
+  uint64_t get_us() const { return this->now_us_; }
+
+  uint32_t millis() override { return this->now_us_ / 1000; }
+  uint32_t micros() override { return this->now_us_; }
+  uint32_t cpu_cycles() override {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+ protected:
+  uint64_t now_us_{0};
+};
+
+/// Counts warnings and errors, and prints messages up to a level (none by default).
+class CountingLog : public LogAdapter {
+ public:
+  explicit CountingLog(LogLevel print_level = static_cast<LogLevel>(0)) : print_level_(print_level) {}
+
+  LogLevel get_level() const override {
+    return this->print_level_ > LogLevel::WARN ? this->print_level_ : LogLevel::WARN;
+  }
+
+  void log(LogLevel level, const char *message) override {
+    if (level == LogLevel::ERROR) {
+      this->errors_++;
+    } else if (level == LogLevel::WARN) {
+      this->warnings_++;
+    }
+    if (level <= this->print_level_)
+      fprintf(stderr, "%s\n", message);
+  }
+
+  uint32_t get_errors() const { return this->errors_; }
+  uint32_t get_warnings() const { return this->warnings_; }
+
+ protected:
+  LogLevel print_level_;
+  uint32_t errors_{0};
+  uint32_t warnings_{0};
+};
+
+}  // namespace json_automation
+}  // namespace esphome
@@ -0,0 +1,329 @@
+// Batch compiler for json_automation rule sets.
+//
+// Parses and validates many device rule sets in parallel with the same parser the component runs,
+// writes one binary rule image per input and a CSV report with sizes and errors. Every worker owns a
+// scratch arena for its JsonDocument, so after warm-up the parse path does not touch the global heap
+// and workers never contend on malloc.
+
+#include "rule_image.h"
+#include "rule_parser.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace esphome::json_automation;
+
+/// Bump allocator for one worker's JsonDocument. Frees are no-ops; reset() reclaims everything at once
+/// between rule sets, and the blocks are kept for the next one.
+class ScratchArena : public ArduinoJson::Allocator {
+ public:
+  void *allocate(size_t size) override {
+    const size_t needed = align(HEADER_SIZE + size);
+    while (this->current_ < this->blocks_.size() && this->offset_ + needed > this->blocks_[this->current_].size) {
+      this->current_++;
+      this->offset_ = 0;
+    }
+    if (this->current_ == this->blocks_.size()) {
+      const size_t block_size = std::max(BLOCK_SIZE, needed);
+      this->blocks_.push_back(Block{std::unique_ptr<uint8_t[]>(new uint8_t[block_size]), block_size});
+      this->reserved_ += block_size;
+      this->offset_ = 0;
+    }
+
+    uint8_t *base = this->blocks_[this->current_].data.get() + this->offset_;
+    std::memcpy(base, &size, sizeof(size));
+    this->offset_ += needed;
+    this->last_ = base + HEADER_SIZE;
+    return this->last_;
+  }
+
+  void deallocate(void *ptr) override {}
+
+  void *reallocate(void *ptr, size_t new_size) override {
+    if (ptr == nullptr)
+      return this->allocate(new_size);
+
+    uint8_t *base = static_cast<uint8_t *>(ptr) - HEADER_SIZE;
+    size_t old_size;
+    std::memcpy(&old_size, base, sizeof(old_size));
+
+    // The most recent allocation can grow or shrink in place
+    if (ptr == this->last_) {
+      const size_t start = base - this->blocks_[this->current_].data.get();
+      const size_t needed = align(HEADER_SIZE + new_size);
+      if (start + needed <= this->blocks_[this->current_].size) {
+        std::memcpy(base, &new_size, sizeof(new_size));
+        this->offset_ = start + needed;
+        return ptr;
+      }
+    }
+
+    void *moved = this->allocate(new_size);
+    std::memcpy(moved, ptr, std::min(old_size, new_size));
+    return moved;
+  }
+
+  void reset() {
+    this->current_ = 0;
+    this->offset_ = 0;
+    this->last_ = nullptr;
+  }
+
+  size_t reserved() const { return this->reserved_; }
+
+ protected:
+  static constexpr size_t BLOCK_SIZE = 64 * 1024;
+  static constexpr size_t HEADER_SIZE = alignof(std::max_align_t);
+
+  struct Block {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size;
+  };
+
+  static size_t align(size_t size) { return (size + HEADER_SIZE - 1) & ~(HEADER_SIZE - 1); }
+
+  std::vector<Block> blocks_;
+  size_t current_{0};
+  size_t offset_{0};
+  size_t reserved_{0};
+  void *last_{nullptr};
+};
+
+struct Job {
+  fs::path input;
+  fs::path output;
+};
+
+struct JobResult {
+  bool ok{false};
+  size_t json_bytes{0};
+  size_t rules{0};
+  size_t skipped{0};
+  size_t image_bytes{0};
+  uint32_t compile_us{0};
+  std::string error;
+};
+
+struct Options {
+  std::vector<std::string> inputs;
+  std::string output_dir;
+  std::string report_path;
+  unsigned jobs{0};
+  bool verify{false};
+};
+
+/// Per-thread state reused across rule sets.
+struct Worker {
+  ScratchArena arena;
+  JsonDocument doc{&arena};
+  std::vector<AutomationRule> rules;
+  std::vector<AutomationRule> decoded;
+  std::vector<uint8_t> image;
+  ParseReport report;
+};
+
+static bool read_file(const fs::path &path, std::string &data) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+  std::ostringstream buffer;
+  buffer << in.rdbuf();
+  data = buffer.str();
+  return true;
+}
+
+static bool write_file(const fs::path &path, const std::vector<uint8_t> &data) {
+  if (path.has_parent_path())
+    fs::create_directories(path.parent_path());
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char *>(data.data()), data.size());
+  return static_cast<bool>(out);
+}
+
+static void compile_one(Worker &worker, const Job &job, const Options &options, JobResult &result) {
+  const auto start = std::chrono::steady_clock::now();
+  std::string json_data;
+  if (!read_file(job.input, json_data)) {
+    result.error = "Cannot read file";
+    return;
+  }
+  result.json_bytes = json_data.size();
+
+  // The device stores the JSON as one NUL-terminated MAX_JSON_SIZE record
+  if (json_data.size() >= MAX_JSON_SIZE) {
+    result.error = "JSON exceeds the device limit of " + std::to_string(MAX_JSON_SIZE - 1) + " bytes";
+    return;
+  }
+
+  worker.doc.clear();
+  worker.arena.reset();
+  worker.rules.clear();
+  worker.report.clear();
+  if (!parse_rules(worker.doc, json_data, worker.rules, worker.report)) {
+    result.error = worker.report.error;
+    return;
+  }
+  result.rules = worker.rules.size();
+  result.skipped = worker.report.warnings.size();
+
+  const uint32_t source_hash = rule_key(json_data);
+  if (!compile_rule_image(worker.rules, source_hash, worker.image, result.error))
+    return;
+  result.image_bytes = worker.image.size();
+
+  if (options.verify &&
+      (!decode_rule_image(worker.image, worker.decoded) || worker.rules != worker.decoded)) {
+    result.error = "Image does not decode back to the parsed rules";
+    return;
+  }
+  if (!options.output_dir.empty() && !write_file(job.output, worker.image)) {
+    result.error = "Cannot write " + job.output.string();
+    return;
+  }
+
+  result.ok = true;
+  result.compile_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::string csv_escape(const std::string &value) {
+  std::string escaped = "\"";
+  for (char c : value) {
+    if (c == '"')
+      escaped += '"';
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-j JOBS] [-o OUTPUT_DIR] [--report REPORT.csv] [--verify] INPUT...\n"
+          "INPUT is a rule-set JSON file or a directory searched recursively for *.json files.\n",
+          program);
+}
+
+static bool parse_args(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+      options.jobs = std::stoul(argv[++i]);
+    } else if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
+      options.output_dir = argv[++i];
+    } else if (arg == "--report" && i + 1 < argc) {
+      options.report_path = argv[++i];
+    } else if (arg == "--verify") {
+      options.verify = true;
+    } else if (!arg.empty() && arg[0] == '-') {
+      return false;
+    } else {
+      options.inputs.push_back(arg);
+    }
+  }
+  return !options.inputs.empty();
+}
+
+static std::vector<Job> collect_jobs(const Options &options) {
+  std::vector<Job> jobs;
+  const fs::path output_dir = options.output_dir;
+  for (const auto &input : options.inputs) {
+    if (fs::is_directory(input)) {
+      std::vector<fs::path> files;
+      for (const auto &entry : fs::recursive_directory_iterator(input)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".json")
+          files.push_back(entry.path());
+      }
+      std::sort(files.begin(), files.end());
+      for (const auto &file : files) {
+        // Keep the directory structure so device sets with the same file name do not collide
+        jobs.push_back(Job{file, (output_dir / fs::relative(file, input)).replace_extension(".jari")});
+      }
+    } else {
+      jobs.push_back(Job{input, (output_dir / fs::path(input).filename()).replace_extension(".jari")});
+    }
+  }
+  return jobs;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_args(argc, argv, options)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  const std::vector<Job> jobs = collect_jobs(options);
+  if (jobs.empty()) {
+    fprintf(stderr, "No rule sets found\n");
+    return 2;
+  }
+
+  unsigned thread_count = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+  thread_count = std::min<size_t>(thread_count, jobs.size());
+
+  std::vector<JobResult> results(jobs.size());
+  std::vector<size_t> arena_bytes(thread_count);
+  std::atomic<size_t> next{0};
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < thread_count; t++) {
+    threads.emplace_back([&, t]() {
+      Worker worker;
+      for (size_t i = next.fetch_add(1); i < jobs.size(); i = next.fetch_add(1))
+        compile_one(worker, jobs[i], options, results[i]);
+      arena_bytes[t] = worker.arena.reserved();
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  const double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  size_t ok = 0, skipped = 0, json_total = 0, image_total = 0, largest = 0;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    const auto &result = results[i];
+    skipped += result.skipped;
+    if (!result.ok) {
+      fprintf(stderr, "%s: %s\n", jobs[i].input.string().c_str(), result.error.c_str());
+      continue;
+    }
+    ok++;
+    json_total += result.json_bytes;
+    image_total += result.image_bytes;
+    if (result.image_bytes > results[largest].image_bytes || !results[largest].ok)
+      largest = i;
+  }
+
+  if (!options.report_path.empty()) {
+    std::ofstream report(options.report_path);
+    report << "input,status,json_bytes,image_bytes,rules,skipped,compile_us,error\n";
+    for (size_t i = 0; i < jobs.size(); i++) {
+      const auto &result = results[i];
+      report << csv_escape(jobs[i].input.string()) << ',' << (result.ok ? "ok" : "error") << ','
+             << result.json_bytes << ',' << result.image_bytes << ',' << result.rules << ',' << result.skipped << ','
+             << result.compile_us << ',' << csv_escape(result.error) << '\n';
+    }
+  }
+
+  printf("Compiled %zu rule sets with %u threads in %.2f s (%.0f sets/s)\n", jobs.size(), thread_count, elapsed_s,
+         jobs.size() / std::max(elapsed_s, 1e-9));
+  printf("  OK: %zu, failed: %zu, skipped rules/actions: %zu\n", ok, jobs.size() - ok, skipped);
+  if (ok > 0) {
+    printf("  JSON %zu B -> images %zu B (%.0f%%)\n", json_total, image_total, 100.0 * image_total / json_total);
+    printf("  Largest image: %zu B (%s)\n", results[largest].image_bytes, jobs[largest].input.string().c_str());
+  }
+  printf("  Arena per thread: %zu KiB max\n", *std::max_element(arena_bytes.begin(), arena_bytes.end()) / 1024);
+  return ok == jobs.size() ? 0 : 1;
+}
@@ -0,0 +1,527 @@
+// Site simulator for json_automation capacity planning.
+//
+// Runs many virtual devices in one process. Each device owns a rule engine with its own rule set,
+// entities and virtual clock, and is driven by a synthetic input and sensor schedule. Virtual time advances
+// from event to event, so an hour of device time costs only the engine work it contains. Host CPU
+// time of every engine call is scaled to an estimated device time and charged to the device, which
+// is busy for that long; events arriving meanwhile queue up and show as latency.
+//
+// Devices are independent, so workers simulate whole devices. Each worker starts with its own
+// range of devices and steals from the back of another worker's queue when it runs dry, which
+// keeps all cores busy when rule sets differ widely in cost.
+
+#include "host_adapters.h"
+#include "rule_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace esphome::json_automation;
+
+// Heap accounting: every operator new/delete is charged to the calling thread. A worker creates and
+// destroys each device on its own thread, so the counter delta is the device's heap footprint.
+// ArduinoJson allocates through malloc and is not counted; its document only lives during parsing.
+
+struct HeapCounter {
+  int64_t live{0};
+  int64_t peak{0};
+};
+
+static thread_local HeapCounter heap_counter;
+static constexpr size_t HEAP_HEADER = alignof(std::max_align_t);
+
+void *operator new(size_t size) {
+  auto *base = static_cast<uint8_t *>(std::malloc(HEAP_HEADER + size));
+  if (base == nullptr)
+    throw std::bad_alloc();
+  *reinterpret_cast<size_t *>(base) = size;
+  heap_counter.live += size;
+  if (heap_counter.live > heap_counter.peak)
+    heap_counter.peak = heap_counter.live;
+  return base + HEAP_HEADER;
+}
+
+void operator delete(void *ptr) noexcept {
+  if (ptr == nullptr)
+    return;
+  auto *base = static_cast<uint8_t *>(ptr) - HEAP_HEADER;
+  heap_counter.live -= *reinterpret_cast<size_t *>(base);
+  std::free(base);
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *ptr) noexcept { operator delete(ptr); }
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { operator delete(ptr); }
+
+struct Options {
+  std::vector<std::string> inputs;
+  std::string report_path;
+  size_t devices{0};
+  unsigned jobs{0};
+  double duration_s{3600};
+  double events_per_minute{6};
+  uint32_t hold_min_ms{80};
+  uint32_t hold_max_ms{600};
+  uint32_t loop_ms{16};
+  uint32_t sensor_interval_ms{10000};
+  double cpu_scale{1.0};
+  uint64_t seed{1};
+};
+
+struct InputEvent {
+  uint64_t at_us;
+  int32_t input;
+  bool state;
+  /// Sample of the sensor handle input instead of an input state.
+  bool sensor;
+  float value;
+};
+
+/// Values a sensor samples from: every threshold of its rules lies inside.
+struct SensorRange {
+  float low;
+  float high;
+};
+
+struct DeviceResult {
+  bool ok{false};
+  size_t rule_set{0};
+  size_t rules{0};
+  size_t active{0};
+  size_t inputs{0};
+  size_t events{0};
+  size_t sensor_samples{0};
+  uint64_t actions{0};
+  uint64_t load_us{0};
+  uint64_t cpu_us{0};
+  int64_t heap_bytes{0};
+  int64_t peak_heap_bytes{0};
+  uint64_t latency_p50_us{0};
+  uint64_t latency_p99_us{0};
+  uint64_t latency_max_us{0};
+  uint64_t sensor_latency_p99_us{0};
+  uint64_t timer_late_max_us{0};
+  uint32_t warnings{0};
+  std::string error;
+};
+
+/// Device indices owned by one worker. The owner takes from the front, thieves from the back.
+class DeviceQueue {
+ public:
+  void push(size_t device) { this->devices_.push_back(device); }
+
+  bool pop(size_t &device) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (this->devices_.empty())
+      return false;
+    device = this->devices_.front();
+    this->devices_.pop_front();
+    return true;
+  }
+
+  bool steal(size_t &device) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (this->devices_.empty())
+      return false;
+    device = this->devices_.back();
+    this->devices_.pop_back();
+    return true;
+  }
+
+ protected:
+  std::mutex mutex_;
+  std::deque<size_t> devices_;
+};
+
+static uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename T> static T percentile(std::vector<T> &values, double fraction) {
+  if (values.empty())
+    return T();
+  const size_t index = std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+/// Range of every sensor handle of the loaded rules, indexed by handle.
+static std::vector<SensorRange> sensor_ranges(RuleEngine &engine, HostEntities &entities) {
+  std::vector<SensorRange> ranges(entities.get_sensor_count(), SensorRange{0, 0});
+  std::vector<bool> seen(ranges.size());
+  for (const auto &rule : engine.get_rules()) {
+    if (rule.trigger.source != TriggerSource::SENSOR)
+      continue;
+    const int32_t handle = entities.resolve_sensor(rule.trigger.input_id);
+    if (handle < 0 || static_cast<size_t>(handle) >= ranges.size())
+      continue;
+    auto &range = ranges[handle];
+    const float threshold = rule.trigger.threshold;
+    range.low = seen[handle] ? std::min(range.low, threshold) : threshold;
+    range.high = seen[handle] ? std::max(range.high, threshold) : threshold;
+    seen[handle] = true;
+  }
+  for (auto &range : ranges) {
+    const float margin = std::max(1.0f, (range.high - range.low) / 4);
+    range.low -= margin;
+    range.high += margin;
+  }
+  return ranges;
+}
+
+/// Poisson press/release pairs over the inputs of one device, and a sample of every sensor each
+/// sensor interval, starting at a random phase, uniform over its range.
+static std::vector<InputEvent> make_schedule(const Options &options, size_t device, size_t input_count,
+                                             const std::vector<SensorRange> &sensors) {
+  std::vector<InputEvent> events;
+  std::mt19937_64 rng(options.seed * 0x9E3779B97F4A7C15ULL + device);
+  const uint64_t end_us = options.duration_s * 1e6;
+
+  if (input_count > 0 && options.events_per_minute > 0) {
+    std::exponential_distribution<double> gap_us(options.events_per_minute / 60e6);
+    std::uniform_int_distribution<int32_t> input(0, input_count - 1);
+    std::uniform_int_distribution<uint32_t> hold_ms(options.hold_min_ms,
+                                                    std::max(options.hold_min_ms, options.hold_max_ms));
+    for (double at = gap_us(rng); at < end_us; at += gap_us(rng)) {
+      const int32_t handle = input(rng);
+      const uint64_t press_us = at;
+      events.push_back(InputEvent{press_us, handle, true, false, 0});
+      events.push_back(
+          InputEvent{std::min<uint64_t>(end_us, press_us + hold_ms(rng) * 1000ULL), handle, false, false, 0});
+    }
+  }
+
+  if (options.sensor_interval_ms > 0) {
+    const uint64_t interval_us = options.sensor_interval_ms * 1000ULL;
+    std::uniform_int_distribution<uint64_t> phase_us(0, interval_us - 1);
+    for (size_t handle = 0; handle < sensors.size(); handle++) {
+      std::uniform_real_distribution<float> value(sensors[handle].low, sensors[handle].high);
+      for (uint64_t at = phase_us(rng); at < end_us; at += interval_us)
+        events.push_back(InputEvent{at, static_cast<int32_t>(handle), false, true, value(rng)});
+    }
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const InputEvent &a, const InputEvent &b) { return a.at_us < b.at_us; });
+  return events;
+}
+
+static void simulate_device(const Options &options, const std::string &json_data, size_t device, DeviceResult &result) {
+  const int64_t heap_base = heap_counter.live;
+  HostEntities entities;
+  MemoryStorage storage;
+  VirtualClock clock;
+  CountingLog log;
+  RuleEngine engine(&entities, &storage, &clock, &log);
+  entities.set_engine(&engine);
+  engine.set_on_error([&result](const std::string &message) { result.error = message; });
+
+  auto start = std::chrono::steady_clock::now();
+  const bool loaded = engine.load(json_data);
+  const uint64_t load_ns = elapsed_ns(start);
+  result.load_us = load_ns * options.cpu_scale / 1000;
+  result.warnings = log.get_warnings() + log.get_errors();
+  if (!loaded)
+    return;
+  result.rules = engine.get_rules().size();
+  result.active = engine.get_active_count();
+  result.inputs = entities.get_input_count();
+  result.heap_bytes = heap_counter.live - heap_base;
+
+  // Schedule and samples are simulator state; keep them out of the device's peak
+  std::vector<InputEvent> events =
+      make_schedule(options, device, entities.get_input_count(), sensor_ranges(engine, entities));
+  std::vector<uint64_t> latencies, sensor_latencies;
+  latencies.reserve(events.size());
+  const int64_t sim_bytes = heap_counter.live - heap_base - result.heap_bytes;
+  heap_counter.peak = heap_counter.live;
+
+  uint64_t cpu_ns = load_ns;
+  uint64_t busy_until_us = result.load_us;
+  const uint64_t loop_us = std::max<uint32_t>(1, options.loop_ms) * 1000ULL;
+  auto charge = [&](uint64_t at_us, uint64_t ns) {
+    cpu_ns += ns;
+    busy_until_us = at_us + static_cast<uint64_t>(ns * options.cpu_scale / 1000);
+  };
+  // Time of the first sensor sample not yet evaluated; the engine evaluates samples in loop()
+  uint64_t posted_us = UINT64_MAX;
+  // Run loop() at every loop tick that has an expired delay or posted sensor samples, up to limit_us
+  auto run_loops = [&](uint64_t limit_us) {
+    while (true) {
+      uint32_t due_ms;
+      const uint64_t due_us = engine.get_next_due(due_ms) ? due_ms * 1000ULL : UINT64_MAX;
+      const uint64_t next_us = std::min(due_us, posted_us);
+      if (next_us == UINT64_MAX)
+        break;
+      const uint64_t tick_us = std::max((next_us + loop_us - 1) / loop_us * loop_us, busy_until_us);
+      if (tick_us > limit_us)
+        break;
+      clock.set_us(tick_us);
+      const auto loop_start = std::chrono::steady_clock::now();
+      engine.loop();
+      charge(tick_us, elapsed_ns(loop_start));
+      if (due_us <= tick_us)
+        result.timer_late_max_us = std::max(result.timer_late_max_us, tick_us - due_us);
+      if (posted_us <= tick_us) {
+        sensor_latencies.push_back(busy_until_us - posted_us);
+        posted_us = UINT64_MAX;
+      }
+    }
+  };
+
+  for (const auto &event : events) {
+    run_loops(event.at_us);
+    const uint64_t at_us = std::max(event.at_us, busy_until_us);
+    clock.set_us(at_us);
+    const auto event_start = std::chrono::steady_clock::now();
+    if (event.sensor) {
+      entities.set_sensor(event.input, event.value);
+      charge(at_us, elapsed_ns(event_start));
+      posted_us = std::min(posted_us, event.at_us);
+      result.sensor_samples++;
+      continue;
+    }
+    entities.set_input(event.input, event.state);
+    charge(at_us, elapsed_ns(event_start));
+    latencies.push_back(busy_until_us - event.at_us);
+  }
+  run_loops(options.duration_s * 1e6);
+
+  result.events = latencies.size();
+  result.actions = entities.get_actions_performed();
+  result.cpu_us = cpu_ns * options.cpu_scale / 1000;
+  result.peak_heap_bytes = std::max(result.heap_bytes, heap_counter.peak - heap_base - sim_bytes);
+  result.latency_p50_us = percentile(latencies, 0.50);
+  result.latency_p99_us = percentile(latencies, 0.99);
+  result.latency_max_us = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+  result.sensor_latency_p99_us = percentile(sensor_latencies, 0.99);
+  result.warnings = log.get_warnings() + log.get_errors();
+  result.ok = true;
+}
+
+static bool read_file(const fs::path &path, std::string &data) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+  std::ostringstream buffer;
+  buffer << in.rdbuf();
+  data = buffer.str();
+  return true;
+}
+
+static std::vector<fs::path> collect_rule_sets(const Options &options) {
+  std::vector<fs::path> paths;
+  for (const auto &input : options.inputs) {
+    if (fs::is_directory(input)) {
+      std::vector<fs::path> files;
+      for (const auto &entry : fs::recursive_directory_iterator(input)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".json")
+          files.push_back(entry.path());
+      }
+      std::sort(files.begin(), files.end());
+      paths.insert(paths.end(), files.begin(), files.end());
+    } else {
+      paths.push_back(input);
+    }
+  }
+  return paths;
+}
+
+static std::string csv_escape(const std::string &value) {
+  std::string escaped = "\"";
+  for (char c : value) {
+    if (c == '"')
+      escaped += '"';
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-n DEVICES] [-j JOBS] [--duration SECONDS] [--events-per-minute N]\n"
+          "          [--hold-ms MIN MAX] [--loop-ms MS] [--sensor-interval-ms MS] [--cpu-scale FACTOR]\n"
+          "          [--seed N] [--report REPORT.csv] INPUT...\n"
+          "INPUT is a rule-set JSON file or a directory searched recursively for *.json files.\n"
+          "Devices take the rule sets in turn; by default there is one device per rule set.\n",
+          program);
+}
+
+static bool parse_args(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if ((arg == "-n" || arg == "--devices") && i + 1 < argc) {
+      options.devices = std::stoul(argv[++i]);
+    } else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+      options.jobs = std::stoul(argv[++i]);
+    } else if (arg == "--duration" && i + 1 < argc) {
+      options.duration_s = std::stod(argv[++i]);
+    } else if (arg == "--events-per-minute" && i + 1 < argc) {
+      options.events_per_minute = std::stod(argv[++i]);
+    } else if (arg == "--hold-ms" && i + 2 < argc) {
+      options.hold_min_ms = std::stoul(argv[++i]);
+      options.hold_max_ms = std::stoul(argv[++i]);
+    } else if (arg == "--loop-ms" && i + 1 < argc) {
+      options.loop_ms = std::stoul(argv[++i]);
+    } else if (arg == "--sensor-interval-ms" && i + 1 < argc) {
+      options.sensor_interval_ms = std::stoul(argv[++i]);
+    } else if (arg == "--cpu-scale" && i + 1 < argc) {
+      options.cpu_scale = std::stod(argv[++i]);
+    } else if (arg == "--seed" && i + 1 < argc) {
+      options.seed = std::stoull(argv[++i]);
+    } else if (arg == "--report" && i + 1 < argc) {
+      options.report_path = argv[++i];
+    } else if (!arg.empty() && arg[0] == '-') {
+      return false;
+    } else {
+      options.inputs.push_back(arg);
+    }
+  }
+  return !options.inputs.empty() && options.duration_s > 0 && options.duration_s < 49 * 86400.0;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_args(argc, argv, options)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  const std::vector<fs::path> paths = collect_rule_sets(options);
+  if (paths.empty()) {
+    fprintf(stderr, "No rule sets found\n");
+    return 2;
+  }
+  std::vector<std::string> rule_sets(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (!read_file(paths[i], rule_sets[i])) {
+      fprintf(stderr, "%s: Cannot read file\n", paths[i].string().c_str());
+      return 2;
+    }
+  }
+
+  const size_t device_count = options.devices ? options.devices : paths.size();
+  unsigned thread_count = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+  thread_count = std::min<size_t>(thread_count, device_count);
+
+  // Contiguous ranges keep neighbouring devices, which often share a rule set, on one worker
+  std::vector<DeviceQueue> queues(thread_count);
+  for (size_t device = 0; device < device_count; device++)
+    queues[device * thread_count / device_count].push(device);
+
+  std::vector<DeviceResult> results(device_count);
+  std::vector<size_t> steals(thread_count);
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < thread_count; t++) {
+    threads.emplace_back([&, t]() {
+      size_t device;
+      while (true) {
+        bool found = queues[t].pop(device);
+        for (unsigned k = 1; !found && k < thread_count; k++) {
+          found = queues[(t + k) % thread_count].steal(device);
+          if (found)
+            steals[t]++;
+        }
+        if (!found)
+          break;
+        results[device].rule_set = device % rule_sets.size();
+        simulate_device(options, rule_sets[results[device].rule_set], device, results[device]);
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  const double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  size_t ok = 0, events = 0, sensor_samples = 0, stolen = 0;
+  uint64_t actions = 0;
+  std::vector<double> busy_pct;
+  std::vector<int64_t> heap, peak_heap;
+  std::vector<uint64_t> latency_p99, sensor_latency_p99, timer_late;
+  size_t worst = device_count;
+  for (size_t i = 0; i < device_count; i++) {
+    const auto &result = results[i];
+    if (!result.ok) {
+      fprintf(stderr, "device %zu (%s): %s\n", i, paths[result.rule_set].string().c_str(), result.error.c_str());
+      continue;
+    }
+    ok++;
+    events += result.events;
+    sensor_samples += result.sensor_samples;
+    actions += result.actions;
+    busy_pct.push_back(100.0 * result.cpu_us / (options.duration_s * 1e6));
+    heap.push_back(result.heap_bytes);
+    peak_heap.push_back(result.peak_heap_bytes);
+    latency_p99.push_back(result.latency_p99_us);
+    if (result.sensor_samples > 0)
+      sensor_latency_p99.push_back(result.sensor_latency_p99_us);
+    timer_late.push_back(result.timer_late_max_us);
+    if (worst == device_count || result.latency_max_us > results[worst].latency_max_us)
+      worst = i;
+  }
+  for (size_t count : steals)
+    stolen += count;
+
+  if (!options.report_path.empty()) {
+    std::ofstream report(options.report_path);
+    report << "device,rule_set,status,rules,active,inputs,events,sensor_samples,actions,load_us,cpu_us,busy_pct,"
+              "heap_bytes,peak_heap_bytes,latency_p50_us,latency_p99_us,latency_max_us,sensor_latency_p99_us,"
+              "timer_late_max_us,warnings,error\n";
+    for (size_t i = 0; i < device_count; i++) {
+      const auto &result = results[i];
+      report << i << ',' << csv_escape(paths[result.rule_set].string()) << ',' << (result.ok ? "ok" : "error") << ','
+             << result.rules << ',' << result.active << ',' << result.inputs << ',' << result.events << ','
+             << result.sensor_samples << ',' << result.actions << ',' << result.load_us << ',' << result.cpu_us << ','
+             << 100.0 * result.cpu_us / (options.duration_s * 1e6) << ',' << result.heap_bytes << ','
+             << result.peak_heap_bytes << ',' << result.latency_p50_us << ',' << result.latency_p99_us << ','
+             << result.latency_max_us << ',' << result.sensor_latency_p99_us << ',' << result.timer_late_max_us << ','
+             << result.warnings << ',' << csv_escape(result.error) << '\n';
+    }
+  }
+
+  const double device_hours = device_count * options.duration_s / 3600;
+  printf("Simulated %zu devices x %.0f s with %u threads in %.2f s (%.0f device-hours/s, %zu steals)\n", device_count,
+         options.duration_s, thread_count, elapsed_s, device_hours / std::max(elapsed_s, 1e-9), stolen);
+  printf("  OK: %zu, failed: %zu, input events: %zu, sensor samples: %zu, actions: %llu\n", ok, device_count - ok,
+         events, sensor_samples, (unsigned long long) actions);
+  if (ok > 0) {
+    printf("  %-22s %12s %12s %12s\n", "per device", "p50", "p95", "max");
+    printf("  %-22s %12.4f %12.4f %12.4f\n", "CPU busy (%)", percentile(busy_pct, 0.50), percentile(busy_pct, 0.95),
+           *std::max_element(busy_pct.begin(), busy_pct.end()));
+    printf("  %-22s %12lld %12lld %12lld\n", "heap (B)", (long long) percentile(heap, 0.50),
+           (long long) percentile(heap, 0.95), (long long) *std::max_element(heap.begin(), heap.end()));
+    printf("  %-22s %12lld %12lld %12lld\n", "peak heap (B)", (long long) percentile(peak_heap, 0.50),
+           (long long) percentile(peak_heap, 0.95), (long long) *std::max_element(peak_heap.begin(), peak_heap.end()));
+    printf("  %-22s %12llu %12llu %12llu\n", "input latency p99 (us)",
+           (unsigned long long) percentile(latency_p99, 0.50), (unsigned long long) percentile(latency_p99, 0.95),
+           (unsigned long long) *std::max_element(latency_p99.begin(), latency_p99.end()));
+    if (!sensor_latency_p99.empty()) {
+      printf("  %-22s %12llu %12llu %12llu\n", "sensor p99 (us)",
+             (unsigned long long) percentile(sensor_latency_p99, 0.50),
+             (unsigned long long) percentile(sensor_latency_p99, 0.95),
+             (unsigned long long) *std::max_element(sensor_latency_p99.begin(), sensor_latency_p99.end()));
+    }
+    printf("  %-22s %12llu %12llu %12llu\n", "timer lateness (us)", (unsigned long long) percentile(timer_late, 0.50),
+           (unsigned long long) percentile(timer_late, 0.95),
+           (unsigned long long) *std::max_element(timer_late.begin(), timer_late.end()));
+    printf("  Slowest input: %llu us on device %zu (%s)\n", (unsigned long long) results[worst].latency_max_us, worst,
+           paths[results[worst].rule_set].string().c_str());
+  }
+  return ok == device_count ? 0 : 1;
+}
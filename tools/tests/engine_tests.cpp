@@ -0,0 +1,196 @@
+// Host regression tests of the rule engine.
+//
+// Each test builds an engine on the host adapters, loads a small rule set and drives inputs through it. The
+// checks do not depend on NDEBUG, so the tests also run in the Release build of the tools; a failed check prints
+// its location and makes the program exit non-zero.
+//
+// Tests of a feature with its own source file live in <feature>_tests.cpp, declared in test_support.h.
+
+#include "test_support.h"
+#include "rule_image.h"
+#include "rule_parser.h"
+#include "threshold_table.h"
+#include "wasm_runtime.h"
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+int failures = 0;
+
+/// Rule pressing input_id that calls run() of module "m" on entity.
+static std::string wasm_rule(const std::string &id, const std::string &input_id, const std::string &entity) {
+  return R"({"id":")" + id + R"(","trigger":{"source":"input","type":"press","input_id":")" + input_id +
+         R"("},"actions":[{"source":"wasm","module":"m","function":"run","entities":[")" + entity + R"("]}]})";
+}
+
+static void test_wasm_calls_pruned() {
+  Fixture f;
+  WasmRuntime wasm(&f.entities, &f.storage, &f.clock, &f.log);
+  f.engine.set_scripts(&wasm);
+  CHECK(wasm.add_module("m", SET_STATE_MODULE, false));
+  CHECK(f.engine.load("[" + wasm_rule("a", "b1", "switch.s1") + "," + wasm_rule("b", "b2", "switch.s2") + "]"));
+  CHECK(wasm.get_call_count() == 2);
+
+  // Calls no rule uses any more are freed on every kind of reload
+  CHECK(f.engine.load("[" + wasm_rule("a", "b1", "switch.s1") + "]"));
+  CHECK(wasm.get_call_count() == 1);
+  for (int i = 0; i < 20; i++)
+    f.load_incrementally("[" + wasm_rule("c", "b3", "switch.n" + std::to_string(i)) + "]");
+  CHECK(wasm.get_call_count() == 1);
+  f.press("b3");
+  CHECK(f.is_on("n19") && !f.is_on("s1"));
+  CHECK(f.engine.remove_subtree("c") == 1);
+  CHECK(wasm.get_call_count() == 0);
+
+  // A staged load keeps its calls while the active set changes
+  CHECK(f.engine.load("[" + wasm_rule("x", "b1", "switch.s1") + "]"));
+  f.engine.set_load_budget(64, 0);
+  CHECK(f.engine.begin_load("[" + wasm_rule("d", "b4", "switch.s4") + "," + wasm_rule("e", "b5", "switch.s5") + "]"));
+  // The first rule is compiled after three steps, the second one not yet
+  for (int i = 0; i < 3; i++)
+    f.engine.loop();
+  CHECK(f.engine.is_loading());
+  CHECK(f.engine.remove_subtree("x") == 1);
+  while (f.engine.is_loading())
+    f.engine.loop();
+  f.press("b4");
+  f.press("b5");
+  CHECK(f.is_on("s4") && f.is_on("s5"));
+  CHECK(wasm.get_call_count() == 2);
+}
+
+static void test_value_condition() {
+  Fixture f;
+  CHECK(f.engine.load(R"([{"id":"hot","trigger":{"source":"input","type":"press","input_id":"unused"},)"
+                      R"("actions":[{"source":"condition","above":20.5},)"
+                      R"({"source":"switch","type":"toggle","switch_id":"fan"}]},)"
+                      R"({"id":"bad","trigger":{"source":"input","type":"press","input_id":"unused"},)"
+                      R"("actions":[{"source":"switch","type":"turn_on","switch_id":"first"},)"
+                      R"({"source":"condition","above":1,"below":2},)"
+                      R"({"source":"switch","type":"turn_on","switch_id":"guarded"}]}])"));
+  // The float value is compared without truncation to an integer
+  f.engine.execute({"hot"}, TriggerPayload::of_float(20.7f));
+  CHECK(f.is_on("fan"));
+  f.engine.execute({"hot"}, TriggerPayload::of_float(20.2f));
+  f.engine.execute({"hot"}, TriggerPayload::of_int(20));
+  CHECK(f.is_on("fan"));
+  f.engine.execute({"hot"}, TriggerPayload::of_int(21));
+  CHECK(!f.is_on("fan"));
+  // Neither a missing value nor NaN passes
+  f.engine.execute({"hot"});
+  f.engine.execute({"hot"}, TriggerPayload::of_float(NAN));
+  CHECK(!f.is_on("fan"));
+
+  // An invalid condition drops the actions it would guard
+  f.engine.execute({"bad"}, TriggerPayload::of_int(5));
+  CHECK(f.is_on("first") && !f.is_on("guarded"));
+}
+
+static void test_rule_image_round_trip() {
+  const std::string json_data =
+      "[" + press_rule("a", "b1", "toggle", "s1") +
+      R"(,{"id":"fan","name":"Fan","fire_on_initial_state":true,"max_latency_ms":40,)"
+      R"("trigger":{"source":"while","any":["humid","!window"]},)"
+      R"("actions":[{"source":"snapshot","name":"before","entities":["switch.fan","light.lamp"]},)"
+      R"({"source":"switch","type":"turn_on","switch_id":"fan"}],)"
+      R"("exit_actions":[{"source":"restore","name":"before"}]},)"
+      R"({"id":"hot","enabled":false,"trigger":{"source":"sensor","type":"below","sensor_id":"temp","threshold":-2.5},)"
+      R"("actions":[{"source":"condition","equals":0.25},{"source":"delay","delay_s":3},)"
+      R"({"source":"wasm","module":"m","function":"run","arg":"trigger","entities":["input.b1","switch.s1"]},)"
+      R"({"source":"wasm","module":"m","function":"stop","arg":-7}]}])";
+  JsonDocument doc;
+  std::vector<AutomationRule> rules, decoded;
+  ParseReport report;
+  CHECK(parse_rules(doc, json_data, rules, report) && rules.size() == 3 && report.warnings.empty());
+
+  std::vector<uint8_t> image;
+  std::string error;
+  uint32_t source_hash = 0;
+  CHECK(compile_rule_image(rules, 0x12345678, image, error));
+  CHECK(decode_rule_image(image, decoded, &source_hash) && source_hash == 0x12345678);
+  CHECK(decoded == rules);
+
+  // A damaged image is rejected by its checksum
+  image[image.size() - 2] ^= 1;
+  CHECK(!decode_rule_image(image, decoded));
+}
+
+/// Sensor 0 has rule 0 (above 10), sensor 1 rules 1 to 8 (above 1 to 8), sensor 2 rule 9 (below 5). The slots of
+/// sensor 1 share the first block with sensor 0 and the third with sensor 2, and fill the second alone.
+static void fill_thresholds(ThresholdTable &table) {
+  table.clear();
+  table.add(0, 10.0f, true, 0);
+  for (uint16_t rule = 1; rule <= 8; rule++)
+    table.add(1, rule, true, rule);
+  table.add(2, 5.0f, false, 9);
+  table.build();
+}
+
+static uint32_t evaluate_bits(ThresholdTable &table) {
+  std::vector<uint32_t> fired;
+  const size_t count = table.evaluate(fired);
+  const uint32_t bits = fired.empty() ? 0 : fired[0];
+  CHECK(count == static_cast<size_t>(__builtin_popcount(bits)));
+  return bits;
+}
+
+static void test_threshold_shared_blocks(ThresholdTable::Kernel kernel) {
+  ThresholdTable table;
+  table.set_kernel(kernel);
+  fill_thresholds(table);
+  CHECK(table.size() == 10 && table.get_slot_count() == 12);
+
+  table.post(1, 4.5f);
+  CHECK(evaluate_bits(table) == 0x1E);
+  // Sensor 1 did not change, so its thresholds in the shared blocks do not fire again
+  table.post(0, 20.0f);
+  table.post(2, 0.0f);
+  CHECK(evaluate_bits(table) == 0x201);
+  table.post(1, 100.0f);
+  CHECK(evaluate_bits(table) == 0x1E0);
+  // Only the last value of a batch is compared
+  table.post(1, 0.0f);
+  table.post(1, 100.0f);
+  CHECK(evaluate_bits(table) == 0);
+  CHECK(table.get_value(1) == 100.0f);
+
+  // A rebuild keeps the states, and NaN arms every threshold again
+  fill_thresholds(table);
+  table.post(1, 100.0f);
+  CHECK(evaluate_bits(table) == 0);
+  table.post(0, NAN);
+  table.post(1, NAN);
+  table.post(2, NAN);
+  CHECK(evaluate_bits(table) == 0);
+  table.post(0, 20.0f);
+  table.post(1, 100.0f);
+  table.post(2, 0.0f);
+  CHECK(evaluate_bits(table) == 0x3FF);
+}
+
+int main() {
+  run_interlock_tests();
+  test_wasm_calls_pruned();
+  run_overlay_tests();
+  run_load_tests();
+  run_rule_block_tests();
+  run_compaction_tests();
+  test_value_condition();
+  run_while_tests();
+  run_settle_tests();
+  run_subtree_tests();
+  run_execute_tests();
+  run_slow_rule_tests();
+  run_scene_tests();
+  run_history_tests();
+  test_rule_image_round_trip();
+  test_threshold_shared_blocks(ThresholdTable::Kernel::SCALAR);
+  test_threshold_shared_blocks(ThresholdTable::Kernel::VECTOR);
+  if (failures != 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All engine tests passed\n");
+  return 0;
+}
@@ -0,0 +1,56 @@
+// Tests of the batch execute API: ids resolved up front, skipped rules and the payload seen by the actions.
+
+#include "test_support.h"
+
+#include <string>
+
+static void test_execute_batch() {
+  Fixture f;
+  CHECK(f.engine.load("[" + press_rule("a", "b1", "toggle", "s1") + "," +
+                      R"({"id":"b","enabled":false,"trigger":{"source":"input","type":"press","input_id":"b2"},)"
+                      R"("actions":[{"source":"switch","type":"toggle","switch_id":"s2"}]},)" +
+                      press_rule("c", "b3", "toggle", "s3") + "]"));
+  const uint32_t warnings = f.log.get_warnings();
+  // Unknown and disabled rules are skipped, a repeated id runs again
+  CHECK(f.engine.execute({"a", "missing", "b", "c", "a"}) == 3);
+  CHECK(!f.is_on("s1") && !f.is_on("s2") && f.is_on("s3"));
+  CHECK(f.log.get_warnings() == warnings + 1);
+  CHECK(f.engine.execute({}) == 0);
+}
+
+static void test_execute_keeps_while_level() {
+  Fixture f;
+  CHECK(f.engine.load(R"([{"id":"fan","trigger":{"source":"while","all":["humid"]},)"
+                      R"("actions":[{"source":"switch","type":"toggle","switch_id":"fan"}],)"
+                      R"("exit_actions":[{"source":"switch","type":"toggle","switch_id":"exited"}]}])"));
+  CHECK(f.engine.execute({"fan"}) == 1);
+  CHECK(f.is_on("fan") && !f.is_on("exited"));
+  // The rule is still outside its level, so the condition becoming true is a transition
+  f.set("humid", true);
+  CHECK(!f.is_on("fan"));
+  f.set("humid", false);
+  CHECK(f.is_on("exited"));
+}
+
+static void test_execute_payload_across_delay() {
+  Fixture f;
+  CHECK(f.engine.load(R"([{"id":"hot","trigger":{"source":"input","type":"press","input_id":"unused"},)"
+                      R"("actions":[{"source":"delay","delay_s":1},{"source":"condition","above":20},)"
+                      R"({"source":"switch","type":"toggle","switch_id":"fan"}]}])"));
+  CHECK(f.engine.execute({"hot"}, TriggerPayload::of_float(25.0f)) == 1);
+  CHECK(!f.is_on("fan") && f.engine.get_pending_count() == 1);
+  // The pending run keeps the payload of the call that started it
+  f.clock.set_us(1000000);
+  f.engine.loop();
+  CHECK(f.is_on("fan"));
+  f.engine.execute({"hot"}, TriggerPayload::of_float(15.0f));
+  f.clock.set_us(2000000);
+  f.engine.loop();
+  CHECK(f.is_on("fan"));
+}
+
+void run_execute_tests() {
+  test_execute_batch();
+  test_execute_keeps_while_level();
+  test_execute_payload_across_delay();
+}
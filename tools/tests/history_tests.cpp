@@ -0,0 +1,130 @@
+// Tests of the execution history: the RAM ring, the flush policy, restoring after a reboot and the encoded log.
+
+#include "test_support.h"
+#include "history.h"
+
+#include <string>
+#include <vector>
+
+/// Memory storage whose blob writes can be made to fail.
+class FlakyStorage : public MemoryStorage {
+ public:
+  bool save_blob(const std::string &name, const std::vector<uint8_t> &data) override {
+    this->writes++;
+    return !this->fail && MemoryStorage::save_blob(name, data);
+  }
+
+  bool fail{false};
+  int writes{0};
+};
+
+static std::vector<uint8_t> encoded(const ExecutionHistory &history) {
+  std::vector<uint8_t> data(history.encoded_size());
+  CHECK(history.read(0, data.data(), data.size()) == data.size());
+  return data;
+}
+
+/// Rule index of record i of an encoded log.
+static uint16_t encoded_rule(const std::vector<uint8_t> &data, size_t i) {
+  const size_t offset = HISTORY_HEADER_SIZE + i * HISTORY_RECORD_SIZE + 4;
+  return data[offset] | (data[offset + 1] << 8);
+}
+
+static void test_history_ring() {
+  ExecutionHistory history;
+  history.set_capacity(3);
+  for (uint16_t rule = 0; rule < 5; rule++)
+    history.record(rule, static_cast<uint8_t>(RunResult::DONE), rule * 100);
+  // The oldest records are overwritten; waiting records never exceed the ring
+  CHECK(history.size() == 3 && history.get_pending() == 3);
+  const std::vector<uint8_t> data = encoded(history);
+  CHECK(data.size() == HISTORY_HEADER_SIZE + 3 * HISTORY_RECORD_SIZE);
+  CHECK(std::string(data.begin(), data.begin() + 4) == "JAHS");
+  CHECK(data[4] == 1 && data[6] == 3 && data[7] == 0);
+  CHECK(encoded_rule(data, 0) == 2 && encoded_rule(data, 1) == 3 && encoded_rule(data, 2) == 4);
+  // Time of the oldest record, little-endian
+  CHECK(data[HISTORY_HEADER_SIZE] == 200 && data[HISTORY_HEADER_SIZE + 1] == 0);
+
+  // Reads in pieces give the same bytes
+  std::vector<uint8_t> pieces(data.size());
+  for (size_t offset = 0; offset < pieces.size(); offset += 5)
+    history.read(offset, pieces.data() + offset, 5);
+  CHECK(pieces == data);
+  uint8_t byte;
+  CHECK(history.read(data.size(), &byte, 1) == 0);
+
+  history.set_capacity(MAX_HISTORY_SIZE + 10);
+  CHECK(history.get_capacity() == MAX_HISTORY_SIZE && history.size() == 0);
+  ExecutionHistory off;
+  off.record(1, 0, 0);
+  CHECK(off.size() == 0 && off.encoded_size() == HISTORY_HEADER_SIZE);
+}
+
+static void test_history_flush_policy() {
+  ExecutionHistory history;
+  FlakyStorage storage;
+  history.set_capacity(8);
+  history.set_flush_policy(2, 1000);
+  history.record(0, 0, 0);
+  CHECK(!history.is_flush_due(5000));
+  history.record(1, 0, 100);
+  // A batch is waiting, but the interval since the last flush has not passed
+  CHECK(!history.is_flush_due(999));
+  CHECK(history.is_flush_due(1000));
+  CHECK(history.flush(&storage, 1000));
+  CHECK(history.get_pending() == 0 && history.get_flushes() == 1 && storage.writes == 1);
+  CHECK(history.flush(&storage, 1000) && storage.writes == 1);
+
+  history.record(2, 0, 1100);
+  history.record(3, 0, 1200);
+  CHECK(!history.is_flush_due(1999) && history.is_flush_due(2000));
+  // A failed write keeps the records waiting and the next try waits for the interval again
+  storage.fail = true;
+  CHECK(!history.flush(&storage, 2000));
+  CHECK(history.get_pending() == 2 && history.get_flushes() == 1);
+  CHECK(!history.is_flush_due(2999));
+  storage.fail = false;
+  CHECK(history.is_flush_due(3000) && history.flush(&storage, 3000));
+  CHECK(history.get_flushes() == 2);
+}
+
+static void test_history_restore() {
+  FlakyStorage storage;
+  ExecutionHistory before;
+  before.set_capacity(4);
+  for (uint16_t rule = 0; rule < 4; rule++)
+    before.record(rule, 0, rule);
+  CHECK(before.flush(&storage, 0));
+
+  // Each boot takes the next number, and its records carry it
+  ExecutionHistory after;
+  after.set_capacity(4);
+  after.restore(&storage);
+  CHECK(after.get_boot() == before.get_boot() + 1 && after.size() == 4);
+  after.record(9, 0, 0);
+  std::vector<uint8_t> data = encoded(after);
+  CHECK(encoded_rule(data, 0) == 1 && encoded_rule(data, 3) == 9);
+  CHECK(data[HISTORY_HEADER_SIZE + 7] == before.get_boot());
+  CHECK(data[HISTORY_HEADER_SIZE + 3 * HISTORY_RECORD_SIZE + 7] == after.get_boot());
+
+  // A smaller ring keeps the newest records
+  ExecutionHistory smaller;
+  smaller.set_capacity(2);
+  smaller.restore(&storage);
+  data = encoded(smaller);
+  CHECK(smaller.size() == 2 && encoded_rule(data, 0) == 2 && encoded_rule(data, 1) == 3);
+
+  // A blob that is not a history is ignored
+  FlakyStorage other;
+  CHECK(other.save_blob("history", {'J', 'A', 'H', 'X', 1, 0, 0, 0}));
+  ExecutionHistory fresh;
+  fresh.set_capacity(2);
+  fresh.restore(&other);
+  CHECK(fresh.size() == 0 && fresh.get_boot() == 0);
+}
+
+void run_history_tests() {
+  test_history_ring();
+  test_history_flush_policy();
+  test_history_restore();
+}
@@ -0,0 +1,109 @@
+// Tests of the relay interlocks: both policies, wasm host calls, scene restores and invalid groups.
+
+#include "test_support.h"
+#include "wasm_runtime.h"
+
+#include <string>
+
+static void test_interlock_reject() {
+  Fixture f;
+  CHECK(f.engine.add_interlock({"switch.up", "switch.down"}, InterlockPolicy::REJECT));
+  CHECK(f.engine.load("[" + press_rule("u", "b_up", "turn_on", "up") + "," +
+                      press_rule("d", "b_down", "toggle", "down") + "]"));
+
+  f.press("b_up");
+  CHECK(f.is_on("up") && f.is_on("after"));
+  f.turn_off("after");
+  // The rejected action stops the rest of the chain
+  f.press("b_down");
+  CHECK(!f.is_on("down") && !f.is_on("after"));
+  CHECK(f.engine.get_interlock_rejected_count() == 1);
+  CHECK(f.log.get_warnings() == 1);
+
+  f.turn_off("up");
+  f.press("b_down");
+  CHECK(f.is_on("down"));
+  // Turning an output off is never blocked
+  f.press("b_down");
+  CHECK(!f.is_on("down"));
+  CHECK(f.engine.get_interlock_rejected_count() == 1);
+}
+
+static void test_interlock_turn_off_others() {
+  Fixture f;
+  CHECK(f.engine.add_interlock({"switch.v1", "switch.v2", "switch.v3"}, InterlockPolicy::TURN_OFF_OTHERS));
+  CHECK(f.engine.load("[" + press_rule("a", "b1", "turn_on", "v1") + "," + press_rule("b", "b2", "toggle", "v2") +
+                      "]"));
+
+  f.press("b1");
+  CHECK(f.is_on("v1"));
+  f.press("b2");
+  CHECK(f.is_on("v2") && !f.is_on("v1"));
+  f.press("b1");
+  CHECK(f.is_on("v1") && !f.is_on("v2"));
+  CHECK(f.engine.get_interlock_rejected_count() == 0);
+}
+
+static void test_interlock_wasm() {
+  Fixture f;
+  WasmRuntime wasm(&f.entities, &f.storage, &f.clock, &f.log);
+  wasm.set_engine(&f.engine);
+  f.engine.set_scripts(&wasm);
+  CHECK(wasm.add_module("m", SET_STATE_MODULE, false));
+  CHECK(f.engine.add_interlock({"switch.up", "switch.down"}, InterlockPolicy::REJECT));
+  CHECK(f.engine.load("[" + press_rule("u", "b_up", "turn_on", "up") +
+                      R"(,{"id":"w","trigger":{"source":"input","type":"press","input_id":"b_wasm"},)"
+                      R"("actions":[{"source":"wasm","module":"m","function":"run","entities":["switch.down"]}]}])"));
+
+  f.press("b_up");
+  // Host functions of a module obey the interlocks like rule actions
+  f.press("b_wasm");
+  CHECK(f.is_on("up") && !f.is_on("down"));
+  CHECK(f.engine.get_interlock_rejected_count() == 1);
+  f.turn_off("up");
+  f.press("b_wasm");
+  CHECK(f.is_on("down"));
+  CHECK(wasm.get_modules().front().traps == 0);
+}
+
+/// A snapshot taken with "up" on is restored after "down" has been turned on outside the snapshot.
+static void test_interlock_restore(InterlockPolicy policy) {
+  Fixture f;
+  CHECK(f.engine.add_interlock({"switch.up", "switch.down"}, policy));
+  CHECK(f.engine.load(
+      "[" + press_rule("d", "b_down", "turn_on", "down") +
+      R"(,{"id":"s","trigger":{"source":"input","type":"press","input_id":"b_snap"},)"
+      R"("actions":[{"source":"snapshot","name":"scene","entities":["switch.up"]}]},)"
+      R"({"id":"r","trigger":{"source":"input","type":"press","input_id":"b_restore"},)"
+      R"("actions":[{"source":"restore","name":"scene"},{"source":"switch","type":"turn_on","switch_id":"after"}]}])"));
+
+  f.entities.perform(ActionSource::SWITCH, ActionType::TURN_ON, f.output("up"));
+  f.press("b_snap");
+  f.turn_off("up");
+  f.press("b_down");
+  f.turn_off("after");
+  f.press("b_restore");
+  if (policy == InterlockPolicy::REJECT) {
+    // The output stays off and the rest of the chain stops, as after a rejected turn_on
+    CHECK(!f.is_on("up") && f.is_on("down") && !f.is_on("after"));
+    CHECK(f.engine.get_interlock_rejected_count() == 1);
+  } else {
+    CHECK(f.is_on("up") && !f.is_on("down") && f.is_on("after"));
+    CHECK(f.engine.get_interlock_rejected_count() == 0);
+  }
+}
+
+static void test_interlock_invalid_entity() {
+  Fixture f;
+  CHECK(!f.engine.add_interlock({"input.x", "switch.a"}, InterlockPolicy::REJECT));
+  CHECK(f.engine.get_interlocks().empty());
+}
+
+void run_interlock_tests() {
+  test_interlock_reject();
+  test_interlock_turn_off_others();
+  test_interlock_wasm();
+  test_interlock_restore(InterlockPolicy::REJECT);
+  test_interlock_restore(InterlockPolicy::TURN_OFF_OTHERS);
+  test_interlock_invalid_entity();
+}
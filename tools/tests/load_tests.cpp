@@ -0,0 +1,107 @@
+// Tests of the incremental loader: the resumable scanner and loads spread over many loop() calls.
+
+#include "test_support.h"
+#include "rule_parser.h"
+
+#include <string>
+#include <vector>
+
+/// Rules whose strings hold brackets, commas and escaped quotes, which the scanner must not take for structure.
+static const std::string TRICKY =
+    R"([ {"id":"a]","name":"x\"},{\\","trigger":{"source":"input","type":"press","input_id":"b1"},)"
+    R"("actions":[{"source":"switch","type":"toggle","switch_id":"s1"}]},)"
+    R"(  {"id":"b","name":"[[","trigger":{"source":"input","type":"release","input_id":"b2"},)"
+    R"("actions":[{"source":"delay","delay_s":1},{"source":"switch","type":"turn_on","switch_id":"s2"}]} ])";
+
+static void test_scanner_elements() {
+  // Every budget, down to one byte per call, splits the array into the same elements
+  for (size_t budget : {1, 3, 64, 4096}) {
+    RuleScanner scanner;
+    ParseReport report;
+    std::vector<std::string> elements;
+    RuleScanner::Status status;
+    size_t start, end, calls = 0;
+    while ((status = scanner.scan(TRICKY, budget, start, end, report)) != RuleScanner::Status::DONE &&
+           status != RuleScanner::Status::ERROR && calls++ < TRICKY.size() * 2) {
+      if (status == RuleScanner::Status::ELEMENT)
+        elements.push_back(TRICKY.substr(start, end - start));
+    }
+    CHECK(status == RuleScanner::Status::DONE && report.ok());
+    CHECK(elements.size() == 2);
+    if (elements.size() == 2)
+      CHECK(elements[0].find(R"({"id":"a]")") == 0 && elements[1].find(R"({"id":"b")") == 0);
+  }
+
+  for (const char *bad : {"{}", "[{}}]", "[{},,{}]", "[{} {}]"}) {
+    RuleScanner scanner;
+    ParseReport report;
+    RuleScanner::Status status;
+    size_t start, end;
+    while ((status = scanner.scan(bad, 1, start, end, report)) == RuleScanner::Status::MORE ||
+           status == RuleScanner::Status::ELEMENT) {
+    }
+    CHECK(status == RuleScanner::Status::ERROR && !report.ok());
+  }
+}
+
+static void test_incremental_matches_load() {
+  Fixture reference;
+  CHECK(reference.engine.load(TRICKY));
+  for (uint32_t budget : {1, 16, 0}) {
+    Fixture f;
+    f.engine.set_load_budget(budget, 0);
+    f.load_incrementally(TRICKY);
+    const RuleList rules = f.engine.get_rules();
+    CHECK(rules.size() == 2);
+    for (size_t i = 0; i < rules.size() && i < reference.engine.get_rules().size(); i++)
+      CHECK(rules[i] == reference.engine.get_rules()[i]);
+    CHECK(f.engine.get_active_count() == 2);
+    // One byte per step takes a step per byte; without a budget the load finishes in one
+    if (budget == 1)
+      CHECK(f.engine.get_last_load_steps() >= TRICKY.size());
+    if (budget == 0)
+      CHECK(f.engine.get_last_load_steps() == 1);
+    f.press("b1");
+    CHECK(f.is_on("s1"));
+  }
+}
+
+static void test_incremental_keeps_active_set() {
+  Fixture f;
+  CHECK(f.engine.load("[" + press_rule("old", "b1", "toggle", "s1") + "]"));
+  f.engine.set_load_budget(16, 0);
+  CHECK(f.engine.begin_load("[" + press_rule("new", "b1", "toggle", "s2") + "]"));
+  f.engine.loop();
+  CHECK(f.engine.is_loading());
+  f.press("b1");
+  CHECK(f.is_on("s1") && !f.is_on("s2"));
+  while (f.engine.is_loading())
+    f.engine.loop();
+  f.press("b1");
+  CHECK(f.is_on("s1") && f.is_on("s2"));
+  // A parse error leaves the active set untouched
+  CHECK(f.engine.begin_load("[{"));
+  while (f.engine.is_loading())
+    f.engine.loop();
+  CHECK(f.engine.get_rules().size() == 1 && f.engine.get_rules()[0].id == "new");
+}
+
+static void test_load_cancels_incremental() {
+  Fixture f;
+  f.engine.set_load_budget(16, 0);
+  CHECK(f.engine.begin_load("[" + press_rule("staged", "b1", "turn_on", "s1") + "]"));
+  f.engine.loop();
+  // A synchronous load replaces the set being staged
+  CHECK(f.engine.load("[" + press_rule("sync", "b2", "turn_on", "s2") + "]"));
+  CHECK(!f.engine.is_loading());
+  for (int i = 0; i < 20; i++)
+    f.engine.loop();
+  CHECK(f.engine.get_rules().size() == 1 && f.engine.get_rules()[0].id == "sync");
+}
+
+void run_load_tests() {
+  test_scanner_elements();
+  test_incremental_matches_load();
+  test_incremental_keeps_active_set();
+  test_load_cancels_incremental();
+}
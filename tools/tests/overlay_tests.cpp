@@ -0,0 +1,81 @@
+// Tests of the base layer and the overlays loaded on top of it, with sync and incremental loads.
+
+#include "test_support.h"
+
+#include <string>
+
+static const std::string BASE = "[" + press_rule("a", "b1", "turn_on", "s1") + "," +
+                                press_rule("b", "b2", "turn_on", "s2") + "," +
+                                press_rule("c", "b3", "turn_on", "s3") + "]";
+static const std::string OVERLAY = "[" + press_rule("b", "b2", "turn_on", "s9") +
+                                   R"(,{"id":"c","enabled":false},{"id":"missing","enabled":false},)" +
+                                   press_rule("d", "b4", "turn_on", "s4") + "]";
+
+/// Overlay rules come first, the base rules they do not replace follow, and patches only toggle enabled.
+static void check_merged(Fixture &f) {
+  const RuleList rules = f.engine.get_rules();
+  CHECK(rules.size() == 4);
+  if (rules.size() == 4) {
+    CHECK(rules[0].id == "b" && rules[1].id == "d" && rules[2].id == "a" && rules[3].id == "c");
+    CHECK(rules[2].enabled && !rules[3].enabled);
+  }
+  CHECK(f.engine.get_active_count() == 3);
+  for (const char *input_id : {"b1", "b2", "b3", "b4"})
+    f.press(input_id);
+  CHECK(f.is_on("s1") && !f.is_on("s2") && !f.is_on("s3") && f.is_on("s4") && f.is_on("s9"));
+}
+
+static void test_overlay_merge() {
+  Fixture f;
+  f.engine.set_base_json(BASE);
+  CHECK(f.engine.load_from_storage());
+  f.engine.create_all();
+  CHECK(f.engine.get_rules().size() == 3 && f.engine.get_active_count() == 3);
+  CHECK(f.engine.load(OVERLAY));
+  check_merged(f);
+}
+
+static void test_overlay_incremental() {
+  Fixture f;
+  f.engine.set_base_json(BASE);
+  f.engine.set_load_budget(40, 0);
+  f.load_incrementally("");
+  CHECK(f.engine.get_rules().size() == 3);
+  f.load_incrementally(OVERLAY);
+  CHECK(f.engine.get_last_load_steps() > 1);
+  check_merged(f);
+}
+
+static void test_overlay_patch_only() {
+  Fixture f;
+  f.engine.set_base_json(BASE);
+  CHECK(f.engine.load(R"([{"id":"a","enabled":false}])"));
+  CHECK(f.engine.get_rules().size() == 3 && f.engine.get_active_count() == 2);
+  f.press("b1");
+  f.press("b2");
+  CHECK(!f.is_on("s1") && f.is_on("s2"));
+  // An empty overlay restores the base layer
+  CHECK(f.engine.load("[]"));
+  CHECK(f.engine.get_active_count() == 3);
+  f.press("b1");
+  CHECK(f.is_on("s1"));
+}
+
+static void test_overlay_enables_base_rule() {
+  Fixture f;
+  f.engine.set_base_json(R"([{"id":"off","enabled":false,"trigger":{"source":"input","type":"press","input_id":"b1"},)"
+                         R"("actions":[{"source":"switch","type":"turn_on","switch_id":"s1"}]}])");
+  CHECK(f.engine.load("[]"));
+  CHECK(f.engine.get_active_count() == 0);
+  CHECK(f.engine.load(R"([{"id":"off","enabled":true}])"));
+  CHECK(f.engine.get_rules().size() == 1 && f.engine.get_active_count() == 1);
+  f.press("b1");
+  CHECK(f.is_on("s1"));
+}
+
+void run_overlay_tests() {
+  test_overlay_merge();
+  test_overlay_incremental();
+  test_overlay_patch_only();
+  test_overlay_enables_base_rule();
+}
@@ -0,0 +1,72 @@
+// Tests of rule block sharing: an incremental load reuses the blocks of unchanged rules from the active set.
+
+#include "test_support.h"
+
+#include <memory>
+#include <string>
+
+static const std::string RULE_A = press_rule("a", "b1", "toggle", "s1");
+static const std::string RULE_B = press_rule("b", "b2", "toggle", "s2");
+static const std::string RULE_C = press_rule("c", "b3", "toggle", "s3");
+
+static void test_unchanged_blocks_shared() {
+  Fixture f;
+  f.engine.set_load_budget(64, 0);
+  f.load_incrementally("[" + RULE_A + "," + RULE_B + "," + RULE_C + "]");
+  CHECK(f.engine.get_last_load_reused() == 0);
+  const RuleBlockRef a = f.engine.get_rule_blocks()[0];
+  const RuleBlockRef c = f.engine.get_rule_blocks()[2];
+  const std::weak_ptr<RuleBlock> old_b = f.engine.get_rule_blocks()[1];
+
+  // b changes and a new rule moves the others down
+  CHECK(f.engine.begin_load("[" + press_rule("d", "b4", "toggle", "s4") + "," + RULE_A + "," +
+                            press_rule("b", "b2", "toggle", "s9") + "," + RULE_C + "]"));
+  while (f.engine.is_loading()) {
+    f.engine.loop();
+    // Until the load completes, the active set holds the old block of b
+    if (f.engine.is_loading())
+      CHECK(!old_b.expired());
+  }
+  const auto &blocks = f.engine.get_rule_blocks();
+  CHECK(blocks.size() == 4);
+  if (blocks.size() == 4) {
+    CHECK(blocks[1] == a && blocks[3] == c);
+    CHECK(blocks[2]->rule.id == "b" && blocks[2]->rule.actions[0].switch_id == "s9");
+  }
+  CHECK(f.engine.get_last_load_reused() == 2);
+  // The fixture copies and the engine are the only owners left; the old b went with the old set
+  CHECK(a.use_count() == 2 && c.use_count() == 2);
+  CHECK(old_b.expired());
+
+  // Shared blocks are compiled against the same entities and still run
+  f.press("b1");
+  f.press("b2");
+  f.press("b3");
+  CHECK(f.is_on("s1") && !f.is_on("s2") && f.is_on("s9") && f.is_on("s3"));
+}
+
+static void test_reused_while_keeps_level() {
+  const std::string fan = R"({"id":"fan","trigger":{"source":"while","all":["humid"]},)"
+                          R"("actions":[{"source":"switch","type":"turn_on","switch_id":"fan"}]})";
+  Fixture f;
+  f.load_incrementally("[" + fan + "]");
+  f.set("humid", true);
+  CHECK(f.is_on("fan"));
+  f.turn_off("fan");
+
+  // An unchanged while rule keeps its level and does not run its actions again
+  f.load_incrementally("[" + RULE_A + "," + fan + "]");
+  CHECK(f.engine.get_last_load_reused() == 1);
+  CHECK(!f.is_on("fan"));
+
+  // A changed one starts over and enters again since its condition holds
+  f.load_incrementally("[" + RULE_A + R"(,{"id":"fan","name":"Fan","trigger":{"source":"while","all":["humid"]},)"
+                       R"("actions":[{"source":"switch","type":"turn_on","switch_id":"fan"}]}])");
+  CHECK(f.engine.get_last_load_reused() == 1);
+  CHECK(f.is_on("fan"));
+}
+
+void run_rule_block_tests() {
+  test_unchanged_blocks_shared();
+  test_reused_while_keeps_level();
+}
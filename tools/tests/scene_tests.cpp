@@ -0,0 +1,155 @@
+// Tests of the snapshot and restore actions: restore order, light brightness, untaken and reloaded snapshots.
+
+#include "test_support.h"
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+/// Host entities where lights have a brightness, recording the restores in order. A restore can run a callback,
+/// as the state callbacks of a real output can run automations.
+class SceneEntities : public HostEntities {
+ public:
+  struct Restore {
+    int32_t handle;
+    bool state;
+    uint8_t level;
+  };
+
+  uint8_t get_output_level(ActionSource source, int32_t handle) override {
+    auto it = this->levels.find(handle);
+    if (it == this->levels.end() || !this->get_output(handle))
+      return HostEntities::get_output_level(source, handle);
+    return it->second;
+  }
+  void restore_output(ActionSource source, int32_t handle, bool state, uint8_t level) override {
+    this->restores.push_back(Restore{handle, state, level});
+    HostEntities::restore_output(source, handle, state, level);
+    if (this->on_restore)
+      this->on_restore();
+  }
+
+  std::map<int32_t, uint8_t> levels;
+  std::vector<Restore> restores;
+  std::function<void()> on_restore;
+};
+
+struct SceneFixture {
+  SceneEntities entities;
+  MemoryStorage storage;
+  VirtualClock clock;
+  CountingLog log;
+  RuleEngine engine{&this->entities, &this->storage, &this->clock, &this->log};
+
+  SceneFixture() { this->entities.set_engine(&this->engine); }
+
+  int32_t output(ActionSource source, const char *object_id) {
+    return this->entities.resolve_output(source, object_id);
+  }
+  void set_output(ActionSource source, const char *object_id, bool state) {
+    this->entities.perform(source, state ? ActionType::TURN_ON : ActionType::TURN_OFF, this->output(source, object_id));
+  }
+  void press(const char *input_id) {
+    const int32_t input = this->entities.resolve_input(input_id);
+    this->entities.set_input(input, true);
+    this->entities.set_input(input, false);
+  }
+};
+
+static const char *const SCENE_RULES =
+    R"([{"id":"snap","trigger":{"source":"input","type":"press","input_id":"b_snap"},)"
+    R"("actions":[{"source":"snapshot","name":"scene","entities":["switch.a","switch.b","light.l"]}]},)"
+    R"({"id":"restore","trigger":{"source":"input","type":"press","input_id":"b_restore"},)"
+    R"("actions":[{"source":"restore","name":"scene"},{"source":"switch","type":"turn_on","switch_id":"after"}]}])";
+
+static void test_scene_restore_order() {
+  SceneFixture f;
+  CHECK(f.engine.load(SCENE_RULES));
+  const int32_t a = f.output(ActionSource::SWITCH, "a");
+  const int32_t b = f.output(ActionSource::SWITCH, "b");
+  const int32_t l = f.output(ActionSource::LIGHT, "l");
+  f.set_output(ActionSource::SWITCH, "a", true);
+  f.set_output(ActionSource::LIGHT, "l", true);
+  f.entities.levels[l] = 128;
+  f.press("b_snap");
+
+  f.set_output(ActionSource::SWITCH, "a", false);
+  f.set_output(ActionSource::SWITCH, "b", true);
+  f.set_output(ActionSource::LIGHT, "l", false);
+  f.press("b_restore");
+  // The output that was off is turned off before the others are turned on, the light at its brightness
+  const auto &restores = f.entities.restores;
+  CHECK(restores.size() == 3);
+  if (restores.size() == 3) {
+    CHECK(restores[0].handle == b && !restores[0].state);
+    CHECK(restores[1].handle == a && restores[1].state);
+    CHECK(restores[2].handle == l && restores[2].state && restores[2].level == 128);
+  }
+  CHECK(f.entities.get_output(a) && !f.entities.get_output(b) && f.entities.get_output(l));
+  CHECK(f.entities.get_output(f.output(ActionSource::SWITCH, "after")));
+}
+
+static void test_scene_not_taken() {
+  SceneFixture f;
+  CHECK(f.engine.load(SCENE_RULES));
+  const uint32_t warnings = f.log.get_warnings();
+  CHECK(!f.engine.restore("scene"));
+  CHECK(!f.engine.restore("missing"));
+  CHECK(f.log.get_warnings() == warnings + 2);
+  // The restore action warns and the chain goes on
+  f.press("b_restore");
+  CHECK(f.entities.restores.empty() && f.entities.get_output(f.output(ActionSource::SWITCH, "after")));
+  CHECK(f.log.get_warnings() == warnings + 3);
+  // A snapshot without any known entity is not taken
+  CHECK(!f.engine.snapshot("empty", {"input.x"}));
+}
+
+static void test_scene_survives_reload() {
+  SceneFixture f;
+  CHECK(f.engine.load(SCENE_RULES));
+  f.set_output(ActionSource::SWITCH, "a", true);
+  f.press("b_snap");
+  CHECK(f.engine.load("[]"));
+  CHECK(f.engine.get_scenes().size() == 1);
+  f.set_output(ActionSource::SWITCH, "a", false);
+  CHECK(f.engine.restore("scene"));
+  CHECK(f.entities.get_output(f.output(ActionSource::SWITCH, "a")));
+
+  // An empty list keeps the list of the earlier snapshot
+  f.set_output(ActionSource::SWITCH, "b", true);
+  CHECK(f.engine.snapshot("scene", {}));
+  f.set_output(ActionSource::SWITCH, "b", false);
+  CHECK(f.engine.restore("scene"));
+  CHECK(f.entities.get_output(f.output(ActionSource::SWITCH, "b")));
+  CHECK(f.engine.get_scenes()[0].entities.size() == 3);
+}
+
+static void test_scene_snapshot_during_restore() {
+  SceneFixture f;
+  CHECK(f.engine.load(SCENE_RULES));
+  f.set_output(ActionSource::SWITCH, "a", true);
+  f.set_output(ActionSource::SWITCH, "b", true);
+  f.press("b_snap");
+  f.set_output(ActionSource::SWITCH, "a", false);
+  f.set_output(ActionSource::SWITCH, "b", false);
+
+  // An output that takes a snapshot of the scene being restored with a new list changes neither the states
+  // nor the outputs the restore goes on with
+  f.entities.on_restore = [&f]() {
+    f.entities.on_restore = nullptr;
+    f.engine.snapshot("scene", {"switch.x"});
+  };
+  CHECK(f.engine.restore("scene"));
+  CHECK(f.entities.restores.size() == 3);
+  CHECK(f.entities.get_output(f.output(ActionSource::SWITCH, "a")));
+  CHECK(f.entities.get_output(f.output(ActionSource::SWITCH, "b")));
+  CHECK(f.engine.get_scenes()[0].entities.size() == 3);
+}
+
+void run_scene_tests() {
+  test_scene_restore_order();
+  test_scene_not_taken();
+  test_scene_survives_reload();
+  test_scene_snapshot_during_restore();
+}
@@ -0,0 +1,88 @@
+// Tests of the boot settle period: input changes right after boot only run rules with fire_on_initial_state.
+
+#include "test_support.h"
+
+#include <string>
+
+static void test_settle_suppresses_runs() {
+  Fixture f;
+  CHECK(f.engine.load("[" + press_rule("plain", "b1", "toggle", "s1") +
+                      R"(,{"id":"initial","fire_on_initial_state":true,)"
+                      R"("trigger":{"source":"input","type":"press","input_id":"b2"},)"
+                      R"("actions":[{"source":"switch","type":"toggle","switch_id":"s2"}]}])"));
+  f.engine.begin_settle(3000);
+  CHECK(f.engine.is_settling());
+  f.press("b1");
+  f.press("b2");
+  CHECK(!f.is_on("s1") && f.is_on("s2"));
+  CHECK(f.engine.get_suppressed_count() == 1);
+
+  // The period ends on time, not on the next input
+  f.clock.set_us(2999000);
+  CHECK(f.engine.is_settling());
+  f.clock.set_us(3000000);
+  CHECK(!f.engine.is_settling());
+  f.press("b1");
+  CHECK(f.is_on("s1"));
+  CHECK(f.engine.get_suppressed_count() == 1);
+
+  // 0 turns the settle period off
+  f.engine.begin_settle(0);
+  CHECK(!f.engine.is_settling());
+}
+
+static void test_settle_across_millis_wrap() {
+  Fixture f;
+  CHECK(f.engine.load("[" + press_rule("plain", "b1", "toggle", "s1") + "]"));
+  const uint64_t wrap_us = (static_cast<uint64_t>(UINT32_MAX) + 1) * 1000;
+  f.clock.set_us(wrap_us - 1000000);
+  f.engine.begin_settle(3000);
+  f.clock.set_us(wrap_us + 1000000);
+  CHECK(f.engine.is_settling());
+  f.clock.set_us(wrap_us + 2000000);
+  CHECK(!f.engine.is_settling());
+}
+
+static void test_settle_tracks_while_level() {
+  Fixture f;
+  CHECK(f.engine.load(R"([{"id":"fan","trigger":{"source":"while","all":["humid"]},)"
+                      R"("actions":[{"source":"switch","type":"turn_on","switch_id":"fan"}],)"
+                      R"("exit_actions":[{"source":"switch","type":"toggle","switch_id":"exited"}]}])"));
+  f.engine.begin_settle(3000);
+  f.set("humid", true);
+  CHECK(!f.is_on("fan") && f.engine.get_suppressed_count() == 1);
+
+  // The level entered during the settle period, so leaving it afterwards is a real transition
+  f.clock.set_us(3000000);
+  f.set("humid", false);
+  CHECK(f.is_on("exited") && !f.is_on("fan"));
+  f.set("humid", true);
+  CHECK(f.is_on("fan"));
+}
+
+static void test_settle_suppresses_sensor_rules() {
+  Fixture f;
+  CHECK(f.engine.load(R"([{"id":"hot","trigger":{"source":"sensor","type":"above","sensor_id":"temp","threshold":25},)"
+                      R"("actions":[{"source":"switch","type":"toggle","switch_id":"fan"}]}])"));
+  const int32_t temp = f.entities.resolve_sensor("temp");
+  f.engine.begin_settle(3000);
+  for (float value : {20.0f, 30.0f}) {
+    f.entities.set_sensor(temp, value);
+    f.engine.loop();
+  }
+  CHECK(!f.is_on("fan") && f.engine.get_suppressed_count() == 1);
+
+  f.clock.set_us(3000000);
+  for (float value : {20.0f, 30.0f}) {
+    f.entities.set_sensor(temp, value);
+    f.engine.loop();
+  }
+  CHECK(f.is_on("fan"));
+}
+
+void run_settle_tests() {
+  test_settle_suppresses_runs();
+  test_settle_across_millis_wrap();
+  test_settle_tracks_while_level();
+  test_settle_suppresses_sensor_rules();
+}
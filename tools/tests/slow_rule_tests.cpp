@@ -0,0 +1,87 @@
+// Tests of the latency budgets: on_slow_rule, its rate limit and the counters.
+
+#include "test_support.h"
+
+#include <string>
+#include <vector>
+
+/// Post value to sensor at post_us and evaluate it in a loop() at loop_us.
+static void post_at(Fixture &f, int32_t sensor, float value, uint64_t post_us, uint64_t loop_us) {
+  f.clock.set_us(post_us);
+  f.entities.set_sensor(sensor, value);
+  f.clock.set_us(loop_us);
+  f.engine.loop();
+}
+
+static void test_slow_rule_reports() {
+  Fixture f;
+  CHECK(f.engine.load(R"([{"id":"hot","max_latency_ms":20,)"
+                      R"("trigger":{"source":"sensor","type":"above","sensor_id":"temp","threshold":25},)"
+                      R"("actions":[{"source":"switch","type":"toggle","switch_id":"fan"}]},)"
+                      R"({"id":"free","trigger":{"source":"sensor","type":"above","sensor_id":"hum","threshold":60},)"
+                      R"("actions":[{"source":"switch","type":"toggle","switch_id":"dry"}]}])"));
+  std::vector<std::string> ids;
+  std::vector<uint32_t> latencies;
+  f.engine.set_on_slow_rule([&](const std::string &id, uint32_t latency_us) {
+    ids.push_back(id);
+    latencies.push_back(latency_us);
+  });
+  const int32_t temp = f.entities.resolve_sensor("temp");
+  const int32_t hum = f.entities.resolve_sensor("hum");
+
+  // Within the budget
+  post_at(f, temp, 20.0f, 0, 0);
+  post_at(f, temp, 30.0f, 1000000, 1010000);
+  CHECK(f.is_on("fan") && f.engine.get_slow_rule_count() == 0);
+
+  // The wait for loop() counts, from the first value of the batch
+  post_at(f, temp, 20.0f, 2000000, 2000000);
+  f.clock.set_us(3000000);
+  f.entities.set_sensor(temp, 28.0f);
+  post_at(f, temp, 30.0f, 3010000, 3030000);
+  CHECK(!f.is_on("fan") && f.engine.get_slow_rule_count() == 1);
+  CHECK(ids.size() == 1 && ids[0] == "hot" && latencies[0] == 30000);
+
+  // Rules without a budget are not measured
+  post_at(f, hum, 50.0f, 4000000, 4000000);
+  post_at(f, hum, 70.0f, 5000000, 5500000);
+  CHECK(f.is_on("dry") && f.engine.get_slow_rule_count() == 1);
+}
+
+static void test_slow_rule_rate_limit() {
+  Fixture f;
+  CHECK(f.engine.load(R"([{"id":"hot","max_latency_ms":20,)"
+                      R"("trigger":{"source":"sensor","type":"above","sensor_id":"temp","threshold":25},)"
+                      R"("actions":[{"source":"switch","type":"toggle","switch_id":"fan"}]}])"));
+  int reports = 0;
+  f.engine.set_on_slow_rule([&reports](const std::string &, uint32_t) { reports++; });
+  const int32_t temp = f.entities.resolve_sensor("temp");
+  // A run 100 ms over its budget, at second
+  auto slow_run = [&f, temp](uint64_t second) {
+    post_at(f, temp, 20.0f, second * 1000000, second * 1000000);
+    post_at(f, temp, 30.0f, second * 1000000 + 500000, second * 1000000 + 600000);
+  };
+
+  // One report per interval of 10 s by default; the others are counted as dropped
+  for (uint64_t second = 0; second < 10; second++)
+    slow_run(second);
+  CHECK(reports == 1);
+  CHECK(f.engine.get_slow_rule_count() == 10 && f.engine.get_slow_rule_dropped() == 9);
+  slow_run(10);
+  CHECK(reports == 2 && f.engine.get_slow_rule_dropped() == 9);
+
+  f.engine.set_slow_rule_interval(2000);
+  slow_run(11);
+  slow_run(12);
+  slow_run(13);
+  CHECK(reports == 3 && f.engine.get_slow_rule_dropped() == 11);
+  f.engine.set_slow_rule_interval(0);
+  slow_run(14);
+  slow_run(15);
+  CHECK(reports == 5 && f.engine.get_slow_rule_count() == 16);
+}
+
+void run_slow_rule_tests() {
+  test_slow_rule_reports();
+  test_slow_rule_rate_limit();
+}
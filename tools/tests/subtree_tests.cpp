@@ -0,0 +1,105 @@
+// Tests of the subtree operations on hierarchical rule ids, and of the renumbering when a subtree is removed.
+
+#include "test_support.h"
+
+#include <string>
+#include <vector>
+
+/// Ids of the rules at indices, comma separated.
+static std::string ids_of(Fixture &f, const std::vector<uint16_t> &indices) {
+  std::string ids;
+  for (uint16_t index : indices)
+    ids += (ids.empty() ? "" : ",") + f.engine.get_rules()[index].id;
+  return ids;
+}
+
+static void test_find_subtree() {
+  Fixture f;
+  CHECK(f.engine.load("[" + press_rule("zone10", "b1", "toggle", "s1") + "," +
+                      press_rule("zone1/lights/night", "b2", "toggle", "s2") + "," +
+                      press_rule("zone1", "b3", "toggle", "s3") + "," + press_rule("zone2", "b4", "toggle", "s4") +
+                      "," + press_rule("zone1/heat", "b5", "toggle", "s5") + "]"));
+  CHECK(ids_of(f, f.engine.find_subtree("zone1")) == "zone1,zone1/heat,zone1/lights/night");
+  CHECK(ids_of(f, f.engine.find_subtree("zone1/")) == "zone1,zone1/heat,zone1/lights/night");
+  CHECK(ids_of(f, f.engine.find_subtree("zone1/lights")) == "zone1/lights/night");
+  CHECK(ids_of(f, f.engine.find_subtree("")) == "zone1,zone1/heat,zone1/lights/night,zone10,zone2");
+  // Prefixes match whole path components
+  CHECK(f.engine.find_subtree("zone").empty());
+  CHECK(f.engine.find_subtree("zone1/l").empty());
+}
+
+static void test_subtree_enable_and_stop() {
+  Fixture f;
+  CHECK(f.engine.load("[" + delayed_rule("zone1/a", "b1", "s1") + "," + press_rule("zone1/b", "b2", "toggle", "s2") +
+                      "," + delayed_rule("zone2/a", "b3", "s3") + "]"));
+  CHECK(f.engine.set_subtree_enabled("zone1", false) == 2);
+  CHECK(f.engine.set_subtree_enabled("zone1", false) == 0);
+  f.press("b2");
+  CHECK(!f.is_on("s2"));
+  CHECK(f.engine.set_subtree_enabled("zone1", true) == 2);
+  f.press("b2");
+  CHECK(f.is_on("s2"));
+
+  // Stopping cancels only the delays of the subtree
+  f.press("b1");
+  f.press("b3");
+  CHECK(f.engine.get_pending_count() == 2);
+  CHECK(f.engine.stop_subtree("zone1") == 1);
+  CHECK(f.engine.stop_subtree("zone1") == 0);
+  f.clock.set_us(1000000);
+  f.engine.loop();
+  CHECK(!f.is_on("s1") && f.is_on("s3"));
+
+  // Disabling a rule cancels its delays as well
+  f.press("b1");
+  CHECK(f.engine.set_subtree_enabled("zone1/a", false) == 1);
+  CHECK(f.engine.get_pending_count() == 0);
+}
+
+static void test_remove_subtree_renumbers() {
+  Fixture f;
+  CHECK(f.engine.load("[" + press_rule("zone/x", "b2", "toggle", "s2") + "," + delayed_rule("a", "b1", "s1") + "," +
+                      delayed_rule("c", "b3", "s3") + "," + press_rule("zone/y", "b2", "toggle", "s2") + "," +
+                      press_rule("d", "b4", "toggle", "s4") + "]"));
+  f.press("b1");
+  const uint32_t generation = f.engine.get_generation();
+  CHECK(f.engine.remove_subtree("zone") == 2);
+  CHECK(f.engine.remove_subtree("zone") == 0);
+  CHECK(f.engine.get_generation() != generation);
+  CHECK(f.engine.get_rules().size() == 3);
+  CHECK(f.engine.find_rule("zone/x") == -1);
+  CHECK(f.engine.find_rule("a") == 0 && f.engine.find_rule("c") == 1 && f.engine.find_rule("d") == 2);
+
+  // Inputs dispatch to the new indices
+  f.press("b2");
+  f.press("b4");
+  CHECK(!f.is_on("s2") && f.is_on("s4"));
+
+  // The delay pending across the removal resumes "a", not "c" which took its old index
+  std::vector<uint16_t> resumed;
+  f.engine.set_on_rule_run([&resumed](uint16_t rule, RunResult) { resumed.push_back(rule); });
+  f.clock.set_us(1000000);
+  f.engine.loop();
+  CHECK(f.is_on("s1") && !f.is_on("s3"));
+  CHECK(ids_of(f, resumed) == "a");
+}
+
+static void test_execute_subtree_in_id_order() {
+  Fixture f;
+  CHECK(f.engine.load("[" + press_rule("zone/b", "b1", "toggle", "s2") + "," +
+                      press_rule("other", "b2", "toggle", "s3") + "," + press_rule("zone/a", "b3", "toggle", "s1") +
+                      "]"));
+  std::vector<uint16_t> runs;
+  f.engine.set_on_rule_run([&runs](uint16_t rule, RunResult) { runs.push_back(rule); });
+  CHECK(f.engine.execute_subtree("zone") == 2);
+  CHECK(ids_of(f, runs) == "zone/a,zone/b");
+  CHECK(f.is_on("s1") && f.is_on("s2") && !f.is_on("s3"));
+  CHECK(f.engine.execute_subtree("none") == 0);
+}
+
+void run_subtree_tests() {
+  test_find_subtree();
+  test_subtree_enable_and_stop();
+  test_remove_subtree_renumbers();
+  test_execute_subtree_in_id_order();
+}
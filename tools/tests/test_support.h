@@ -0,0 +1,95 @@
+#pragma once
+
+// Helpers shared by the engine tests: the CHECK macro, an engine on the host adapters and rule builders.
+
+#include "host_adapters.h"
+#include "rule_engine.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace esphome::json_automation;
+
+/// Failed checks of the whole test program.
+extern int failures;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+/// Engine on host adapters, with helpers to press inputs and read outputs by object id.
+struct Fixture {
+  HostEntities entities;
+  MemoryStorage storage;
+  VirtualClock clock;
+  CountingLog log;
+  RuleEngine engine{&this->entities, &this->storage, &this->clock, &this->log};
+
+  Fixture() { this->entities.set_engine(&this->engine); }
+
+  int32_t output(const char *object_id) { return this->entities.resolve_output(ActionSource::SWITCH, object_id); }
+  bool is_on(const char *object_id) { return this->entities.get_output(this->output(object_id)); }
+  void turn_off(const char *object_id) {
+    this->entities.perform(ActionSource::SWITCH, ActionType::TURN_OFF, this->output(object_id));
+  }
+  void set(const char *input_id, bool state) {
+    this->entities.set_input(this->entities.resolve_input(input_id), state);
+  }
+  void press(const char *input_id) {
+    this->set(input_id, true);
+    this->set(input_id, false);
+  }
+  /// Run an incremental load to completion, one budget per loop().
+  void load_incrementally(const std::string &json_data) {
+    CHECK(this->engine.begin_load(json_data));
+    while (this->engine.is_loading())
+      this->engine.loop();
+  }
+};
+
+/// Rule pressing input_id that sets switch_id with type, then turns on the switch "after".
+inline std::string press_rule(const std::string &id, const std::string &input_id, const std::string &type,
+                              const std::string &switch_id) {
+  return R"({"id":")" + id + R"(","trigger":{"source":"input","type":"press","input_id":")" + input_id +
+         R"("},"actions":[{"source":"switch","type":")" + type + R"(","switch_id":")" + switch_id +
+         R"("},{"source":"switch","type":"turn_on","switch_id":"after"}]})";
+}
+
+/// Rule pressing input_id that waits a second, then turns on switch_id.
+inline std::string delayed_rule(const std::string &id, const std::string &input_id, const std::string &switch_id) {
+  return R"({"id":")" + id + R"(","trigger":{"source":"input","type":"press","input_id":")" + input_id +
+         R"("},"actions":[{"source":"delay","delay_s":1},{"source":"switch","type":"turn_on","switch_id":")" +
+         switch_id + R"("}]})";
+}
+
+/// Module importing env.set_state and exporting run(), which calls set_state(0, 1).
+inline const std::vector<uint8_t> SET_STATE_MODULE = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    // Types: (i32, i32) -> () and () -> ()
+    0x01, 0x09, 0x02, 0x60, 0x02, 0x7f, 0x7f, 0x00, 0x60, 0x00, 0x00,
+    // Import env.set_state
+    0x02, 0x11, 0x01, 0x03, 'e', 'n', 'v', 0x09, 's', 'e', 't', '_', 's', 't', 'a', 't', 'e', 0x00, 0x00,
+    // Function 1 and its export "run"
+    0x03, 0x02, 0x01, 0x01, 0x07, 0x07, 0x01, 0x03, 'r', 'u', 'n', 0x00, 0x01,
+    // Code: i32.const 0, i32.const 1, call 0
+    0x0a, 0x0a, 0x01, 0x08, 0x00, 0x41, 0x00, 0x41, 0x01, 0x10, 0x00, 0x0b,
+};
+
+// Tests in the feature files, run by engine_tests.cpp
+void run_load_tests();
+void run_rule_block_tests();
+void run_compaction_tests();
+void run_while_tests();
+void run_settle_tests();
+void run_subtree_tests();
+void run_overlay_tests();
+void run_execute_tests();
+void run_interlock_tests();
+void run_slow_rule_tests();
+void run_scene_tests();
+void run_history_tests();
@@ -0,0 +1,251 @@
+// Host tests of the WebAssembly interpreter.
+//
+// Modules are assembled from sections in the tests. The checks cover modules that parse() must reject, traps,
+// fuel and call depth limits, and memory bounds; a failed check prints its location and makes the program exit
+// non-zero.
+
+#include "wasm_interpreter.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace esphome::json_automation;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+using Bytes = std::vector<uint8_t>;
+
+static void append_u32(Bytes &out, uint32_t value) {
+  do {
+    const uint8_t byte = value & 0x7F;
+    value >>= 7;
+    out.push_back(value != 0 ? byte | 0x80 : byte);
+  } while (value != 0);
+}
+
+static Bytes section(uint8_t id, const Bytes &content) {
+  Bytes out{id};
+  append_u32(out, content.size());
+  out.insert(out.end(), content.begin(), content.end());
+  return out;
+}
+
+static Bytes module(std::initializer_list<Bytes> sections) {
+  Bytes out{0x00, 'a', 's', 'm', 0x01, 0x00, 0x00, 0x00};
+  for (const Bytes &s : sections)
+    out.insert(out.end(), s.begin(), s.end());
+  return out;
+}
+
+/// Code section with one body per instruction list; the bodies have no locals beyond their parameters.
+static Bytes code(std::initializer_list<Bytes> bodies) {
+  Bytes content;
+  append_u32(content, bodies.size());
+  for (const Bytes &instructions : bodies) {
+    append_u32(content, instructions.size() + 2);
+    content.push_back(0x00);
+    content.insert(content.end(), instructions.begin(), instructions.end());
+    content.push_back(0x0B);
+  }
+  return section(10, content);
+}
+
+/// Types 0: () -> i32, 1: (i32) -> i32, 2: (i32, i32) -> (), 3: () -> ().
+static const Bytes TYPES = section(1, {0x04, 0x60, 0x00, 0x01, 0x7F, 0x60, 0x01, 0x7F, 0x01, 0x7F, 0x60, 0x02, 0x7F,
+                                       0x7F, 0x00, 0x60, 0x00, 0x00});
+static const Bytes IMPORT_SET_STATE =
+    section(2, {0x01, 0x03, 'e', 'n', 'v', 0x09, 's', 'e', 't', '_', 's', 't', 'a', 't', 'e', 0x00, 0x02});
+static const Bytes IMPORT_LOG = section(2, {0x01, 0x03, 'e', 'n', 'v', 0x03, 'l', 'o', 'g', 0x00, 0x02});
+static const Bytes EXPORT_RUN = section(7, {0x01, 0x03, 'r', 'u', 'n', 0x00, 0x00});
+static const Bytes CUSTOM = section(0, {0x04, 'n', 'a', 'm', 'e', 0xFF});
+
+/// Host that records what modules ask of it.
+class RecordingHost : public WasmHost {
+ public:
+  int32_t get_state(uint32_t entity) override { return entity == 0 ? 1 : -1; }
+  void set_state(uint32_t entity, bool state) override { this->set_calls++; }
+  void toggle(uint32_t entity) override {}
+  uint32_t millis() override { return 0; }
+  void log(const char *message, size_t length) override { this->logged.assign(message, length); }
+
+  int set_calls{0};
+  std::string logged;
+};
+
+static bool parses(const Bytes &bytes) {
+  WasmModule m;
+  std::string error;
+  const bool ok = m.parse(bytes.data(), bytes.size(), error);
+  CHECK(ok || !error.empty());
+  return ok;
+}
+
+/// Parse and instantiate bytes, which must succeed.
+static bool instantiate(WasmInstance &instance, const Bytes &bytes, const WasmLimits &limits = WasmLimits()) {
+  auto m = std::make_shared<WasmModule>();
+  std::string error;
+  if (!m->parse(bytes.data(), bytes.size(), error) || !instance.instantiate(m, limits, error)) {
+    fprintf(stderr, "module rejected: %s\n", error.c_str());
+    return false;
+  }
+  return true;
+}
+
+struct CallResult {
+  bool ok;
+  int32_t value;
+  std::string error;
+};
+
+static CallResult call(WasmInstance &instance, uint32_t function, std::vector<int32_t> args = {},
+                       WasmHost *host = nullptr) {
+  CallResult r{false, 0, ""};
+  bool has_result;
+  r.ok = instance.call(function, args.data(), args.size(), host, r.value, has_result, r.error);
+  return r;
+}
+
+static void test_call() {
+  const Bytes bytes = module({TYPES, section(3, {0x01, 0x00}), EXPORT_RUN, code({{0x41, 0x2A}})});
+  WasmInstance instance;
+  CHECK(instantiate(instance, bytes));
+  CHECK(instance.get_module().find_export("run") == 0);
+  const CallResult r = call(instance, 0);
+  CHECK(r.ok && r.value == 42);
+}
+
+static void test_section_order() {
+  const Bytes functions = section(3, {0x01, 0x03});
+  // Custom sections may appear anywhere
+  CHECK(parses(module({CUSTOM, TYPES, CUSTOM, functions, code({{}}), CUSTOM})));
+  // An empty code section before the function section would leave the function without code
+  CHECK(!parses(module({TYPES, section(10, {0x00}), functions})));
+  // An import after the code section would shift the call targets the code was validated against
+  CHECK(!parses(module({TYPES, functions, code({{0x10, 0x00}}), IMPORT_SET_STATE})));
+  CHECK(!parses(module({TYPES, TYPES, functions, code({{}})})));
+  CHECK(!parses(module({TYPES, functions, code({{}}), code({{}})})));
+  CHECK(!parses(module({functions, TYPES, code({{}})})));
+  CHECK(!parses(module({TYPES, functions})));
+  CHECK(!parses(module({TYPES, functions, code({{}, {}})})));
+  // The data count section goes between the element and code sections
+  CHECK(parses(module({TYPES, functions, section(12, {0x00}), code({{}})})));
+  CHECK(!parses(module({TYPES, functions, code({{}}), section(12, {0x00})})));
+}
+
+static void test_malformed() {
+  const Bytes functions = section(3, {0x01, 0x00});
+  CHECK(!parses(Bytes{0x00, 'a', 's', 'm', 0x02, 0x00, 0x00, 0x00}));
+  CHECK(!parses(Bytes{0x00, 'a', 's', 'm', 0x01, 0x00, 0x00}));
+  // Section length beyond the module
+  CHECK(!parses(module({TYPES, Bytes{0x00, 0x10, 0x00}})));
+  // Operand stack underflow, missing result, call to a missing function, unknown import
+  CHECK(!parses(module({TYPES, functions, code({{0x6A}})})));
+  CHECK(!parses(module({TYPES, functions, code({{}})})));
+  CHECK(!parses(module({TYPES, functions, code({{0x10, 0x05, 0x41, 0x00}})})));
+  CHECK(!parses(module({TYPES, section(2, {0x01, 0x03, 'e', 'n', 'v', 0x01, 'x', 0x00, 0x03})})));
+  // set_state with the signature of millis
+  CHECK(!parses(module({TYPES, section(2, {0x01, 0x03, 'e', 'n', 'v', 0x09, 's', 'e', 't', '_', 's', 't', 'a',
+                                           't', 'e', 0x00, 0x00})})));
+  // Memory access in a module without memory
+  CHECK(!parses(module({TYPES, functions, code({{0x41, 0x00, 0x28, 0x02, 0x00}})})));
+}
+
+static void test_traps() {
+  // 0: unreachable, 1: 1 / 0, 2: unbounded recursion, 3: endless loop, 4: returns 7
+  const Bytes bytes = module({TYPES, section(3, {0x05, 0x00, 0x00, 0x03, 0x03, 0x00}),
+                              code({{0x00},
+                                    {0x41, 0x01, 0x41, 0x00, 0x6D},
+                                    {0x10, 0x02},
+                                    {0x03, 0x40, 0x0C, 0x00, 0x0B},
+                                    {0x41, 0x07}})});
+  WasmLimits limits;
+  limits.fuel = 1000;
+  WasmInstance instance;
+  CHECK(instantiate(instance, bytes, limits));
+
+  CHECK(call(instance, 0).error == "unreachable executed");
+  CHECK(call(instance, 1).error == "integer divide by zero");
+  CHECK(call(instance, 2).error == "call stack exhausted");
+  const CallResult r = call(instance, 3);
+  CHECK(!r.ok && r.error == "out of fuel");
+  CHECK(instance.get_last_fuel_used() == 1000);
+  // A trap leaves the instance usable
+  const CallResult after = call(instance, 4);
+  CHECK(after.ok && after.value == 7);
+  CHECK(!instance.is_running());
+  CHECK(call(instance, 5).error == "not a module function");
+  CHECK(call(instance, 4, {1}).error == "argument count mismatch");
+}
+
+static void test_memory_bounds() {
+  // Import 0: env.log; 1: load(address), 2: store8(address) returning 0, 3: log(address) of 8 bytes returning 0
+  const Bytes bytes = module({TYPES, IMPORT_LOG, section(3, {0x03, 0x01, 0x01, 0x01}), section(5, {0x01, 0x00, 0x01}),
+                              code({{0x20, 0x00, 0x28, 0x02, 0x00},
+                                    {0x20, 0x00, 0x41, 0x25, 0x3A, 0x00, 0x00, 0x41, 0x00},
+                                    {0x20, 0x00, 0x41, 0x08, 0x10, 0x00, 0x41, 0x00}}),
+                              section(11, {0x01, 0x00, 0x41, 0x00, 0x0B, 0x04, 0x01, 0x02, 0x03, 0x04})});
+  // The module declares a 64 KiB page, the limit allocates 64 bytes
+  WasmLimits limits;
+  limits.memory_bytes = 64;
+  WasmInstance instance;
+  RecordingHost host;
+  CHECK(instantiate(instance, bytes, limits));
+
+  CHECK(call(instance, 1, {0}).value == 0x04030201);
+  CHECK(call(instance, 1, {60}).ok);
+  CHECK(call(instance, 1, {61}).error == "memory access out of bounds");
+  // The address and offset do not wrap around
+  CHECK(call(instance, 1, {-1}).error == "memory access out of bounds");
+  CHECK(call(instance, 2, {63}).ok);
+  CHECK(call(instance, 1, {60}).value == 0x25000000);
+  CHECK(call(instance, 2, {64}).error == "memory access out of bounds");
+  CHECK(call(instance, 3, {0}, &host).ok);
+  CHECK(host.logged == std::string("\x01\x02\x03\x04\0\0\0\0", 8));
+  CHECK(call(instance, 3, {56}, &host).ok);
+  CHECK(call(instance, 3, {57}, &host).error == "memory access out of bounds");
+
+  // A data segment beyond the allocated memory fails instantiation
+  const Bytes far = module({TYPES, section(5, {0x01, 0x00, 0x01}),
+                            section(11, {0x01, 0x00, 0x41, 0x3E, 0x0B, 0x04, 0x01, 0x02, 0x03, 0x04})});
+  auto m = std::make_shared<WasmModule>();
+  std::string error;
+  CHECK(m->parse(far.data(), far.size(), error));
+  WasmInstance small;
+  CHECK(!small.instantiate(m, limits, error));
+}
+
+static void test_host_calls() {
+  // Import 0: env.set_state; 1: set_state(0, 1)
+  const Bytes bytes = module({TYPES, IMPORT_SET_STATE, section(3, {0x01, 0x03}),
+                              code({{0x41, 0x00, 0x41, 0x01, 0x10, 0x00}})});
+  WasmInstance instance;
+  RecordingHost host;
+  CHECK(instantiate(instance, bytes));
+  CHECK(call(instance, 0, {}, &host).error == "not a module function");
+  CHECK(call(instance, 1, {}, &host).ok);
+  CHECK(host.set_calls == 1);
+}
+
+int main() {
+  test_call();
+  test_section_order();
+  test_malformed();
+  test_traps();
+  test_memory_bounds();
+  test_host_calls();
+  if (failures != 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All WebAssembly tests passed\n");
+  return 0;
+}
@@ -0,0 +1,84 @@
+// Tests of while rules: level conditions over inputs, re-evaluated only when a dependency changes.
+
+#include "test_support.h"
+
+#include <string>
+
+static void test_while_rule() {
+  Fixture f;
+  CHECK(f.engine.load(R"([{"id":"fan","trigger":{"source":"while","all":["humid","!window"]},)"
+                      R"("actions":[{"source":"switch","type":"turn_on","switch_id":"fan"}],)"
+                      R"("exit_actions":[{"source":"switch","type":"turn_off","switch_id":"fan"}]}])"));
+  f.set("humid", true);
+  CHECK(f.is_on("fan"));
+  f.set("window", true);
+  CHECK(!f.is_on("fan"));
+  f.set("window", false);
+  CHECK(f.is_on("fan"));
+  f.set("humid", false);
+  CHECK(!f.is_on("fan"));
+}
+
+static void test_while_any() {
+  Fixture f;
+  CHECK(f.engine.load(R"([{"id":"alarm","trigger":{"source":"while","any":["door","!armed"]},)"
+                      R"("actions":[{"source":"switch","type":"toggle","switch_id":"siren"}],)"
+                      R"("exit_actions":[{"source":"switch","type":"toggle","switch_id":"siren"}]}])"));
+  // "!armed" holds with every input off, so the rule enters when it is activated
+  CHECK(f.is_on("siren"));
+  f.set("armed", true);
+  CHECK(!f.is_on("siren"));
+  f.set("door", true);
+  CHECK(f.is_on("siren"));
+  // A change that keeps the level does not run the actions again
+  f.set("armed", false);
+  CHECK(f.is_on("siren"));
+  f.set("door", false);
+  f.set("armed", true);
+  CHECK(!f.is_on("siren"));
+}
+
+static void test_while_exit_cancels_enter() {
+  Fixture f;
+  CHECK(f.engine.load(R"([{"id":"light","trigger":{"source":"while","all":["motion"]},)"
+                      R"("actions":[{"source":"delay","delay_s":2},)"
+                      R"({"source":"switch","type":"turn_on","switch_id":"lamp"}],)"
+                      R"("exit_actions":[{"source":"switch","type":"turn_off","switch_id":"lamp"}]}])"));
+  f.set("motion", true);
+  CHECK(f.engine.get_pending_count() == 1);
+  f.clock.set_us(1000000);
+  f.set("motion", false);
+  // The exit stops the half-finished enter chain
+  f.clock.set_us(3000000);
+  f.engine.loop();
+  CHECK(!f.is_on("lamp") && f.engine.get_pending_count() == 0);
+
+  f.set("motion", true);
+  f.clock.set_us(5000000);
+  f.engine.loop();
+  CHECK(f.is_on("lamp"));
+}
+
+static void test_while_condition_profiled() {
+  Fixture f;
+  f.engine.set_profiling(true);
+  CHECK(f.engine.load(R"([{"id":"fan","trigger":{"source":"while","all":["humid"]},)"
+                      R"("actions":[{"source":"switch","type":"turn_on","switch_id":"fan"}]}])"));
+  // Activation evaluates the condition once, then each input change does
+  CHECK(f.engine.get_while_condition_stats().count == 1);
+  f.set("humid", true);
+  f.set("humid", false);
+  CHECK(f.engine.get_while_condition_stats().count == 3);
+  // The rule's stats hold its condition evaluations and its one action
+  const auto &rule_stats = f.engine.get_rule_stats();
+  CHECK(rule_stats.count("fan") == 1 && rule_stats.at("fan").count == 4);
+  f.engine.reset_execution_stats();
+  CHECK(f.engine.get_while_condition_stats().count == 0);
+}
+
+void run_while_tests() {
+  test_while_rule();
+  test_while_any();
+  test_while_exit_cancels_enter();
+  test_while_condition_profiled();
+}
@@ -0,0 +1,158 @@
+// Host benchmark of the sensor threshold evaluation.
+//
+// Spreads a number of thresholds over a number of sensors and feeds every sensor several values per loop tick,
+// then times three ways of evaluating them: after every value with the scalar kernel, once per tick with the
+// scalar kernel, and once per tick with the vector kernel. The batched variants compare each sensor once per
+// tick, so they also see fewer crossings; both batched variants must fire the same rules.
+//
+// The default run leads with the common shape of many sensors with a threshold each, updated once per tick,
+// followed by a sweep of larger tables over a few busy sensors.
+
+#include "threshold_table.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace esphome::json_automation;
+
+struct Scenario {
+  size_t thresholds;
+  unsigned sensors;
+  unsigned updates;
+};
+
+struct Options {
+  std::vector<Scenario> scenarios{{64, 64, 1},   {1024, 1024, 1}, {64, 16, 4},   {256, 16, 4},
+                                  {1024, 16, 4}, {4096, 16, 4},   {16384, 16, 4}};
+  unsigned ticks{2000};
+  unsigned seed{1};
+};
+
+struct Result {
+  double ns_per_tick;
+  uint64_t fired;
+};
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [--thresholds N[,N...]] [--sensors N] [--updates-per-tick N] [--ticks N] [--seed N]\n"
+          "Thresholds are spread evenly over the sensors; every sensor gets the given number of values per tick.\n"
+          "Any of the first three options replaces the default scenarios with one sweep (16 sensors, 4 updates).\n",
+          program);
+}
+
+static bool parse_args(int argc, char **argv, Options &options) {
+  std::vector<size_t> sizes{64, 256, 1024, 4096, 16384};
+  unsigned sensors = 16;
+  unsigned updates = 4;
+  bool sweep = false;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--thresholds" && i + 1 < argc) {
+      sizes.clear();
+      for (char *p = argv[++i]; *p != '\0';) {
+        sizes.push_back(std::strtoul(p, &p, 10));
+        if (*p == ',')
+          p++;
+      }
+      sweep = true;
+    } else if (arg == "--sensors" && i + 1 < argc) {
+      sensors = std::stoul(argv[++i]);
+      sweep = true;
+    } else if (arg == "--updates-per-tick" && i + 1 < argc) {
+      updates = std::stoul(argv[++i]);
+      sweep = true;
+    } else if (arg == "--ticks" && i + 1 < argc) {
+      options.ticks = std::stoul(argv[++i]);
+    } else if (arg == "--seed" && i + 1 < argc) {
+      options.seed = std::stoul(argv[++i]);
+    } else {
+      return false;
+    }
+  }
+  if (sweep) {
+    options.scenarios.clear();
+    for (size_t size : sizes)
+      options.scenarios.push_back(Scenario{size, sensors, updates});
+  }
+  return sensors > 0 && updates > 0 && options.ticks > 0;
+}
+
+/// Thresholds between 0 and 100, half of them "above" and half "below"; sensor values wander over the same range.
+static void fill(ThresholdTable &table, size_t count, unsigned sensors, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> limit(0.0f, 100.0f);
+  for (size_t i = 0; i < count; i++)
+    table.add(i % sensors, limit(rng), i % 2 == 0, i);
+  table.build();
+}
+
+static Result run(const Scenario &scenario, const Options &options, ThresholdTable::Kernel kernel, bool batched) {
+  ThresholdTable table;
+  table.set_kernel(kernel);
+  fill(table, scenario.thresholds, scenario.sensors, options.seed);
+  std::vector<float> values(scenario.sensors, 50.0f);
+  std::mt19937 rng(options.seed + 1);
+  std::normal_distribution<float> step(0.0f, 2.0f);
+  std::vector<uint32_t> fired;
+  Result result{0, 0};
+
+  std::chrono::nanoseconds elapsed{0};
+  for (unsigned tick = 0; tick < options.ticks; tick++) {
+    // Values are drawn outside the timed part
+    std::vector<float> updates;
+    for (unsigned u = 0; u < scenario.updates; u++) {
+      for (unsigned s = 0; s < scenario.sensors; s++) {
+        values[s] = std::min(100.0f, std::max(0.0f, values[s] + step(rng)));
+        updates.push_back(values[s]);
+      }
+    }
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0, sensor = 0; i < updates.size(); i++) {
+      table.post(sensor, updates[i]);
+      if (!batched)
+        result.fired += table.evaluate(fired);
+      // Cheaper than i % sensors, which would add a division per value to the timed part
+      if (++sensor == scenario.sensors)
+        sensor = 0;
+    }
+    if (batched)
+      result.fired += table.evaluate(fired);
+    elapsed += std::chrono::steady_clock::now() - start;
+  }
+  result.ns_per_tick = static_cast<double>(elapsed.count()) / options.ticks;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_args(argc, argv, options)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  printf("Vector kernel: %s; %u ticks\n", ThresholdTable::get_vector_isa(), options.ticks);
+  printf("%10s %8s %8s %16s %14s %18s %9s %9s\n", "thresholds", "sensors", "updates", "per value (ns)",
+         "batched (ns)", "batched SIMD (ns)", "batching", "SIMD");
+  int status = 0;
+  for (const Scenario &scenario : options.scenarios) {
+    const Result each = run(scenario, options, ThresholdTable::Kernel::SCALAR, false);
+    const Result scalar = run(scenario, options, ThresholdTable::Kernel::SCALAR, true);
+    const Result vector = run(scenario, options, ThresholdTable::Kernel::VECTOR, true);
+    printf("%10zu %8u %8u %16.0f %14.0f %18.0f %8.1fx %8.1fx\n", scenario.thresholds, scenario.sensors,
+           scenario.updates, each.ns_per_tick, scalar.ns_per_tick, vector.ns_per_tick,
+           each.ns_per_tick / scalar.ns_per_tick, scalar.ns_per_tick / vector.ns_per_tick);
+    if (scalar.fired != vector.fired) {
+      fprintf(stderr, "%zu thresholds on %u sensors: scalar kernel fired %llu rules, vector kernel %llu\n",
+              scenario.thresholds, scenario.sensors, (unsigned long long) scalar.fired,
+              (unsigned long long) vector.fired);
+      status = 1;
+    }
+  }
+  return status;
+}
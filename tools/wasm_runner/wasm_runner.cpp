@@ -0,0 +1,131 @@
+// Host runner for json_automation WebAssembly modules.
+//
+// Loads a module into the same sandbox the device uses (WasmRuntime with its memory, fuel and stack
+// limits), calls one exported function like a "wasm" rule action would, and prints what the module did:
+// its log output, the entity states afterwards, the fuel used and whether the rule chain would continue.
+
+#include "host_adapters.h"
+#include "wasm_runtime.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace esphome::json_automation;
+
+struct Options {
+  std::string module_path;
+  WasmCall call;
+  /// Initial states, parallel to call.entities.
+  std::vector<bool> states;
+  WasmLimits limits;
+  unsigned repeat{1};
+};
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [--entity DOMAIN.ID[=STATE]]... [--arg N] [--repeat N] [--fuel N] [--memory BYTES]\n"
+          "          [--stack SLOTS] MODULE.wasm FUNCTION\n"
+          "DOMAIN is switch, light or input; entity indices follow the order of --entity.\n",
+          program);
+}
+
+static bool parse_args(int argc, char **argv, Options &options) {
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--entity" && i + 1 < argc) {
+      const std::string entity = argv[++i];
+      const size_t equals = entity.find('=');
+      options.call.entities.push_back(entity.substr(0, equals));
+      options.states.push_back(equals != std::string::npos && entity.substr(equals + 1) != "0");
+    } else if (arg == "--arg" && i + 1 < argc) {
+      options.call.arg = std::stol(argv[++i]);
+    } else if (arg == "--repeat" && i + 1 < argc) {
+      options.repeat = std::stoul(argv[++i]);
+    } else if (arg == "--fuel" && i + 1 < argc) {
+      options.limits.fuel = std::stoul(argv[++i]);
+    } else if (arg == "--memory" && i + 1 < argc) {
+      options.limits.memory_bytes = std::stoul(argv[++i]);
+    } else if (arg == "--stack" && i + 1 < argc) {
+      options.limits.stack_slots = std::stoul(argv[++i]);
+    } else if (!arg.empty() && arg[0] == '-') {
+      return false;
+    } else {
+      positional.push_back(arg);
+    }
+  }
+  if (positional.size() != 2)
+    return false;
+  options.module_path = positional[0];
+  options.call.module = fs::path(positional[0]).stem().string();
+  options.call.function = positional[1];
+  return true;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_args(argc, argv, options)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::ifstream file(options.module_path, std::ios::binary);
+  if (!file) {
+    fprintf(stderr, "Cannot read %s\n", options.module_path.c_str());
+    return 2;
+  }
+  const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  HostEntities entities;
+  MemoryStorage storage;
+  VirtualClock clock;
+  CountingLog log(LogLevel::INFO);
+  WasmRuntime runtime(&entities, &storage, &clock, &log);
+  runtime.set_limits(options.limits);
+  if (!runtime.add_module(options.call.module, data, false))
+    return 1;
+
+  const int32_t handle = runtime.resolve_call(options.call);
+  if (handle == INVALID_HANDLE)
+    return 1;
+  // Entities exist once resolved; apply the initial states to the same handles
+  std::vector<int32_t> handles;
+  for (size_t i = 0; i < options.call.entities.size(); i++) {
+    const std::string &name = options.call.entities[i];
+    const std::string object_id = name.substr(name.find('.') + 1);
+    if (name.compare(0, 6, "input.") == 0) {
+      handles.push_back(entities.resolve_input(object_id));
+      if (options.states[i])
+        entities.set_input(handles.back(), true);
+    } else {
+      handles.push_back(entities.resolve_output(ActionSource::SWITCH, object_id));
+      if (options.states[i])
+        entities.perform(ActionSource::SWITCH, ActionType::TURN_ON, handles.back());
+    }
+  }
+
+  unsigned continued = 0;
+  for (unsigned i = 0; i < options.repeat; i++) {
+    clock.set_us(clock.get_us() + 1000);
+    if (runtime.run_call(handle, TriggerPayload::of_int(options.call.arg)))
+      continued++;
+  }
+
+  const WasmModuleSlot &slot = runtime.get_modules().front();
+  printf("module %s: %u bytes, %u calls, %u traps, max fuel %u\n", slot.name.c_str(), (unsigned) data.size(),
+         slot.calls, slot.traps, slot.max_fuel_used);
+  printf("chain continued %u of %u times\n", continued, options.repeat);
+  for (size_t i = 0; i < handles.size(); i++) {
+    const bool input = options.call.entities[i].compare(0, 6, "input.") == 0;
+    const bool state = input ? entities.get_input_state(handles[i])
+                             : entities.get_output_state(ActionSource::SWITCH, handles[i]);
+    printf("entity %u %s: %s\n", (unsigned) i, options.call.entities[i].c_str(), state ? "on" : "off");
+  }
+  return slot.traps == 0 ? 0 : 1;
+}